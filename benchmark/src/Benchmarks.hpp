@@ -0,0 +1,52 @@
+#ifndef WEB_SOCKETS_BENCHMARKS_HPP
+#define WEB_SOCKETS_BENCHMARKS_HPP
+
+/**
+ * @file Benchmarks.hpp
+ *
+ * This module declares the functions and types shared by the
+ * benchmarks of the WebSockets library.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <functional>
+#include <stddef.h>
+#include <string>
+
+namespace Benchmarks {
+
+    /**
+     * This is the type of function which runs one benchmark.
+     *
+     * @param[in] iterations
+     *     This is the number of operations the benchmark should perform.
+     */
+    typedef std::function< void(size_t iterations) > BenchmarkDelegate;
+
+    /**
+     * This function registers a benchmark to be run by the benchmark
+     * program.
+     *
+     * @param[in] name
+     *     This is the name of the benchmark, used in the results.
+     *
+     * @param[in] iterations
+     *     This is the number of operations the benchmark should perform.
+     *
+     * @param[in] benchmark
+     *     This is the function which runs the benchmark.
+     *
+     * @return
+     *     A value is returned so that this function may be used
+     *     to initialize a static variable.
+     */
+    bool Register(
+        const std::string& name,
+        size_t iterations,
+        BenchmarkDelegate benchmark
+    );
+
+}
+
+#endif /* WEB_SOCKETS_BENCHMARKS_HPP */
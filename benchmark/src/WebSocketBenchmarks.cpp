@@ -0,0 +1,533 @@
+/**
+ * @file WebSocketBenchmarks.cpp
+ *
+ * This module contains the benchmarks of the
+ * WebSockets::WebSocket class.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include "Benchmarks.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <Http/Connection.hpp>
+#include <Http/Request.hpp>
+#include <Http/Response.hpp>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include <WebSockets/ShardedServer.hpp>
+#include <WebSockets/WebSocket.hpp>
+
+namespace {
+
+    /**
+     * This is a fake connection which discards everything sent to it,
+     * so that benchmarks measure only the work done by the WebSocket.
+     */
+    struct NullConnection
+        : public Http::Connection
+    {
+        // Properties
+
+        /**
+         * This is the delegate to call in order to simulate data coming
+         * into the WebSocket from the remote peer.
+         */
+        DataReceivedDelegate dataReceivedDelegate;
+
+        /**
+         * This is the total number of octets sent by the WebSocket.
+         */
+        size_t octetsSent = 0;
+
+        // Http::Connection
+
+        virtual std::string GetPeerAddress() override {
+            return "null-peer";
+        }
+
+        virtual std::string GetPeerId() override {
+            return "null-peer:5555";
+        }
+
+        virtual void SetDataReceivedDelegate(DataReceivedDelegate newDataReceivedDelegate) override {
+            dataReceivedDelegate = newDataReceivedDelegate;
+        }
+
+        virtual void SetBrokenDelegate(BrokenDelegate newBrokenDelegate) override {
+        }
+
+        virtual void SendData(const std::vector< uint8_t >& data) override {
+            octetsSent += data.size();
+        }
+
+        virtual void Break(bool clean) override {
+        }
+    };
+
+    /**
+     * This is a fake connection which blocks for a while to send data,
+     * as a real transport does when its send buffer is full, so that
+     * benchmarks can measure how much sending holds up other work.
+     */
+    struct SlowConnection
+        : public NullConnection
+    {
+        // Properties
+
+        /**
+         * This is how long the connection takes to send data.
+         */
+        std::chrono::microseconds sendTime = std::chrono::microseconds(20);
+
+        // Http::Connection
+
+        virtual void SendData(const std::vector< uint8_t >& data) override {
+            std::this_thread::sleep_for(sendTime);
+            NullConnection::SendData(data);
+        }
+    };
+
+    /**
+     * This function makes the frame a client sends to carry a small,
+     * masked text message.
+     *
+     * @return
+     *     The frame is returned.
+     */
+    std::vector< uint8_t > MakeSmallClientTextFrame() {
+        std::vector< uint8_t > frame{0x81, 0x90, 0x12, 0x34, 0x56, 0x78};
+        for (size_t i = 0; i < 16; ++i) {
+            frame.push_back((uint8_t)('x' ^ frame[2 + (i % 4)]));
+        }
+        return frame;
+    }
+
+    /**
+     * This is the number of WebSockets to which the broadcast
+     * benchmarks send each message.
+     */
+    constexpr size_t BROADCAST_RECIPIENTS = 100;
+
+    /**
+     * This is the message sent by the broadcast benchmarks.
+     */
+    const std::string BROADCAST_MESSAGE = (
+        "{\"type\":\"quote\",\"symbol\":\"EXAMPLE\",\"bid\":101.25,"
+        "\"ask\":101.50,\"volume\":123456,\"exchange\":\"EXAMPLE\"}"
+    );
+
+    /**
+     * This function makes an HTTP request which opens a WebSocket.
+     *
+     * @return
+     *     The request is returned.
+     */
+    Http::Request MakeOpeningRequest() {
+        Http::Request request;
+        request.method = "GET";
+        request.headers.SetHeader("Connection", "upgrade");
+        request.headers.SetHeader("Upgrade", "websocket");
+        request.headers.SetHeader("Sec-WebSocket-Version", "13");
+        request.headers.SetHeader("Sec-WebSocket-Key", "dGhlIHNhbXBsZSBub25jZQ==");
+        return request;
+    }
+
+    /**
+     * This function opens WebSockets in the server role which
+     * negotiate the "permessage-deflate" extension without compression
+     * context takeover, for use in the broadcast benchmarks.
+     *
+     * @return
+     *     The WebSockets are returned.
+     */
+    std::vector< std::shared_ptr< WebSockets::WebSocket > > OpenBroadcastRecipients() {
+        WebSockets::WebSocket::Configuration configuration;
+        configuration.perMessageDeflate = true;
+        configuration.compressionPool = std::make_shared< WebSockets::CompressionPool >();
+        std::vector< std::shared_ptr< WebSockets::WebSocket > > recipients;
+        for (size_t i = 0; i < BROADCAST_RECIPIENTS; ++i) {
+            const auto ws = std::make_shared< WebSockets::WebSocket >();
+            ws->Configure(configuration);
+            auto request = MakeOpeningRequest();
+            request.headers.SetHeader(
+                "Sec-WebSocket-Extensions",
+                "permessage-deflate; server_no_context_takeover"
+            );
+            Http::Response response;
+            (void)ws->OpenAsServer(
+                std::make_shared< NullConnection >(),
+                request,
+                response,
+                ""
+            );
+            recipients.push_back(ws);
+        }
+        return recipients;
+    }
+
+    /**
+     * This benchmark measures sending small text messages in the
+     * client role, where every frame needs a fresh masking key.
+     */
+    const auto smallClientSends = Benchmarks::Register(
+        "WebSocket::SendText (client, 16 octets)",
+        1000000,
+        [](size_t iterations){
+            const auto connection = std::make_shared< NullConnection >();
+            WebSockets::WebSocket ws;
+            ws.Open(connection, WebSockets::WebSocket::Role::Client);
+            const std::string message(16, 'x');
+            for (size_t i = 0; i < iterations; ++i) {
+                ws.SendText(message);
+            }
+        }
+    );
+
+    /**
+     * This benchmark measures sending small text messages in the
+     * server role, for comparison with the client role.
+     */
+    const auto smallServerSends = Benchmarks::Register(
+        "WebSocket::SendText (server, 16 octets)",
+        1000000,
+        [](size_t iterations){
+            const auto connection = std::make_shared< NullConnection >();
+            WebSockets::WebSocket ws;
+            ws.Open(connection, WebSockets::WebSocket::Role::Server);
+            const std::string message(16, 'x');
+            for (size_t i = 0; i < iterations; ++i) {
+                ws.SendText(message);
+            }
+        }
+    );
+
+
+    /**
+     * This benchmark measures sending a compressed message to many
+     * WebSockets by calling SendText on each one, compressing the
+     * message separately for every recipient.
+     */
+    const auto compressedSendsToEach = Benchmarks::Register(
+        "WebSocket::SendText (100 recipients, compressed)",
+        1000,
+        [](size_t iterations){
+            const auto recipients = OpenBroadcastRecipients();
+            for (size_t i = 0; i < iterations; ++i) {
+                for (const auto& recipient: recipients) {
+                    recipient->SendText(BROADCAST_MESSAGE);
+                }
+            }
+        }
+    );
+
+    /**
+     * This benchmark measures broadcasting a compressed message to many
+     * WebSockets, compressing the message once for all of them.
+     */
+    const auto compressedBroadcasts = Benchmarks::Register(
+        "WebSocket::BroadcastText (100 recipients, compressed)",
+        1000,
+        [](size_t iterations){
+            const auto recipients = OpenBroadcastRecipients();
+            for (size_t i = 0; i < iterations; ++i) {
+                WebSockets::WebSocket::BroadcastText(recipients, BROADCAST_MESSAGE);
+            }
+        }
+    );
+
+
+    /**
+     * This is the number of threads sending at once in the
+     * multiple-producer send benchmarks.
+     */
+    constexpr size_t SENDING_THREADS = 4;
+
+    /**
+     * This function sends small text messages over the given WebSocket
+     * from the given number of threads at once.
+     *
+     * @param[in] ws
+     *     This is the WebSocket over which to send the messages.
+     *
+     * @param[in] threads
+     *     This is the number of threads to send from.
+     *
+     * @param[in] iterations
+     *     This is the total number of messages to send.
+     */
+    void SendFromThreads(
+        WebSockets::WebSocket& ws,
+        size_t threads,
+        size_t iterations
+    ) {
+        std::vector< std::thread > senders;
+        for (size_t i = 0; i < threads; ++i) {
+            senders.emplace_back(
+                [&ws, threads, iterations]{
+                    const std::string message(16, 'x');
+                    for (size_t i = 0; i < iterations / threads; ++i) {
+                        ws.SendText(message);
+                    }
+                }
+            );
+        }
+        for (auto& sender: senders) {
+            sender.join();
+        }
+    }
+
+    /**
+     * This benchmark measures sending small text messages in the
+     * server role from one thread, over a connection whose sends block,
+     * for comparison with sending from several threads at once.
+     */
+    const auto smallServerSendsBlocking = Benchmarks::Register(
+        "WebSocket::SendText (server, 16 octets, blocking sends, 1 thread)",
+        20000,
+        [](size_t iterations){
+            const auto connection = std::make_shared< SlowConnection >();
+            WebSockets::WebSocket ws;
+            ws.Open(connection, WebSockets::WebSocket::Role::Server);
+            SendFromThreads(ws, 1, iterations);
+        }
+    );
+
+    /**
+     * This benchmark measures sending small text messages in the
+     * server role from several threads at once, over a connection
+     * whose sends block, where frames queued while one thread is
+     * sending can be handed to the connection together.
+     */
+    const auto smallServerSendsBlockingMultipleThreads = Benchmarks::Register(
+        "WebSocket::SendText (server, 16 octets, blocking sends, 4 threads)",
+        20000,
+        [](size_t iterations){
+            const auto connection = std::make_shared< SlowConnection >();
+            WebSockets::WebSocket ws;
+            ws.Open(connection, WebSockets::WebSocket::Role::Server);
+            SendFromThreads(ws, SENDING_THREADS, iterations);
+        }
+    );
+
+    /**
+     * This benchmark measures receiving small text messages in the
+     * server role, for comparison with receiving while another
+     * thread sends.
+     */
+    const auto smallServerReceives = Benchmarks::Register(
+        "WebSocket::ReceiveData (server, 16 octets)",
+        200000,
+        [](size_t iterations){
+            const auto connection = std::make_shared< SlowConnection >();
+            WebSockets::WebSocket ws;
+            ws.Open(connection, WebSockets::WebSocket::Role::Server);
+            WebSockets::WebSocket::Delegates delegates;
+            delegates.text = [](std::string&& data){};
+            ws.SetDelegates(std::move(delegates));
+            const auto frame = MakeSmallClientTextFrame();
+            for (size_t i = 0; i < iterations; ++i) {
+                connection->dataReceivedDelegate(frame);
+            }
+        }
+    );
+
+    /**
+     * This benchmark measures receiving small text messages in the
+     * server role with all delegates set, each holding onto enough state
+     * that the function wrapping it has to allocate memory when copied.
+     */
+    const auto smallServerReceivesWithStatefulDelegates = Benchmarks::Register(
+        "WebSocket::ReceiveData (server, 16 octets, stateful delegates)",
+        1000000,
+        [](size_t iterations){
+            const auto connection = std::make_shared< NullConnection >();
+            WebSockets::WebSocket ws;
+            ws.Open(connection, WebSockets::WebSocket::Role::Server);
+            const std::string state(64, 'x');
+            size_t octetsReceived = 0;
+            WebSockets::WebSocket::Delegates delegates;
+            delegates.ping = [state, &octetsReceived](std::string&& data){
+                octetsReceived += data.length();
+            };
+            delegates.pong = delegates.ping;
+            delegates.text = delegates.ping;
+            delegates.binary = delegates.ping;
+            delegates.close = [state](unsigned int code, std::string&& reason){};
+            ws.SetDelegates(std::move(delegates));
+            const auto frame = MakeSmallClientTextFrame();
+            for (size_t i = 0; i < iterations; ++i) {
+                connection->dataReceivedDelegate(frame);
+            }
+        }
+    );
+
+    /**
+     * This benchmark measures receiving small text messages in the
+     * server role while another thread keeps sending messages over
+     * a connection which is slow to send.
+     */
+    const auto smallServerReceivesWhileSending = Benchmarks::Register(
+        "WebSocket::ReceiveData (server, 16 octets, concurrent sends)",
+        200000,
+        [](size_t iterations){
+            const auto connection = std::make_shared< SlowConnection >();
+            WebSockets::WebSocket ws;
+            ws.Open(connection, WebSockets::WebSocket::Role::Server);
+            WebSockets::WebSocket::Delegates delegates;
+            delegates.text = [](std::string&& data){};
+            ws.SetDelegates(std::move(delegates));
+            const auto frame = MakeSmallClientTextFrame();
+            std::atomic< bool > stopSending(false);
+            std::thread sender(
+                [&ws, &stopSending]{
+                    const std::string message(16, 'x');
+                    while (!stopSending) {
+                        ws.SendText(message);
+                    }
+                }
+            );
+            for (size_t i = 0; i < iterations; ++i) {
+                connection->dataReceivedDelegate(frame);
+            }
+            stopSending = true;
+            sender.join();
+        }
+    );
+
+    /**
+     * This is the number of WebSockets opened in the sharded
+     * server benchmarks.
+     */
+    constexpr size_t SHARDED_SERVER_CONNECTIONS = 64;
+
+    /**
+     * This function measures receiving small text messages over many
+     * WebSockets opened through a sharded server, with one thread
+     * standing in for the transport's I/O threads.
+     *
+     * @param[in] shards
+     *     This is the number of shards to run, or zero to run one
+     *     per processor core.
+     *
+     * @param[in] iterations
+     *     This is the total number of messages to receive.
+     */
+    void ReceiveThroughShardedServer(
+        size_t shards,
+        size_t iterations
+    ) {
+        WebSockets::ShardedServer server;
+        WebSockets::ShardedServer::Configuration configuration;
+        configuration.shards = shards;
+        server.Start(configuration);
+        std::mutex mutex;
+        std::vector< std::shared_ptr< WebSockets::WebSocket > > webSockets;
+        std::atomic< size_t > messagesReceived(0);
+        std::vector< std::shared_ptr< NullConnection > > connections;
+        for (size_t i = 0; i < SHARDED_SERVER_CONNECTIONS; ++i) {
+            const auto connection = std::make_shared< NullConnection >();
+            Http::Response response;
+            (void)server.OpenAsServer(
+                connection,
+                MakeOpeningRequest(),
+                response,
+                "",
+                [&mutex, &webSockets, &messagesReceived](
+                    std::shared_ptr< WebSockets::WebSocket > ws,
+                    size_t shard
+                ){
+                    WebSockets::WebSocket::Delegates delegates;
+                    delegates.text = [&messagesReceived](std::string&& data){
+                        ++messagesReceived;
+                    };
+                    ws->SetDelegates(std::move(delegates));
+                    std::lock_guard< decltype(mutex) > lock(mutex);
+                    webSockets.push_back(ws);
+                }
+            );
+            connections.push_back(connection);
+        }
+        const auto frame = MakeSmallClientTextFrame();
+        for (size_t i = 0; i < iterations; ++i) {
+            connections[i % connections.size()]->dataReceivedDelegate(frame);
+        }
+        while (messagesReceived < iterations) {
+            std::this_thread::yield();
+        }
+        server.Stop();
+    }
+
+    /**
+     * This benchmark measures receiving small text messages over many
+     * WebSockets opened through a sharded server with one shard, for
+     * comparison with running one shard per processor core.
+     */
+    const auto shardedServerReceivesOneShard = Benchmarks::Register(
+        "ShardedServer::ReceiveData (1 shard, 64 WebSockets, 16 octets)",
+        200000,
+        [](size_t iterations){
+            ReceiveThroughShardedServer(1, iterations);
+        }
+    );
+
+    /**
+     * This benchmark measures receiving small text messages over many
+     * WebSockets opened through a sharded server with one shard per
+     * processor core.
+     */
+    const auto shardedServerReceivesAllCores = Benchmarks::Register(
+        "ShardedServer::ReceiveData (1 shard per core, 64 WebSockets, 16 octets)",
+        200000,
+        [](size_t iterations){
+            ReceiveThroughShardedServer(0, iterations);
+        }
+    );
+
+    /**
+     * This benchmark measures the server side of opening handshakes,
+     * as happens for every client during a reconnect storm.
+     */
+    const auto serverHandshakes = Benchmarks::Register(
+        "WebSocket::OpenAsServer (handshakes)",
+        200000,
+        [](size_t iterations){
+            const auto connection = std::make_shared< NullConnection >();
+            const auto request = MakeOpeningRequest();
+            for (size_t i = 0; i < iterations; ++i) {
+                WebSockets::WebSocket ws;
+                Http::Response response;
+                (void)ws.OpenAsServer(connection, request, response, "");
+            }
+        }
+    );
+
+    /**
+     * This benchmark measures the client side of opening handshakes,
+     * checking the answer received from the server.
+     */
+    const auto clientHandshakes = Benchmarks::Register(
+        "WebSocket::FinishOpenAsClient (handshakes)",
+        200000,
+        [](size_t iterations){
+            const auto connection = std::make_shared< NullConnection >();
+            for (size_t i = 0; i < iterations; ++i) {
+                WebSockets::WebSocket client;
+                Http::Request request;
+                request.method = "GET";
+                client.StartOpenAsClient(request);
+                WebSockets::WebSocket server;
+                Http::Response response;
+                (void)server.OpenAsServer(connection, request, response, "");
+                (void)client.FinishOpenAsClient(connection, response);
+            }
+        }
+    );
+
+}
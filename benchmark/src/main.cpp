@@ -0,0 +1,96 @@
+/**
+ * @file main.cpp
+ *
+ * This module holds the entry point of the benchmark program
+ * of the WebSockets library.  It runs every registered benchmark
+ * (or only those whose names contain the text given on the command line)
+ * and reports how many operations per second each one achieved.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include "Benchmarks.hpp"
+
+#include <chrono>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+    /**
+     * This holds information about a benchmark registered to be run.
+     */
+    struct RegisteredBenchmark {
+        /**
+         * This is the name of the benchmark, used in the results.
+         */
+        std::string name;
+
+        /**
+         * This is the number of operations the benchmark should perform.
+         */
+        size_t iterations;
+
+        /**
+         * This is the function which runs the benchmark.
+         */
+        Benchmarks::BenchmarkDelegate benchmark;
+    };
+
+    /**
+     * This function returns the list of registered benchmarks.
+     *
+     * @return
+     *     The list of registered benchmarks is returned.
+     */
+    std::vector< RegisteredBenchmark >& GetRegisteredBenchmarks() {
+        static std::vector< RegisteredBenchmark > registeredBenchmarks;
+        return registeredBenchmarks;
+    }
+
+}
+
+namespace Benchmarks {
+
+    bool Register(
+        const std::string& name,
+        size_t iterations,
+        BenchmarkDelegate benchmark
+    ) {
+        GetRegisteredBenchmarks().push_back({name, iterations, benchmark});
+        return true;
+    }
+
+}
+
+/**
+ * This function is the entrypoint of the program.
+ *
+ * @param[in] argc
+ *     This is the number of command-line arguments given to the program.
+ *
+ * @param[in] argv
+ *     This is the array of command-line arguments given to the program.
+ */
+int main(int argc, char* argv[]) {
+    const std::string filter = ((argc > 1) ? argv[1] : "");
+    for (const auto& registeredBenchmark: GetRegisteredBenchmarks()) {
+        if (registeredBenchmark.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        registeredBenchmark.benchmark(registeredBenchmark.iterations);
+        const auto elapsed = std::chrono::duration< double >(
+            std::chrono::steady_clock::now() - start
+        ).count();
+        printf(
+            "%-48s %10zu ops in %8.3f s  (%12.0f ops/s)\n",
+            registeredBenchmark.name.c_str(),
+            registeredBenchmark.iterations,
+            elapsed,
+            (double)registeredBenchmark.iterations / elapsed
+        );
+    }
+    return 0;
+}
@@ -0,0 +1,173 @@
+#ifndef WEB_SOCKETS_COMPRESSION_POOL_HPP
+#define WEB_SOCKETS_COMPRESSION_POOL_HPP
+
+/**
+ * @file CompressionPool.hpp
+ *
+ * This module declares the WebSockets::CompressionPool class.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <memory>
+#include <stddef.h>
+
+namespace WebSockets {
+
+    class PerMessageDeflate;
+
+    /**
+     * This class holds compression and decompression streams which are not
+     * currently in use, so that they can be recycled by WebSockets instead
+     * of being set up from scratch for every message.
+     *
+     * One pool may be shared by any number of WebSockets, through their
+     * configurations, and may be used from any thread.
+     */
+    class CompressionPool {
+        // Types
+    public:
+        /**
+         * This holds information about the use of the pool.
+         */
+        struct Statistics {
+            /**
+             * This is the number of compression streams currently
+             * held by the pool, waiting to be reused.
+             */
+            size_t idleDeflaters = 0;
+
+            /**
+             * This is the number of decompression streams currently
+             * held by the pool, waiting to be reused.
+             */
+            size_t idleInflaters = 0;
+
+            /**
+             * This is the number of octets of memory currently used by
+             * the streams held by the pool.
+             */
+            size_t idleMemory = 0;
+
+            /**
+             * This is the total number of streams the pool has had
+             * to set up because it had none suitable to reuse.
+             */
+            size_t streamsCreated = 0;
+
+            /**
+             * This is the total number of times the pool has handed out
+             * a stream which it was holding.
+             */
+            size_t streamsReused = 0;
+        };
+
+        /**
+         * This is the type of structure which holds a compression or
+         * decompression stream.  It is defined in the implementation,
+         * and only used within the library.
+         */
+        struct Stream;
+
+        // Lifecycle management
+    public:
+        ~CompressionPool() noexcept;
+        CompressionPool(const CompressionPool&) = delete;
+        CompressionPool(CompressionPool&&) noexcept;
+        CompressionPool& operator=(const CompressionPool&) = delete;
+        CompressionPool& operator=(CompressionPool&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the constructor of the class.
+         *
+         * @param[in] maxIdleStreams
+         *     This is the largest number of streams the pool should hold
+         *     while they're not in use.  Streams returned to the pool
+         *     once it holds this many are destroyed instead.
+         */
+        explicit CompressionPool(size_t maxIdleStreams = 64);
+
+        /**
+         * This method returns information about the use of the pool.
+         *
+         * @return
+         *     Information about the use of the pool is returned.
+         */
+        Statistics GetStatistics() const;
+
+        // Private methods
+    private:
+        /**
+         * The streams handed out by the pool are only used by the
+         * "permessage-deflate" extension, within the library.
+         */
+        friend class PerMessageDeflate;
+
+        /**
+         * This method hands out a compression stream, recycling one
+         * held by the pool if possible.
+         *
+         * @param[in] windowBits
+         *     This is the base-2 logarithm of the sliding window size
+         *     the stream should use.
+         *
+         * @param[in] memoryLevel
+         *     This is the amount of memory, from 1 to 9, the stream should
+         *     use for its internal compression state.
+         *
+         * @return
+         *     The compression stream is returned.
+         *
+         * @retval nullptr
+         *     This is returned if the stream could not be set up.
+         */
+        std::unique_ptr< Stream > AcquireDeflater(
+            int windowBits,
+            int memoryLevel
+        );
+
+        /**
+         * This method hands out a decompression stream, recycling one
+         * held by the pool if possible.
+         *
+         * @param[in] windowBits
+         *     This is the base-2 logarithm of the sliding window size
+         *     the stream should use.
+         *
+         * @return
+         *     The decompression stream is returned.
+         *
+         * @retval nullptr
+         *     This is returned if the stream could not be set up.
+         */
+        std::unique_ptr< Stream > AcquireInflater(int windowBits);
+
+        /**
+         * This method gives a stream back to the pool, which resets it
+         * and either holds it for reuse or destroys it.
+         *
+         * @param[in] stream
+         *     This is the stream to give back to the pool.
+         */
+        void Release(std::unique_ptr< Stream >&& stream);
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::unique_ptr< Impl > impl_;
+    };
+
+}
+
+#endif /* WEB_SOCKETS_COMPRESSION_POOL_HPP */
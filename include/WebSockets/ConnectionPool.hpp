@@ -0,0 +1,234 @@
+#ifndef WEB_SOCKETS_CONNECTION_POOL_HPP
+#define WEB_SOCKETS_CONNECTION_POOL_HPP
+
+/**
+ * @file ConnectionPool.hpp
+ *
+ * This module declares the WebSockets::ConnectionPool class.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <chrono>
+#include <Http/IClient.hpp>
+#include <memory>
+#include <stddef.h>
+#include <SystemAbstractions/DiagnosticsSender.hpp>
+#include <WebSockets/MakeConnection.hpp>
+#include <WebSockets/MakeConnections.hpp>
+#include <WebSockets/WebSocket.hpp>
+
+namespace WebSockets {
+
+    /**
+     * This class keeps a number of WebSockets in the client role open,
+     * ready for use, to each of a number of upstream servers, so that a
+     * WebSocket can be handed out at once when one is needed, without
+     * waiting to connect and complete the opening handshake.
+     *
+     * WebSockets handed out are replaced in the background.  WebSockets
+     * waiting to be handed out are checked from time to time by sending
+     * them a ping, and those which receive nothing by the next check, or
+     * which close, are replaced.  WebSockets which close while waiting
+     * are noticed at the next check, or when next asked for.
+     *
+     * The pool never sets the delegates of the WebSockets it keeps, so
+     * anything received by a WebSocket while it waits to be handed out,
+     * including the pongs answering the pool's pings, is held by the
+     * WebSocket until whoever it's handed to sets delegates, subject to
+     * the event buffer limits of the WebSocket configuration.
+     */
+    class ConnectionPool {
+        // Types
+    public:
+        /**
+         * This holds configurable variables that control the behavior of the
+         * pool.
+         */
+        struct Configuration {
+            /**
+             * This is the number of WebSockets to keep ready for use
+             * to each upstream server.
+             */
+            size_t warmConnections = 2;
+
+            /**
+             * This is the time between checks of the WebSockets waiting
+             * to be handed out.  If zero, checks are only made when
+             * CheckHealth is called.
+             */
+            std::chrono::milliseconds healthCheckInterval = std::chrono::milliseconds(0);
+
+            /**
+             * These are the configurable parameters to set for each
+             * WebSocket opened by the pool.
+             */
+            WebSocket::Configuration webSocketConfiguration;
+        };
+
+        /**
+         * This holds information about the use of the pool.
+         */
+        struct Statistics {
+            /**
+             * This is the number of WebSockets asked for which were
+             * handed out at once.
+             */
+            size_t hits = 0;
+
+            /**
+             * This is the number of WebSockets asked for which had to
+             * be connected first, because none were ready.
+             */
+            size_t misses = 0;
+
+            /**
+             * This is the fraction of WebSockets asked for which were
+             * handed out at once.
+             */
+            double hitRate = 0.0;
+
+            /**
+             * This is the number of WebSockets ready to be handed out.
+             */
+            size_t idleConnections = 0;
+
+            /**
+             * This is the number of WebSockets connected by the pool
+             * to keep ready for use.
+             */
+            size_t connectionsMade = 0;
+
+            /**
+             * This is the number of attempts by the pool to connect
+             * WebSockets to keep ready for use which failed.
+             */
+            size_t connectionsFailed = 0;
+
+            /**
+             * This is the number of WebSockets found to have closed
+             * while waiting to be handed out.
+             */
+            size_t connectionsLost = 0;
+
+            /**
+             * This is the number of WebSockets replaced because they
+             * received nothing after being sent a ping, by the next check.
+             */
+            size_t healthChecksFailed = 0;
+        };
+
+        // Lifecycle management
+    public:
+        ~ConnectionPool() noexcept;
+        ConnectionPool(const ConnectionPool&) = delete;
+        ConnectionPool(ConnectionPool&&) noexcept;
+        ConnectionPool& operator=(const ConnectionPool&) = delete;
+        ConnectionPool& operator=(ConnectionPool&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the default constructor.
+         */
+        ConnectionPool();
+
+        /**
+         * This method starts the pool, checking the WebSockets it keeps
+         * on the configured interval, if any.  It does nothing if the
+         * pool is already started.
+         *
+         * @param[in] http
+         *     This is the web client object to use to make connections.
+         *
+         * @param[in] diagnosticsSender
+         *     This is the object to use to publish any diagnostic messages.
+         *
+         * @param[in] configuration
+         *     These are the configurable parameters to use for the pool.
+         */
+        void Start(
+            std::shared_ptr< Http::IClient > http,
+            std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender,
+            const Configuration& configuration
+        );
+
+        /**
+         * This method stops the pool, aborting connection attempts in
+         * progress, closing the WebSockets waiting to be handed out,
+         * and forgetting all upstream servers.  Connection attempts made
+         * for callers of Acquire are aborted too, which calls their
+         * functions with nullptr.
+         */
+        void Stop();
+
+        /**
+         * This method adds an upstream server to the pool and starts
+         * connecting WebSockets to it, to keep ready for use.  It does
+         * nothing if the server was added before.
+         *
+         * @param[in] upstream
+         *     This identifies the server to which to connect.
+         */
+        void AddUpstream(const Endpoint& upstream);
+
+        /**
+         * This method hands out a WebSocket connected to the given upstream
+         * server.  If one is ready, the given function is called with it
+         * before this method returns.  Otherwise, a new connection is made
+         * for the caller, and the function is called once the attempt is
+         * finished.  Either way, the upstream server is added to the pool
+         * if it wasn't already, and the WebSocket is replaced in the
+         * background.
+         *
+         * @param[in] upstream
+         *     This identifies the server to which the WebSocket
+         *     should be connected.
+         *
+         * @param[in] completeDelegate
+         *     This is the function to call with the WebSocket, or with
+         *     nullptr if the connection could not be made, or the attempt
+         *     was aborted by stopping the pool.  The function should set
+         *     the delegates of the WebSocket, through which anything
+         *     received while it waited in the pool is then reported.
+         */
+        void Acquire(
+            const Endpoint& upstream,
+            MakeConnectionCompleteDelegate completeDelegate
+        );
+
+        /**
+         * This method checks the WebSockets waiting to be handed out,
+         * replacing any which closed, or which received nothing since
+         * the ping sent by the previous check, and sending each of the
+         * rest a new ping.  It also retries
+         * connecting any WebSockets the pool is short of.
+         */
+        void CheckHealth();
+
+        /**
+         * This method returns information about the use of the pool.
+         *
+         * @return
+         *     Information about the use of the pool is returned.
+         */
+        Statistics GetStatistics() const;
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::shared_ptr< Impl > impl_;
+    };
+
+}
+
+#endif /* WEB_SOCKETS_CONNECTION_POOL_HPP */
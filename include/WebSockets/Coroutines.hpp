@@ -0,0 +1,426 @@
+#ifndef WEB_SOCKETS_COROUTINES_HPP
+#define WEB_SOCKETS_COROUTINES_HPP
+
+/**
+ * @file Coroutines.hpp
+ *
+ * This module declares the WebSockets::AsyncWebSocket class, which
+ * is only available when compiling with C++20 coroutine support.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#if defined(__cpp_impl_coroutine)
+
+#include <atomic>
+#include <coroutine>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <WebSockets/WebSocket.hpp>
+
+namespace WebSockets {
+
+    /**
+     * This class wraps a WebSocket with operations which can be awaited
+     * by C++20 coroutines, on top of the WebSocket's delegates and
+     * send completion callbacks.
+     *
+     * Once wrapped, the WebSocket's delegates belong to the wrapper and
+     * must not be replaced.  Messages received while no coroutine is
+     * waiting for one are held until received.  Only one coroutine at a
+     * time may wait to receive a message.  Coroutines are resumed by
+     * whichever thread calls the WebSocket's delegates, or hands a message
+     * being sent to the connection.
+     *
+     * Awaiting an operation allocates nothing beyond what the WebSocket
+     * itself does to send or receive the message.
+     */
+    class AsyncWebSocket {
+        // Types
+    public:
+        /**
+         * This holds a message received by the WebSocket.
+         */
+        struct ReceivedMessage {
+            /**
+             * These are the kinds of messages which may be received.
+             */
+            enum class Type {
+                /**
+                 * This is a complete text message.
+                 */
+                Text,
+
+                /**
+                 * This is a complete binary message.
+                 */
+                Binary,
+
+                /**
+                 * The WebSocket received a close frame or was closed due
+                 * to an error.  This is received again by every later
+                 * attempt to receive a message.
+                 */
+                Close,
+            };
+
+            /**
+             * This is the kind of message received.
+             */
+            Type type = Type::Close;
+
+            /**
+             * This is the payload of a text or binary message, or the
+             * reason given in a close frame.
+             */
+            std::string data;
+
+            /**
+             * This is the status code given in a close frame.
+             */
+            unsigned int closeCode = 0;
+        };
+
+        /**
+         * This holds the messages received by the WebSocket, along with
+         * any coroutine waiting for one.  It's shared with the WebSocket's
+         * delegates, which may outlive the wrapper.
+         */
+        struct Channel {
+            /**
+             * This is used to synchronize access to the channel.
+             */
+            std::mutex mutex;
+
+            /**
+             * These are the messages received and not yet taken.
+             */
+            std::deque< ReceivedMessage > messages;
+
+            /**
+             * This indicates whether or not the WebSocket has been closed.
+             */
+            bool closed = false;
+
+            /**
+             * This is the close message received, if the WebSocket
+             * has been closed.
+             */
+            ReceivedMessage closeMessage;
+
+            /**
+             * This is the coroutine, if any, waiting to receive a message.
+             */
+            std::coroutine_handle<> waiter;
+
+            /**
+             * This is where to store the message for the waiting coroutine.
+             */
+            ReceivedMessage* waiterMessage = nullptr;
+
+            /**
+             * This method takes the next message received, if there is one.
+             * The channel must be locked.
+             *
+             * @param[out] message
+             *     This is where to store the message taken.
+             *
+             * @return
+             *     An indication of whether or not a message was taken
+             *     is returned.
+             */
+            bool Take(ReceivedMessage& message) {
+                if (!messages.empty()) {
+                    message = std::move(messages.front());
+                    messages.pop_front();
+                    return true;
+                }
+                if (closed) {
+                    message = closeMessage;
+                    return true;
+                }
+                return false;
+            }
+
+            /**
+             * This method hands the given message to the waiting coroutine,
+             * resuming it, or holds the message if no coroutine is waiting.
+             *
+             * @param[in] message
+             *     This is the message received.
+             */
+            void Deliver(ReceivedMessage&& message) {
+                std::unique_lock< decltype(mutex) > lock(mutex);
+                if (message.type == ReceivedMessage::Type::Close) {
+                    if (closed) {
+                        return;
+                    }
+                    closed = true;
+                    closeMessage = message;
+                }
+                if (!waiter) {
+                    if (message.type != ReceivedMessage::Type::Close) {
+                        messages.push_back(std::move(message));
+                    }
+                    return;
+                }
+                *waiterMessage = std::move(message);
+                const auto resumer = waiter;
+                waiter = nullptr;
+                waiterMessage = nullptr;
+                lock.unlock();
+                resumer.resume();
+            }
+        };
+
+        /**
+         * This is the object awaited by a coroutine to receive
+         * the next message.
+         */
+        class ReceiveAwaiter {
+        public:
+            explicit ReceiveAwaiter(std::shared_ptr< Channel > channel)
+                : channel_(std::move(channel))
+            {
+            }
+
+            bool await_ready() {
+                std::lock_guard< decltype(channel_->mutex) > lock(channel_->mutex);
+                return channel_->Take(message_);
+            }
+
+            bool await_suspend(std::coroutine_handle<> handle) {
+                std::lock_guard< decltype(channel_->mutex) > lock(channel_->mutex);
+                if (channel_->Take(message_)) {
+                    return false;
+                }
+                channel_->waiter = handle;
+                channel_->waiterMessage = &message_;
+                return true;
+            }
+
+            ReceivedMessage await_resume() {
+                return std::move(message_);
+            }
+
+        private:
+            /**
+             * This is the channel from which to receive the message.
+             */
+            std::shared_ptr< Channel > channel_;
+
+            /**
+             * This is where the message received is stored.
+             */
+            ReceivedMessage message_;
+        };
+
+        /**
+         * This is the object awaited by a coroutine to send a message.
+         * The result of awaiting it indicates whether or not the message
+         * was handed to the connection.
+         */
+        class SendAwaiter {
+        public:
+            SendAwaiter(
+                std::shared_ptr< WebSocket > webSocket,
+                bool text,
+                std::string&& data,
+                WebSocket::Compression compression
+            )
+                : webSocket_(std::move(webSocket))
+                , text_(text)
+                , data_(std::move(data))
+                , compression_(compression)
+            {
+            }
+
+            bool await_ready() const noexcept {
+                return false;
+            }
+
+            bool await_suspend(std::coroutine_handle<> handle) {
+                handle_ = handle;
+                WebSocket::SentDelegate sentDelegate = [this](bool sent){
+                    sent_ = sent;
+                    if (completed_.exchange(true)) {
+                        handle_.resume();
+                    }
+                };
+                if (text_) {
+                    webSocket_->SendText(data_, true, compression_, std::move(sentDelegate));
+                } else {
+                    webSocket_->SendBinary(data_, true, compression_, std::move(sentDelegate));
+                }
+                return !completed_.exchange(true);
+            }
+
+            bool await_resume() const noexcept {
+                return sent_;
+            }
+
+        private:
+            /**
+             * This is the WebSocket over which to send the message.
+             */
+            std::shared_ptr< WebSocket > webSocket_;
+
+            /**
+             * This indicates whether the message is text or binary.
+             */
+            bool text_;
+
+            /**
+             * This is the payload of the message.
+             */
+            std::string data_;
+
+            /**
+             * This is the choice made about compressing the message.
+             */
+            WebSocket::Compression compression_;
+
+            /**
+             * This is the coroutine to resume once the message is sent.
+             */
+            std::coroutine_handle<> handle_;
+
+            /**
+             * This indicates whether or not the message was handed
+             * to the connection.
+             */
+            bool sent_ = false;
+
+            /**
+             * This is set by whichever comes second of the send completing
+             * and the coroutine finishing its suspension, so that exactly
+             * one of them resumes the coroutine, and a send which completes
+             * at once doesn't suspend it at all.
+             */
+            std::atomic< bool > completed_{false};
+        };
+
+        // Public methods
+    public:
+        /**
+         * This constructor wraps the given WebSocket, setting its delegates.
+         *
+         * @param[in] webSocket
+         *     This is the WebSocket to wrap.
+         */
+        explicit AsyncWebSocket(std::shared_ptr< WebSocket > webSocket)
+            : webSocket_(std::move(webSocket))
+            , channel_(std::make_shared< Channel >())
+        {
+            WebSocket::Delegates delegates;
+            const auto channel = channel_;
+            delegates.text = [channel](std::string&& data){
+                ReceivedMessage message;
+                message.type = ReceivedMessage::Type::Text;
+                message.data = std::move(data);
+                channel->Deliver(std::move(message));
+            };
+            delegates.binary = [channel](std::string&& data){
+                ReceivedMessage message;
+                message.type = ReceivedMessage::Type::Binary;
+                message.data = std::move(data);
+                channel->Deliver(std::move(message));
+            };
+            delegates.close = [channel](
+                unsigned int code,
+                std::string&& reason
+            ){
+                ReceivedMessage message;
+                message.type = ReceivedMessage::Type::Close;
+                message.data = std::move(reason);
+                message.closeCode = code;
+                channel->Deliver(std::move(message));
+            };
+            webSocket_->SetDelegates(std::move(delegates));
+        }
+
+        /**
+         * This method returns the WebSocket wrapped.
+         *
+         * @return
+         *     The WebSocket wrapped is returned.
+         */
+        std::shared_ptr< WebSocket > GetWebSocket() const {
+            return webSocket_;
+        }
+
+        /**
+         * This method returns an object to await in order to receive
+         * the next message.
+         *
+         * @return
+         *     An object to await in order to receive the next message
+         *     is returned.
+         */
+        ReceiveAwaiter ReceiveMessage() {
+            return ReceiveAwaiter(channel_);
+        }
+
+        /**
+         * This method returns an object to await in order to send
+         * a complete text message.
+         *
+         * @param[in] data
+         *     This is the data to include with the message.
+         *
+         * @param[in] compression
+         *     This is used to choose whether or not to compress the
+         *     message, if the "permessage-deflate" extension is in use.
+         *
+         * @return
+         *     An object to await in order to send the message is returned.
+         */
+        SendAwaiter SendText(
+            std::string data,
+            WebSocket::Compression compression = WebSocket::Compression::Auto
+        ) {
+            return SendAwaiter(webSocket_, true, std::move(data), compression);
+        }
+
+        /**
+         * This method returns an object to await in order to send
+         * a complete binary message.
+         *
+         * @param[in] data
+         *     This is the data to include with the message.
+         *
+         * @param[in] compression
+         *     This is used to choose whether or not to compress the
+         *     message, if the "permessage-deflate" extension is in use.
+         *
+         * @return
+         *     An object to await in order to send the message is returned.
+         */
+        SendAwaiter SendBinary(
+            std::string data,
+            WebSocket::Compression compression = WebSocket::Compression::Auto
+        ) {
+            return SendAwaiter(webSocket_, false, std::move(data), compression);
+        }
+
+        // Private properties
+    private:
+        /**
+         * This is the WebSocket wrapped.
+         */
+        std::shared_ptr< WebSocket > webSocket_;
+
+        /**
+         * This holds the messages received by the WebSocket.
+         */
+        std::shared_ptr< Channel > channel_;
+    };
+
+}
+
+#endif /* __cpp_impl_coroutine */
+
+#endif /* WEB_SOCKETS_COROUTINES_HPP */
@@ -0,0 +1,201 @@
+#ifndef WEB_SOCKETS_EXTENSION_HPP
+#define WEB_SOCKETS_EXTENSION_HPP
+
+/**
+ * @file Extension.hpp
+ *
+ * This module declares the WebSockets::Extension interface.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <functional>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace WebSockets {
+
+    /**
+     * This is the interface to an extension of the WebSocket protocol,
+     * as described in section 9 of
+     * [RFC 6455](https://tools.ietf.org/html/rfc6455).
+     *
+     * Each WebSocket makes its own instances of the extensions it may
+     * negotiate, through the factories listed in its configuration.
+     * Once negotiated in the opening handshake, extensions are chained
+     * together in the order in which they're listed in the
+     * "Sec-WebSocket-Extensions" header of the handshake response.
+     * Data being sent passes through the chain in that order, and data
+     * received passes through it in the reverse order.
+     *
+     * Extensions transform the payloads of text and binary messages.
+     * Each fragment of a message being sent is encoded as it's sent,
+     * and each message received is decoded once all of its fragments
+     * have been received.  An extension may set the reserved bits it
+     * claims in the first frame of a message, to mark the message as
+     * one it has encoded.  Reserved bits are not allowed in any other
+     * frames, nor any reserved bits not claimed by negotiated extensions.
+     *
+     * Messages are sent and received independently, so EncodeFragment
+     * and DecodeMessage may be called at the same time from different
+     * threads, although each is only called by one thread at a time.
+     * Neither should block nor call back into the WebSocket.
+     */
+    class Extension {
+        // Types
+    public:
+        /**
+         * These are the parameters of an extension offer or response,
+         * in the order in which they appear in the
+         * "Sec-WebSocket-Extensions" header.  A parameter given without
+         * a value has an empty value.
+         */
+        typedef std::vector< std::pair< std::string, std::string > > Parameters;
+
+        /**
+         * This is the type of function used to make a new instance
+         * of an extension, for one WebSocket to negotiate and use.
+         */
+        typedef std::function< std::shared_ptr< Extension >() > Factory;
+
+        // Lifecycle management
+    public:
+        virtual ~Extension() noexcept {}
+
+        // Public methods
+    public:
+        /**
+         * This method returns the name of the extension, as it appears in
+         * the "Sec-WebSocket-Extensions" header.
+         *
+         * @return
+         *     The name of the extension is returned.
+         */
+        virtual std::string GetName() = 0;
+
+        /**
+         * This method returns the reserved bits of the first octet of
+         * a frame (0x40 for RSV1, 0x20 for RSV2, and 0x10 for RSV3) which
+         * the extension uses.  No two negotiated extensions may claim
+         * the same reserved bit.
+         *
+         * @return
+         *     The reserved bits claimed by the extension are returned.
+         */
+        virtual uint8_t GetReservedBits() = 0;
+
+        /**
+         * This method forms the parameters of the extension offer
+         * a client makes in the opening handshake.
+         *
+         * @return
+         *     The parameters of the extension offer are returned.
+         */
+        virtual Parameters MakeOffer() = 0;
+
+        /**
+         * This method checks the parameters of an extension response
+         * received by a client, in reply to the offer formed by MakeOffer.
+         *
+         * @param[in] response
+         *     These are the parameters of the extension response.
+         *
+         * @return
+         *     An indication of whether or not the response is acceptable
+         *     is returned.  If it isn't, the opening handshake fails.
+         */
+        virtual bool NegotiateAsClient(const Parameters& response) = 0;
+
+        /**
+         * This method checks the parameters of an extension offer
+         * received by a server and, if they're acceptable, forms the
+         * parameters of the extension response.  If a client makes more
+         * than one offer for the extension, this is called for each one
+         * in turn, until one is accepted.
+         *
+         * @param[in] offer
+         *     These are the parameters of the extension offer.
+         *
+         * @param[out] response
+         *     This is where to store the parameters of the
+         *     extension response.
+         *
+         * @return
+         *     An indication of whether or not the offer was accepted
+         *     is returned.
+         */
+        virtual bool NegotiateAsServer(
+            const Parameters& offer,
+            Parameters& response
+        ) = 0;
+
+        /**
+         * This method encodes the next fragment of a text or binary
+         * message being sent.
+         *
+         * @param[in] firstFragment
+         *     This indicates whether or not this is the first fragment
+         *     of the message.
+         *
+         * @param[in] lastFragment
+         *     This indicates whether or not this is the last fragment
+         *     of the message.
+         *
+         * @param[in,out] payload
+         *     This is the payload of the fragment to encode in place.
+         *
+         * @param[out] reservedBits
+         *     This is where to store the reserved bits to set in the frame.
+         *     Only the bits claimed by the extension are used, and only
+         *     in the first frame of the message.
+         *
+         * @param[out] failureReason
+         *     If the fragment can't be encoded, this is where to store
+         *     the reason to give when failing the WebSocket.
+         *
+         * @return
+         *     An indication of whether or not the fragment was encoded
+         *     successfully is returned.
+         */
+        virtual bool EncodeFragment(
+            bool firstFragment,
+            bool lastFragment,
+            std::string& payload,
+            uint8_t& reservedBits,
+            std::string& failureReason
+        ) = 0;
+
+        /**
+         * This method decodes a complete text or binary message received.
+         * The WebSocket fails the connection if the decoded message is
+         * larger than its maximum message size, so an extension may stop
+         * decoding as soon as the message grows beyond that size.
+         *
+         * @param[in] reservedBits
+         *     These are the reserved bits set in the first frame
+         *     of the message.
+         *
+         * @param[in,out] message
+         *     This is the message to decode in place.
+         *
+         * @param[out] failureReason
+         *     If the message can't be decoded, this is where to store
+         *     the reason to give when failing the WebSocket.
+         *
+         * @return
+         *     An indication of whether or not the message was decoded
+         *     successfully is returned.
+         */
+        virtual bool DecodeMessage(
+            uint8_t reservedBits,
+            std::string& message,
+            std::string& failureReason
+        ) = 0;
+    };
+
+}
+
+#endif /* WEB_SOCKETS_EXTENSION_HPP */
@@ -0,0 +1,172 @@
+#ifndef WEB_SOCKETS_KEEP_ALIVE_MANAGER_HPP
+#define WEB_SOCKETS_KEEP_ALIVE_MANAGER_HPP
+
+/**
+ * @file KeepAliveManager.hpp
+ *
+ * This module declares the WebSockets::KeepAliveManager class.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <chrono>
+#include <memory>
+#include <stddef.h>
+#include <WebSockets/WebSocket.hpp>
+
+namespace WebSockets {
+
+    /**
+     * This class keeps track of whether or not the peers of any number of
+     * open WebSockets are still there, sending each WebSocket a ping
+     * whenever nothing has been received over it for a while, and failing
+     * any WebSocket which then receives nothing more, or which doesn't
+     * receive the reply to a close frame it sent, in time.
+     *
+     * Every WebSocket added has one timer at a time in a hierarchical
+     * timer wheel, so that setting, moving, and cancelling timers takes
+     * constant time however many WebSockets there are.  One thread
+     * advances the wheel and looks after the WebSockets whose timers
+     * expire.  Anything received over a WebSocket, not only pongs,
+     * counts as a sign that its peer is there.
+     *
+     * WebSockets are held weakly, and forgotten once they're destroyed
+     * or closed.
+     */
+    class KeepAliveManager {
+        // Types
+    public:
+        /**
+         * This holds configurable variables that control the behavior
+         * of the manager.
+         */
+        struct Configuration {
+            /**
+             * This is how long a WebSocket may receive nothing before
+             * it's sent a ping.
+             */
+            std::chrono::milliseconds pingInterval = std::chrono::milliseconds(30000);
+
+            /**
+             * This is how long to wait for something to be received
+             * after sending a ping, or for the reply to a close frame,
+             * before failing the WebSocket.
+             */
+            std::chrono::milliseconds replyTimeout = std::chrono::milliseconds(10000);
+
+            /**
+             * This is how far apart the ticks of the timer wheel are.
+             * Timers expire on the first tick at or after the time set,
+             * so this is how late a ping or timeout may be.
+             */
+            std::chrono::milliseconds tickInterval = std::chrono::milliseconds(100);
+        };
+
+        /**
+         * This holds information about what the manager has done.
+         */
+        struct Statistics {
+            /**
+             * This is the number of WebSockets being looked after.
+             */
+            size_t webSockets = 0;
+
+            /**
+             * This is the number of pings sent.
+             */
+            size_t pingsSent = 0;
+
+            /**
+             * This is the number of times a ping was due but not sent
+             * because something had been received recently.
+             */
+            size_t pingsSkipped = 0;
+
+            /**
+             * This is the number of WebSockets failed because nothing was
+             * received over them in time after a ping was sent.
+             */
+            size_t pingTimeouts = 0;
+
+            /**
+             * This is the number of WebSockets failed because the reply
+             * to a close frame they sent wasn't received in time.
+             */
+            size_t closeTimeouts = 0;
+        };
+
+        // Lifecycle management
+    public:
+        ~KeepAliveManager() noexcept;
+        KeepAliveManager(const KeepAliveManager&) = delete;
+        KeepAliveManager(KeepAliveManager&&) noexcept;
+        KeepAliveManager& operator=(const KeepAliveManager&) = delete;
+        KeepAliveManager& operator=(KeepAliveManager&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the default constructor.
+         */
+        KeepAliveManager();
+
+        /**
+         * This method starts the thread which looks after the WebSockets
+         * added.  It does nothing if the manager was started before.
+         *
+         * @param[in] configuration
+         *     These are the configurable parameters to use.
+         */
+        void Start(const Configuration& configuration);
+
+        /**
+         * This method stops the thread which looks after the WebSockets
+         * added, and forgets all of them.
+         */
+        void Stop();
+
+        /**
+         * This method starts looking after the given open WebSocket.
+         * Its first ping is due a ping interval after whatever it last
+         * received, or from now if it hasn't received anything yet.
+         * Adding a WebSocket again starts looking after it afresh.
+         *
+         * @param[in] ws
+         *     This is the WebSocket to look after.
+         */
+        void Add(std::shared_ptr< WebSocket > ws);
+
+        /**
+         * This method stops looking after the given WebSocket.
+         *
+         * @param[in] ws
+         *     This is the WebSocket to stop looking after.
+         */
+        void Remove(const std::shared_ptr< WebSocket >& ws);
+
+        /**
+         * This method returns information about what the manager has done.
+         *
+         * @return
+         *     Information about what the manager has done is returned.
+         */
+        Statistics GetStatistics() const;
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::shared_ptr< Impl > impl_;
+    };
+
+}
+
+#endif /* WEB_SOCKETS_KEEP_ALIVE_MANAGER_HPP */
@@ -9,21 +9,135 @@
  * © 2018 by Richard Walters
  */
 
+#include <chrono>
 #include <functional>
 #include <future>
 #include <Http/IClient.hpp>
 #include <memory>
+#include <stddef.h>
 #include <stdint.h>
 #include <string>
 #include <SystemAbstractions/DiagnosticsSender.hpp>
+#include <vector>
 #include <WebSockets/WebSocket.hpp>
 
 namespace WebSockets {
 
+    /**
+     * This identifies a web server to which to connect.
+     */
+    struct Endpoint {
+        /**
+         * This is the host name or IP address of the server.
+         */
+        std::string host;
+
+        /**
+         * This is the port number of the server.
+         */
+        uint16_t port = 0;
+    };
+
+    /**
+     * This holds the times at which a connection attempt made by the
+     * MakeConnection function reached each phase.  Each time is left as
+     * the clock's epoch (the default) if the attempt didn't reach that
+     * phase.  The times at which the first frames were sent and received
+     * are available from the WebSocket, through its GetActivityTimes method.
+     */
+    struct MakeConnectionTimings {
+        /**
+         * This is when the attempt was started.
+         */
+        std::chrono::steady_clock::time_point started;
+
+        /**
+         * This is when the request for the opening handshake was built
+         * and handed to the web client.
+         */
+        std::chrono::steady_clock::time_point requestBuilt;
+
+        /**
+         * This is when the response to the opening handshake was received.
+         * The web client doesn't report when its connection to the server
+         * is made, so the time taken to connect is included in the time
+         * between building the request and receiving the response.
+         */
+        std::chrono::steady_clock::time_point responseReceived;
+
+        /**
+         * This is when the response was found to complete the opening
+         * handshake and the WebSocket was opened.
+         */
+        std::chrono::steady_clock::time_point upgradeValidated;
+
+        /**
+         * This is when the attempt was finished, whether it succeeded,
+         * failed, or was aborted.
+         */
+        std::chrono::steady_clock::time_point completed;
+    };
+
+    /**
+     * This holds a histogram of the times taken by one phase of the
+     * connection attempts made by the MakeConnection function.
+     */
+    struct MakeConnectionHistogram {
+        /**
+         * These are the numbers of times which fell into each bucket.
+         * The first bucket counts times under one microsecond.  Each
+         * bucket after that, at index i, counts times at least 2^(i-1)
+         * microseconds and under 2^i microseconds, except that the last
+         * bucket also counts all longer times.
+         */
+        std::vector< size_t > counts;
+    };
+
+    /**
+     * This holds histograms of the times taken by each phase of all the
+     * connection attempts made by the MakeConnection function so far.
+     * Each phase is only counted for the attempts which reached its end.
+     */
+    struct MakeConnectionHistograms {
+        /**
+         * This is the time from starting an attempt to building its request.
+         */
+        MakeConnectionHistogram buildingRequest;
+
+        /**
+         * This is the time from building the request to receiving
+         * the response.
+         */
+        MakeConnectionHistogram awaitingResponse;
+
+        /**
+         * This is the time from receiving the response to finding it
+         * completes the opening handshake.
+         */
+        MakeConnectionHistogram validatingUpgrade;
+
+        /**
+         * This is the time from starting an attempt to finishing it,
+         * counted only for the attempts which made a connection.
+         */
+        MakeConnectionHistogram connecting;
+    };
+
     /**
      * This is used to return values from the MakeConnection function.
      */
     struct MakeConnectionResults {
+        /**
+         * This is the WebSocket being connected, available at once so
+         * that messages can be sent over it before the connection is
+         * made.  They're held and sent right behind the opening
+         * handshake once it succeeds, or discarded if the connection
+         * can't be made.  It's nullptr when racing connection attempts
+         * to several servers, since which WebSocket will be used isn't
+         * known until one of them wins.
+         */
+        std::shared_ptr< WebSocket > ws;
+
         /**
          * This is a mechanism to access the result of the connection attempt.
          * If the connection is successful, it will yield a WebSocket object
@@ -32,6 +146,13 @@ namespace WebSockets {
          */
         std::future< std::shared_ptr< WebSocket > > connectionFuture;
 
+        /**
+         * This is a mechanism to access the times at which the connection
+         * attempt reached each phase.  It's ready once the connection
+         * attempt is finished.
+         */
+        std::future< MakeConnectionTimings > timingsFuture;
+
         /**
          * This is a function which can be called to abort the connection
          * attempt early.
@@ -39,9 +160,21 @@ namespace WebSockets {
         std::function< void() > abortConnection;
     };
 
+    /**
+     * This is the type of function called once an attempt to connect
+     * to a web server and upgrade the connection to a WebSocket
+     * is finished.
+     *
+     * @param[in] ws
+     *     This is the WebSocket connected to the server, or nullptr
+     *     if the connection could not be made or the attempt was aborted.
+     */
+    typedef std::function< void(std::shared_ptr< WebSocket > ws) > MakeConnectionCompleteDelegate;
+
     /**
      * This method is called to asynchronously attempt to connect to a web
-     * server and upgrade the connection a WebSocket.
+     * server and upgrade the connection a WebSocket.  No thread is used
+     * to wait for the attempt.
      *
      * @param[in] http
      *     This is the web client object to use to make the connection.
@@ -71,6 +204,149 @@ namespace WebSockets {
         WebSocket::Configuration configuration = WebSocket::Configuration()
     );
 
+    /**
+     * This method is called to asynchronously attempt to connect to a web
+     * server and upgrade the connection to a WebSocket, calling the given
+     * function once the attempt is finished.  No thread is used to wait
+     * for the attempt; the function is called by whichever thread
+     * completes the HTTP transaction or aborts the attempt, and it may be
+     * called before this function returns.
+     *
+     * @param[in] http
+     *     This is the web client object to use to make the connection.
+     *
+     * @param[in] host
+     *     This is the host name or IP address of the server to which to
+     *     connect.
+     *
+     * @param[in] port
+     *     This is the port number of the server to which to connect.
+     *
+     * @param[in] diagnosticsSender
+     *     This is the object to use to publish any diagnostic messages.
+     *
+     * @param[in] completeDelegate
+     *     This is the function to call, exactly once, when the
+     *     attempt is finished.
+     *
+     * @param[in] configuration
+     *     These are the configurable parameters to set for the WebSocket.
+     *
+     * @return
+     *     A function which can be called to abort the connection attempt
+     *     early is returned.
+     */
+    std::function< void() > MakeConnection(
+        std::shared_ptr< Http::IClient > http,
+        const std::string& host,
+        uint16_t port,
+        std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender,
+        MakeConnectionCompleteDelegate completeDelegate,
+        WebSocket::Configuration configuration = WebSocket::Configuration()
+    );
+
+    /**
+     * This method is called to asynchronously attempt to connect to any one
+     * of a number of equivalent web servers, such as replicas of the same
+     * service, and upgrade the connection to a WebSocket, calling the given
+     * function once the attempt is finished.
+     *
+     * Connection attempts are started in the order in which the endpoints
+     * are listed, each one after the given delay since the previous one
+     * was started, or at once if all the attempts started so far have
+     * failed.  The first connection upgraded to a WebSocket is used, and
+     * the other attempts are aborted, with any of them which succeed anyway
+     * being closed.  If the delay isn't zero and there is more than one
+     * endpoint, one thread is used to wait between starting attempts;
+     * otherwise all the attempts are started at once.
+     *
+     * @param[in] http
+     *     This is the web client object to use to make the connections.
+     *
+     * @param[in] endpoints
+     *     These identify the servers to which to try connecting.
+     *
+     * @param[in] staggerDelay
+     *     This is the time to wait after starting each connection attempt
+     *     before starting the next one.
+     *
+     * @param[in] diagnosticsSender
+     *     This is the object to use to publish any diagnostic messages.
+     *
+     * @param[in] completeDelegate
+     *     This is the function to call, exactly once, when the
+     *     attempt is finished.
+     *
+     * @param[in] configuration
+     *     These are the configurable parameters to set for the WebSocket.
+     *
+     * @return
+     *     A function which can be called to abort all the connection
+     *     attempts early is returned.
+     */
+    std::function< void() > MakeConnection(
+        std::shared_ptr< Http::IClient > http,
+        const std::vector< Endpoint >& endpoints,
+        std::chrono::milliseconds staggerDelay,
+        std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender,
+        MakeConnectionCompleteDelegate completeDelegate,
+        WebSocket::Configuration configuration = WebSocket::Configuration()
+    );
+
+    /**
+     * This method is called to asynchronously attempt to connect to any one
+     * of a number of equivalent web servers, such as replicas of the same
+     * service, and upgrade the connection to a WebSocket.
+     *
+     * Connection attempts are started in the order in which the endpoints
+     * are listed, each one after the given delay since the previous one
+     * was started, or at once if all the attempts started so far have
+     * failed.  The first connection upgraded to a WebSocket is used, and
+     * the other attempts are aborted, with any of them which succeed anyway
+     * being closed.  If the delay isn't zero and there is more than one
+     * endpoint, one thread is used to wait between starting attempts;
+     * otherwise all the attempts are started at once.
+     *
+     * @param[in] http
+     *     This is the web client object to use to make the connections.
+     *
+     * @param[in] endpoints
+     *     These identify the servers to which to try connecting.
+     *
+     * @param[in] staggerDelay
+     *     This is the time to wait after starting each connection attempt
+     *     before starting the next one.
+     *
+     * @param[in] diagnosticsSender
+     *     This is the object to use to publish any diagnostic messages.
+     *
+     * @param[in] configuration
+     *     These are the configurable parameters to set for the WebSocket.
+     *
+     * @return
+     *     A structure is returned containing information and tools to
+     *     use in coordinating with the asynchronous connection operation.
+     *     The timings given are those of the attempt which made the
+     *     connection, or else of the last attempt to fail.
+     */
+    MakeConnectionResults MakeConnection(
+        std::shared_ptr< Http::IClient > http,
+        const std::vector< Endpoint >& endpoints,
+        std::chrono::milliseconds staggerDelay,
+        std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender,
+        WebSocket::Configuration configuration = WebSocket::Configuration()
+    );
+
+    /**
+     * This function returns histograms of the times taken by each phase of
+     * all the connection attempts made by the MakeConnection function so far.
+     *
+     * @return
+     *     Histograms of the times taken by each phase of all the connection
+     *     attempts made so far are returned.
+     */
+    MakeConnectionHistograms GetMakeConnectionHistograms();
+
 }
 
 #endif /* WEB_SOCKETS_MAKE_CONNECTION_HPP */
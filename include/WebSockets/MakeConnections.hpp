@@ -0,0 +1,192 @@
+#ifndef WEB_SOCKETS_MAKE_CONNECTIONS_HPP
+#define WEB_SOCKETS_MAKE_CONNECTIONS_HPP
+
+/**
+ * @file MakeConnections.hpp
+ *
+ * This module declares the WebSockets::MakeConnections function.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <chrono>
+#include <functional>
+#include <future>
+#include <Http/IClient.hpp>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <SystemAbstractions/DiagnosticsSender.hpp>
+#include <vector>
+#include <WebSockets/MakeConnection.hpp>
+#include <WebSockets/WebSocket.hpp>
+
+namespace WebSockets {
+
+    /**
+     * This holds configurable variables that control how the
+     * MakeConnections function paces its connection attempts.
+     */
+    struct MakeConnectionsOptions {
+        /**
+         * This is the most connection attempts to have in progress
+         * at once.  If zero, there is no limit.
+         */
+        size_t maxInFlight = 0;
+
+        /**
+         * This is the most connection attempts to start per second,
+         * spread evenly over each second.  If zero, attempts are
+         * started as fast as maxInFlight allows.
+         */
+        double rampRate = 0.0;
+    };
+
+    /**
+     * This holds information about how a number of connection
+     * attempts made by the MakeConnections function went.
+     */
+    struct MakeConnectionsStatistics {
+        /**
+         * This is the number of connections made.
+         */
+        size_t connected = 0;
+
+        /**
+         * This is the number of connection attempts which failed
+         * or were aborted.
+         */
+        size_t failed = 0;
+
+        /**
+         * This is the number of connection attempts not started
+         * because the operation was aborted first.
+         */
+        size_t notStarted = 0;
+
+        /**
+         * This is the most connection attempts in progress at once.
+         */
+        size_t peakInFlight = 0;
+
+        /**
+         * This is the time from starting the first connection attempt
+         * to finishing the last one.
+         */
+        std::chrono::microseconds elapsed = std::chrono::microseconds(0);
+
+        /**
+         * This is the number of connections made per second, over
+         * the elapsed time.
+         */
+        double connectRate = 0.0;
+
+        /**
+         * This is the shortest time taken to make a connection.
+         */
+        std::chrono::microseconds minimumLatency = std::chrono::microseconds(0);
+
+        /**
+         * This is the median time taken to make a connection.
+         */
+        std::chrono::microseconds medianLatency = std::chrono::microseconds(0);
+
+        /**
+         * This is the time within which 99 percent of the connections
+         * were made.
+         */
+        std::chrono::microseconds p99Latency = std::chrono::microseconds(0);
+
+        /**
+         * This is the longest time taken to make a connection.
+         */
+        std::chrono::microseconds maximumLatency = std::chrono::microseconds(0);
+    };
+
+    /**
+     * This is the type of function called by the MakeConnections function
+     * as each connection attempt is finished.
+     *
+     * @param[in] index
+     *     This is the index of the endpoint to which the
+     *     connection attempt was made.
+     *
+     * @param[in] ws
+     *     This is the WebSocket connected to the server, or nullptr
+     *     if the connection could not be made or the attempt was aborted.
+     *
+     * @param[in] latency
+     *     This is the time taken by the connection attempt.
+     */
+    typedef std::function<
+        void(
+            size_t index,
+            std::shared_ptr< WebSocket > ws,
+            std::chrono::microseconds latency
+        )
+    > MakeConnectionsDelegate;
+
+    /**
+     * This is used to return values from the MakeConnections function.
+     */
+    struct MakeConnectionsResults {
+        /**
+         * This is a mechanism to access information about how the
+         * connection attempts went, once all of them are finished.
+         */
+        std::future< MakeConnectionsStatistics > statisticsFuture;
+
+        /**
+         * This is a function which can be called to abort the connection
+         * attempts in progress and not start any more.
+         */
+        std::function< void() > abortConnections;
+    };
+
+    /**
+     * This method is called to asynchronously attempt to connect to a
+     * number of web servers, upgrading each connection to a WebSocket,
+     * limiting how many attempts are in progress at once and how quickly
+     * they're started.  Attempts are started in the order in which the
+     * endpoints are listed; the same endpoint may be listed many times.
+     *
+     * Without a ramp rate, attempts are started by whichever thread
+     * finishes an earlier attempt, and no thread is used.  With a ramp
+     * rate, one thread paces the starts for the whole operation.
+     *
+     * @param[in] http
+     *     This is the web client object to use to make the connections.
+     *
+     * @param[in] endpoints
+     *     These identify the servers to which to connect.
+     *
+     * @param[in] diagnosticsSender
+     *     This is the object to use to publish any diagnostic messages.
+     *
+     * @param[in] options
+     *     These control how the connection attempts are paced.
+     *
+     * @param[in] connectionDelegate
+     *     This is the function to call as each connection attempt
+     *     is finished.
+     *
+     * @param[in] configuration
+     *     These are the configurable parameters to set for each WebSocket.
+     *
+     * @return
+     *     A structure is returned containing information and tools to
+     *     use in coordinating with the asynchronous connection operation.
+     */
+    MakeConnectionsResults MakeConnections(
+        std::shared_ptr< Http::IClient > http,
+        const std::vector< Endpoint >& endpoints,
+        std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender,
+        const MakeConnectionsOptions& options,
+        MakeConnectionsDelegate connectionDelegate,
+        WebSocket::Configuration configuration = WebSocket::Configuration()
+    );
+
+}
+
+#endif /* WEB_SOCKETS_MAKE_CONNECTIONS_HPP */
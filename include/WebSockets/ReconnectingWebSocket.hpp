@@ -0,0 +1,273 @@
+#ifndef WEB_SOCKETS_RECONNECTING_WEB_SOCKET_HPP
+#define WEB_SOCKETS_RECONNECTING_WEB_SOCKET_HPP
+
+/**
+ * @file ReconnectingWebSocket.hpp
+ *
+ * This module declares the WebSockets::ReconnectingWebSocket class.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <chrono>
+#include <Http/IClient.hpp>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <SystemAbstractions/DiagnosticsSender.hpp>
+#include <WebSockets/WebSocket.hpp>
+
+namespace WebSockets {
+
+    /**
+     * This class keeps a WebSocket in the client role connected to a web
+     * server, connecting it again whenever it's closed, other than by
+     * the user.
+     *
+     * Attempts to connect again are spaced out by a delay chosen at random
+     * between the initial delay and three times the previous delay, up to
+     * a maximum ("decorrelated jitter"), so that many clients which lost
+     * their connections to the same server at once don't all try to
+     * connect again at the same times.
+     *
+     * Messages sent while not connected are held, up to a limit, and sent
+     * once connected again.  Messages sent just as the connection is lost
+     * may be lost with it.  The delegates set are used for every WebSocket
+     * connected in turn, except that the close delegate is only called
+     * once the WebSocket is closed by the user.  If no WebSocket is
+     * connected at that time, the close delegate is called by Close.
+     *
+     * A thread is used to wait between attempts to connect.
+     */
+    class ReconnectingWebSocket {
+        // Types
+    public:
+        /**
+         * This holds configurable variables that control the behavior of the
+         * WebSocket.
+         */
+        struct Configuration {
+            /**
+             * This is the shortest time to wait before trying to connect
+             * again after the connection is lost or an attempt fails.
+             */
+            std::chrono::milliseconds initialBackoff = std::chrono::milliseconds(100);
+
+            /**
+             * This is the longest time to wait before trying to connect
+             * again after the connection is lost or an attempt fails.
+             */
+            std::chrono::milliseconds maxBackoff = std::chrono::milliseconds(30000);
+
+            /**
+             * This is the most octets of message payload to hold, while not
+             * connected, to send once connected.  Messages which would
+             * exceed the limit are discarded.
+             */
+            size_t maxBufferedOctets = 1048576;
+
+            /**
+             * These are the configurable parameters to set for each
+             * WebSocket connected.
+             */
+            WebSocket::Configuration webSocketConfiguration;
+        };
+
+        /**
+         * This holds information about how well the WebSocket
+         * has stayed connected.
+         */
+        struct Statistics {
+            /**
+             * This is the number of times the connection was lost.
+             */
+            size_t connectionsLost = 0;
+
+            /**
+             * This is the number of attempts made to connect.
+             */
+            size_t connectionAttempts = 0;
+
+            /**
+             * This is the number of attempts to connect which failed.
+             */
+            size_t connectionAttemptsFailed = 0;
+
+            /**
+             * This is the number of times the WebSocket was connected
+             * again after the connection was lost.
+             */
+            size_t recoveries = 0;
+
+            /**
+             * This is the number of messages held while not connected.
+             */
+            size_t messagesBuffered = 0;
+
+            /**
+             * This is the number of messages discarded because holding them
+             * would have exceeded the limit.
+             */
+            size_t messagesDropped = 0;
+
+            /**
+             * This is the number of octets of message payload being held.
+             */
+            size_t bufferedOctets = 0;
+
+            /**
+             * This is the time taken, the last time the connection was lost,
+             * to connect again.
+             */
+            std::chrono::microseconds lastTimeToRecover = std::chrono::microseconds(0);
+
+            /**
+             * This is the average time taken to connect again after
+             * the connection was lost.
+             */
+            std::chrono::microseconds averageTimeToRecover = std::chrono::microseconds(0);
+
+            /**
+             * This is the longest time taken to connect again after
+             * the connection was lost.
+             */
+            std::chrono::microseconds maximumTimeToRecover = std::chrono::microseconds(0);
+        };
+
+        // Lifecycle management
+    public:
+        ~ReconnectingWebSocket() noexcept;
+        ReconnectingWebSocket(const ReconnectingWebSocket&) = delete;
+        ReconnectingWebSocket(ReconnectingWebSocket&&) noexcept;
+        ReconnectingWebSocket& operator=(const ReconnectingWebSocket&) = delete;
+        ReconnectingWebSocket& operator=(ReconnectingWebSocket&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the default constructor.
+         */
+        ReconnectingWebSocket();
+
+        /**
+         * This method sets the functions to call whenever interesting
+         * events occur, for the current WebSocket and any connected later.
+         *
+         * @param[in] delegates
+         *     These are the functions to call whenever interesting
+         *     events occur.
+         */
+        void SetDelegates(WebSocket::Delegates&& delegates);
+
+        /**
+         * This method starts connecting the WebSocket to the given server.
+         * It does nothing if it was started before.
+         *
+         * @param[in] http
+         *     This is the web client object to use to make connections.
+         *
+         * @param[in] host
+         *     This is the host name or IP address of the server to which to
+         *     connect.
+         *
+         * @param[in] port
+         *     This is the port number of the server to which to connect.
+         *
+         * @param[in] diagnosticsSender
+         *     This is the object to use to publish any diagnostic messages.
+         *
+         * @param[in] configuration
+         *     These are the configurable parameters to use.
+         */
+        void Start(
+            std::shared_ptr< Http::IClient > http,
+            const std::string& host,
+            uint16_t port,
+            std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender,
+            const Configuration& configuration
+        );
+
+        /**
+         * This method stops connecting the WebSocket again, discards any
+         * messages being held, and closes the WebSocket, if connected,
+         * sending a close frame with the given status code and reason.
+         * The close delegate is called once the close is complete, or
+         * right away, with the given status code and reason, if no
+         * WebSocket is connected.
+         *
+         * @param[in] code
+         *     This is the status code to send in the close frame.
+         *
+         * @param[in] reason
+         *     This is the reason text to send in the close frame.
+         */
+        void Close(
+            unsigned int code = 1005,
+            const std::string& reason = ""
+        );
+
+        /**
+         * This method returns an indication of whether or not the
+         * WebSocket is connected.
+         *
+         * @return
+         *     An indication of whether or not the WebSocket is connected
+         *     is returned.
+         */
+        bool IsConnected() const;
+
+        /**
+         * This method sends a complete text message over the WebSocket,
+         * or holds it to send once connected.
+         *
+         * @param[in] data
+         *     This is the data to include with the message.
+         *
+         * @return
+         *     An indication of whether or not the message was sent or held
+         *     is returned.  It's false if the message was discarded.
+         */
+        bool SendText(const std::string& data);
+
+        /**
+         * This method sends a complete binary message over the WebSocket,
+         * or holds it to send once connected.
+         *
+         * @param[in] data
+         *     This is the data to include with the message.
+         *
+         * @return
+         *     An indication of whether or not the message was sent or held
+         *     is returned.  It's false if the message was discarded.
+         */
+        bool SendBinary(const std::string& data);
+
+        /**
+         * This method returns information about how well the WebSocket
+         * has stayed connected.
+         *
+         * @return
+         *     Information about how well the WebSocket has stayed connected
+         *     is returned.
+         */
+        Statistics GetStatistics() const;
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::shared_ptr< Impl > impl_;
+    };
+
+}
+
+#endif /* WEB_SOCKETS_RECONNECTING_WEB_SOCKET_HPP */
@@ -0,0 +1,246 @@
+#ifndef WEB_SOCKETS_SHARDED_SERVER_HPP
+#define WEB_SOCKETS_SHARDED_SERVER_HPP
+
+/**
+ * @file ShardedServer.hpp
+ *
+ * This module declares the WebSockets::ShardedServer class.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <functional>
+#include <Http/Connection.hpp>
+#include <Http/Request.hpp>
+#include <Http/Response.hpp>
+#include <memory>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <WebSockets/WebSocket.hpp>
+
+namespace WebSockets {
+
+    /**
+     * This class spreads WebSockets in the server role across a number of
+     * shards, each of which is a thread running its own loop of work,
+     * usually one per processor core.
+     *
+     * Each WebSocket opened through the server belongs to one shard.
+     * Data received for the WebSocket is processed, and its delegates are
+     * called, only by the thread of that shard, so state kept for the
+     * WebSocket by its delegates needs no locking as long as it's only
+     * touched by work run on the same shard.  Work may be handed to any
+     * shard, from any thread, without blocking, for example to send
+     * messages over WebSockets belonging to other shards.
+     *
+     * The server must not be started or stopped while any of its other
+     * methods are in use.
+     */
+    class ShardedServer {
+        // Types
+    public:
+        /**
+         * This holds configurable variables that control the behavior of the
+         * server.
+         */
+        struct Configuration {
+            /**
+             * This is the number of shards to run.
+             *
+             * If zero, one shard is run for each processor core.
+             */
+            size_t shards = 0;
+
+            /**
+             * This flag indicates whether or not to bind the thread of
+             * each shard to one processor core, where the platform
+             * supports it.
+             */
+            bool pinShards = true;
+
+            /**
+             * These are the configurable parameters to set for each
+             * WebSocket opened through the server.  The executor is
+             * replaced by one which runs work on the WebSocket's shard.
+             */
+            WebSocket::Configuration webSocketConfiguration;
+        };
+
+        /**
+         * This holds information about the use of the server.
+         */
+        struct Statistics {
+            /**
+             * This is the number of WebSockets opened through the server
+             * on each shard.
+             */
+            std::vector< size_t > webSocketsOpened;
+
+            /**
+             * This is the number of pieces of work run by each shard.
+             */
+            std::vector< size_t > workDone;
+        };
+
+        /**
+         * This is the type of function called, on the WebSocket's shard,
+         * once a WebSocket has been opened through the server.  It's
+         * expected to set the delegates of the WebSocket and hold onto it.
+         *
+         * @param[in] ws
+         *     This is the WebSocket which was opened.
+         *
+         * @param[in] shard
+         *     This is the index of the shard to which the
+         *     WebSocket belongs.
+         */
+        typedef std::function<
+            void(
+                std::shared_ptr< WebSocket > ws,
+                size_t shard
+            )
+        > OpenDelegate;
+
+        /**
+         * This is returned by GetCurrentShard when called by a thread
+         * which doesn't belong to any shard of the server.
+         */
+        static constexpr size_t NOT_A_SHARD = (size_t)-1;
+
+        // Lifecycle management
+    public:
+        ~ShardedServer() noexcept;
+        ShardedServer(const ShardedServer&) = delete;
+        ShardedServer(ShardedServer&&) noexcept;
+        ShardedServer& operator=(const ShardedServer&) = delete;
+        ShardedServer& operator=(ShardedServer&&) noexcept;
+
+        // Public methods
+    public:
+        /**
+         * This is the default constructor.
+         */
+        ShardedServer();
+
+        /**
+         * This method starts the threads of the shards of the server.
+         * It does nothing if the server is already started.
+         *
+         * @param[in] configuration
+         *     These are the configurable parameters to use for the server.
+         */
+        void Start(const Configuration& configuration);
+
+        /**
+         * This method stops the threads of the shards of the server,
+         * waiting for them to finish the work they're doing.  Work not yet
+         * started, and any work handed to the shards afterwards, such as
+         * data received over the connections of their WebSockets, is
+         * discarded without being done.  This must not be called by the
+         * thread of a shard.
+         */
+        void Stop();
+
+        /**
+         * This method returns the number of shards run by the server.
+         *
+         * @return
+         *     The number of shards run by the server is returned.
+         */
+        size_t GetShardCount() const;
+
+        /**
+         * This method returns the index of the shard whose thread
+         * is calling the method.
+         *
+         * @return
+         *     The index of the shard whose thread is calling the method
+         *     is returned.
+         *
+         * @retval NOT_A_SHARD
+         *     This is returned if the calling thread doesn't belong to any
+         *     shard of the server.
+         */
+        size_t GetCurrentShard() const;
+
+        /**
+         * This method hands the given work to the given shard, to be done
+         * by the thread of the shard after any work handed to it before.
+         * It never blocks.
+         *
+         * @param[in] shard
+         *     This is the index of the shard which should do the work.
+         *
+         * @param[in] work
+         *     This is the work to do.
+         */
+        void Post(
+            size_t shard,
+            std::function< void() >&& work
+        );
+
+        /**
+         * This method returns information about the use of the server.
+         *
+         * @return
+         *     Information about the use of the server is returned.
+         */
+        Statistics GetStatistics() const;
+
+        /**
+         * This method opens a WebSocket in the server role on the given
+         * connection, in response to the given HTTP request of the opening
+         * handshake, and assigns it to a shard, taking turns among them.
+         * From then on, data received over the connection is handed to the
+         * shard to process.
+         *
+         * @param[in] connection
+         *     This is the connection over which the opening handshake
+         *     request was received.
+         *
+         * @param[in] request
+         *     This is the opening handshake request.
+         *
+         * @param[out] response
+         *     This is where to store the opening handshake response
+         *     to send back.
+         *
+         * @param[in] trailer
+         *     This is any data received over the connection
+         *     after the request.
+         *
+         * @param[in] openDelegate
+         *     This is the function to call, on the WebSocket's shard,
+         *     if the WebSocket is opened.
+         *
+         * @return
+         *     An indication of whether or not the opening handshake
+         *     succeeded is returned.
+         */
+        bool OpenAsServer(
+            std::shared_ptr< Http::Connection > connection,
+            const Http::Request& request,
+            Http::Response& response,
+            const std::string& trailer,
+            OpenDelegate openDelegate
+        );
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::unique_ptr< Impl > impl_;
+    };
+
+}
+
+#endif /* WEB_SOCKETS_SHARDED_SERVER_HPP */
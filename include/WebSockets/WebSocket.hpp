@@ -9,13 +9,18 @@
  * © 2018 by Richard Walters
  */
 
+#include <chrono>
 #include <functional>
 #include <Http/Connection.hpp>
 #include <Http/Request.hpp>
 #include <Http/Response.hpp>
 #include <memory>
+#include <stdint.h>
 #include <string>
 #include <SystemAbstractions/DiagnosticsSender.hpp>
+#include <vector>
+#include <WebSockets/CompressionPool.hpp>
+#include <WebSockets/Extension.hpp>
 
 namespace WebSockets {
 
@@ -45,6 +50,60 @@ namespace WebSockets {
             Server,
         };
 
+        /**
+         * This is used to choose whether or not to compress a message
+         * sent, when the "permessage-deflate" extension is in use.
+         */
+        enum class Compression {
+            /**
+             * The WebSocket decides, based on the size of the message
+             * and how well recent messages compressed.
+             */
+            Auto,
+
+            /**
+             * The message is compressed.
+             */
+            Always,
+
+            /**
+             * The message is not compressed.
+             */
+            Never,
+        };
+
+        /**
+         * This is used to choose what the WebSocket does when events
+         * received before delegates are set exceed the limits set
+         * in its configuration.
+         */
+        enum class EventBufferOverflowPolicy {
+            /**
+             * The WebSocket is failed with status code 1008
+             * (policy violation).  If the WebSocket has already sent
+             * a close frame, the oldest events are discarded instead,
+             * as for DropOldest, and the connection is broken.
+             */
+            Close,
+
+            /**
+             * The oldest events are discarded until the limits are met.
+             * Close events are never discarded.
+             */
+            DropOldest,
+        };
+
+        /**
+         * This is the type of function used to run work on behalf of the
+         * WebSocket, such as calling its delegates.  It should arrange for
+         * the given work to be done, typically by a thread pool, and
+         * return without waiting for it.
+         *
+         * @param[in] work
+         *     This is the work to do.
+         */
+        typedef std::function< void(std::function< void() >&& work) > Executor;
+
         /**
          * This holds configurable variables that control the behavior of the
          * WebSocket.
@@ -57,6 +116,333 @@ namespace WebSockets {
              * If zero, there is no limit.
              */
             size_t maxFrameSize = 0;
+
+            /**
+             * This is the maximum allowed size of an incoming text or
+             * binary message, both as received and once decoded by any
+             * extensions, beyond which receipt of the message causes
+             * the connection to be failed with status code 1009.
+             *
+             * If zero, there is no limit.
+             */
+            size_t maxMessageSize = 0;
+
+            /**
+             * This is the maximum allowed size of an incoming text or
+             * binary message once decoded by any extensions, beyond which
+             * receipt of the message causes the connection to be failed
+             * with status code 1009.  It applies along with
+             * maxMessageSize, and compressed messages are decompressed
+             * only up to the smaller of the two, so that a small message
+             * can't expand to exhaust memory.
+             *
+             * If zero, only maxMessageSize limits decoded messages, and
+             * the "permessage-deflate" extension isn't negotiated unless
+             * maxMessageSize is set.
+             */
+            size_t maxDecodedMessageSize = 16 * 1024 * 1024;
+
+            /**
+             * This flag indicates whether or not to negotiate the
+             * "permessage-deflate" extension, documented in
+             * [RFC 7692](https://tools.ietf.org/html/rfc7692), which
+             * compresses the payloads of text and binary messages.
+             */
+            bool perMessageDeflate = false;
+
+            /**
+             * This flag indicates whether or not the server should reset
+             * its compression context after every message it sends.
+             * A client requests this of the server, while a server
+             * imposes it on itself.
+             */
+            bool serverNoContextTakeover = false;
+
+            /**
+             * This flag indicates whether or not the client should reset
+             * its compression context after every message it sends.
+             * A client imposes this on itself, while a server
+             * requests it of the client.
+             */
+            bool clientNoContextTakeover = false;
+
+            /**
+             * This is the largest base-2 logarithm of the sliding window
+             * size, from 8 to 15, that the server may use to compress
+             * messages.
+             */
+            int serverMaxWindowBits = 15;
+
+            /**
+             * This is the largest base-2 logarithm of the sliding window
+             * size, from 8 to 15, that the client may use to compress
+             * messages.
+             */
+            int clientMaxWindowBits = 15;
+
+            /**
+             * This is the amount of memory, from 1 to 9, used for the
+             * internal state of compressing messages, in addition to the
+             * sliding window.  Lower values use less memory at the cost
+             * of compression speed and ratio.
+             */
+            int compressionMemoryLevel = 8;
+
+            /**
+             * If not nullptr, this is where the WebSocket obtains the
+             * streams it uses to compress and decompress messages, and
+             * where it returns them when no longer needed.  Sharing one
+             * pool among many WebSockets lets them recycle each other's
+             * streams.
+             *
+             * In any direction where the compression context is reset
+             * after every message (because "server_no_context_takeover" or
+             * "client_no_context_takeover" was negotiated), the WebSocket
+             * only holds a stream while a message is being compressed or
+             * decompressed.
+             */
+            std::shared_ptr< CompressionPool > compressionPool;
+
+            /**
+             * This is the smallest message, in octets, which the WebSocket
+             * decides to compress.  For a message sent in fragments,
+             * the size of the first fragment is used.
+             */
+            size_t compressionThreshold = 0;
+
+            /**
+             * This is the largest compression ratio (compressed size
+             * divided by uncompressed size), averaged over recent messages,
+             * for which the WebSocket keeps deciding to compress messages.
+             * Beyond it, the WebSocket only compresses an occasional
+             * message, to find out whether messages have become more
+             * compressible.
+             *
+             * If zero, the compression ratio of recent messages is not used.
+             */
+            double compressionRatioCutoff = 0.0;
+
+            /**
+             * These are used to make the extensions, other than
+             * "permessage-deflate", which the WebSocket may negotiate.
+             * A client offers them in this order, after
+             * "permessage-deflate" if it's enabled.
+             */
+            std::vector< Extension::Factory > extensions;
+
+            /**
+             * These are the subprotocols the WebSocket supports, in order
+             * of preference.  A client offers them all in this order,
+             * while a server selects the first of them which the
+             * client offers.
+             *
+             * If empty, no subprotocol is negotiated.
+             */
+            std::vector< std::string > subprotocols;
+
+            /**
+             * If not nullptr, this is used to call the delegates of the
+             * WebSocket, so that the thread which received the data
+             * (typically the transport's I/O thread) only has to process
+             * frames.  Whatever the executor, delegates of one WebSocket
+             * are called one at a time, in the order in which events
+             * happened.
+             *
+             * If nullptr, delegates are called by whichever thread is
+             * using the WebSocket when the events are reported.
+             */
+            Executor executor;
+
+            /**
+             * This is the most events (messages, pings, and pongs
+             * received) which the WebSocket holds onto until delegates
+             * are set, before applying the event buffer overflow policy.
+             *
+             * If zero, there is no limit.
+             */
+            size_t maxBufferedEvents = 0;
+
+            /**
+             * This is the most data, in octets, held in events which the
+             * WebSocket holds onto until delegates are set, before
+             * applying the event buffer overflow policy.
+             *
+             * If zero, there is no limit.
+             */
+            size_t maxBufferedEventOctets = 0;
+
+            /**
+             * This is what the WebSocket does when events received before
+             * delegates are set exceed the limits above.
+             */
+            EventBufferOverflowPolicy eventBufferOverflowPolicy = EventBufferOverflowPolicy::Close;
+
+            /**
+             * This flag indicates whether or not to measure the round-trip
+             * time of the connection.  If set, pings sent without data
+             * carry a sequence number and the time they were sent, so that
+             * the pongs answering them can be timed.
+             */
+            bool measureRoundTripTimes = false;
+        };
+
+        /**
+         * This holds information about the compression of messages
+         * by the WebSocket.
+         */
+        struct CompressionStatistics {
+            /**
+             * This is the number of octets of memory currently held
+             * by the WebSocket for compressing and decompressing messages.
+             */
+            size_t memoryInUse = 0;
+
+            /**
+             * This is the largest number of octets of memory held at any
+             * one time by the WebSocket for compressing and decompressing
+             * messages.
+             */
+            size_t peakMemoryInUse = 0;
+
+            /**
+             * This is the number of messages sent compressed.
+             */
+            size_t messagesCompressed = 0;
+
+            /**
+             * This is the number of messages sent uncompressed, while
+             * the "permessage-deflate" extension was in use.
+             */
+            size_t messagesNotCompressed = 0;
+
+            /**
+             * This is the total size of the messages sent compressed,
+             * before they were compressed.
+             */
+            uint64_t octetsBeforeCompression = 0;
+
+            /**
+             * This is the total size of the messages sent compressed,
+             * after they were compressed.
+             */
+            uint64_t octetsAfterCompression = 0;
+
+            /**
+             * This is the total time spent compressing messages sent.
+             */
+            std::chrono::nanoseconds compressionTime = std::chrono::nanoseconds::zero();
+
+            /**
+             * This is the compression ratio (compressed size divided by
+             * uncompressed size), averaged over recent messages.
+             */
+            double recentCompressionRatio = 0.0;
+        };
+
+        /**
+         * This holds information about the events held by the WebSocket
+         * waiting to be reported through delegates.
+         */
+        struct EventBufferStatistics {
+            /**
+             * This is the number of events currently waiting to be
+             * reported through delegates.
+             */
+            size_t eventsBuffered = 0;
+
+            /**
+             * This is the amount of data, in octets, held in the events
+             * currently waiting to be reported through delegates.
+             */
+            size_t octetsBuffered = 0;
+
+            /**
+             * This is the largest number of events that have been waiting
+             * at any one time to be reported through delegates.
+             */
+            size_t peakEventsBuffered = 0;
+
+            /**
+             * This is the largest amount of data, in octets, held in the
+             * events that have been waiting at any one time to be reported
+             * through delegates.
+             */
+            size_t peakOctetsBuffered = 0;
+
+            /**
+             * This is the number of events discarded, under the
+             * EventBufferOverflowPolicy::DropOldest policy, because
+             * they were received before delegates were set and
+             * exceeded the configured limits.
+             */
+            size_t eventsDropped = 0;
+        };
+
+        /**
+         * This holds the times at which notable things happened on the
+         * WebSocket connection.  Each time is left as the clock's epoch
+         * (the default) until the thing it marks has happened.
+         */
+        struct ActivityTimes {
+            /**
+             * This is when the first frame was handed to the connection
+             * to be sent.
+             */
+            std::chrono::steady_clock::time_point firstFrameSent;
+
+            /**
+             * This is when the first frame was received.
+             */
+            std::chrono::steady_clock::time_point firstFrameReceived;
+
+            /**
+             * This is when the most recent frame was received.
+             */
+            std::chrono::steady_clock::time_point lastFrameReceived;
+
+            /**
+             * This is when a close frame was queued to be sent.
+             */
+            std::chrono::steady_clock::time_point closeSent;
+
+            /**
+             * This is when the WebSocket was closed, either by receiving
+             * a close frame or by failing.
+             */
+            std::chrono::steady_clock::time_point closed;
+        };
+
+        /**
+         * This holds the round-trip times measured on the WebSocket
+         * connection, if configured to measure them.
+         */
+        struct RoundTripTimes {
+            /**
+             * This is the number of round trips measured.
+             */
+            size_t samples = 0;
+
+            /**
+             * This is the most recently measured round-trip time.
+             */
+            std::chrono::microseconds last = std::chrono::microseconds(0);
+
+            /**
+             * This is the exponentially weighted moving average of the
+             * round-trip times measured, with each new one given a
+             * weight of one eighth.
+             */
+            std::chrono::microseconds smoothed = std::chrono::microseconds(0);
+
+            /**
+             * This is the shortest round-trip time measured.
+             */
+            std::chrono::microseconds minimum = std::chrono::microseconds(0);
+
+            /**
+             * This is the longest round-trip time measured.
+             */
+            std::chrono::microseconds maximum = std::chrono::microseconds(0);
         };
 
         /**
@@ -86,6 +472,18 @@ namespace WebSockets {
             )
         > CloseReceivedDelegate;
 
+        /**
+         * This is the type of function used to notify the user that
+         * a message, or fragment thereof, has been handed to the
+         * connection to send, or could not be.
+         *
+         * @param[in] sent
+         *     This indicates whether or not the message was handed to
+         *     the connection.  It's false if the message wasn't accepted
+         *     for sending, or the connection was broken first.
+         */
+        typedef std::function< void(bool sent) > SentDelegate;
+
         /**
          * This holds all the functions provided by the user to call whenever
          * interesting events occur.
@@ -166,11 +564,70 @@ namespace WebSockets {
          */
         void Configure(Configuration configuration);
 
+        /**
+         * This method returns information about the compression of messages
+         * by the WebSocket.
+         *
+         * @return
+         *     Information about the compression of messages by the WebSocket
+         *     is returned.
+         */
+        CompressionStatistics GetCompressionStatistics();
+
+        /**
+         * This method returns the subprotocol selected in the
+         * opening handshake.
+         *
+         * @return
+         *     The subprotocol selected in the opening handshake is returned,
+         *     or an empty string if no subprotocol was selected.
+         */
+        std::string GetSubprotocol();
+
+        /**
+         * This method returns information about the events held by the
+         * WebSocket waiting to be reported through delegates.
+         *
+         * @return
+         *     Information about the events held by the WebSocket waiting
+         *     to be reported through delegates is returned.
+         */
+        EventBufferStatistics GetEventBufferStatistics();
+
+        /**
+         * This method returns the times at which notable things happened
+         * on the WebSocket connection.
+         *
+         * @return
+         *     The times at which notable things happened on the
+         *     WebSocket connection are returned.
+         */
+        ActivityTimes GetActivityTimes();
+
+        /**
+         * This method returns the round-trip times measured on the
+         * WebSocket connection.  They're only measured if the WebSocket
+         * is configured to measure them, from pongs answering pings
+         * sent by the WebSocket without data.  Other pongs are ignored.
+         *
+         * @return
+         *     The round-trip times measured on the WebSocket
+         *     connection are returned.
+         */
+        RoundTripTimes GetRoundTripTimes();
+
         /**
          * This method puts the WebSocket into the OPENING state,
          * in the client role, updating the given HTTP request
          * in order to perform the opening handshake.
          *
+         * Messages sent while in the OPENING state are held, and sent
+         * once the opening handshake succeeds, ahead of any sent later,
+         * so that they can go out right behind the handshake.  If the
+         * handshake fails, or the WebSocket is closed first, they're
+         * discarded, and any functions given to be called once they're
+         * sent are called to report that they could not be.
+         *
          * @param[in,out] request
          *     This is the HTTP request that will be used to perform
          *     the opening handshake of the WebSocket.  This method
@@ -183,7 +640,9 @@ namespace WebSockets {
         /**
          * This method puts the WebSocket into the OPENED state,
          * in the client role, by checking the given HTTP response
-         * returned that completes the handshake.
+         * returned that completes the handshake.  Any messages sent
+         * since the handshake was started are sent if it succeeded,
+         * or discarded if it failed.
          *
          * @param[in] connection
          *     This is the connection to use to send and receive frames.
@@ -193,13 +652,20 @@ namespace WebSockets {
          *     handshake of the WebSocket.  This response may indicate
          *     that the handshake failed.
          *
+         * @param[in] trailer
+         *     This holds any characters that have already been received
+         *     from the connection but come after the end of the response.
+         *     These are frames the server sent along with the response,
+         *     and they're received as soon as the WebSocket is opened.
+         *
          * @return
          *     An indication of whether or not the opening handshake
          *     succeeded is returned.
          */
         bool FinishOpenAsClient(
             std::shared_ptr< Http::Connection > connection,
-            const Http::Response& response
+            const Http::Response& response,
+            const std::string& trailer = ""
         );
 
         /**
@@ -223,7 +689,13 @@ namespace WebSockets {
          * @param[in] trailer
          *     This holds any characters that have already been received
          *     from the connection but come after the end of the open
-         *     request.
+         *     request.  These are frames the client sent along with the
+         *     request, and they're received as soon as the WebSocket is
+         *     opened.  Since the response hasn't been sent yet, any frames
+         *     sent in reply to them, such as pongs and close frames, are
+         *     held until the next time the WebSocket sends or receives
+         *     a frame, so that they never reach the client ahead of
+         *     the response.
          *
          * @return
          *     An indication of whether or not the opening handshake
@@ -254,6 +726,12 @@ namespace WebSockets {
         /**
          * This method initiates the closing of the WebSocket,
          * sending a close frame with the given status code and reason.
+         * If the WebSocket is still in the OPENING state, any messages
+         * sent since the opening handshake was started are discarded.
+         *
+         * The status code 1006 is never sent; instead the connection is
+         * broken and the close delegate called with it, even if a close
+         * frame was sent before and its reply hasn't come back.
          *
          * @param[in] code
          *     This is the status code to send in the close frame.
@@ -271,6 +749,9 @@ namespace WebSockets {
          *
          * @param[in] data
          *     This is the optional data to include with the message.
+         *     If none is given and the WebSocket is configured to
+         *     measure round-trip times, the message carries the data
+         *     used to time the pong answering it.
          */
         void Ping(const std::string& data = "");
 
@@ -292,10 +773,16 @@ namespace WebSockets {
          * @param[in] lastFragment
          *     This indicates whether or not this is the last
          *     frame in its message.
+         *
+         * @param[in] compression
+         *     This is used to choose whether or not to compress the
+         *     message, if the "permessage-deflate" extension is in use.
+         *     It only matters for the first frame of a message.
          */
         void SendText(
             const std::string& data,
-            bool lastFragment = true
+            bool lastFragment = true,
+            Compression compression = Compression::Auto
         );
 
         /**
@@ -308,10 +795,140 @@ namespace WebSockets {
          * @param[in] lastFragment
          *     This indicates whether or not this is the last
          *     frame in its message.
+         *
+         * @param[in] compression
+         *     This is used to choose whether or not to compress the
+         *     message, if the "permessage-deflate" extension is in use.
+         *     It only matters for the first frame of a message.
+         */
+        void SendBinary(
+            const std::string& data,
+            bool lastFragment = true,
+            Compression compression = Compression::Auto
+        );
+
+        /**
+         * This method sends a text message, or fragment thereof,
+         * over the WebSocket, and arranges for the given function to be
+         * called once it's been handed to the connection.  Messages sent
+         * by other threads at the same time may be handed over later,
+         * by other threads, so the function may be called by
+         * any thread using the WebSocket.
+         *
+         * @param[in] data
+         *     This is the data to include with the message.
+         *
+         * @param[in] lastFragment
+         *     This indicates whether or not this is the last
+         *     frame in its message.
+         *
+         * @param[in] compression
+         *     This is used to choose whether or not to compress the
+         *     message, if the "permessage-deflate" extension is in use.
+         *     It only matters for the first frame of a message.
+         *
+         * @param[in] sentDelegate
+         *     This is the function to call once the message has been
+         *     handed to the connection, or could not be.
+         */
+        void SendText(
+            const std::string& data,
+            bool lastFragment,
+            Compression compression,
+            SentDelegate sentDelegate
+        );
+
+        /**
+         * This method sends a binary message, or fragment thereof,
+         * over the WebSocket, and arranges for the given function to be
+         * called once it's been handed to the connection.  Messages sent
+         * by other threads at the same time may be handed over later,
+         * by other threads, so the function may be called by
+         * any thread using the WebSocket.
+         *
+         * @param[in] data
+         *     This is the data to include with the message.
+         *
+         * @param[in] lastFragment
+         *     This indicates whether or not this is the last
+         *     frame in its message.
+         *
+         * @param[in] compression
+         *     This is used to choose whether or not to compress the
+         *     message, if the "permessage-deflate" extension is in use.
+         *     It only matters for the first frame of a message.
+         *
+         * @param[in] sentDelegate
+         *     This is the function to call once the message has been
+         *     handed to the connection, or could not be.
          */
         void SendBinary(
             const std::string& data,
-            bool lastFragment = true
+            bool lastFragment,
+            Compression compression,
+            SentDelegate sentDelegate
+        );
+
+        /**
+         * This function sends the same complete text message over each
+         * of the given WebSockets.
+         *
+         * Where the "permessage-deflate" extension is in use and the
+         * compression context is reset after every message, the message
+         * is compressed only once for all recipients which negotiated the
+         * same compression settings, and recipients in the server role
+         * also share the same encoded frame.  Other recipients send the
+         * message just as if SendText were called for each of them.
+         *
+         * Recipients in the midst of sending a fragmented message, or
+         * which have started closing, are skipped.
+         *
+         * @param[in] recipients
+         *     These are the WebSockets over which to send the message.
+         *
+         * @param[in] data
+         *     This is the data to include with the message.
+         *
+         * @param[in] compression
+         *     This is used to choose whether or not to compress the
+         *     message, for each recipient using the "permessage-deflate"
+         *     extension.
+         */
+        static void BroadcastText(
+            const std::vector< std::shared_ptr< WebSocket > >& recipients,
+            const std::string& data,
+            Compression compression = Compression::Auto
+        );
+
+        /**
+         * This function sends the same complete binary message over each
+         * of the given WebSockets.
+         *
+         * Where the "permessage-deflate" extension is in use and the
+         * compression context is reset after every message, the message
+         * is compressed only once for all recipients which negotiated the
+         * same compression settings, and recipients in the server role
+         * also share the same encoded frame.  Other recipients send the
+         * message just as if SendBinary were called for each of them.
+         *
+         * Recipients in the midst of sending a fragmented message, or
+         * which have started closing, are skipped.
+         *
+         * @param[in] recipients
+         *     These are the WebSockets over which to send the message.
+         *
+         * @param[in] data
+         *     This is the data to include with the message.
+         *
+         * @param[in] compression
+         *     This is used to choose whether or not to compress the
+         *     message, for each recipient using the "permessage-deflate"
+         *     extension.
+         */
+        static void BroadcastBinary(
+            const std::vector< std::shared_ptr< WebSocket > >& recipients,
+            const std::string& data,
+            Compression compression = Compression::Auto
         );
 
         /**
@@ -0,0 +1,282 @@
+/**
+ * @file CompressionPool.cpp
+ *
+ * This module contains the implementation of the
+ * WebSockets::CompressionPool class.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include "CompressionStream.hpp"
+
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdlib.h>
+#include <vector>
+#include <WebSockets/CompressionPool.hpp>
+#include <zlib.h>
+
+namespace {
+
+    /**
+     * This is the size of the header placed in front of every block of
+     * memory allocated for zlib, in order to remember the size of the
+     * block.  It's as large as the most strictly aligned type, so that
+     * the memory after it is suitably aligned.
+     */
+    constexpr size_t ALLOCATION_HEADER_SIZE = sizeof(max_align_t);
+
+    /**
+     * This function is called by zlib to allocate memory for a stream.
+     *
+     * @param[in] opaque
+     *     This points to the stream for which the memory is allocated.
+     *
+     * @param[in] items
+     *     This is the number of items to allocate.
+     *
+     * @param[in] size
+     *     This is the size of each item to allocate.
+     *
+     * @return
+     *     The allocated memory is returned.
+     *
+     * @retval Z_NULL
+     *     This is returned if the memory could not be allocated.
+     */
+    voidpf Allocate(
+        voidpf opaque,
+        uInt items,
+        uInt size
+    ) {
+        const auto stream = (WebSockets::CompressionPool::Stream*)opaque;
+        const auto blockSize = (size_t)items * (size_t)size;
+        const auto block = (char*)malloc(ALLOCATION_HEADER_SIZE + blockSize);
+        if (block == nullptr) {
+            return Z_NULL;
+        }
+        *(size_t*)block = blockSize;
+        stream->memory += blockSize;
+        return block + ALLOCATION_HEADER_SIZE;
+    }
+
+    /**
+     * This function is called by zlib to free memory for a stream.
+     *
+     * @param[in] opaque
+     *     This points to the stream for which the memory was allocated.
+     *
+     * @param[in] address
+     *     This is the address of the memory to free.
+     */
+    void Free(
+        voidpf opaque,
+        voidpf address
+    ) {
+        const auto stream = (WebSockets::CompressionPool::Stream*)opaque;
+        const auto block = (char*)address - ALLOCATION_HEADER_SIZE;
+        stream->memory -= *(size_t*)block;
+        free(block);
+    }
+
+    /**
+     * This function sets up a new zlib stream.
+     *
+     * @param[in] kind
+     *     This identifies what the stream does.
+     *
+     * @param[in] windowBits
+     *     This is the base-2 logarithm of the sliding window size
+     *     the stream should use.
+     *
+     * @param[in] memoryLevel
+     *     This is the amount of memory, from 1 to 9, a compression stream
+     *     should use for its internal compression state.
+     *
+     * @return
+     *     The new stream is returned.
+     *
+     * @retval nullptr
+     *     This is returned if the stream could not be set up.
+     */
+    std::unique_ptr< WebSockets::CompressionPool::Stream > MakeStream(
+        WebSockets::CompressionPool::Stream::Kind kind,
+        int windowBits,
+        int memoryLevel
+    ) {
+        std::unique_ptr< WebSockets::CompressionPool::Stream > stream(
+            new WebSockets::CompressionPool::Stream()
+        );
+        stream->kind = kind;
+        stream->windowBits = windowBits;
+        stream->memoryLevel = memoryLevel;
+        stream->zStream = z_stream();
+        stream->zStream.zalloc = Allocate;
+        stream->zStream.zfree = Free;
+        stream->zStream.opaque = stream.get();
+        int result;
+        if (kind == WebSockets::CompressionPool::Stream::Kind::Deflate) {
+            result = deflateInit2(
+                &stream->zStream,
+                Z_DEFAULT_COMPRESSION,
+                Z_DEFLATED,
+                -windowBits,
+                memoryLevel,
+                Z_DEFAULT_STRATEGY
+            );
+        } else {
+            result = inflateInit2(
+                &stream->zStream,
+                -windowBits
+            );
+        }
+        if (result != Z_OK) {
+            return nullptr;
+        }
+        stream->initialized = true;
+        return stream;
+    }
+
+}
+
+namespace WebSockets {
+
+    /**
+     * This contains the private properties of a CompressionPool instance.
+     */
+    struct CompressionPool::Impl {
+        // Properties
+
+        /**
+         * This is used to synchronize access to the pool.
+         */
+        mutable std::mutex mutex;
+
+        /**
+         * This is the largest number of streams the pool should hold
+         * while they're not in use.
+         */
+        size_t maxIdleStreams = 0;
+
+        /**
+         * These are the streams currently held by the pool.
+         */
+        std::vector< std::unique_ptr< Stream > > idleStreams;
+
+        /**
+         * This holds information about the use of the pool.
+         */
+        Statistics statistics;
+
+        // Methods
+
+        /**
+         * This method hands out a stream, recycling one held by the pool
+         * if possible.
+         *
+         * @param[in] kind
+         *     This identifies what the stream should do.
+         *
+         * @param[in] windowBits
+         *     This is the base-2 logarithm of the sliding window size
+         *     the stream should use.
+         *
+         * @param[in] memoryLevel
+         *     This is the amount of memory, from 1 to 9, a compression
+         *     stream should use for its internal compression state.
+         *
+         * @return
+         *     The stream is returned.
+         *
+         * @retval nullptr
+         *     This is returned if the stream could not be set up.
+         */
+        std::unique_ptr< Stream > Acquire(
+            Stream::Kind kind,
+            int windowBits,
+            int memoryLevel
+        ) {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            for (auto it = idleStreams.rbegin(); it != idleStreams.rend(); ++it) {
+                auto& stream = *it;
+                if (
+                    (stream->kind == kind)
+                    && (stream->windowBits == windowBits)
+                    && (
+                        (kind == Stream::Kind::Inflate)
+                        || (stream->memoryLevel == memoryLevel)
+                    )
+                ) {
+                    auto reusedStream = std::move(stream);
+                    (void)idleStreams.erase(std::next(it).base());
+                    if (kind == Stream::Kind::Deflate) {
+                        --statistics.idleDeflaters;
+                    } else {
+                        --statistics.idleInflaters;
+                    }
+                    statistics.idleMemory -= reusedStream->memory;
+                    ++statistics.streamsReused;
+                    return reusedStream;
+                }
+            }
+            lock.unlock();
+            auto createdStream = MakeStream(kind, windowBits, memoryLevel);
+            if (createdStream != nullptr) {
+                lock.lock();
+                ++statistics.streamsCreated;
+            }
+            return createdStream;
+        }
+    };
+
+    CompressionPool::~CompressionPool() noexcept = default;
+    CompressionPool::CompressionPool(CompressionPool&&) noexcept = default;
+    CompressionPool& CompressionPool::operator=(CompressionPool&&) noexcept = default;
+
+    CompressionPool::CompressionPool(size_t maxIdleStreams)
+        : impl_(new Impl)
+    {
+        impl_->maxIdleStreams = maxIdleStreams;
+    }
+
+    auto CompressionPool::GetStatistics() const -> Statistics {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        return impl_->statistics;
+    }
+
+    std::unique_ptr< CompressionPool::Stream > CompressionPool::AcquireDeflater(
+        int windowBits,
+        int memoryLevel
+    ) {
+        return impl_->Acquire(Stream::Kind::Deflate, windowBits, memoryLevel);
+    }
+
+    std::unique_ptr< CompressionPool::Stream > CompressionPool::AcquireInflater(int windowBits) {
+        return impl_->Acquire(Stream::Kind::Inflate, windowBits, 0);
+    }
+
+    void CompressionPool::Release(std::unique_ptr< Stream >&& stream) {
+        if (stream == nullptr) {
+            return;
+        }
+        auto releasedStream = std::move(stream);
+        if (releasedStream->kind == Stream::Kind::Deflate) {
+            (void)deflateReset(&releasedStream->zStream);
+        } else {
+            (void)inflateReset(&releasedStream->zStream);
+        }
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        if (impl_->idleStreams.size() >= impl_->maxIdleStreams) {
+            return;
+        }
+        if (releasedStream->kind == Stream::Kind::Deflate) {
+            ++impl_->statistics.idleDeflaters;
+        } else {
+            ++impl_->statistics.idleInflaters;
+        }
+        impl_->statistics.idleMemory += releasedStream->memory;
+        impl_->idleStreams.push_back(std::move(releasedStream));
+    }
+
+}
@@ -0,0 +1,94 @@
+#ifndef WEB_SOCKETS_COMPRESSION_STREAM_HPP
+#define WEB_SOCKETS_COMPRESSION_STREAM_HPP
+
+/**
+ * @file CompressionStream.hpp
+ *
+ * This module defines the WebSockets::CompressionPool::Stream structure.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <stddef.h>
+#include <WebSockets/CompressionPool.hpp>
+#include <zlib.h>
+
+namespace WebSockets {
+
+    /**
+     * This holds a zlib stream used either to compress or to decompress
+     * data, along with what's needed to recycle it.
+     */
+    struct CompressionPool::Stream {
+        // Types
+
+        /**
+         * This identifies what the stream does.
+         */
+        enum class Kind {
+            /**
+             * The stream compresses data.
+             */
+            Deflate,
+
+            /**
+             * The stream decompresses data.
+             */
+            Inflate,
+        };
+
+        // Properties
+
+        /**
+         * This identifies what the stream does.
+         */
+        Kind kind = Kind::Deflate;
+
+        /**
+         * This is the base-2 logarithm of the sliding window size
+         * the stream uses.
+         */
+        int windowBits = 15;
+
+        /**
+         * This is the amount of memory, from 1 to 9, a compression stream
+         * uses for its internal compression state.
+         */
+        int memoryLevel = 8;
+
+        /**
+         * This is the zlib stream itself.
+         */
+        z_stream zStream;
+
+        /**
+         * This indicates whether or not zlib has set up the stream.
+         */
+        bool initialized = false;
+
+        /**
+         * This is the number of octets of memory currently allocated
+         * by zlib for the stream.
+         */
+        size_t memory = 0;
+
+        // Methods
+
+        /**
+         * This is the destructor of the structure.
+         */
+        ~Stream() noexcept {
+            if (!initialized) {
+                return;
+            }
+            if (kind == Kind::Deflate) {
+                (void)deflateEnd(&zStream);
+            } else {
+                (void)inflateEnd(&zStream);
+            }
+        }
+    };
+
+}
+
+#endif /* WEB_SOCKETS_COMPRESSION_STREAM_HPP */
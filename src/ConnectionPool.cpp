@@ -0,0 +1,560 @@
+/**
+ * @file ConnectionPool.cpp
+ *
+ * This module contains the implementation of the
+ * WebSockets::ConnectionPool class.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <Http/IClient.hpp>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <string>
+#include <SystemAbstractions/DiagnosticsSender.hpp>
+#include <thread>
+#include <vector>
+#include <WebSockets/ConnectionPool.hpp>
+#include <WebSockets/MakeConnection.hpp>
+#include <WebSockets/WebSocket.hpp>
+
+namespace {
+
+    /**
+     * This is the clock used to tell whether or not anything has been
+     * received over a WebSocket since it was sent a ping.
+     */
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * This holds onto a WebSocket waiting in the pool to be handed out.
+     */
+    struct IdleConnection {
+        /**
+         * This is the WebSocket waiting to be handed out.
+         */
+        std::shared_ptr< WebSockets::WebSocket > ws;
+
+        /**
+         * This flag is set if a ping has been sent over the WebSocket.
+         */
+        bool pinged = false;
+
+        /**
+         * This is when the last ping was sent over the WebSocket.
+         */
+        Clock::time_point pingSent;
+    };
+
+    /**
+     * This holds the state of the pool for one upstream server.
+     */
+    struct Upstream {
+        /**
+         * This identifies the server.
+         */
+        WebSockets::Endpoint endpoint;
+
+        /**
+         * These are the WebSockets waiting to be handed out,
+         * oldest first.
+         */
+        std::deque< std::shared_ptr< IdleConnection > > idle;
+
+        /**
+         * These are the functions to call to abort the connection attempts
+         * in progress to keep WebSockets ready for use, keyed by attempt.
+         */
+        std::map< size_t, std::function< void() > > attempts;
+    };
+
+    /**
+     * This forms the key under which the given upstream server is kept.
+     *
+     * @param[in] upstream
+     *     This identifies the upstream server.
+     *
+     * @return
+     *     The key under which the upstream server is kept is returned.
+     */
+    std::string MakeUpstreamKey(const WebSockets::Endpoint& upstream) {
+        return upstream.host + ":" + std::to_string(upstream.port);
+    }
+
+    /**
+     * This function determines whether or not the given WebSocket
+     * has closed.
+     *
+     * @param[in] times
+     *     These are the times of activity of the WebSocket.
+     *
+     * @return
+     *     An indication of whether or not the WebSocket has closed
+     *     is returned.
+     */
+    bool IsClosed(const WebSockets::WebSocket::ActivityTimes& times) {
+        return (times.closed != Clock::time_point());
+    }
+
+}
+
+namespace WebSockets {
+
+    /**
+     * This contains the private properties of a ConnectionPool instance.
+     */
+    struct ConnectionPool::Impl
+        : public std::enable_shared_from_this< Impl >
+    {
+        // Properties
+
+        /**
+         * This is used to synchronize access to the pool.
+         */
+        mutable std::mutex mutex;
+
+        /**
+         * This is used to wake the thread checking the health of the pool
+         * when the pool is stopped.
+         */
+        std::condition_variable stopCondition;
+
+        /**
+         * This indicates whether or not the pool is started.
+         */
+        bool started = false;
+
+        /**
+         * This is incremented whenever the pool is stopped, so that
+         * connection attempts finishing afterwards can be recognized
+         * and ignored.
+         */
+        size_t generation = 0;
+
+        /**
+         * This is used to identify connection attempts.
+         */
+        size_t nextAttempt = 0;
+
+        /**
+         * This is the web client object to use to make connections.
+         */
+        std::shared_ptr< Http::IClient > http;
+
+        /**
+         * This is the object to use to publish any diagnostic messages.
+         */
+        std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender;
+
+        /**
+         * These are the configurable parameters of the pool.
+         */
+        Configuration configuration;
+
+        /**
+         * This holds the state of the pool for each upstream server,
+         * keyed by server.
+         */
+        std::map< std::string, Upstream > upstreams;
+
+        /**
+         * These are the functions to call to abort the connection attempts
+         * in progress on behalf of callers of Acquire, keyed by attempt.
+         */
+        std::map< size_t, std::function< void() > > acquisitions;
+
+        /**
+         * This holds information about the use of the pool.
+         */
+        Statistics statistics;
+
+        /**
+         * This is the thread which checks the health of the pool
+         * on the configured interval, if any.
+         */
+        std::thread healthThread;
+
+        // Methods
+
+        /**
+         * This method starts connection attempts to the given upstream
+         * server, to bring the number of WebSockets waiting to be handed out
+         * or being connected up to the configured number.  Attempts which
+         * fail are not retried until the next health check.
+         *
+         * @param[in] key
+         *     This is the key under which the upstream server is kept.
+         */
+        void Refill(const std::string& key) {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            const auto upstreamsEntry = upstreams.find(key);
+            if (
+                !started
+                || (upstreamsEntry == upstreams.end())
+            ) {
+                return;
+            }
+            auto& upstream = upstreamsEntry->second;
+            const auto pooled = upstream.idle.size() + upstream.attempts.size();
+            if (pooled >= configuration.warmConnections) {
+                return;
+            }
+            const auto attemptGeneration = generation;
+            const auto httpToUse = http;
+            const auto diagnosticsSenderToUse = diagnosticsSender;
+            const auto webSocketConfiguration = configuration.webSocketConfiguration;
+            for (
+                size_t needed = configuration.warmConnections - pooled;
+                needed > 0;
+                --needed
+            ) {
+                const auto attempt = nextAttempt++;
+                const auto endpoint = upstream.endpoint;
+                upstream.attempts[attempt] = nullptr;
+                lock.unlock();
+                std::weak_ptr< Impl > selfWeak(shared_from_this());
+                const auto abortAttempt = MakeConnection(
+                    httpToUse,
+                    endpoint.host,
+                    endpoint.port,
+                    diagnosticsSenderToUse,
+                    [selfWeak, key, attempt, attemptGeneration](std::shared_ptr< WebSocket > ws){
+                        const auto self = selfWeak.lock();
+                        if (self == nullptr) {
+                            if (ws != nullptr) {
+                                ws->Close(1001);
+                            }
+                            return;
+                        }
+                        self->AttemptFinished(key, attempt, attemptGeneration, ws);
+                    },
+                    webSocketConfiguration
+                );
+                lock.lock();
+                if (attemptGeneration != generation) {
+                    lock.unlock();
+                    abortAttempt();
+                    return;
+                }
+                const auto attemptsEntry = upstream.attempts.find(attempt);
+                if (attemptsEntry != upstream.attempts.end()) {
+                    attemptsEntry->second = abortAttempt;
+                }
+            }
+        }
+
+        /**
+         * This method is called when an attempt to connect a WebSocket
+         * to keep ready for use is finished.
+         *
+         * @param[in] key
+         *     This is the key under which the upstream server is kept.
+         *
+         * @param[in] attempt
+         *     This identifies the connection attempt.
+         *
+         * @param[in] attemptGeneration
+         *     This is the generation of the pool when the attempt
+         *     was started.
+         *
+         * @param[in] ws
+         *     This is the WebSocket connected, or nullptr if the
+         *     connection could not be made.
+         */
+        void AttemptFinished(
+            const std::string& key,
+            size_t attempt,
+            size_t attemptGeneration,
+            std::shared_ptr< WebSocket > ws
+        ) {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            const auto upstreamsEntry = upstreams.find(key);
+            if (
+                (attemptGeneration != generation)
+                || (upstreamsEntry == upstreams.end())
+            ) {
+                lock.unlock();
+                if (ws != nullptr) {
+                    ws->Close(1001);
+                }
+                return;
+            }
+            (void)upstreamsEntry->second.attempts.erase(attempt);
+            if (ws == nullptr) {
+                ++statistics.connectionsFailed;
+                return;
+            }
+            ++statistics.connectionsMade;
+            const auto idleConnection = std::make_shared< IdleConnection >();
+            idleConnection->ws = ws;
+            upstreamsEntry->second.idle.push_back(idleConnection);
+        }
+
+        /**
+         * This method adds an upstream server to the pool, if it
+         * isn't already.  The pool must be locked.
+         *
+         * @param[in] upstream
+         *     This identifies the upstream server.
+         *
+         * @return
+         *     The key under which the upstream server is kept is returned.
+         */
+        std::string AddUpstream(const Endpoint& upstream) {
+            const auto key = MakeUpstreamKey(upstream);
+            auto& upstreamState = upstreams[key];
+            upstreamState.endpoint = upstream;
+            return key;
+        }
+
+        /**
+         * This method checks the WebSockets waiting to be handed out.
+         */
+        void CheckHealth() {
+            std::vector< std::shared_ptr< WebSocket > > webSocketsToClose;
+            std::vector< std::shared_ptr< WebSocket > > webSocketsToPing;
+            std::vector< std::string > keys;
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            for (auto& upstreamsEntry: upstreams) {
+                keys.push_back(upstreamsEntry.first);
+                auto& idle = upstreamsEntry.second.idle;
+                for (auto it = idle.begin(); it != idle.end(); ) {
+                    const auto& idleConnection = *it;
+                    const auto times = idleConnection->ws->GetActivityTimes();
+                    if (IsClosed(times)) {
+                        ++statistics.connectionsLost;
+                        it = idle.erase(it);
+                    } else if (
+                        idleConnection->pinged
+                        && (times.lastFrameReceived < idleConnection->pingSent)
+                    ) {
+                        webSocketsToClose.push_back(idleConnection->ws);
+                        ++statistics.healthChecksFailed;
+                        it = idle.erase(it);
+                    } else {
+                        idleConnection->pinged = true;
+                        idleConnection->pingSent = Clock::now();
+                        webSocketsToPing.push_back(idleConnection->ws);
+                        ++it;
+                    }
+                }
+            }
+            lock.unlock();
+            for (const auto& ws: webSocketsToClose) {
+                ws->Close(1001, "no pong received");
+            }
+            for (const auto& ws: webSocketsToPing) {
+                ws->Ping();
+            }
+            for (const auto& key: keys) {
+                Refill(key);
+            }
+        }
+
+        /**
+         * This method runs the thread which checks the health of the pool
+         * on the configured interval.
+         */
+        void CheckHealthPeriodically() {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            while (started) {
+                (void)stopCondition.wait_for(
+                    lock,
+                    configuration.healthCheckInterval,
+                    [this]{ return !started; }
+                );
+                if (!started) {
+                    break;
+                }
+                lock.unlock();
+                CheckHealth();
+                lock.lock();
+            }
+        }
+
+        /**
+         * This method stops the pool.
+         */
+        void Stop() {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            if (!started) {
+                return;
+            }
+            started = false;
+            ++generation;
+            std::vector< std::function< void() > > attemptsToAbort;
+            std::vector< std::shared_ptr< WebSocket > > webSocketsToClose;
+            for (const auto& acquisitionsEntry: acquisitions) {
+                if (acquisitionsEntry.second != nullptr) {
+                    attemptsToAbort.push_back(acquisitionsEntry.second);
+                }
+            }
+            acquisitions.clear();
+            for (const auto& upstreamsEntry: upstreams) {
+                for (const auto& attemptsEntry: upstreamsEntry.second.attempts) {
+                    if (attemptsEntry.second != nullptr) {
+                        attemptsToAbort.push_back(attemptsEntry.second);
+                    }
+                }
+                for (const auto& idleConnection: upstreamsEntry.second.idle) {
+                    webSocketsToClose.push_back(idleConnection->ws);
+                }
+            }
+            upstreams.clear();
+            stopCondition.notify_all();
+            lock.unlock();
+            if (healthThread.joinable()) {
+                healthThread.join();
+            }
+            for (const auto& abortAttempt: attemptsToAbort) {
+                abortAttempt();
+            }
+            for (const auto& ws: webSocketsToClose) {
+                ws->Close(1001);
+            }
+        }
+    };
+
+    ConnectionPool::~ConnectionPool() noexcept {
+        if (impl_ != nullptr) {
+            impl_->Stop();
+        }
+    }
+    ConnectionPool::ConnectionPool(ConnectionPool&&) noexcept = default;
+    ConnectionPool& ConnectionPool::operator=(ConnectionPool&&) noexcept = default;
+
+    ConnectionPool::ConnectionPool()
+        : impl_(new Impl)
+    {
+    }
+
+    void ConnectionPool::Start(
+        std::shared_ptr< Http::IClient > http,
+        std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender,
+        const Configuration& configuration
+    ) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        if (impl_->started) {
+            return;
+        }
+        impl_->http = http;
+        impl_->diagnosticsSender = diagnosticsSender;
+        impl_->configuration = configuration;
+        impl_->started = true;
+        if (configuration.healthCheckInterval.count() > 0) {
+            const auto implRaw = impl_.get();
+            impl_->healthThread = std::thread(
+                [implRaw]{
+                    implRaw->CheckHealthPeriodically();
+                }
+            );
+        }
+    }
+
+    void ConnectionPool::Stop() {
+        impl_->Stop();
+    }
+
+    void ConnectionPool::AddUpstream(const Endpoint& upstream) {
+        std::unique_lock< decltype(impl_->mutex) > lock(impl_->mutex);
+        if (!impl_->started) {
+            return;
+        }
+        const auto key = impl_->AddUpstream(upstream);
+        lock.unlock();
+        impl_->Refill(key);
+    }
+
+    void ConnectionPool::Acquire(
+        const Endpoint& upstream,
+        MakeConnectionCompleteDelegate completeDelegate
+    ) {
+        std::unique_lock< decltype(impl_->mutex) > lock(impl_->mutex);
+        if (!impl_->started) {
+            lock.unlock();
+            completeDelegate(nullptr);
+            return;
+        }
+        const auto key = impl_->AddUpstream(upstream);
+        auto& idle = impl_->upstreams[key].idle;
+        std::shared_ptr< WebSocket > ws;
+        while (
+            (ws == nullptr)
+            && !idle.empty()
+        ) {
+            const auto idleConnection = idle.front();
+            idle.pop_front();
+            if (IsClosed(idleConnection->ws->GetActivityTimes())) {
+                ++impl_->statistics.connectionsLost;
+            } else {
+                ws = idleConnection->ws;
+            }
+        }
+        if (ws == nullptr) {
+            ++impl_->statistics.misses;
+            const auto http = impl_->http;
+            const auto diagnosticsSender = impl_->diagnosticsSender;
+            const auto webSocketConfiguration = impl_->configuration.webSocketConfiguration;
+            const auto attempt = impl_->nextAttempt++;
+            const auto attemptGeneration = impl_->generation;
+            impl_->acquisitions[attempt] = nullptr;
+            lock.unlock();
+            std::weak_ptr< Impl > implWeak(impl_);
+            const auto abortAttempt = MakeConnection(
+                http,
+                upstream.host,
+                upstream.port,
+                diagnosticsSender,
+                [implWeak, attempt, completeDelegate](std::shared_ptr< WebSocket > ws){
+                    const auto impl = implWeak.lock();
+                    if (impl != nullptr) {
+                        std::lock_guard< decltype(impl->mutex) > lock(impl->mutex);
+                        (void)impl->acquisitions.erase(attempt);
+                    }
+                    completeDelegate(ws);
+                },
+                webSocketConfiguration
+            );
+            lock.lock();
+            if (attemptGeneration != impl_->generation) {
+                lock.unlock();
+                abortAttempt();
+            } else {
+                const auto acquisitionsEntry = impl_->acquisitions.find(attempt);
+                if (acquisitionsEntry != impl_->acquisitions.end()) {
+                    acquisitionsEntry->second = abortAttempt;
+                }
+                lock.unlock();
+            }
+        } else {
+            ++impl_->statistics.hits;
+            lock.unlock();
+            completeDelegate(ws);
+        }
+        impl_->Refill(key);
+    }
+
+    void ConnectionPool::CheckHealth() {
+        impl_->CheckHealth();
+    }
+
+    auto ConnectionPool::GetStatistics() const -> Statistics {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        auto statistics = impl_->statistics;
+        for (const auto& upstreamsEntry: impl_->upstreams) {
+            statistics.idleConnections += upstreamsEntry.second.idle.size();
+        }
+        const auto requests = statistics.hits + statistics.misses;
+        if (requests > 0) {
+            statistics.hitRate = (double)statistics.hits / (double)requests;
+        }
+        return statistics;
+    }
+
+}
@@ -0,0 +1,85 @@
+/**
+ * @file ExtensionElement.cpp
+ *
+ * This module contains the implementation of the functions which parse
+ * and format WebSockets::ExtensionElement structures.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include "ExtensionElement.hpp"
+
+#include <string>
+#include <SystemAbstractions/StringExtensions.hpp>
+#include <vector>
+
+namespace WebSockets {
+
+    std::vector< ExtensionElement > ParseExtensionElements(
+        const std::vector< std::string >& tokens
+    ) {
+        std::vector< ExtensionElement > elements;
+        for (const auto& token: tokens) {
+            ExtensionElement element;
+            size_t start = 0;
+            bool first = true;
+            for (;;) {
+                const auto delimiter = token.find(';', start);
+                const auto part = SystemAbstractions::Trim(
+                    token.substr(
+                        start,
+                        (delimiter == std::string::npos)
+                        ? std::string::npos
+                        : delimiter - start
+                    )
+                );
+                if (first) {
+                    element.name = SystemAbstractions::ToLower(part);
+                    first = false;
+                } else if (!part.empty()) {
+                    const auto equals = part.find('=');
+                    std::string name, value;
+                    if (equals == std::string::npos) {
+                        name = part;
+                    } else {
+                        name = SystemAbstractions::Trim(part.substr(0, equals));
+                        value = SystemAbstractions::Trim(part.substr(equals + 1));
+                        if (
+                            (value.length() >= 2)
+                            && (value.front() == '"')
+                            && (value.back() == '"')
+                        ) {
+                            value = value.substr(1, value.length() - 2);
+                        }
+                    }
+                    element.parameters.emplace_back(
+                        SystemAbstractions::ToLower(name),
+                        value
+                    );
+                }
+                if (delimiter == std::string::npos) {
+                    break;
+                }
+                start = delimiter + 1;
+            }
+            if (!element.name.empty()) {
+                elements.push_back(std::move(element));
+            }
+        }
+        return elements;
+    }
+
+    std::string FormatExtensionElement(const ExtensionElement& element) {
+        std::string token = element.name;
+        for (const auto& parameter: element.parameters) {
+            token += "; ";
+            token += parameter.first;
+            if (!parameter.second.empty()) {
+                token += "=";
+                token += parameter.second;
+            }
+        }
+        return token;
+    }
+
+}
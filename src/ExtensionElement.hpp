@@ -0,0 +1,64 @@
+#ifndef WEB_SOCKETS_EXTENSION_ELEMENT_HPP
+#define WEB_SOCKETS_EXTENSION_ELEMENT_HPP
+
+/**
+ * @file ExtensionElement.hpp
+ *
+ * This module declares the WebSockets::ExtensionElement structure
+ * and the functions which parse and format it.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <string>
+#include <vector>
+#include <WebSockets/Extension.hpp>
+
+namespace WebSockets {
+
+    /**
+     * This represents one element of a "Sec-WebSocket-Extensions" header,
+     * which names an extension and lists its parameters.
+     */
+    struct ExtensionElement {
+        /**
+         * This is the name of the extension.
+         */
+        std::string name;
+
+        /**
+         * These are the parameters of the extension, in the order in which
+         * they appear.  A parameter given without a value has an empty value.
+         */
+        Extension::Parameters parameters;
+    };
+
+    /**
+     * This function parses the tokens of a "Sec-WebSocket-Extensions"
+     * header into extension elements.
+     *
+     * @param[in] tokens
+     *     These are the comma-separated tokens of the header.
+     *
+     * @return
+     *     The extension elements parsed from the header are returned.
+     */
+    std::vector< ExtensionElement > ParseExtensionElements(
+        const std::vector< std::string >& tokens
+    );
+
+    /**
+     * This function formats the given extension element as a token
+     * of a "Sec-WebSocket-Extensions" header.
+     *
+     * @param[in] element
+     *     This is the extension element to format.
+     *
+     * @return
+     *     The formatted extension element is returned.
+     */
+    std::string FormatExtensionElement(const ExtensionElement& element);
+
+}
+
+#endif /* WEB_SOCKETS_EXTENSION_ELEMENT_HPP */
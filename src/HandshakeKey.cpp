@@ -0,0 +1,494 @@
+/**
+ * @file HandshakeKey.cpp
+ *
+ * This module contains the implementation of the functions which check
+ * the "Sec-WebSocket-Key" header of the opening handshake and compute
+ * the matching "Sec-WebSocket-Accept" header.
+ *
+ * Since the key always has the same length, the data hashed to compute
+ * the answer always fits in two SHA-1 blocks, the second of which holds
+ * only padding, so the hash is computed directly on fixed buffers on the
+ * stack.  Where the processor has the SHA extensions, they're used to
+ * hash each block.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include "HandshakeKey.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define WEB_SOCKETS_SHA_NI
+#define WEB_SOCKETS_SHA_NI_TARGET __attribute__((target("sha,sse4.1")))
+#include <cpuid.h>
+#include <immintrin.h>
+#elif (defined(_M_X64) || defined(_M_IX86)) && defined(_MSC_VER)
+#define WEB_SOCKETS_SHA_NI
+#define WEB_SOCKETS_SHA_NI_TARGET
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace {
+
+    /**
+     * This is the string added to the "Sec-WebSocket-Key" before computing
+     * the SHA-1 hash and Base64 encoding the result to form the
+     * corresponding "Sec-WebSocket-Accept" value.
+     */
+    const char WEBSOCKET_KEY_SALT[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+    /**
+     * This is the length of the salt added to the key, in octets.
+     */
+    constexpr size_t WEBSOCKET_KEY_SALT_LENGTH = sizeof(WEBSOCKET_KEY_SALT) - 1;
+
+    /**
+     * This is the size of a SHA-1 block, in octets.
+     */
+    constexpr size_t SHA1_BLOCK_SIZE = 64;
+
+    /**
+     * This is the size of a SHA-1 digest, in octets.
+     */
+    constexpr size_t SHA1_DIGEST_SIZE = 20;
+
+    /**
+     * These are the characters used in Base64 encoding, in order
+     * of the values they encode.
+     */
+    const char BASE64_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    /**
+     * This is the second and last SHA-1 block hashed to compute each
+     * answer.  It holds only the end of the padding and the length of
+     * the data hashed, in bits, which are the same for every key.
+     */
+    const uint8_t FINAL_BLOCK[SHA1_BLOCK_SIZE] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        (uint8_t)(((WebSockets::HANDSHAKE_KEY_LENGTH + WEBSOCKET_KEY_SALT_LENGTH) * 8) >> 8),
+        (uint8_t)((WebSockets::HANDSHAKE_KEY_LENGTH + WEBSOCKET_KEY_SALT_LENGTH) * 8),
+    };
+
+    /**
+     * This function rotates the given value left by the given
+     * number of bits.
+     *
+     * @param[in] value
+     *     This is the value to rotate.
+     *
+     * @param[in] bits
+     *     This is the number of bits by which to rotate the value.
+     *
+     * @return
+     *     The rotated value is returned.
+     */
+    inline uint32_t RotateLeft(uint32_t value, int bits) {
+        return (value << bits) | (value >> (32 - bits));
+    }
+
+#ifdef WEB_SOCKETS_SHA_NI
+    /**
+     * This function updates a SHA-1 state by hashing one block,
+     * using the SHA extensions of the processor.
+     *
+     * @param[in,out] state
+     *     This is the state to update.
+     *
+     * @param[in] block
+     *     This points to the block to hash.
+     */
+    WEB_SOCKETS_SHA_NI_TARGET
+    void Sha1CompressShaNi(uint32_t* state, const uint8_t* block) {
+        const auto byteSwap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+        auto abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0x1B);
+        auto e0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+        auto e1 = _mm_setzero_si128();
+        const auto abcdSaved = abcd;
+        const auto e0Saved = e0;
+        __m128i message[4];
+
+        // Rounds 0-3
+        message[0] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(block + 0)), byteSwap);
+        e0 = _mm_add_epi32(e0, message[0]);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+        // Rounds 4-7
+        message[1] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(block + 16)), byteSwap);
+        e1 = _mm_sha1nexte_epu32(e1, message[1]);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+        message[0] = _mm_sha1msg1_epu32(message[0], message[1]);
+
+        // Rounds 8-11
+        message[2] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(block + 32)), byteSwap);
+        e0 = _mm_sha1nexte_epu32(e0, message[2]);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        message[1] = _mm_sha1msg1_epu32(message[1], message[2]);
+        message[0] = _mm_xor_si128(message[0], message[2]);
+
+        // Rounds 12-15
+        message[3] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(block + 48)), byteSwap);
+        e1 = _mm_sha1nexte_epu32(e1, message[3]);
+        e0 = abcd;
+        message[0] = _mm_sha1msg2_epu32(message[0], message[3]);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+        message[2] = _mm_sha1msg1_epu32(message[2], message[3]);
+        message[1] = _mm_xor_si128(message[1], message[3]);
+
+        // Rounds 16-19
+        e0 = _mm_sha1nexte_epu32(e0, message[0]);
+        e1 = abcd;
+        message[1] = _mm_sha1msg2_epu32(message[1], message[0]);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        message[3] = _mm_sha1msg1_epu32(message[3], message[0]);
+        message[2] = _mm_xor_si128(message[2], message[0]);
+
+        // Rounds 20-23
+        e1 = _mm_sha1nexte_epu32(e1, message[1]);
+        e0 = abcd;
+        message[2] = _mm_sha1msg2_epu32(message[2], message[1]);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 1);
+        message[0] = _mm_sha1msg1_epu32(message[0], message[1]);
+        message[3] = _mm_xor_si128(message[3], message[1]);
+
+        // Rounds 24-27
+        e0 = _mm_sha1nexte_epu32(e0, message[2]);
+        e1 = abcd;
+        message[3] = _mm_sha1msg2_epu32(message[3], message[2]);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 1);
+        message[1] = _mm_sha1msg1_epu32(message[1], message[2]);
+        message[0] = _mm_xor_si128(message[0], message[2]);
+
+        // Rounds 28-31
+        e1 = _mm_sha1nexte_epu32(e1, message[3]);
+        e0 = abcd;
+        message[0] = _mm_sha1msg2_epu32(message[0], message[3]);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 1);
+        message[2] = _mm_sha1msg1_epu32(message[2], message[3]);
+        message[1] = _mm_xor_si128(message[1], message[3]);
+
+        // Rounds 32-35
+        e0 = _mm_sha1nexte_epu32(e0, message[0]);
+        e1 = abcd;
+        message[1] = _mm_sha1msg2_epu32(message[1], message[0]);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 1);
+        message[3] = _mm_sha1msg1_epu32(message[3], message[0]);
+        message[2] = _mm_xor_si128(message[2], message[0]);
+
+        // Rounds 36-39
+        e1 = _mm_sha1nexte_epu32(e1, message[1]);
+        e0 = abcd;
+        message[2] = _mm_sha1msg2_epu32(message[2], message[1]);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 1);
+        message[0] = _mm_sha1msg1_epu32(message[0], message[1]);
+        message[3] = _mm_xor_si128(message[3], message[1]);
+
+        // Rounds 40-43
+        e0 = _mm_sha1nexte_epu32(e0, message[2]);
+        e1 = abcd;
+        message[3] = _mm_sha1msg2_epu32(message[3], message[2]);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+        message[1] = _mm_sha1msg1_epu32(message[1], message[2]);
+        message[0] = _mm_xor_si128(message[0], message[2]);
+
+        // Rounds 44-47
+        e1 = _mm_sha1nexte_epu32(e1, message[3]);
+        e0 = abcd;
+        message[0] = _mm_sha1msg2_epu32(message[0], message[3]);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 2);
+        message[2] = _mm_sha1msg1_epu32(message[2], message[3]);
+        message[1] = _mm_xor_si128(message[1], message[3]);
+
+        // Rounds 48-51
+        e0 = _mm_sha1nexte_epu32(e0, message[0]);
+        e1 = abcd;
+        message[1] = _mm_sha1msg2_epu32(message[1], message[0]);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+        message[3] = _mm_sha1msg1_epu32(message[3], message[0]);
+        message[2] = _mm_xor_si128(message[2], message[0]);
+
+        // Rounds 52-55
+        e1 = _mm_sha1nexte_epu32(e1, message[1]);
+        e0 = abcd;
+        message[2] = _mm_sha1msg2_epu32(message[2], message[1]);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 2);
+        message[0] = _mm_sha1msg1_epu32(message[0], message[1]);
+        message[3] = _mm_xor_si128(message[3], message[1]);
+
+        // Rounds 56-59
+        e0 = _mm_sha1nexte_epu32(e0, message[2]);
+        e1 = abcd;
+        message[3] = _mm_sha1msg2_epu32(message[3], message[2]);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+        message[1] = _mm_sha1msg1_epu32(message[1], message[2]);
+        message[0] = _mm_xor_si128(message[0], message[2]);
+
+        // Rounds 60-63
+        e1 = _mm_sha1nexte_epu32(e1, message[3]);
+        e0 = abcd;
+        message[0] = _mm_sha1msg2_epu32(message[0], message[3]);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+        message[2] = _mm_sha1msg1_epu32(message[2], message[3]);
+        message[1] = _mm_xor_si128(message[1], message[3]);
+
+        // Rounds 64-67
+        e0 = _mm_sha1nexte_epu32(e0, message[0]);
+        e1 = abcd;
+        message[1] = _mm_sha1msg2_epu32(message[1], message[0]);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+        message[3] = _mm_sha1msg1_epu32(message[3], message[0]);
+        message[2] = _mm_xor_si128(message[2], message[0]);
+
+        // Rounds 68-71
+        e1 = _mm_sha1nexte_epu32(e1, message[1]);
+        e0 = abcd;
+        message[2] = _mm_sha1msg2_epu32(message[2], message[1]);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+        message[3] = _mm_xor_si128(message[3], message[1]);
+
+        // Rounds 72-75
+        e0 = _mm_sha1nexte_epu32(e0, message[2]);
+        e1 = abcd;
+        message[3] = _mm_sha1msg2_epu32(message[3], message[2]);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+        // Rounds 76-79
+        e1 = _mm_sha1nexte_epu32(e1, message[3]);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+        // Add the hash of the block to the state.
+        e0 = _mm_sha1nexte_epu32(e0, e0Saved);
+        abcd = _mm_add_epi32(abcd, abcdSaved);
+        _mm_storeu_si128((__m128i*)state, _mm_shuffle_epi32(abcd, 0x1B));
+        state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+    }
+
+    /**
+     * This function checks whether or not the processor has the
+     * SHA extensions, along with the SSSE3 and SSE4.1 extensions
+     * used with them.
+     *
+     * @return
+     *     An indication of whether or not the processor has the
+     *     SHA extensions is returned.
+     */
+    bool HasShaExtensions() {
+#ifdef _MSC_VER
+        int registers[4];
+        __cpuid(registers, 0);
+        if (registers[0] < 7) {
+            return false;
+        }
+        __cpuidex(registers, 1, 0);
+        const auto ecx1 = (unsigned int)registers[2];
+        __cpuidex(registers, 7, 0);
+        const auto ebx7 = (unsigned int)registers[1];
+#else
+        unsigned int eax, ebx, ecx, edx;
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+            return false;
+        }
+        const auto ecx1 = ecx;
+        if (
+            (__get_cpuid_max(0, nullptr) < 7)
+            || !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)
+        ) {
+            return false;
+        }
+        const auto ebx7 = ebx;
+#endif
+        return (
+            ((ecx1 & (1u << 9)) != 0)     // SSSE3
+            && ((ecx1 & (1u << 19)) != 0) // SSE4.1
+            && ((ebx7 & (1u << 29)) != 0) // SHA
+        );
+    }
+#endif /* WEB_SOCKETS_SHA_NI */
+
+    /**
+     * This function selects the fastest function available on this
+     * processor to update a SHA-1 state by hashing one block.
+     *
+     * @return
+     *     The function to use to hash each block is returned.
+     */
+    WebSockets::Sha1CompressFunction SelectSha1Compress() {
+        const auto compressShaNi = WebSockets::GetSha1CompressShaNi();
+        if (compressShaNi != nullptr) {
+            return compressShaNi;
+        }
+        return WebSockets::Sha1CompressPortable;
+    }
+
+    /**
+     * This function checks whether or not the given character
+     * is one used in Base64 encoding, other than padding.
+     *
+     * @param[in] c
+     *     This is the character to check.
+     *
+     * @return
+     *     An indication of whether or not the given character is
+     *     one used in Base64 encoding is returned.
+     */
+    bool IsBase64Character(char c) {
+        return (
+            ((c >= 'A') && (c <= 'Z'))
+            || ((c >= 'a') && (c <= 'z'))
+            || ((c >= '0') && (c <= '9'))
+            || (c == '+')
+            || (c == '/')
+        );
+    }
+
+}
+
+namespace WebSockets {
+
+    void Sha1CompressPortable(uint32_t* state, const uint8_t* block) {
+        uint32_t w[80];
+        for (size_t i = 0; i < 16; ++i) {
+            w[i] = (
+                ((uint32_t)block[i * 4] << 24)
+                | ((uint32_t)block[i * 4 + 1] << 16)
+                | ((uint32_t)block[i * 4 + 2] << 8)
+                | (uint32_t)block[i * 4 + 3]
+            );
+        }
+        for (size_t i = 16; i < 80; ++i) {
+            w[i] = RotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+        uint32_t a = state[0];
+        uint32_t b = state[1];
+        uint32_t c = state[2];
+        uint32_t d = state[3];
+        uint32_t e = state[4];
+        for (size_t i = 0; i < 80; ++i) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            const auto temp = RotateLeft(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = RotateLeft(b, 30);
+            b = a;
+            a = temp;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+
+    Sha1CompressFunction GetSha1CompressShaNi() {
+#ifdef WEB_SOCKETS_SHA_NI
+        if (HasShaExtensions()) {
+            return Sha1CompressShaNi;
+        }
+#endif /* WEB_SOCKETS_SHA_NI */
+        return nullptr;
+    }
+
+    bool IsValidHandshakeKey(const std::string& key) {
+        if (key.length() != HANDSHAKE_KEY_LENGTH) {
+            return false;
+        }
+        for (size_t i = 0; i < HANDSHAKE_KEY_LENGTH - 2; ++i) {
+            if (!IsBase64Character(key[i])) {
+                return false;
+            }
+        }
+        return (
+            (key[HANDSHAKE_KEY_LENGTH - 2] == '=')
+            && (key[HANDSHAKE_KEY_LENGTH - 1] == '=')
+        );
+    }
+
+    void ComputeHandshakeAnswer(
+        const char* key,
+        char* answer
+    ) {
+        static const auto compress = SelectSha1Compress();
+        ComputeHandshakeAnswer(key, answer, compress);
+    }
+
+    void ComputeHandshakeAnswer(
+        const char* key,
+        char* answer,
+        Sha1CompressFunction compress
+    ) {
+        // Hash the key and the salt, which together fill all but
+        // the start of the padding in the first block.
+        uint8_t block[SHA1_BLOCK_SIZE];
+        (void)memcpy(block, key, HANDSHAKE_KEY_LENGTH);
+        (void)memcpy(block + HANDSHAKE_KEY_LENGTH, WEBSOCKET_KEY_SALT, WEBSOCKET_KEY_SALT_LENGTH);
+        const size_t dataLength = HANDSHAKE_KEY_LENGTH + WEBSOCKET_KEY_SALT_LENGTH;
+        block[dataLength] = 0x80;
+        (void)memset(block + dataLength + 1, 0, SHA1_BLOCK_SIZE - dataLength - 1);
+        uint32_t state[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+        compress(state, block);
+        compress(state, FINAL_BLOCK);
+        uint8_t digest[SHA1_DIGEST_SIZE + 1];
+        for (size_t i = 0; i < 5; ++i) {
+            digest[i * 4] = (uint8_t)(state[i] >> 24);
+            digest[i * 4 + 1] = (uint8_t)(state[i] >> 16);
+            digest[i * 4 + 2] = (uint8_t)(state[i] >> 8);
+            digest[i * 4 + 3] = (uint8_t)state[i];
+        }
+
+        // Base64 encode the digest.  Its 20 octets make six full groups
+        // of three, and a last group of two, padded with one character.
+        digest[SHA1_DIGEST_SIZE] = 0;
+        for (size_t i = 0; i < 7; ++i) {
+            const uint32_t group = (
+                ((uint32_t)digest[i * 3] << 16)
+                | ((uint32_t)digest[i * 3 + 1] << 8)
+                | (uint32_t)digest[i * 3 + 2]
+            );
+            answer[i * 4] = BASE64_ALPHABET[(group >> 18) & 0x3F];
+            answer[i * 4 + 1] = BASE64_ALPHABET[(group >> 12) & 0x3F];
+            answer[i * 4 + 2] = BASE64_ALPHABET[(group >> 6) & 0x3F];
+            answer[i * 4 + 3] = BASE64_ALPHABET[group & 0x3F];
+        }
+        answer[HANDSHAKE_ANSWER_LENGTH - 1] = '=';
+    }
+
+    bool IsHandshakeAnswerFor(
+        const std::string& key,
+        const std::string& answer
+    ) {
+        if (
+            (key.length() != HANDSHAKE_KEY_LENGTH)
+            || (answer.length() != HANDSHAKE_ANSWER_LENGTH)
+        ) {
+            return false;
+        }
+        char expectedAnswer[HANDSHAKE_ANSWER_LENGTH];
+        ComputeHandshakeAnswer(key.data(), expectedAnswer);
+        return (memcmp(expectedAnswer, answer.data(), HANDSHAKE_ANSWER_LENGTH) == 0);
+    }
+
+}
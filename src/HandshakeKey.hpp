@@ -0,0 +1,142 @@
+#ifndef WEB_SOCKETS_HANDSHAKE_KEY_HPP
+#define WEB_SOCKETS_HANDSHAKE_KEY_HPP
+
+/**
+ * @file HandshakeKey.hpp
+ *
+ * This module declares the functions which check the
+ * "Sec-WebSocket-Key" header of the opening handshake and compute
+ * the matching "Sec-WebSocket-Accept" header.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace WebSockets {
+
+    /**
+     * This is the length of the value of the "Sec-WebSocket-Key" header,
+     * which is 16 octets of random data, Base64 encoded.
+     */
+    constexpr size_t HANDSHAKE_KEY_LENGTH = 24;
+
+    /**
+     * This is the length of the value of the "Sec-WebSocket-Accept"
+     * header, which is a SHA-1 digest, Base64 encoded.
+     */
+    constexpr size_t HANDSHAKE_ANSWER_LENGTH = 28;
+
+    /**
+     * This is the type of function which updates a SHA-1 state
+     * by hashing one block of 64 octets.
+     *
+     * @param[in,out] state
+     *     This is the state to update.
+     *
+     * @param[in] block
+     *     This points to the block to hash.
+     */
+    typedef void (*Sha1CompressFunction)(uint32_t* state, const uint8_t* block);
+
+    /**
+     * This function updates a SHA-1 state by hashing one block,
+     * using only portable code.
+     *
+     * @param[in,out] state
+     *     This is the state to update.
+     *
+     * @param[in] block
+     *     This points to the block to hash.
+     */
+    void Sha1CompressPortable(uint32_t* state, const uint8_t* block);
+
+    /**
+     * This function returns the function which updates a SHA-1 state
+     * using the SHA extensions of the processor, if they're available.
+     *
+     * @return
+     *     The function which hashes each block using the SHA extensions
+     *     of the processor is returned, or nullptr if the processor
+     *     doesn't have them or they aren't supported by this build.
+     */
+    Sha1CompressFunction GetSha1CompressShaNi();
+
+    /**
+     * This function checks whether or not the given value of the
+     * "Sec-WebSocket-Key" header is the Base64 encoding of 16 octets,
+     * without decoding it.
+     *
+     * @param[in] key
+     *     This is the key value to check.
+     *
+     * @return
+     *     An indication of whether or not the key is valid is returned.
+     */
+    bool IsValidHandshakeKey(const std::string& key);
+
+    /**
+     * This function computes the value of the "Sec-WebSocket-Accept"
+     * header that matches the given value of the "Sec-WebSocket-Key"
+     * header, without allocating memory.
+     *
+     * @param[in] key
+     *     This points to the HANDSHAKE_KEY_LENGTH characters of the key
+     *     value for which to compute the matching answer.
+     *
+     * @param[out] answer
+     *     This points to where to store the HANDSHAKE_ANSWER_LENGTH
+     *     characters of the answer computed from the given key.
+     */
+    void ComputeHandshakeAnswer(
+        const char* key,
+        char* answer
+    );
+
+    /**
+     * This function computes the value of the "Sec-WebSocket-Accept"
+     * header that matches the given value of the "Sec-WebSocket-Key"
+     * header, using the given function to hash each block.
+     *
+     * @param[in] key
+     *     This points to the HANDSHAKE_KEY_LENGTH characters of the key
+     *     value for which to compute the matching answer.
+     *
+     * @param[out] answer
+     *     This points to where to store the HANDSHAKE_ANSWER_LENGTH
+     *     characters of the answer computed from the given key.
+     *
+     * @param[in] compress
+     *     This is the function to use to hash each block.
+     */
+    void ComputeHandshakeAnswer(
+        const char* key,
+        char* answer,
+        Sha1CompressFunction compress
+    );
+
+    /**
+     * This function checks whether or not the given value of the
+     * "Sec-WebSocket-Accept" header matches the given value of the
+     * "Sec-WebSocket-Key" header.
+     *
+     * @param[in] key
+     *     This is the key value sent.
+     *
+     * @param[in] answer
+     *     This is the answer value received.
+     *
+     * @return
+     *     An indication of whether or not the answer matches
+     *     the key is returned.
+     */
+    bool IsHandshakeAnswerFor(
+        const std::string& key,
+        const std::string& answer
+    );
+
+}
+
+#endif /* WEB_SOCKETS_HANDSHAKE_KEY_HPP */
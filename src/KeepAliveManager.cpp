@@ -0,0 +1,640 @@
+/**
+ * @file KeepAliveManager.cpp
+ *
+ * This module contains the implementation of the
+ * WebSockets::KeepAliveManager class.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <WebSockets/KeepAliveManager.hpp>
+#include <WebSockets/WebSocket.hpp>
+
+namespace {
+
+    /**
+     * This is the clock used to schedule pings and timeouts.
+     */
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * This is the number of bits of a tick count used to pick
+     * a slot in each level of the timer wheel.
+     */
+    constexpr unsigned int WHEEL_SLOT_BITS = 6;
+
+    /**
+     * This is the number of slots in each level of the timer wheel.
+     */
+    constexpr size_t WHEEL_SLOTS = ((size_t)1 << WHEEL_SLOT_BITS);
+
+    /**
+     * This is the number of levels in the timer wheel.  Timers may be
+     * set up to WHEEL_SLOTS to the power of WHEEL_LEVELS ticks ahead.
+     */
+    constexpr size_t WHEEL_LEVELS = 4;
+
+    /**
+     * This is one timer in a timer wheel.  Timers are linked into
+     * circular lists, one per slot of the wheel, each with a timer
+     * of its own used only as the head of the list.
+     */
+    struct Timer {
+        /**
+         * This is the timer before this one in its list.
+         */
+        Timer* prev = this;
+
+        /**
+         * This is the timer after this one in its list.
+         */
+        Timer* next = this;
+
+        /**
+         * This is the tick at which the timer expires.
+         */
+        uint64_t expiry = 0;
+
+        /**
+         * This method takes the timer out of whatever list it's in.
+         */
+        void Unlink() {
+            prev->next = next;
+            next->prev = prev;
+            prev = next = this;
+        }
+
+        /**
+         * This method indicates whether or not the timer is set,
+         * which means it's in a list.
+         *
+         * @return
+         *     An indication of whether or not the timer is set
+         *     is returned.
+         */
+        bool IsSet() const {
+            return (next != this);
+        }
+    };
+
+    /**
+     * This is a hierarchical timer wheel.  Each level has a ring of
+     * slots, each covering WHEEL_SLOTS times as many ticks as a slot in
+     * the level below.  A timer is put in the lowest level whose current
+     * ring reaches its expiry, and moves down a level each time the
+     * wheel reaches its slot, until it expires from the lowest level.
+     * Setting and cancelling a timer takes constant time, and each timer
+     * moves at most WHEEL_LEVELS - 1 times before it expires.
+     */
+    struct TimerWheel {
+        // Properties
+
+        /**
+         * This is the tick the wheel has reached.
+         */
+        uint64_t now = 0;
+
+        /**
+         * This is the number of timers set.
+         */
+        size_t count = 0;
+
+        /**
+         * These are the heads of the lists of timers in each
+         * slot of each level of the wheel.
+         */
+        Timer slots[WHEEL_LEVELS][WHEEL_SLOTS];
+
+        // Methods
+
+        /**
+         * This method sets the given timer to expire at the given tick,
+         * or the next tick, if the given one has already been reached.
+         * Timers set further ahead than the wheel reaches expire early,
+         * at the furthest tick the wheel reaches.
+         *
+         * @param[in] timer
+         *     This is the timer to set.
+         *
+         * @param[in] expiry
+         *     This is the tick at which the timer should expire.
+         */
+        void Set(
+            Timer* timer,
+            uint64_t expiry
+        ) {
+            Cancel(timer);
+            Place(timer, std::max(expiry, now + 1));
+        }
+
+        /**
+         * This method puts the given timer, which isn't set, in the
+         * slot of the wheel for the given tick, which hasn't passed.
+         *
+         * @param[in] timer
+         *     This is the timer to put in the wheel.
+         *
+         * @param[in] expiry
+         *     This is the tick at which the timer should expire.
+         */
+        void Place(
+            Timer* timer,
+            uint64_t expiry
+        ) {
+            size_t level = 0;
+            while (
+                (level + 1 < WHEEL_LEVELS)
+                && ((expiry >> (WHEEL_SLOT_BITS * (level + 1))) != (now >> (WHEEL_SLOT_BITS * (level + 1))))
+            ) {
+                ++level;
+            }
+            if (level == WHEEL_LEVELS - 1) {
+                const auto shift = WHEEL_SLOT_BITS * level;
+                const auto furthest = (now >> shift) + (WHEEL_SLOTS - 1);
+                if ((expiry >> shift) > furthest) {
+                    expiry = (furthest << shift);
+                }
+            }
+            timer->expiry = expiry;
+            const auto head = &slots[level][(expiry >> (WHEEL_SLOT_BITS * level)) & (WHEEL_SLOTS - 1)];
+            timer->prev = head->prev;
+            timer->next = head;
+            head->prev->next = timer;
+            head->prev = timer;
+            ++count;
+        }
+
+        /**
+         * This method cancels the given timer, if it's set.
+         *
+         * @param[in] timer
+         *     This is the timer to cancel.
+         */
+        void Cancel(Timer* timer) {
+            if (!timer->IsSet()) {
+                return;
+            }
+            timer->Unlink();
+            --count;
+        }
+
+        /**
+         * This method advances the wheel to the given tick, collecting
+         * the timers which expire along the way.
+         *
+         * @param[in] tick
+         *     This is the tick to which to advance the wheel.
+         *
+         * @param[out] expired
+         *     This is where to put the timers which expire.  They're
+         *     no longer set.
+         */
+        void Advance(
+            uint64_t tick,
+            std::vector< Timer* >& expired
+        ) {
+            while (now < tick) {
+                if (count == 0) {
+                    now = tick;
+                    break;
+                }
+                ++now;
+                size_t topLevel = 0;
+                while (
+                    (topLevel + 1 < WHEEL_LEVELS)
+                    && ((now & (((uint64_t)1 << (WHEEL_SLOT_BITS * (topLevel + 1))) - 1)) == 0)
+                ) {
+                    ++topLevel;
+                }
+                for (size_t level = topLevel; level > 0; --level) {
+                    auto head = &slots[level][(now >> (WHEEL_SLOT_BITS * level)) & (WHEEL_SLOTS - 1)];
+                    while (head->IsSet()) {
+                        const auto timer = head->next;
+                        Cancel(timer);
+                        Place(timer, timer->expiry);
+                    }
+                }
+                auto head = &slots[0][now & (WHEEL_SLOTS - 1)];
+                while (head->IsSet()) {
+                    const auto timer = head->next;
+                    Cancel(timer);
+                    expired.push_back(timer);
+                }
+            }
+        }
+    };
+
+    /**
+     * This holds what the manager keeps track of for one WebSocket.
+     */
+    struct Entry
+        : public Timer
+    {
+        /**
+         * This identifies the WebSocket being looked after.
+         */
+        WebSockets::WebSocket* key = nullptr;
+
+        /**
+         * This is the WebSocket being looked after.
+         */
+        std::weak_ptr< WebSockets::WebSocket > ws;
+
+        /**
+         * This is the latest time at which the WebSocket was known
+         * to be active: when it was added, or when it last
+         * received something.
+         */
+        Clock::time_point lastActive;
+
+        /**
+         * This is when a ping was sent over the WebSocket, if the
+         * manager is waiting for something to be received after it,
+         * or the clock's epoch otherwise.
+         */
+        Clock::time_point pingSent;
+
+        /**
+         * This flag is set while the manager's thread is looking after
+         * the WebSocket, without holding the manager's lock.
+         */
+        bool busy = false;
+
+        /**
+         * This flag is set if the WebSocket was removed while the
+         * manager's thread was looking after it.
+         */
+        bool removed = false;
+
+        /**
+         * This flag is set if the WebSocket was added again while the
+         * manager's thread was looking after it.
+         */
+        bool restarted = false;
+    };
+
+}
+
+namespace WebSockets {
+
+    /**
+     * This contains the private properties of a KeepAliveManager instance.
+     */
+    struct KeepAliveManager::Impl {
+        // Properties
+
+        /**
+         * This is used to synchronize access to the instance.
+         */
+        mutable std::mutex mutex;
+
+        /**
+         * This is used to wake the manager's thread when there's
+         * something for it to do.
+         */
+        std::condition_variable wakeCondition;
+
+        /**
+         * These are the configurable parameters in use.
+         */
+        Configuration configuration;
+
+        /**
+         * This is the time at which the timer wheel was at tick zero.
+         */
+        Clock::time_point startTime;
+
+        /**
+         * This holds the timers of the WebSockets being looked after.
+         */
+        TimerWheel wheel;
+
+        /**
+         * These are the WebSockets being looked after.
+         */
+        std::unordered_map< WebSocket*, std::unique_ptr< Entry > > entries;
+
+        /**
+         * This holds information about what the manager has done.
+         */
+        Statistics statistics;
+
+        /**
+         * This flag is set once the manager has been started.
+         */
+        bool started = false;
+
+        /**
+         * This flag is set once the manager has been stopped.
+         */
+        bool stopping = false;
+
+        /**
+         * This is the thread which looks after the WebSockets.
+         */
+        std::thread worker;
+
+        // Methods
+
+        /**
+         * This method returns the tick of the timer wheel at or after
+         * the given time.
+         *
+         * @param[in] time
+         *     This is the time to convert.
+         *
+         * @return
+         *     The tick of the timer wheel at or after the given
+         *     time is returned.
+         */
+        uint64_t TickAtOrAfter(Clock::time_point time) const {
+            if (time <= startTime) {
+                return 0;
+            }
+            const auto tickLength = std::chrono::duration_cast< Clock::duration >(
+                configuration.tickInterval
+            ).count();
+            const auto elapsed = (time - startTime).count();
+            return (uint64_t)((elapsed + tickLength - 1) / tickLength);
+        }
+
+        /**
+         * This method returns the tick of the timer wheel which has
+         * most recently passed.
+         *
+         * @return
+         *     The tick of the timer wheel which has most recently passed
+         *     is returned.
+         */
+        uint64_t CurrentTick() const {
+            const auto tickLength = std::chrono::duration_cast< Clock::duration >(
+                configuration.tickInterval
+            ).count();
+            return (uint64_t)((Clock::now() - startTime).count() / tickLength);
+        }
+
+        /**
+         * This method starts looking after the WebSocket of the given
+         * entry afresh, setting its timer for its first ping.
+         * The instance must be locked and started.
+         *
+         * @param[in] entry
+         *     This holds what the manager keeps track of
+         *     for the WebSocket.
+         */
+        void Restart(Entry* entry) {
+            const auto ws = entry->ws.lock();
+            entry->lastActive = Clock::now();
+            if (ws != nullptr) {
+                const auto lastFrameReceived = ws->GetActivityTimes().lastFrameReceived;
+                if (lastFrameReceived != Clock::time_point()) {
+                    entry->lastActive = lastFrameReceived;
+                }
+            }
+            entry->pingSent = Clock::time_point();
+            if (wheel.count == 0) {
+                wheel.now = CurrentTick();
+            }
+            wheel.Set(entry, TickAtOrAfter(entry->lastActive + configuration.pingInterval));
+        }
+
+        /**
+         * This method looks after the WebSocket of the given entry, whose
+         * timer has expired, sending it a ping or failing it, as needed.
+         * It's called by the manager's thread without holding the lock.
+         *
+         * @param[in,out] entry
+         *     This holds what the manager keeps track of
+         *     for the WebSocket.
+         *
+         * @param[out] next
+         *     This is where to store the time at which to look after
+         *     the WebSocket again.
+         *
+         * @param[in,out] counts
+         *     This is where to count what was done.
+         *
+         * @return
+         *     An indication of whether or not to keep looking after
+         *     the WebSocket is returned.
+         */
+        bool LookAfter(
+            Entry* entry,
+            Clock::time_point& next,
+            Statistics& counts
+        ) {
+            const auto ws = entry->ws.lock();
+            if (ws == nullptr) {
+                return false;
+            }
+            const auto times = ws->GetActivityTimes();
+            if (times.closed != Clock::time_point()) {
+                return false;
+            }
+            const auto now = Clock::now();
+            if (times.closeSent != Clock::time_point()) {
+                next = times.closeSent + configuration.replyTimeout;
+                if (now < next) {
+                    return true;
+                }
+                ++counts.closeTimeouts;
+                ws->Close(1006, "timed out waiting for close reply");
+                return false;
+            }
+            if (entry->pingSent != Clock::time_point()) {
+                if (times.lastFrameReceived < entry->pingSent) {
+                    next = entry->pingSent + configuration.replyTimeout;
+                    if (now < next) {
+                        return true;
+                    }
+                    ++counts.pingTimeouts;
+                    ws->Close(1006, "timed out waiting for pong");
+                    return false;
+                }
+                entry->pingSent = Clock::time_point();
+                entry->lastActive = times.lastFrameReceived;
+            }
+            next = std::max(entry->lastActive, times.lastFrameReceived) + configuration.pingInterval;
+            if (now < next) {
+                if (times.lastFrameReceived > entry->lastActive) {
+                    entry->lastActive = times.lastFrameReceived;
+                    ++counts.pingsSkipped;
+                }
+                return true;
+            }
+            entry->pingSent = now;
+            next = now + configuration.replyTimeout;
+            ++counts.pingsSent;
+            ws->Ping();
+            return true;
+        }
+
+        /**
+         * This method is the body of the manager's thread, which advances
+         * the timer wheel and looks after the WebSockets whose timers
+         * expire, until the manager is stopped.
+         */
+        void Run() {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            std::vector< Timer* > expired;
+            std::vector< Clock::time_point > nextTimes;
+            std::vector< bool > keep;
+            while (!stopping) {
+                if (wheel.count == 0) {
+                    wakeCondition.wait(lock);
+                    continue;
+                }
+                const auto nextTickTime = startTime + configuration.tickInterval * (Clock::rep)(wheel.now + 1);
+                if (Clock::now() < nextTickTime) {
+                    (void)wakeCondition.wait_until(lock, nextTickTime);
+                    continue;
+                }
+                wheel.Advance(CurrentTick(), expired);
+                if (expired.empty()) {
+                    continue;
+                }
+                for (const auto timer: expired) {
+                    static_cast< Entry* >(timer)->busy = true;
+                }
+                lock.unlock();
+                Statistics counts;
+                nextTimes.resize(expired.size());
+                keep.resize(expired.size());
+                for (size_t i = 0; i < expired.size(); ++i) {
+                    keep[i] = LookAfter(static_cast< Entry* >(expired[i]), nextTimes[i], counts);
+                }
+                lock.lock();
+                statistics.pingsSent += counts.pingsSent;
+                statistics.pingsSkipped += counts.pingsSkipped;
+                statistics.pingTimeouts += counts.pingTimeouts;
+                statistics.closeTimeouts += counts.closeTimeouts;
+                for (size_t i = 0; i < expired.size(); ++i) {
+                    const auto entry = static_cast< Entry* >(expired[i]);
+                    entry->busy = false;
+                    if (entry->restarted && !entry->removed) {
+                        entry->restarted = false;
+                        Restart(entry);
+                    } else if (keep[i] && !entry->removed) {
+                        wheel.Set(entry, TickAtOrAfter(nextTimes[i]));
+                    } else {
+                        (void)entries.erase(entry->key);
+                    }
+                }
+                expired.clear();
+            }
+        }
+    };
+
+    KeepAliveManager::~KeepAliveManager() noexcept {
+        if (impl_ == nullptr) {
+            return;
+        }
+        Stop();
+    }
+    KeepAliveManager::KeepAliveManager(KeepAliveManager&&) noexcept = default;
+    KeepAliveManager& KeepAliveManager::operator=(KeepAliveManager&&) noexcept = default;
+
+    KeepAliveManager::KeepAliveManager()
+        : impl_(new Impl)
+    {
+    }
+
+    void KeepAliveManager::Start(const Configuration& configuration) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        if (impl_->started) {
+            return;
+        }
+        impl_->started = true;
+        impl_->configuration = configuration;
+        impl_->configuration.tickInterval = std::max(
+            impl_->configuration.tickInterval,
+            std::chrono::milliseconds(1)
+        );
+        impl_->startTime = Clock::now();
+        for (const auto& entry: impl_->entries) {
+            impl_->Restart(entry.second.get());
+        }
+        const auto impl = impl_;
+        impl_->worker = std::thread(
+            [impl]{
+                impl->Run();
+            }
+        );
+    }
+
+    void KeepAliveManager::Stop() {
+        std::unique_lock< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->stopping = true;
+        impl_->wakeCondition.notify_all();
+        lock.unlock();
+        if (impl_->worker.joinable()) {
+            if (impl_->worker.get_id() == std::this_thread::get_id()) {
+                impl_->worker.detach();
+                return;
+            }
+            impl_->worker.join();
+        }
+        lock.lock();
+        for (const auto& entry: impl_->entries) {
+            impl_->wheel.Cancel(entry.second.get());
+        }
+        impl_->entries.clear();
+    }
+
+    void KeepAliveManager::Add(std::shared_ptr< WebSocket > ws) {
+        if (ws == nullptr) {
+            return;
+        }
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        if (impl_->stopping) {
+            return;
+        }
+        auto& entry = impl_->entries[ws.get()];
+        if (entry == nullptr) {
+            entry.reset(new Entry());
+            entry->key = ws.get();
+        }
+        entry->ws = ws;
+        entry->removed = false;
+        if (entry->busy) {
+            entry->restarted = true;
+            return;
+        }
+        if (impl_->started) {
+            impl_->Restart(entry.get());
+            impl_->wakeCondition.notify_all();
+        }
+    }
+
+    void KeepAliveManager::Remove(const std::shared_ptr< WebSocket >& ws) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        const auto entry = impl_->entries.find(ws.get());
+        if (entry == impl_->entries.end()) {
+            return;
+        }
+        if (entry->second->busy) {
+            entry->second->removed = true;
+            return;
+        }
+        impl_->wheel.Cancel(entry->second.get());
+        (void)impl_->entries.erase(entry);
+    }
+
+    auto KeepAliveManager::GetStatistics() const -> Statistics {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        auto statistics = impl_->statistics;
+        statistics.webSockets = impl_->entries.size();
+        return statistics;
+    }
+
+}
@@ -7,22 +7,150 @@
  * © 2018 by Richard Walters
  */
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <functional>
 #include <future>
 #include <Http/IClient.hpp>
+#include <memory>
 #include <mutex>
+#include <stddef.h>
 #include <stdint.h>
 #include <string>
 #include <SystemAbstractions/DiagnosticsSender.hpp>
+#include <thread>
+#include <vector>
 #include <WebSockets/MakeConnection.hpp>
 #include <WebSockets/WebSocket.hpp>
 
 namespace {
 
+    /**
+     * This is the clock used to time connection attempts.
+     */
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * This is the number of buckets in each histogram of the times taken
+     * by the phases of connection attempts.
+     */
+    constexpr size_t HISTOGRAM_BUCKETS = 32;
+
+    /**
+     * These identify the phases of connection attempts for which
+     * histograms of the times taken are kept.
+     */
+    enum Phase {
+        PHASE_BUILDING_REQUEST,
+        PHASE_AWAITING_RESPONSE,
+        PHASE_VALIDATING_UPGRADE,
+        PHASE_CONNECTING,
+        NUM_PHASES
+    };
+
+    /**
+     * These are the histograms of the times taken by each phase of all
+     * the connection attempts made so far.
+     */
+    std::atomic< size_t > histogramCounts[NUM_PHASES][HISTOGRAM_BUCKETS];
+
+    /**
+     * This is the type of function called internally once a connection
+     * attempt is finished, to report its outcome along with its timings.
+     *
+     * @param[in] ws
+     *     This is the WebSocket connected to the server, or nullptr
+     *     if the connection could not be made or the attempt was aborted.
+     *
+     * @param[in] timings
+     *     These are the times at which the attempt reached each phase.
+     */
+    typedef std::function<
+        void(
+            std::shared_ptr< WebSockets::WebSocket > ws,
+            const WebSockets::MakeConnectionTimings& timings
+        )
+    > TimedCompleteDelegate;
+
+    /**
+     * This function counts the time taken by a phase of a connection
+     * attempt in the histogram for that phase, if the phase was finished.
+     *
+     * @param[in] phase
+     *     This identifies the phase of the connection attempt.
+     *
+     * @param[in] phaseStarted
+     *     This is when the phase was started.
+     *
+     * @param[in] phaseFinished
+     *     This is when the phase was finished, or the clock's epoch
+     *     if the phase wasn't finished.
+     */
+    void CountPhase(
+        Phase phase,
+        Clock::time_point phaseStarted,
+        Clock::time_point phaseFinished
+    ) {
+        if (phaseFinished == Clock::time_point()) {
+            return;
+        }
+        auto microseconds = std::chrono::duration_cast< std::chrono::microseconds >(
+            phaseFinished - phaseStarted
+        ).count();
+        size_t bucket = 0;
+        while (
+            (microseconds > 0)
+            && (bucket + 1 < HISTOGRAM_BUCKETS)
+        ) {
+            ++bucket;
+            microseconds >>= 1;
+        }
+        (void)histogramCounts[phase][bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * This function counts the times taken by the phases of a finished
+     * connection attempt in the histograms for those phases.
+     *
+     * @param[in] timings
+     *     These are the times at which the attempt reached each phase.
+     */
+    void CountPhases(const WebSockets::MakeConnectionTimings& timings) {
+        CountPhase(PHASE_BUILDING_REQUEST, timings.started, timings.requestBuilt);
+        CountPhase(PHASE_AWAITING_RESPONSE, timings.requestBuilt, timings.responseReceived);
+        CountPhase(PHASE_VALIDATING_UPGRADE, timings.responseReceived, timings.upgradeValidated);
+        if (timings.upgradeValidated != Clock::time_point()) {
+            CountPhase(PHASE_CONNECTING, timings.started, timings.completed);
+        }
+    }
+
+    /**
+     * This function makes a copy of the histogram of the times taken
+     * by the given phase of connection attempts.
+     *
+     * @param[in] phase
+     *     This identifies the phase of the connection attempts.
+     *
+     * @return
+     *     A copy of the histogram of the times taken by the given phase
+     *     of connection attempts is returned.
+     */
+    WebSockets::MakeConnectionHistogram CopyHistogram(Phase phase) {
+        WebSockets::MakeConnectionHistogram histogram;
+        histogram.counts.reserve(HISTOGRAM_BUCKETS);
+        for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+            histogram.counts.push_back(
+                histogramCounts[phase][i].load(std::memory_order_relaxed)
+            );
+        }
+        return histogram;
+    }
+
     /**
      * This holds variables that are shared between the MakeConnection
-     * function, MakeConnectionSynchronous function, and the delegates
-     * they hand out to be called when different events happen.
+     * function and the delegates it hands out to be called when different
+     * events happen during a connection attempt.
      */
     struct MakeConnectionSharedContext {
         // Properties
@@ -33,46 +161,197 @@ namespace {
         std::mutex mutex;
 
         /**
-         * This is used to signal MakeConnectionSynchronous to wake up,
-         * while it's waiting for the connection transaction to complete.
+         * This is the object to use to publish any diagnostic messages.
+         */
+        std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender;
+
+        /**
+         * This is the WebSocket being opened.
+         */
+        std::shared_ptr< WebSockets::WebSocket > ws;
+
+        /**
+         * This is the HTTP transaction used to open the WebSocket.
+         * It's released once the attempt is finished, since its
+         * completion delegate refers back to this structure.
+         */
+        std::shared_ptr< Http::IClient::Transaction > transaction;
+
+        /**
+         * This is the function to call once the attempt is finished.
          */
-        std::condition_variable connectionWaitDone;
+        TimedCompleteDelegate completeDelegate;
 
         /**
-         * This flag is set if the connection attempt should be aborted.
+         * These are the times at which the attempt reached each phase.
          */
-        bool abortAttempt = false;
+        WebSockets::MakeConnectionTimings timings;
 
         /**
-         * This flag is set if the connection attempt is completed.
+         * This flag is set if the WebSocket was opened on the
+         * connection upgraded by the HTTP transaction.
          */
-        bool transactionCompleted = false;
+        bool wsEngaged = false;
+
+        /**
+         * This flag is set once the connection attempt is finished,
+         * whether it completed or was aborted.
+         */
+        bool finished = false;
 
         // Methods
 
         /**
-         * This method blocks until either the connection attempt is aborted or
-         * completed.
+         * This method marks the connection attempt as finished, unless it
+         * already is, counts the times taken by its phases, and hands back
+         * the resources held for it.
+         *
+         * @param[out] transactionFinished
+         *     This is where to store the HTTP transaction used in the
+         *     connection attempt.
+         *
+         * @param[out] completeDelegateToCall
+         *     This is where to store the function to call to report
+         *     the result of the connection attempt.
+         *
+         * @param[out] timingsFinished
+         *     This is where to store the times at which the connection
+         *     attempt reached each phase.
          *
          * @return
-         *     An indication of whether or not the connection attempt was
-         *     aborted is returned.
+         *     An indication of whether or not the connection attempt
+         *     was marked as finished by this call is returned.
          */
-        bool Wait() {
-            std::unique_lock< decltype(mutex) > lock(mutex);
-            connectionWaitDone.wait(
-                lock,
-                [this]{
-                    return abortAttempt || transactionCompleted;
-                }
+        bool Finish(
+            std::shared_ptr< Http::IClient::Transaction >& transactionFinished,
+            TimedCompleteDelegate& completeDelegateToCall,
+            WebSockets::MakeConnectionTimings& timingsFinished
+        ) {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            if (finished) {
+                return false;
+            }
+            finished = true;
+            transactionFinished = std::move(transaction);
+            transaction = nullptr;
+            completeDelegateToCall = std::move(completeDelegate);
+            completeDelegate = nullptr;
+            if (
+                (transactionFinished != nullptr)
+                && (transactionFinished->state == Http::IClient::Transaction::State::Completed)
+                && (timings.responseReceived == Clock::time_point())
+            ) {
+                timings.responseReceived = Clock::now();
+            }
+            timings.completed = Clock::now();
+            timingsFinished = timings;
+            CountPhases(timings);
+            return true;
+        }
+
+        /**
+         * This method is called when the connection attempt is aborted.
+         */
+        void Abort() {
+            std::shared_ptr< Http::IClient::Transaction > transactionFinished;
+            TimedCompleteDelegate completeDelegateToCall;
+            WebSockets::MakeConnectionTimings timingsFinished;
+            if (!Finish(transactionFinished, completeDelegateToCall, timingsFinished)) {
+                return;
+            }
+            diagnosticsSender->SendDiagnosticInformationString(
+                SystemAbstractions::DiagnosticsSender::Levels::WARNING,
+                "connection aborted"
             );
-            return !abortAttempt;
+            ws->Close();
+            completeDelegateToCall(nullptr, timingsFinished);
+        }
+
+        /**
+         * This method is called when the HTTP transaction used to open
+         * the WebSocket is completed, in order to report the outcome
+         * of the connection attempt.
+         */
+        void TransactionCompleted() {
+            std::shared_ptr< Http::IClient::Transaction > transactionFinished;
+            TimedCompleteDelegate completeDelegateToCall;
+            WebSockets::MakeConnectionTimings timingsFinished;
+            if (!Finish(transactionFinished, completeDelegateToCall, timingsFinished)) {
+                return;
+            }
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            const auto engaged = wsEngaged;
+            lock.unlock();
+            switch (transactionFinished->state) {
+                case Http::IClient::Transaction::State::Completed: {
+                    if (engaged) {
+                        diagnosticsSender->SendDiagnosticInformationString(
+                            2,
+                            "Connection established."
+                        );
+                    } else {
+                        if (transactionFinished->response.statusCode == 101) {
+                            diagnosticsSender->SendDiagnosticInformationString(
+                                SystemAbstractions::DiagnosticsSender::Levels::WARNING,
+                                "Connection upgraded, but failed to engage WebSocket"
+                            );
+                        } else {
+                            diagnosticsSender->SendDiagnosticInformationFormatted(
+                                SystemAbstractions::DiagnosticsSender::Levels::WARNING,
+                                "Got back response: %u %s",
+                                transactionFinished->response.statusCode,
+                                transactionFinished->response.reasonPhrase.c_str()
+                            );
+                        }
+                    }
+                } break;
+
+                case Http::IClient::Transaction::State::UnableToConnect: {
+                    diagnosticsSender->SendDiagnosticInformationString(
+                        SystemAbstractions::DiagnosticsSender::Levels::WARNING,
+                        "unable to connect"
+                    );
+                } break;
+
+                case Http::IClient::Transaction::State::Broken: {
+                    diagnosticsSender->SendDiagnosticInformationString(
+                        SystemAbstractions::DiagnosticsSender::Levels::WARNING,
+                        "connection broken by server"
+                    );
+                } break;
+
+                case Http::IClient::Transaction::State::Timeout: {
+                    diagnosticsSender->SendDiagnosticInformationString(
+                        SystemAbstractions::DiagnosticsSender::Levels::WARNING,
+                        "timeout waiting for response"
+                    );
+                } break;
+
+                default: {
+                    diagnosticsSender->SendDiagnosticInformationFormatted(
+                        SystemAbstractions::DiagnosticsSender::Levels::ERROR,
+                        "Unknown transaction state (%d)",
+                        (int)transactionFinished->state
+                    );
+                } break;
+            }
+            if (engaged) {
+                completeDelegateToCall(ws, timingsFinished);
+            } else {
+                ws->Close();
+                completeDelegateToCall(nullptr, timingsFinished);
+            }
         }
     };
 
     /**
-     * This method is called to synchronously attempt to connect to a web
-     * server and upgrade the connection a WebSocket.
+     * This function starts an attempt to connect to a web server and
+     * upgrade the connection to a WebSocket.
+     *
+     * @param[in] ws
+     *     This is the WebSocket to open.  It holds any messages sent
+     *     over it until the attempt succeeds, and discards them if
+     *     the attempt fails or is aborted.
      *
      * @param[in] http
      *     This is the web client object to use to make the connection.
@@ -85,39 +364,40 @@ namespace {
      *     This is the port number of the server to which to connect.
      *
      * @param[in] diagnosticsSender
-     *     This is the function to call to publish any diagnostic messages.
+     *     This is the object to use to publish any diagnostic messages.
      *
-     * @param[in] sharedContext
-     *     This olds variables that are shared between the MakeConnection
-     *     function, MakeConnectionSynchronous function, and the delegates
-     *     they hand out to be called when different events happen.
+     * @param[in] completeDelegate
+     *     This is the function to call, exactly once, when the
+     *     attempt is finished.
      *
-     * @param[in] webSocketConfiguration
-     *     This contains variables that are used to customize the behavior
-     *     of the WebSocket.
+     * @param[in] configuration
+     *     These are the configurable parameters to set for the WebSocket.
      *
      * @return
-     *     The new WebSocket connection to the server is returned.
-     *
-     * @retval nullptr
-     *     This is returned if the connection could not be made.
+     *     A function which can be called to abort the connection
+     *     attempt early is returned.
      */
-    std::shared_ptr< WebSockets::WebSocket > MakeConnectionSynchronous(
+    std::function< void() > StartConnection(
+        std::shared_ptr< WebSockets::WebSocket > ws,
         std::shared_ptr< Http::IClient > http,
-        std::string host,
+        const std::string& host,
         uint16_t port,
         std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender,
-        std::shared_ptr< MakeConnectionSharedContext > sharedContext,
-        WebSockets::WebSocket::Configuration webSocketConfiguration
+        TimedCompleteDelegate completeDelegate,
+        const WebSockets::WebSocket::Configuration& configuration
     ) {
+        const auto sharedContext = std::make_shared< MakeConnectionSharedContext >();
+        sharedContext->diagnosticsSender = diagnosticsSender;
+        sharedContext->completeDelegate = completeDelegate;
+        sharedContext->timings.started = Clock::now();
         diagnosticsSender->SendDiagnosticInformationString(
             2,
             "Connecting..."
         );
 
         // Set up a client-side WebSocket and form the HTTP request for it.
-        const auto ws = std::make_shared< WebSockets::WebSocket >();
-        ws->Configure(webSocketConfiguration);
+        sharedContext->ws = ws;
+        ws->Configure(configuration);
         Http::Request request;
         request.method = "GET";
         request.target.SetScheme("ws");
@@ -125,100 +405,402 @@ namespace {
         request.target.SetPort(port);
         request.target.SetPath({""});
         ws->StartOpenAsClient(request);
+        sharedContext->timings.requestBuilt = Clock::now();
 
         // Use the HTTP client to send the request, providing a callback if the
-        // connection was successfully upgraded to the WebSocket protocol.
-        bool wsEngaged = false;
+        // connection was successfully upgraded to the WebSocket protocol,
+        // and another to report the outcome once the transaction completes.
         const auto transaction = http->Request(
             request,
             true,
-            [
-                ws,
-                &wsEngaged
-            ](
+            [sharedContext](
                 const Http::Response& response,
                 std::shared_ptr< Http::Connection > connection,
                 const std::string& trailer
             ){
-                if (ws->FinishOpenAsClient(connection, response)) {
-                    wsEngaged = true;
+                std::unique_lock< decltype(sharedContext->mutex) > lock(sharedContext->mutex);
+                sharedContext->timings.responseReceived = Clock::now();
+                lock.unlock();
+                if (sharedContext->ws->FinishOpenAsClient(connection, response, trailer)) {
+                    lock.lock();
+                    sharedContext->timings.upgradeValidated = Clock::now();
+                    sharedContext->wsEngaged = true;
                 }
             }
         );
+        {
+            std::lock_guard< decltype(sharedContext->mutex) > lock(sharedContext->mutex);
+            sharedContext->transaction = transaction;
+        }
         transaction->SetCompletionDelegate(
             [sharedContext]{
-                std::lock_guard< decltype(sharedContext->mutex) > lock(sharedContext->mutex);
-                sharedContext->transactionCompleted = true;
-                sharedContext->connectionWaitDone.notify_one();
+                sharedContext->TransactionCompleted();
             }
         );
-        if (!sharedContext->Wait()) {
+        return [sharedContext]{
+            sharedContext->Abort();
+        };
+    }
+
+    /**
+     * This holds variables that are shared between the MakeConnection
+     * function racing connection attempts to a number of servers, the
+     * thread staggering the attempts, if any, and the delegates handed
+     * out to be called as the attempts finish.
+     */
+    struct MakeConnectionRaceSharedContext
+        : public std::enable_shared_from_this< MakeConnectionRaceSharedContext >
+    {
+        // Properties
+
+        /**
+         * This is used to synchronize access to the structure.
+         */
+        std::mutex mutex;
+
+        /**
+         * This is used to wake the thread staggering connection attempts
+         * when an attempt is started or the race is finished.
+         */
+        std::condition_variable wakeCondition;
+
+        /**
+         * This is the web client object to use to make the connections.
+         */
+        std::shared_ptr< Http::IClient > http;
+
+        /**
+         * These identify the servers to which to try connecting.
+         */
+        std::vector< WebSockets::Endpoint > endpoints;
+
+        /**
+         * This is the time to wait after starting each connection attempt
+         * before starting the next one.
+         */
+        std::chrono::milliseconds staggerDelay;
+
+        /**
+         * This is the object to use to publish any diagnostic messages.
+         */
+        std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender;
+
+        /**
+         * These are the configurable parameters to set for each WebSocket.
+         */
+        WebSockets::WebSocket::Configuration configuration;
+
+        /**
+         * This is the function to call once the race is finished.
+         */
+        TimedCompleteDelegate completeDelegate;
+
+        /**
+         * These are the functions to call to abort the connection
+         * attempts started, in the order in which they were started.
+         */
+        std::vector< std::function< void() > > abortDelegates;
+
+        /**
+         * This is the time at which the last connection attempt was started.
+         */
+        std::chrono::steady_clock::time_point lastStartTime;
+
+        /**
+         * This is the number of connection attempts started.
+         */
+        size_t started = 0;
+
+        /**
+         * This is the number of connection attempts which failed.
+         */
+        size_t failed = 0;
+
+        /**
+         * This is the index of the endpoint to which the connection
+         * used was made, or the number of endpoints if none was made.
+         */
+        size_t winner = 0;
+
+        /**
+         * This flag is set once a connection is made, all the attempts
+         * have failed, or the race is aborted.
+         */
+        bool finished = false;
+
+        // Methods
+
+        /**
+         * This method starts the next connection attempt.
+         *
+         * @param[in,out] lock
+         *     This is the lock held on the structure, which is released
+         *     while the connection attempt is started.
+         */
+        void StartNext(std::unique_lock< decltype(mutex) >& lock) {
+            const auto index = started++;
+            lastStartTime = std::chrono::steady_clock::now();
+            wakeCondition.notify_all();
+            const auto& endpoint = endpoints[index];
+            const auto self = shared_from_this();
+            lock.unlock();
+            const auto abortDelegate = StartConnection(
+                std::make_shared< WebSockets::WebSocket >(),
+                http,
+                endpoint.host,
+                endpoint.port,
+                diagnosticsSender,
+                [self, index](
+                    std::shared_ptr< WebSockets::WebSocket > ws,
+                    const WebSockets::MakeConnectionTimings& timings
+                ){
+                    self->AttemptFinished(index, ws, timings);
+                },
+                configuration
+            );
+            lock.lock();
+            if (!finished) {
+                abortDelegates[index] = abortDelegate;
+            } else if (winner != index) {
+                // The race was decided while the attempt was being started,
+                // so the attempt wasn't there to be aborted; abort it now.
+                lock.unlock();
+                abortDelegate();
+                lock.lock();
+            }
+        }
+
+        /**
+         * This method marks the race as finished and hands back what's
+         * needed to wrap it up.
+         *
+         * @param[out] abortDelegatesToCall
+         *     This is where to store the functions to call to abort
+         *     the connection attempts which lost the race.
+         *
+         * @param[out] completeDelegateToCall
+         *     This is where to store the function to call to report
+         *     the result of the race.
+         */
+        void Finish(
+            std::vector< std::function< void() > >& abortDelegatesToCall,
+            TimedCompleteDelegate& completeDelegateToCall
+        ) {
+            finished = true;
+            for (size_t i = 0; i < abortDelegates.size(); ++i) {
+                if (
+                    (i != winner)
+                    && (abortDelegates[i] != nullptr)
+                ) {
+                    abortDelegatesToCall.push_back(std::move(abortDelegates[i]));
+                }
+            }
+            abortDelegates.clear();
+            completeDelegateToCall = std::move(completeDelegate);
+            completeDelegate = nullptr;
+            wakeCondition.notify_all();
+        }
+
+        /**
+         * This method is called whenever a connection attempt is finished.
+         *
+         * @param[in] index
+         *     This is the index of the endpoint to which the
+         *     connection attempt was made.
+         *
+         * @param[in] ws
+         *     This is the WebSocket connected to the server, or nullptr
+         *     if the connection could not be made or the attempt was aborted.
+         *
+         * @param[in] timings
+         *     These are the times at which the attempt reached each phase.
+         */
+        void AttemptFinished(
+            size_t index,
+            std::shared_ptr< WebSockets::WebSocket > ws,
+            const WebSockets::MakeConnectionTimings& timings
+        ) {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            if (finished) {
+                lock.unlock();
+                if (ws != nullptr) {
+                    ws->Close(1001, "");
+                }
+                return;
+            }
+            if (ws == nullptr) {
+                ++failed;
+                if (failed < endpoints.size()) {
+                    if (
+                        (failed == started)
+                        && (started < endpoints.size())
+                    ) {
+                        StartNext(lock);
+                    }
+                    return;
+                }
+                winner = endpoints.size();
+            } else {
+                winner = index;
+            }
+            std::vector< std::function< void() > > abortDelegatesToCall;
+            TimedCompleteDelegate completeDelegateToCall;
+            Finish(abortDelegatesToCall, completeDelegateToCall);
+            lock.unlock();
+            for (const auto& abortDelegate: abortDelegatesToCall) {
+                abortDelegate();
+            }
+            completeDelegateToCall(ws, timings);
+        }
+
+        /**
+         * This method is run by the thread staggering connection attempts,
+         * starting each one once the delay since the last one has elapsed,
+         * until all are started or the race is finished.
+         */
+        void Stagger() {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            while (
+                !finished
+                && (started < endpoints.size())
+            ) {
+                const auto nextStartTime = lastStartTime + staggerDelay;
+                if (std::chrono::steady_clock::now() >= nextStartTime) {
+                    StartNext(lock);
+                } else {
+                    (void)wakeCondition.wait_until(lock, nextStartTime);
+                }
+            }
+        }
+
+        /**
+         * This method is called to abort the race.
+         */
+        void Abort() {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            if (finished) {
+                return;
+            }
+            winner = endpoints.size();
+            std::vector< std::function< void() > > abortDelegatesToCall;
+            TimedCompleteDelegate completeDelegateToCall;
+            Finish(abortDelegatesToCall, completeDelegateToCall);
+            lock.unlock();
+            for (const auto& abortDelegate: abortDelegatesToCall) {
+                abortDelegate();
+            }
+            completeDelegateToCall(nullptr, WebSockets::MakeConnectionTimings());
+        }
+    };
+
+    /**
+     * This function starts racing attempts to connect to any one of
+     * a number of equivalent web servers and upgrade the connection
+     * to a WebSocket.
+     *
+     * @param[in] http
+     *     This is the web client object to use to make the connections.
+     *
+     * @param[in] endpoints
+     *     These identify the servers to which to try connecting.
+     *
+     * @param[in] staggerDelay
+     *     This is the time to wait after starting each connection attempt
+     *     before starting the next one.
+     *
+     * @param[in] diagnosticsSender
+     *     This is the object to use to publish any diagnostic messages.
+     *
+     * @param[in] completeDelegate
+     *     This is the function to call, exactly once, when the
+     *     race is finished.
+     *
+     * @param[in] configuration
+     *     These are the configurable parameters to set for the WebSocket.
+     *
+     * @return
+     *     A function which can be called to abort all the connection
+     *     attempts early is returned.
+     */
+    std::function< void() > StartRace(
+        std::shared_ptr< Http::IClient > http,
+        const std::vector< WebSockets::Endpoint >& endpoints,
+        std::chrono::milliseconds staggerDelay,
+        std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender,
+        TimedCompleteDelegate completeDelegate,
+        const WebSockets::WebSocket::Configuration& configuration
+    ) {
+        if (endpoints.empty()) {
             diagnosticsSender->SendDiagnosticInformationString(
                 SystemAbstractions::DiagnosticsSender::Levels::WARNING,
-                "connection aborted"
+                "no endpoints to which to connect"
             );
-            return nullptr;
+            completeDelegate(nullptr, WebSockets::MakeConnectionTimings());
+            return []{};
         }
-        switch (transaction->state) {
-            case Http::IClient::Transaction::State::Completed: {
-                if (wsEngaged) {
-                    diagnosticsSender->SendDiagnosticInformationString(
-                        2,
-                        "Connection established."
-                    );
-                } else {
-                    if (transaction->response.statusCode == 101) {
-                        diagnosticsSender->SendDiagnosticInformationString(
-                            SystemAbstractions::DiagnosticsSender::Levels::WARNING,
-                            "Connection upgraded, but failed to engage WebSocket"
-                        );
-                    } else {
-                        diagnosticsSender->SendDiagnosticInformationFormatted(
-                            SystemAbstractions::DiagnosticsSender::Levels::WARNING,
-                            "Got back response: %u %s",
-                            transaction->response.statusCode,
-                            transaction->response.reasonPhrase.c_str()
-                        );
-                    }
+        const auto sharedContext = std::make_shared< MakeConnectionRaceSharedContext >();
+        sharedContext->http = http;
+        sharedContext->endpoints = endpoints;
+        sharedContext->staggerDelay = staggerDelay;
+        sharedContext->diagnosticsSender = diagnosticsSender;
+        sharedContext->configuration = configuration;
+        sharedContext->completeDelegate = completeDelegate;
+        sharedContext->abortDelegates.resize(endpoints.size());
+
+        // Start the first attempt now.  Without a delay, start the rest
+        // along with it; otherwise leave them to a thread which waits
+        // between starting them, unless earlier attempts fail first.
+        std::unique_lock< decltype(sharedContext->mutex) > lock(sharedContext->mutex);
+        do {
+            sharedContext->StartNext(lock);
+        } while (
+            (staggerDelay.count() == 0)
+            && !sharedContext->finished
+            && (sharedContext->started < endpoints.size())
+        );
+        if (
+            !sharedContext->finished
+            && (sharedContext->started < endpoints.size())
+        ) {
+            std::thread(
+                [sharedContext]{
+                    sharedContext->Stagger();
                 }
-            } break;
-
-            case Http::IClient::Transaction::State::UnableToConnect: {
-                diagnosticsSender->SendDiagnosticInformationString(
-                    SystemAbstractions::DiagnosticsSender::Levels::WARNING,
-                    "unable to connect"
-                );
-            } break;
-
-            case Http::IClient::Transaction::State::Broken: {
-                diagnosticsSender->SendDiagnosticInformationString(
-                    SystemAbstractions::DiagnosticsSender::Levels::WARNING,
-                    "connection broken by server"
-                );
-            } break;
-
-            case Http::IClient::Transaction::State::Timeout: {
-                diagnosticsSender->SendDiagnosticInformationString(
-                    SystemAbstractions::DiagnosticsSender::Levels::WARNING,
-                    "timeout waiting for response"
-                );
-            } break;
-
-            default: {
-                diagnosticsSender->SendDiagnosticInformationFormatted(
-                    SystemAbstractions::DiagnosticsSender::Levels::ERROR,
-                    "Unknown transaction state (%d)",
-                    (int)transaction->state
-                );
-            } break;
+            ).detach();
         }
-        return wsEngaged ? ws : nullptr;
+        return [sharedContext]{
+            sharedContext->Abort();
+        };
     }
 
 }
 
 namespace WebSockets {
 
+    std::function< void() > MakeConnection(
+        std::shared_ptr< Http::IClient > http,
+        const std::string& host,
+        uint16_t port,
+        std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender,
+        MakeConnectionCompleteDelegate completeDelegate,
+        WebSocket::Configuration configuration
+    ) {
+        return StartConnection(
+            std::make_shared< WebSocket >(),
+            http,
+            host,
+            port,
+            diagnosticsSender,
+            [completeDelegate](
+                std::shared_ptr< WebSocket > ws,
+                const MakeConnectionTimings&
+            ){
+                completeDelegate(ws);
+            },
+            configuration
+        );
+    }
+
     MakeConnectionResults MakeConnection(
         std::shared_ptr< Http::IClient > http,
         const std::string& host,
@@ -227,24 +809,88 @@ namespace WebSockets {
         WebSocket::Configuration configuration
     ) {
         MakeConnectionResults results;
-        const auto sharedContext = std::make_shared< MakeConnectionSharedContext >();
-        const auto aborted = std::make_shared< std::promise< void > >();
-        results.connectionFuture = std::async(
-            std::launch::async,
-            MakeConnectionSynchronous,
+        const auto connectionPromise = std::make_shared< std::promise< std::shared_ptr< WebSocket > > >();
+        const auto timingsPromise = std::make_shared< std::promise< MakeConnectionTimings > >();
+        results.connectionFuture = connectionPromise->get_future();
+        results.timingsFuture = timingsPromise->get_future();
+        results.ws = std::make_shared< WebSocket >();
+        results.abortConnection = StartConnection(
+            results.ws,
             http,
             host,
             port,
             diagnosticsSender,
-            sharedContext,
+            [connectionPromise, timingsPromise](
+                std::shared_ptr< WebSocket > ws,
+                const MakeConnectionTimings& timings
+            ){
+                timingsPromise->set_value(timings);
+                connectionPromise->set_value(ws);
+            },
+            configuration
+        );
+        return results;
+    }
+
+    std::function< void() > MakeConnection(
+        std::shared_ptr< Http::IClient > http,
+        const std::vector< Endpoint >& endpoints,
+        std::chrono::milliseconds staggerDelay,
+        std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender,
+        MakeConnectionCompleteDelegate completeDelegate,
+        WebSocket::Configuration configuration
+    ) {
+        return StartRace(
+            http,
+            endpoints,
+            staggerDelay,
+            diagnosticsSender,
+            [completeDelegate](
+                std::shared_ptr< WebSocket > ws,
+                const MakeConnectionTimings&
+            ){
+                completeDelegate(ws);
+            },
+            configuration
+        );
+    }
+
+    MakeConnectionResults MakeConnection(
+        std::shared_ptr< Http::IClient > http,
+        const std::vector< Endpoint >& endpoints,
+        std::chrono::milliseconds staggerDelay,
+        std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender,
+        WebSocket::Configuration configuration
+    ) {
+        MakeConnectionResults results;
+        const auto connectionPromise = std::make_shared< std::promise< std::shared_ptr< WebSocket > > >();
+        const auto timingsPromise = std::make_shared< std::promise< MakeConnectionTimings > >();
+        results.connectionFuture = connectionPromise->get_future();
+        results.timingsFuture = timingsPromise->get_future();
+        results.abortConnection = StartRace(
+            http,
+            endpoints,
+            staggerDelay,
+            diagnosticsSender,
+            [connectionPromise, timingsPromise](
+                std::shared_ptr< WebSocket > ws,
+                const MakeConnectionTimings& timings
+            ){
+                timingsPromise->set_value(timings);
+                connectionPromise->set_value(ws);
+            },
             configuration
         );
-        results.abortConnection = [sharedContext]{
-            std::lock_guard< decltype(sharedContext->mutex) > lock(sharedContext->mutex);
-            sharedContext->abortAttempt = true;
-            sharedContext->connectionWaitDone.notify_one();
-        };
         return results;
     }
 
+    MakeConnectionHistograms GetMakeConnectionHistograms() {
+        MakeConnectionHistograms histograms;
+        histograms.buildingRequest = CopyHistogram(PHASE_BUILDING_REQUEST);
+        histograms.awaitingResponse = CopyHistogram(PHASE_AWAITING_RESPONSE);
+        histograms.validatingUpgrade = CopyHistogram(PHASE_VALIDATING_UPGRADE);
+        histograms.connecting = CopyHistogram(PHASE_CONNECTING);
+        return histograms;
+    }
+
 }
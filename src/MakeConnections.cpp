@@ -0,0 +1,443 @@
+/**
+ * @file MakeConnections.cpp
+ *
+ * This module contains the implementation of the WebSockets::MakeConnections
+ * function.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <Http/IClient.hpp>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <string>
+#include <SystemAbstractions/DiagnosticsSender.hpp>
+#include <thread>
+#include <vector>
+#include <WebSockets/MakeConnection.hpp>
+#include <WebSockets/MakeConnections.hpp>
+#include <WebSockets/WebSocket.hpp>
+
+namespace {
+
+    /**
+     * This is the clock used to time connection attempts.
+     */
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * This holds variables that are shared between the MakeConnections
+     * function, the thread pacing connection attempts, if any, and the
+     * delegates handed out to be called as connection attempts finish.
+     */
+    struct MakeConnectionsSharedContext
+        : public std::enable_shared_from_this< MakeConnectionsSharedContext >
+    {
+        // Properties
+
+        /**
+         * This is used to synchronize access to the structure.
+         */
+        std::mutex mutex;
+
+        /**
+         * This is used to wake the thread pacing connection attempts
+         * when an attempt finishes or the operation is aborted.
+         */
+        std::condition_variable wakeCondition;
+
+        /**
+         * This is the web client object to use to make the connections.
+         */
+        std::shared_ptr< Http::IClient > http;
+
+        /**
+         * These identify the servers to which to connect.
+         */
+        std::vector< WebSockets::Endpoint > endpoints;
+
+        /**
+         * This is the object to use to publish any diagnostic messages.
+         */
+        std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender;
+
+        /**
+         * These control how the connection attempts are paced.
+         */
+        WebSockets::MakeConnectionsOptions options;
+
+        /**
+         * This is the function to call as each connection attempt
+         * is finished.
+         */
+        WebSockets::MakeConnectionsDelegate connectionDelegate;
+
+        /**
+         * These are the configurable parameters to set for each WebSocket.
+         */
+        WebSockets::WebSocket::Configuration configuration;
+
+        /**
+         * This is used to deliver the statistics once all connection
+         * attempts are finished.
+         */
+        std::promise< WebSockets::MakeConnectionsStatistics > statisticsPromise;
+
+        /**
+         * This is the information gathered so far about how the
+         * connection attempts went.
+         */
+        WebSockets::MakeConnectionsStatistics statistics;
+
+        /**
+         * These are the times taken to make the connections made so far.
+         */
+        std::vector< std::chrono::microseconds > latencies;
+
+        /**
+         * These are the times at which the connection attempts started,
+         * indexed by endpoint.
+         */
+        std::vector< Clock::time_point > startTimes;
+
+        /**
+         * These are the functions to call to abort the connection attempts
+         * started, indexed by endpoint.
+         */
+        std::vector< std::function< void() > > abortDelegates;
+
+        /**
+         * These indicate which connection attempts have finished,
+         * indexed by endpoint.
+         */
+        std::vector< bool > attemptsFinished;
+
+        /**
+         * This is the time at which the first connection attempt started.
+         */
+        Clock::time_point firstStartTime;
+
+        /**
+         * This is the index of the next endpoint to which
+         * to start a connection attempt.
+         */
+        size_t nextIndex = 0;
+
+        /**
+         * This is the number of connection attempts in progress.
+         */
+        size_t inFlight = 0;
+
+        /**
+         * This is the number of connection attempts finished, or
+         * given up before they were started.
+         */
+        size_t finished = 0;
+
+        /**
+         * This flag is set while some thread is starting connection attempts,
+         * so that attempts finishing at once (possibly on the same thread)
+         * leave it to that thread to start more, rather than recursing.
+         */
+        bool starting = false;
+
+        /**
+         * This flag is set if another attempt may be started while
+         * some thread is starting connection attempts.
+         */
+        bool startAgain = false;
+
+        /**
+         * This flag is set if the operation has been aborted.
+         */
+        bool aborted = false;
+
+        /**
+         * This flag is set once the statistics have been delivered.
+         */
+        bool statisticsDelivered = false;
+
+        // Methods
+
+        /**
+         * This method determines whether or not another connection attempt
+         * may be started now, without regard to the ramp rate.
+         * The structure must be locked.
+         *
+         * @return
+         *     An indication of whether or not another connection attempt
+         *     may be started now is returned.
+         */
+        bool MayStartAnother() const {
+            return (
+                !aborted
+                && (nextIndex < endpoints.size())
+                && (
+                    (options.maxInFlight == 0)
+                    || (inFlight < options.maxInFlight)
+                )
+            );
+        }
+
+        /**
+         * This method returns the earliest time at which the ramp rate allows
+         * the connection attempt for the given endpoint to start.
+         *
+         * @param[in] index
+         *     This is the index of the endpoint to which to start
+         *     a connection attempt.
+         *
+         * @return
+         *     The earliest time at which the connection attempt may start
+         *     is returned.
+         */
+        Clock::time_point GetDueTime(size_t index) const {
+            return firstStartTime + std::chrono::duration_cast< Clock::duration >(
+                std::chrono::duration< double >((double)index / options.rampRate)
+            );
+        }
+
+        /**
+         * This method starts the connection attempt to the next endpoint.
+         * The structure must be locked, and is unlocked while the attempt
+         * is being started.
+         *
+         * @param[in,out] lock
+         *     This is the lock held on the structure.
+         */
+        void StartNext(std::unique_lock< std::mutex >& lock) {
+            const auto index = nextIndex++;
+            ++inFlight;
+            statistics.peakInFlight = std::max(statistics.peakInFlight, inFlight);
+            const auto now = Clock::now();
+            if (index == 0) {
+                firstStartTime = now;
+            }
+            startTimes[index] = now;
+            const auto endpoint = endpoints[index];
+            lock.unlock();
+            const auto self = shared_from_this();
+            const auto abortDelegate = WebSockets::MakeConnection(
+                http,
+                endpoint.host,
+                endpoint.port,
+                diagnosticsSender,
+                [self, index](std::shared_ptr< WebSockets::WebSocket > ws){
+                    self->ConnectionFinished(index, ws);
+                },
+                configuration
+            );
+            lock.lock();
+            if (aborted) {
+                lock.unlock();
+                abortDelegate();
+                lock.lock();
+            } else if (!attemptsFinished[index]) {
+                abortDelegates[index] = abortDelegate;
+            }
+        }
+
+        /**
+         * This method starts as many connection attempts as are allowed
+         * now, when no ramp rate is set.
+         */
+        void StartMore() {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            if (starting) {
+                startAgain = true;
+                return;
+            }
+            starting = true;
+            do {
+                startAgain = false;
+                while (MayStartAnother()) {
+                    StartNext(lock);
+                }
+            } while (startAgain);
+            starting = false;
+            FinishIfDone(lock);
+        }
+
+        /**
+         * This method is run by the thread pacing connection attempts,
+         * when a ramp rate is set.
+         */
+        void Pace() {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            while (
+                !aborted
+                && (nextIndex < endpoints.size())
+            ) {
+                if (!MayStartAnother()) {
+                    wakeCondition.wait(lock);
+                    continue;
+                }
+                if (nextIndex > 0) {
+                    const auto dueTime = GetDueTime(nextIndex);
+                    if (Clock::now() < dueTime) {
+                        (void)wakeCondition.wait_until(lock, dueTime);
+                        continue;
+                    }
+                }
+                StartNext(lock);
+            }
+            FinishIfDone(lock);
+        }
+
+        /**
+         * This method is called whenever a connection attempt is finished.
+         *
+         * @param[in] index
+         *     This is the index of the endpoint to which the
+         *     connection attempt was made.
+         *
+         * @param[in] ws
+         *     This is the WebSocket connected to the server, or nullptr
+         *     if the connection could not be made.
+         */
+        void ConnectionFinished(
+            size_t index,
+            std::shared_ptr< WebSockets::WebSocket > ws
+        ) {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            const auto latency = std::chrono::duration_cast< std::chrono::microseconds >(
+                Clock::now() - startTimes[index]
+            );
+            if (ws == nullptr) {
+                ++statistics.failed;
+            } else {
+                ++statistics.connected;
+                latencies.push_back(latency);
+            }
+            abortDelegates[index] = nullptr;
+            attemptsFinished[index] = true;
+            --inFlight;
+            ++finished;
+            lock.unlock();
+            if (connectionDelegate != nullptr) {
+                connectionDelegate(index, ws, latency);
+            }
+            if (options.rampRate > 0.0) {
+                lock.lock();
+                wakeCondition.notify_all();
+                FinishIfDone(lock);
+            } else {
+                StartMore();
+            }
+        }
+
+        /**
+         * This method aborts the connection attempts in progress
+         * and gives up on those not yet started.
+         */
+        void Abort() {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            if (aborted) {
+                return;
+            }
+            aborted = true;
+            statistics.notStarted = endpoints.size() - nextIndex;
+            finished += statistics.notStarted;
+            nextIndex = endpoints.size();
+            auto abortDelegatesToCall = std::move(abortDelegates);
+            abortDelegates.assign(endpoints.size(), nullptr);
+            wakeCondition.notify_all();
+            lock.unlock();
+            for (const auto& abortDelegate: abortDelegatesToCall) {
+                if (abortDelegate != nullptr) {
+                    abortDelegate();
+                }
+            }
+            lock.lock();
+            FinishIfDone(lock);
+        }
+
+        /**
+         * This method delivers the statistics if all connection attempts
+         * are finished and no thread is still starting attempts.
+         * The structure must be locked, and may be unlocked.
+         *
+         * @param[in,out] lock
+         *     This is the lock held on the structure.
+         */
+        void FinishIfDone(std::unique_lock< std::mutex >& lock) {
+            if (
+                starting
+                || (finished < endpoints.size())
+                || statisticsDelivered
+            ) {
+                return;
+            }
+            if (!latencies.empty()) {
+                std::sort(latencies.begin(), latencies.end());
+                statistics.minimumLatency = latencies.front();
+                statistics.medianLatency = latencies[latencies.size() / 2];
+                statistics.p99Latency = latencies[(latencies.size() * 99 - 1) / 100];
+                statistics.maximumLatency = latencies.back();
+            }
+            if (statistics.connected + statistics.failed > 0) {
+                statistics.elapsed = std::chrono::duration_cast< std::chrono::microseconds >(
+                    Clock::now() - firstStartTime
+                );
+                if (statistics.elapsed.count() > 0) {
+                    statistics.connectRate = (
+                        (double)statistics.connected * 1000000.0
+                        / (double)statistics.elapsed.count()
+                    );
+                }
+            }
+            statisticsDelivered = true;
+            const auto statisticsToDeliver = statistics;
+            lock.unlock();
+            statisticsPromise.set_value(statisticsToDeliver);
+            lock.lock();
+        }
+    };
+
+}
+
+namespace WebSockets {
+
+    MakeConnectionsResults MakeConnections(
+        std::shared_ptr< Http::IClient > http,
+        const std::vector< Endpoint >& endpoints,
+        std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender,
+        const MakeConnectionsOptions& options,
+        MakeConnectionsDelegate connectionDelegate,
+        WebSocket::Configuration configuration
+    ) {
+        const auto sharedContext = std::make_shared< MakeConnectionsSharedContext >();
+        sharedContext->http = http;
+        sharedContext->endpoints = endpoints;
+        sharedContext->diagnosticsSender = diagnosticsSender;
+        sharedContext->options = options;
+        sharedContext->connectionDelegate = connectionDelegate;
+        sharedContext->configuration = configuration;
+        sharedContext->startTimes.resize(endpoints.size());
+        sharedContext->abortDelegates.resize(endpoints.size());
+        sharedContext->attemptsFinished.resize(endpoints.size());
+        sharedContext->latencies.reserve(endpoints.size());
+        MakeConnectionsResults results;
+        results.statisticsFuture = sharedContext->statisticsPromise.get_future();
+        results.abortConnections = [sharedContext]{
+            sharedContext->Abort();
+        };
+        if (options.rampRate > 0.0) {
+            std::thread(
+                [sharedContext]{
+                    sharedContext->Pace();
+                }
+            ).detach();
+        } else {
+            sharedContext->StartMore();
+        }
+        return results;
+    }
+
+}
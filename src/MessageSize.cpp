@@ -0,0 +1,31 @@
+/**
+ * @file MessageSize.cpp
+ *
+ * This module contains the implementation of the function which works
+ * out how large a message received may become once decoded by the
+ * extensions negotiated.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include "MessageSize.hpp"
+
+#include <algorithm>
+#include <stddef.h>
+
+namespace WebSockets {
+
+    size_t GetMaxDecodedMessageSize(const WebSocket::Configuration& configuration) {
+        if (configuration.maxMessageSize == 0) {
+            return configuration.maxDecodedMessageSize;
+        }
+        if (configuration.maxDecodedMessageSize == 0) {
+            return configuration.maxMessageSize;
+        }
+        return std::min(
+            configuration.maxMessageSize,
+            configuration.maxDecodedMessageSize
+        );
+    }
+
+}
@@ -0,0 +1,35 @@
+#ifndef WEB_SOCKETS_MESSAGE_SIZE_HPP
+#define WEB_SOCKETS_MESSAGE_SIZE_HPP
+
+/**
+ * @file MessageSize.hpp
+ *
+ * This module declares the function which works out how large a message
+ * received may become once decoded by the extensions negotiated.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <stddef.h>
+#include <WebSockets/WebSocket.hpp>
+
+namespace WebSockets {
+
+    /**
+     * This function returns the largest size to which a message received
+     * may grow once decoded by the extensions negotiated, which is the
+     * smaller of the maximum message size and the maximum decoded
+     * message size, ignoring whichever is zero.
+     *
+     * @param[in] configuration
+     *     This holds the limits set for the WebSocket.
+     *
+     * @return
+     *     The largest size, in octets, to which a message received may
+     *     grow once decoded is returned, or zero if there is no limit.
+     */
+    size_t GetMaxDecodedMessageSize(const WebSocket::Configuration& configuration);
+
+}
+
+#endif /* WEB_SOCKETS_MESSAGE_SIZE_HPP */
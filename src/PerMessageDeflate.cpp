@@ -0,0 +1,797 @@
+/**
+ * @file PerMessageDeflate.cpp
+ *
+ * This module contains the implementation of the
+ * WebSockets::PerMessageDeflate class.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include "CompressionStream.hpp"
+#include "MessageSize.hpp"
+#include "PerMessageDeflate.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+namespace {
+
+    /**
+     * This is the smallest base-2 logarithm of the sliding window size
+     * that may be negotiated for the extension.
+     */
+    constexpr int MIN_WINDOW_BITS = 8;
+
+    /**
+     * This is the smallest base-2 logarithm of the sliding window size
+     * that zlib supports when compressing.  zlib quietly uses this
+     * window size when asked for a smaller one, which would produce data
+     * the peer isn't required to be able to decompress.
+     */
+    constexpr int MIN_DEFLATE_WINDOW_BITS = 9;
+
+    /**
+     * This is the largest base-2 logarithm of the sliding window size
+     * that may be negotiated for the extension.
+     */
+    constexpr int MAX_WINDOW_BITS = 15;
+
+    /**
+     * This is the reserved bit which the extension sets in the first frame
+     * of each compressed message.
+     */
+    constexpr uint8_t RSV1 = 0x40;
+
+    /**
+     * These are the octets which end the output of every compression flush,
+     * which are left off of messages sent, and added back to messages
+     * received before decompressing them.
+     */
+    const std::string FLUSH_TRAILER("\x00\x00\xff\xff", 4);
+
+    /**
+     * This is the smallest amount of space to reserve for output
+     * whenever zlib is called to compress or decompress data.
+     */
+    constexpr size_t MIN_OUTPUT_CHUNK_SIZE = 256;
+
+    /**
+     * This function parses the value of a window bits parameter
+     * of the extension.
+     *
+     * @param[in] value
+     *     This is the parameter value to parse.
+     *
+     * @param[out] windowBits
+     *     This is where to store the parsed value.
+     *
+     * @return
+     *     An indication of whether or not the value is valid is returned.
+     */
+    bool ParseWindowBits(
+        const std::string& value,
+        int& windowBits
+    ) {
+        if (
+            (value.length() < 1)
+            || (value.length() > 2)
+            || (value[0] == '0')
+        ) {
+            return false;
+        }
+        windowBits = 0;
+        for (auto digit: value) {
+            if ((digit < '0') || (digit > '9')) {
+                return false;
+            }
+            windowBits = windowBits * 10 + (digit - '0');
+        }
+        return (
+            (windowBits >= MIN_WINDOW_BITS)
+            && (windowBits <= MAX_WINDOW_BITS)
+        );
+    }
+
+    /**
+     * This function limits the given window bits to the range
+     * allowed by the extension.
+     *
+     * @param[in] windowBits
+     *     This is the value to limit.
+     *
+     * @param[in] minWindowBits
+     *     This is the smallest value allowed.
+     *
+     * @return
+     *     The limited value is returned.
+     */
+    int ClampWindowBits(
+        int windowBits,
+        int minWindowBits
+    ) {
+        return std::min(std::max(windowBits, minWindowBits), MAX_WINDOW_BITS);
+    }
+
+    /**
+     * This holds the parameters of the extension agreed upon
+     * in the opening handshake.
+     */
+    struct NegotiatedParameters {
+        /**
+         * This indicates whether or not the server resets its
+         * compression context after every message.
+         */
+        bool serverNoContextTakeover = false;
+
+        /**
+         * This indicates whether or not the client resets its
+         * compression context after every message.
+         */
+        bool clientNoContextTakeover = false;
+
+        /**
+         * This is the base-2 logarithm of the size of the sliding
+         * window the server uses to compress messages.
+         */
+        int serverMaxWindowBits = MAX_WINDOW_BITS;
+
+        /**
+         * This is the base-2 logarithm of the size of the sliding
+         * window the client uses to compress messages.
+         */
+        int clientMaxWindowBits = MAX_WINDOW_BITS;
+    };
+
+    /**
+     * This holds the parameters found in an extension offer
+     * or extension response.
+     */
+    struct ParsedParameters {
+        /**
+         * This indicates whether or not the "server_no_context_takeover"
+         * parameter was given.
+         */
+        bool serverNoContextTakeover = false;
+
+        /**
+         * This indicates whether or not the "client_no_context_takeover"
+         * parameter was given.
+         */
+        bool clientNoContextTakeover = false;
+
+        /**
+         * This indicates whether or not the "server_max_window_bits"
+         * parameter was given.
+         */
+        bool serverMaxWindowBitsGiven = false;
+
+        /**
+         * This is the value of the "server_max_window_bits" parameter,
+         * if it was given.
+         */
+        int serverMaxWindowBits = MAX_WINDOW_BITS;
+
+        /**
+         * This indicates whether or not the "client_max_window_bits"
+         * parameter was given.
+         */
+        bool clientMaxWindowBitsGiven = false;
+
+        /**
+         * This is the value of the "client_max_window_bits" parameter,
+         * or MAX_WINDOW_BITS if it was given without a value or not given.
+         */
+        int clientMaxWindowBits = MAX_WINDOW_BITS;
+    };
+
+    /**
+     * This function checks and parses the parameters of the given
+     * extension offer or response.
+     *
+     * @param[in] parameters
+     *     These are the parameters of the extension offer
+     *     or response to parse.
+     *
+     * @param[in] allowClientMaxWindowBitsWithoutValue
+     *     This indicates whether or not the "client_max_window_bits"
+     *     parameter may be given without a value.
+     *
+     * @param[out] parsedParameters
+     *     This is where to store the parsed parameters.
+     *
+     * @return
+     *     An indication of whether or not the parameters are all known,
+     *     valid, and given no more than once is returned.
+     */
+    bool ParseParameters(
+        const WebSockets::Extension::Parameters& parameters,
+        bool allowClientMaxWindowBitsWithoutValue,
+        ParsedParameters& parsedParameters
+    ) {
+        for (const auto& parameter: parameters) {
+            if (parameter.first == "server_no_context_takeover") {
+                if (
+                    parsedParameters.serverNoContextTakeover
+                    || !parameter.second.empty()
+                ) {
+                    return false;
+                }
+                parsedParameters.serverNoContextTakeover = true;
+            } else if (parameter.first == "client_no_context_takeover") {
+                if (
+                    parsedParameters.clientNoContextTakeover
+                    || !parameter.second.empty()
+                ) {
+                    return false;
+                }
+                parsedParameters.clientNoContextTakeover = true;
+            } else if (parameter.first == "server_max_window_bits") {
+                if (
+                    parsedParameters.serverMaxWindowBitsGiven
+                    || !ParseWindowBits(
+                        parameter.second,
+                        parsedParameters.serverMaxWindowBits
+                    )
+                ) {
+                    return false;
+                }
+                parsedParameters.serverMaxWindowBitsGiven = true;
+            } else if (parameter.first == "client_max_window_bits") {
+                if (parsedParameters.clientMaxWindowBitsGiven) {
+                    return false;
+                }
+                if (parameter.second.empty()) {
+                    if (!allowClientMaxWindowBitsWithoutValue) {
+                        return false;
+                    }
+                } else if (
+                    !ParseWindowBits(
+                        parameter.second,
+                        parsedParameters.clientMaxWindowBits
+                    )
+                ) {
+                    return false;
+                }
+                parsedParameters.clientMaxWindowBitsGiven = true;
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * This function appends the given amount of uninitialized space to
+     * the end of the given buffer, and points the output of the given
+     * zlib stream at it.
+     *
+     * @param[in,out] buffer
+     *     This is the buffer to extend.
+     *
+     * @param[in] used
+     *     This is the number of octets at the front of the buffer
+     *     which hold output.
+     *
+     * @param[in,out] stream
+     *     This is the zlib stream whose output to set.
+     */
+    void PrepareOutput(
+        std::string& buffer,
+        size_t used,
+        z_stream& stream
+    ) {
+        const auto chunkSize = std::max(MIN_OUTPUT_CHUNK_SIZE, used);
+        buffer.resize(used + chunkSize);
+        stream.next_out = (Bytef*)&buffer[used];
+        stream.avail_out = (uInt)chunkSize;
+    }
+
+}
+
+namespace WebSockets {
+
+    /**
+     * This contains the private properties of a PerMessageDeflate instance.
+     */
+    struct PerMessageDeflate::Impl {
+        // Properties
+
+        /**
+         * This holds the compression settings of the WebSocket.
+         */
+        WebSocket::Configuration configuration;
+
+        /**
+         * This is the base-2 logarithm of the sliding window size
+         * used to compress messages sent.
+         */
+        int deflateWindowBits = MAX_WINDOW_BITS;
+
+        /**
+         * This is the base-2 logarithm of the sliding window size
+         * used to decompress messages received.
+         */
+        int inflateWindowBits = MAX_WINDOW_BITS;
+
+        /**
+         * This indicates whether or not to reset the compression context
+         * after every message sent.
+         */
+        bool deflateNoContextTakeover = false;
+
+        /**
+         * This indicates whether or not to reset the decompression context
+         * after every message received.
+         */
+        bool inflateNoContextTakeover = false;
+
+        /**
+         * This is the amount of memory, from 1 to 9, the compression
+         * stream uses for its internal compression state.
+         */
+        int deflateMemoryLevel = 8;
+
+        /**
+         * This is where compression and decompression streams are
+         * obtained, and where they're returned when no longer needed.
+         */
+        std::shared_ptr< CompressionPool > pool;
+
+        /**
+         * This is the stream used to compress messages sent, while
+         * it's held by the extension.
+         */
+        std::unique_ptr< CompressionPool::Stream > deflater;
+
+        /**
+         * This is the stream used to decompress messages received, while
+         * it's held by the extension.
+         */
+        std::unique_ptr< CompressionPool::Stream > inflater;
+
+        /**
+         * This is the amount of memory held by the extension for
+         * compression state, as of the last time it was measured.
+         * Messages are compressed and decompressed by different threads,
+         * so each keeps track of the memory used by its own stream.
+         */
+        std::atomic< size_t > deflaterMemory{0};
+
+        /**
+         * This is the amount of memory held by the extension for
+         * decompression state, as of the last time it was measured.
+         */
+        std::atomic< size_t > inflaterMemory{0};
+
+        /**
+         * This is the largest amount of memory held at any one time
+         * by the extension for compression and decompression state.
+         */
+        std::atomic< size_t > peakMemory{0};
+
+        // Methods
+
+        /**
+         * This method returns the amount of memory currently held by
+         * the extension for compression and decompression state.
+         *
+         * @return
+         *     The number of octets of memory currently held by the
+         *     extension is returned.
+         */
+        size_t GetMemoryInUse() const {
+            return deflaterMemory + inflaterMemory;
+        }
+
+        /**
+         * This method measures the memory held by the given stream,
+         * and updates the record of the largest amount of memory
+         * held at any one time by the extension.
+         *
+         * @param[in] stream
+         *     This is the stream to measure, if it's held.
+         *
+         * @param[out] streamMemory
+         *     This is where to store the amount of memory
+         *     held by the stream.
+         */
+        void UpdateMemory(
+            const std::unique_ptr< CompressionPool::Stream >& stream,
+            std::atomic< size_t >& streamMemory
+        ) {
+            streamMemory = ((stream == nullptr) ? 0 : stream->memory);
+            const auto memory = GetMemoryInUse();
+            auto peak = peakMemory.load();
+            while (
+                (memory > peak)
+                && !peakMemory.compare_exchange_weak(peak, memory)
+            ) {
+            }
+        }
+
+        /**
+         * This method sets up the extension to compress and decompress
+         * messages according to the parameters agreed upon in the
+         * opening handshake.
+         *
+         * @param[in] parameters
+         *     These are the parameters agreed upon in the opening handshake.
+         *
+         * @param[in] role
+         *     This is the role the local endpoint plays in the connection.
+         */
+        void Start(
+            const NegotiatedParameters& parameters,
+            WebSocket::Role role
+        ) {
+            if (role == WebSocket::Role::Server) {
+                deflateWindowBits = parameters.serverMaxWindowBits;
+                deflateNoContextTakeover = parameters.serverNoContextTakeover;
+                inflateWindowBits = parameters.clientMaxWindowBits;
+                inflateNoContextTakeover = parameters.clientNoContextTakeover;
+            } else {
+                deflateWindowBits = parameters.clientMaxWindowBits;
+                deflateNoContextTakeover = parameters.clientNoContextTakeover;
+                inflateWindowBits = parameters.serverMaxWindowBits;
+                inflateNoContextTakeover = parameters.serverNoContextTakeover;
+            }
+            deflateWindowBits = ClampWindowBits(
+                deflateWindowBits,
+                MIN_DEFLATE_WINDOW_BITS
+            );
+
+            // Some peers which negotiate the smallest window size actually
+            // compress using the next larger one (see MIN_DEFLATE_WINDOW_BITS),
+            // so decompress using the larger window to be able to handle it.
+            inflateWindowBits = ClampWindowBits(
+                inflateWindowBits,
+                MIN_DEFLATE_WINDOW_BITS
+            );
+        }
+    };
+
+    const std::string PerMessageDeflate::NAME = "permessage-deflate";
+
+    PerMessageDeflate::~PerMessageDeflate() noexcept {
+        impl_->pool->Release(std::move(impl_->deflater));
+        impl_->pool->Release(std::move(impl_->inflater));
+    }
+
+    PerMessageDeflate::PerMessageDeflate(const WebSocket::Configuration& configuration)
+        : impl_(new Impl)
+    {
+        impl_->configuration = configuration;
+        impl_->deflateMemoryLevel = std::min(
+            std::max(configuration.compressionMemoryLevel, 1),
+            9
+        );
+        impl_->pool = configuration.compressionPool;
+        if (impl_->pool == nullptr) {
+            impl_->pool = std::make_shared< CompressionPool >(0);
+        }
+    }
+
+    std::string PerMessageDeflate::GetName() {
+        return NAME;
+    }
+
+    uint8_t PerMessageDeflate::GetReservedBits() {
+        return RSV1;
+    }
+
+    auto PerMessageDeflate::MakeOffer() -> Parameters {
+        const auto& configuration = impl_->configuration;
+        Parameters offer;
+        if (configuration.serverNoContextTakeover) {
+            offer.emplace_back("server_no_context_takeover", "");
+        }
+        if (configuration.clientNoContextTakeover) {
+            offer.emplace_back("client_no_context_takeover", "");
+        }
+        const auto serverMaxWindowBits = ClampWindowBits(
+            configuration.serverMaxWindowBits,
+            MIN_WINDOW_BITS
+        );
+        if (serverMaxWindowBits < MAX_WINDOW_BITS) {
+            offer.emplace_back(
+                "server_max_window_bits",
+                std::to_string(serverMaxWindowBits)
+            );
+        }
+        const auto clientMaxWindowBits = ClampWindowBits(
+            configuration.clientMaxWindowBits,
+            MIN_DEFLATE_WINDOW_BITS
+        );
+        offer.emplace_back(
+            "client_max_window_bits",
+            (
+                (clientMaxWindowBits < MAX_WINDOW_BITS)
+                ? std::to_string(clientMaxWindowBits)
+                : ""
+            )
+        );
+        return offer;
+    }
+
+    bool PerMessageDeflate::NegotiateAsServer(
+        const Parameters& offer,
+        Parameters& response
+    ) {
+        const auto& configuration = impl_->configuration;
+        NegotiatedParameters parameters;
+        ParsedParameters offered;
+        if (!ParseParameters(offer, true, offered)) {
+            return false;
+        }
+        parameters.serverNoContextTakeover = (
+            offered.serverNoContextTakeover
+            || configuration.serverNoContextTakeover
+        );
+        parameters.clientNoContextTakeover = (
+            offered.clientNoContextTakeover
+            || configuration.clientNoContextTakeover
+        );
+        if (offered.serverMaxWindowBits < MIN_DEFLATE_WINDOW_BITS) {
+            return false;
+        }
+        parameters.serverMaxWindowBits = std::min(
+            offered.serverMaxWindowBits,
+            ClampWindowBits(
+                configuration.serverMaxWindowBits,
+                MIN_DEFLATE_WINDOW_BITS
+            )
+        );
+        const auto clientMaxWindowBits = ClampWindowBits(
+            configuration.clientMaxWindowBits,
+            MIN_WINDOW_BITS
+        );
+        if (offered.clientMaxWindowBitsGiven) {
+            parameters.clientMaxWindowBits = std::min(
+                offered.clientMaxWindowBits,
+                clientMaxWindowBits
+            );
+        } else if (clientMaxWindowBits < MAX_WINDOW_BITS) {
+            return false;
+        } else {
+            parameters.clientMaxWindowBits = MAX_WINDOW_BITS;
+        }
+        response.clear();
+        if (parameters.serverNoContextTakeover) {
+            response.emplace_back("server_no_context_takeover", "");
+        }
+        if (parameters.clientNoContextTakeover) {
+            response.emplace_back("client_no_context_takeover", "");
+        }
+        if (
+            offered.serverMaxWindowBitsGiven
+            || (parameters.serverMaxWindowBits < MAX_WINDOW_BITS)
+        ) {
+            response.emplace_back(
+                "server_max_window_bits",
+                std::to_string(parameters.serverMaxWindowBits)
+            );
+        }
+        if (parameters.clientMaxWindowBits < MAX_WINDOW_BITS) {
+            response.emplace_back(
+                "client_max_window_bits",
+                std::to_string(parameters.clientMaxWindowBits)
+            );
+        }
+        impl_->Start(parameters, WebSocket::Role::Server);
+        return true;
+    }
+
+    bool PerMessageDeflate::NegotiateAsClient(const Parameters& response) {
+        const auto& configuration = impl_->configuration;
+        NegotiatedParameters parameters;
+        ParsedParameters accepted;
+        if (!ParseParameters(response, false, accepted)) {
+            return false;
+        }
+        const auto serverMaxWindowBits = ClampWindowBits(
+            configuration.serverMaxWindowBits,
+            MIN_WINDOW_BITS
+        );
+        if (accepted.serverMaxWindowBits > serverMaxWindowBits) {
+            return false;
+        }
+        const auto clientMaxWindowBits = ClampWindowBits(
+            configuration.clientMaxWindowBits,
+            MIN_DEFLATE_WINDOW_BITS
+        );
+        if (
+            (accepted.clientMaxWindowBits < MIN_DEFLATE_WINDOW_BITS)
+            || (
+                accepted.clientMaxWindowBitsGiven
+                && (accepted.clientMaxWindowBits > clientMaxWindowBits)
+            )
+        ) {
+            return false;
+        }
+        parameters.serverNoContextTakeover = accepted.serverNoContextTakeover;
+        parameters.clientNoContextTakeover = (
+            accepted.clientNoContextTakeover
+            || configuration.clientNoContextTakeover
+        );
+        parameters.serverMaxWindowBits = accepted.serverMaxWindowBits;
+        parameters.clientMaxWindowBits = std::min(
+            accepted.clientMaxWindowBits,
+            clientMaxWindowBits
+        );
+        impl_->Start(parameters, WebSocket::Role::Client);
+        return true;
+    }
+
+    bool PerMessageDeflate::Compress(
+        const std::string& data,
+        bool lastFragment,
+        std::string& output
+    ) {
+        if (impl_->deflater == nullptr) {
+            impl_->deflater = impl_->pool->AcquireDeflater(
+                impl_->deflateWindowBits,
+                impl_->deflateMemoryLevel
+            );
+            if (impl_->deflater == nullptr) {
+                return false;
+            }
+        }
+        auto& deflater = impl_->deflater->zStream;
+        deflater.next_in = (Bytef*)data.data();
+        deflater.avail_in = (uInt)data.length();
+        output.clear();
+        size_t used = 0;
+        do {
+            PrepareOutput(output, used, deflater);
+            const auto available = deflater.avail_out;
+            const auto result = deflate(&deflater, Z_SYNC_FLUSH);
+            if (
+                (result != Z_OK)
+                && (result != Z_BUF_ERROR)
+            ) {
+                return false;
+            }
+            used += available - deflater.avail_out;
+        } while (deflater.avail_out == 0);
+        output.resize(used);
+        impl_->UpdateMemory(impl_->deflater, impl_->deflaterMemory);
+        if (lastFragment) {
+            if (
+                (output.length() >= FLUSH_TRAILER.length())
+                && (
+                    output.compare(
+                        output.length() - FLUSH_TRAILER.length(),
+                        FLUSH_TRAILER.length(),
+                        FLUSH_TRAILER
+                    ) == 0
+                )
+            ) {
+                output.resize(output.length() - FLUSH_TRAILER.length());
+            }
+            if (impl_->deflateNoContextTakeover) {
+                impl_->pool->Release(std::move(impl_->deflater));
+                impl_->deflaterMemory = 0;
+            }
+        }
+        return true;
+    }
+
+    bool PerMessageDeflate::Decompress(
+        const std::string& data,
+        std::string& output
+    ) {
+        if (impl_->inflater == nullptr) {
+            impl_->inflater = impl_->pool->AcquireInflater(
+                impl_->inflateWindowBits
+            );
+            if (impl_->inflater == nullptr) {
+                return false;
+            }
+        }
+        auto& inflater = impl_->inflater->zStream;
+        const auto input = data + FLUSH_TRAILER;
+        inflater.next_in = (Bytef*)input.data();
+        inflater.avail_in = (uInt)input.length();
+        output.clear();
+        size_t used = 0;
+        bool endOfStream = false;
+        const auto maxDecodedMessageSize = GetMaxDecodedMessageSize(impl_->configuration);
+        do {
+            PrepareOutput(output, used, inflater);
+            const auto available = inflater.avail_out;
+            const auto result = inflate(&inflater, Z_SYNC_FLUSH);
+            used += available - inflater.avail_out;
+            if (
+                (maxDecodedMessageSize > 0)
+                && (used > maxDecodedMessageSize)
+            ) {
+                output.resize(used);
+                impl_->UpdateMemory(impl_->inflater, impl_->inflaterMemory);
+                impl_->pool->Release(std::move(impl_->inflater));
+                impl_->inflaterMemory = 0;
+                return true;
+            }
+            if (result == Z_STREAM_END) {
+                endOfStream = true;
+                break;
+            }
+            if (result == Z_BUF_ERROR) {
+                if (inflater.avail_out > 0) {
+                    break;
+                }
+            } else if (result != Z_OK) {
+                impl_->UpdateMemory(impl_->inflater, impl_->inflaterMemory);
+                impl_->pool->Release(std::move(impl_->inflater));
+                impl_->inflaterMemory = 0;
+                return false;
+            }
+        } while (
+            (inflater.avail_in > 0)
+            || (inflater.avail_out == 0)
+        );
+        output.resize(used);
+        impl_->UpdateMemory(impl_->inflater, impl_->inflaterMemory);
+        if (impl_->inflateNoContextTakeover) {
+            impl_->pool->Release(std::move(impl_->inflater));
+            impl_->inflaterMemory = 0;
+        } else if (endOfStream) {
+            (void)inflateReset(&inflater);
+        }
+        return true;
+    }
+
+    bool PerMessageDeflate::EncodeFragment(
+        bool firstFragment,
+        bool lastFragment,
+        std::string& payload,
+        uint8_t& reservedBits,
+        std::string& failureReason
+    ) {
+        std::string compressedPayload;
+        if (!Compress(payload, lastFragment, compressedPayload)) {
+            failureReason = "unable to compress message";
+            return false;
+        }
+        payload = std::move(compressedPayload);
+        reservedBits = (firstFragment ? RSV1 : 0);
+        return true;
+    }
+
+    bool PerMessageDeflate::DecodeMessage(
+        uint8_t reservedBits,
+        std::string& message,
+        std::string& failureReason
+    ) {
+        if ((reservedBits & RSV1) == 0) {
+            return true;
+        }
+        std::string decompressedMessage;
+        if (!Decompress(message, decompressedMessage)) {
+            failureReason = "invalid compressed data";
+            return false;
+        }
+        message = std::move(decompressedMessage);
+        return true;
+    }
+
+    int PerMessageDeflate::GetSharedCompressionKey() const {
+        if (!impl_->deflateNoContextTakeover) {
+            return 0;
+        }
+        return (impl_->deflateWindowBits << 4) | impl_->deflateMemoryLevel;
+    }
+
+    size_t PerMessageDeflate::GetMemoryInUse() const {
+        return impl_->GetMemoryInUse();
+    }
+
+    size_t PerMessageDeflate::GetPeakMemoryInUse() const {
+        return impl_->peakMemory;
+    }
+
+}
@@ -0,0 +1,176 @@
+#ifndef WEB_SOCKETS_PER_MESSAGE_DEFLATE_HPP
+#define WEB_SOCKETS_PER_MESSAGE_DEFLATE_HPP
+
+/**
+ * @file PerMessageDeflate.hpp
+ *
+ * This module declares the WebSockets::PerMessageDeflate class.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <WebSockets/Extension.hpp>
+#include <WebSockets/WebSocket.hpp>
+
+namespace WebSockets {
+
+    /**
+     * This class implements the "permessage-deflate" extension of the
+     * WebSocket protocol, documented in
+     * [RFC 7692](https://tools.ietf.org/html/rfc7692).
+     */
+    class PerMessageDeflate
+        : public Extension
+    {
+        // Lifecycle management
+    public:
+        ~PerMessageDeflate() noexcept;
+        PerMessageDeflate(const PerMessageDeflate&) = delete;
+        PerMessageDeflate(PerMessageDeflate&&) = delete;
+        PerMessageDeflate& operator=(const PerMessageDeflate&) = delete;
+        PerMessageDeflate& operator=(PerMessageDeflate&&) = delete;
+
+        // Public methods
+    public:
+        /**
+         * This is the name of the extension, as it appears in the
+         * "Sec-WebSocket-Extensions" header.
+         */
+        static const std::string NAME;
+
+        /**
+         * This is the constructor of the class.
+         *
+         * @param[in] configuration
+         *     This holds the compression settings of the WebSocket.
+         */
+        explicit PerMessageDeflate(const WebSocket::Configuration& configuration);
+
+        /**
+         * This method compresses the next part of a message being sent.
+         *
+         * @param[in] data
+         *     This is the uncompressed part of the message.
+         *
+         * @param[in] lastFragment
+         *     This indicates whether or not this is the last part
+         *     of the message.
+         *
+         * @param[out] output
+         *     This is where to store the compressed data.
+         *
+         * @return
+         *     An indication of whether or not the data was compressed
+         *     successfully is returned.
+         */
+        bool Compress(
+            const std::string& data,
+            bool lastFragment,
+            std::string& output
+        );
+
+        /**
+         * This method decompresses a complete message received.
+         * Decompression stops as soon as the output grows beyond the
+         * largest size allowed for a decoded message, leaving the output
+         * longer than that size but not the complete message, which
+         * the WebSocket is then expected to reject.
+         *
+         * @param[in] data
+         *     This is the compressed payload of the message.
+         *
+         * @param[out] output
+         *     This is where to store the decompressed message.
+         *
+         * @return
+         *     An indication of whether or not the message was decompressed
+         *     successfully is returned.
+         */
+        bool Decompress(
+            const std::string& data,
+            std::string& output
+        );
+
+        /**
+         * This method returns a value identifying the settings used to
+         * compress messages sent, if each message is compressed without
+         * reference to any before it.  Extensions returning the same
+         * nonzero value compress any given message identically, so a
+         * message sent through several of them need only be compressed
+         * once.
+         *
+         * @return
+         *     A nonzero value identifying the compression settings is
+         *     returned, or zero if the compression context is carried
+         *     over from one message to the next.
+         */
+        int GetSharedCompressionKey() const;
+
+        /**
+         * This method returns the amount of memory currently held by
+         * the extension for compression and decompression state.
+         * Streams are only held while needed, so this is zero between
+         * messages in any direction where the compression context
+         * is reset after every message.
+         *
+         * @return
+         *     The number of octets of memory currently held by the
+         *     extension is returned.
+         */
+        size_t GetMemoryInUse() const;
+
+        /**
+         * This method returns the largest amount of memory held at any
+         * one time by the extension for compression and decompression
+         * state.
+         *
+         * @return
+         *     The largest number of octets of memory held at any one time
+         *     by the extension is returned.
+         */
+        size_t GetPeakMemoryInUse() const;
+
+        // Extension
+
+        virtual std::string GetName() override;
+        virtual uint8_t GetReservedBits() override;
+        virtual Parameters MakeOffer() override;
+        virtual bool NegotiateAsClient(const Parameters& response) override;
+        virtual bool NegotiateAsServer(
+            const Parameters& offer,
+            Parameters& response
+        ) override;
+        virtual bool EncodeFragment(
+            bool firstFragment,
+            bool lastFragment,
+            std::string& payload,
+            uint8_t& reservedBits,
+            std::string& failureReason
+        ) override;
+        virtual bool DecodeMessage(
+            uint8_t reservedBits,
+            std::string& message,
+            std::string& failureReason
+        ) override;
+
+        // Private properties
+    private:
+        /**
+         * This is the type of structure that contains the private
+         * properties of the instance.  It is defined in the implementation
+         * and declared here to ensure that it is scoped inside the class.
+         */
+        struct Impl;
+
+        /**
+         * This contains the private properties of the instance.
+         */
+        std::unique_ptr< Impl > impl_;
+    };
+
+}
+
+#endif /* WEB_SOCKETS_PER_MESSAGE_DEFLATE_HPP */
@@ -0,0 +1,604 @@
+/**
+ * @file ReconnectingWebSocket.cpp
+ *
+ * This module contains the implementation of the
+ * WebSockets::ReconnectingWebSocket class.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <Http/IClient.hpp>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <SystemAbstractions/DiagnosticsSender.hpp>
+#include <thread>
+#include <WebSockets/MakeConnection.hpp>
+#include <WebSockets/ReconnectingWebSocket.hpp>
+#include <WebSockets/WebSocket.hpp>
+
+namespace {
+
+    /**
+     * This is the clock used to time connection attempts and recoveries.
+     */
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * This holds a message waiting to be sent once connected.
+     */
+    struct HeldMessage {
+        /**
+         * This indicates whether the message is text or binary.
+         */
+        bool text = false;
+
+        /**
+         * This is the payload of the message.
+         */
+        std::string data;
+    };
+
+}
+
+namespace WebSockets {
+
+    /**
+     * This contains the private properties of a ReconnectingWebSocket
+     * instance.
+     */
+    struct ReconnectingWebSocket::Impl
+        : public std::enable_shared_from_this< Impl >
+    {
+        // Properties
+
+        /**
+         * This is used to synchronize access to the instance.
+         */
+        mutable std::mutex mutex;
+
+        /**
+         * This is used to wake the thread which connects the WebSocket
+         * when there's something for it to do.
+         */
+        std::condition_variable wakeCondition;
+
+        /**
+         * This is the web client object to use to make connections.
+         */
+        std::shared_ptr< Http::IClient > http;
+
+        /**
+         * This is the host name or IP address of the server to which to
+         * connect.
+         */
+        std::string host;
+
+        /**
+         * This is the port number of the server to which to connect.
+         */
+        uint16_t port = 0;
+
+        /**
+         * This is the object to use to publish any diagnostic messages.
+         */
+        std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender;
+
+        /**
+         * These are the configurable parameters in use.
+         */
+        Configuration configuration;
+
+        /**
+         * These are the functions provided by the user to call whenever
+         * interesting events occur.
+         */
+        std::shared_ptr< const WebSocket::Delegates > delegates = std::make_shared< WebSocket::Delegates >();
+
+        /**
+         * This is the WebSocket currently connected, if any.
+         */
+        std::shared_ptr< WebSocket > ws;
+
+        /**
+         * This flag is set once the instance has been started.
+         */
+        bool started = false;
+
+        /**
+         * This flag is set once the user has closed the WebSocket,
+         * or the instance is being destroyed.
+         */
+        bool closed = false;
+
+        /**
+         * This flag is set while a connection attempt is in progress.
+         */
+        bool connecting = false;
+
+        /**
+         * This flag is set while messages held are being sent over
+         * the WebSocket just connected.
+         */
+        bool flushing = false;
+
+        /**
+         * This flag is set once the WebSocket has been connected for the
+         * first time, after which further connections are recoveries.
+         */
+        bool everConnected = false;
+
+        /**
+         * This is the function to call to abort the connection attempt
+         * in progress, if any.
+         */
+        std::function< void() > abortConnection;
+
+        /**
+         * These are the messages waiting to be sent once connected.
+         */
+        std::deque< HeldMessage > heldMessages;
+
+        /**
+         * This is the delay chosen before the last connection attempt,
+         * or zero if no attempt has failed since the last connection.
+         */
+        std::chrono::milliseconds previousBackoff = std::chrono::milliseconds(0);
+
+        /**
+         * This is the time at which the connection was last lost.
+         */
+        Clock::time_point lostTime;
+
+        /**
+         * This is the total time taken to recover from lost connections.
+         */
+        std::chrono::microseconds totalTimeToRecover = std::chrono::microseconds(0);
+
+        /**
+         * This is used to choose the delays between connection attempts.
+         */
+        std::mt19937 generator;
+
+        /**
+         * This holds information about how well the WebSocket
+         * has stayed connected.
+         */
+        Statistics statistics;
+
+        /**
+         * This is the thread which connects the WebSocket.
+         */
+        std::thread worker;
+
+        // Methods
+
+        /**
+         * This method chooses how long to wait before the next connection
+         * attempt, using "decorrelated jitter": a random delay between the
+         * initial backoff and three times the previous delay, capped.
+         * The instance must be locked.
+         *
+         * @return
+         *     The time to wait before the next connection attempt
+         *     is returned.
+         */
+        std::chrono::milliseconds ChooseBackoff() {
+            const auto lowest = configuration.initialBackoff.count();
+            const auto previous = std::max(previousBackoff.count(), lowest);
+            const auto highest = std::max(
+                lowest,
+                std::min(configuration.maxBackoff.count(), previous * 3)
+            );
+            std::uniform_int_distribution< decltype(lowest) > distribution(lowest, highest);
+            previousBackoff = std::chrono::milliseconds(distribution(generator));
+            return previousBackoff;
+        }
+
+        /**
+         * This method runs the thread which connects the WebSocket,
+         * whenever it isn't connected or being connected.
+         */
+        void Run() {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            bool firstAttempt = true;
+            while (!closed) {
+                if (
+                    (ws != nullptr)
+                    || connecting
+                ) {
+                    wakeCondition.wait(lock);
+                    continue;
+                }
+                if (!firstAttempt) {
+                    const auto backoff = ChooseBackoff();
+                    if (
+                        wakeCondition.wait_for(
+                            lock,
+                            backoff,
+                            [this]{ return closed; }
+                        )
+                    ) {
+                        break;
+                    }
+                }
+                firstAttempt = false;
+                connecting = true;
+                ++statistics.connectionAttempts;
+                lock.unlock();
+                std::weak_ptr< Impl > selfWeak(shared_from_this());
+                const auto abort = MakeConnection(
+                    http,
+                    host,
+                    port,
+                    diagnosticsSender,
+                    [selfWeak](std::shared_ptr< WebSocket > newWs){
+                        const auto self = selfWeak.lock();
+                        if (self == nullptr) {
+                            if (newWs != nullptr) {
+                                newWs->Close(1001);
+                            }
+                            return;
+                        }
+                        self->ConnectionAttemptFinished(newWs);
+                    },
+                    configuration.webSocketConfiguration
+                );
+                lock.lock();
+                if (connecting) {
+                    abortConnection = abort;
+                }
+            }
+            const auto abort = std::move(abortConnection);
+            abortConnection = nullptr;
+            lock.unlock();
+            if (abort != nullptr) {
+                abort();
+            }
+        }
+
+        /**
+         * This method is called whenever a connection attempt is finished.
+         *
+         * @param[in] newWs
+         *     This is the WebSocket connected, or nullptr if the connection
+         *     could not be made.
+         */
+        void ConnectionAttemptFinished(std::shared_ptr< WebSocket > newWs) {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            connecting = false;
+            abortConnection = nullptr;
+            if (closed) {
+                lock.unlock();
+                if (newWs != nullptr) {
+                    newWs->Close(1001);
+                }
+                return;
+            }
+            if (newWs == nullptr) {
+                ++statistics.connectionAttemptsFailed;
+                wakeCondition.notify_all();
+                return;
+            }
+            ws = newWs;
+            flushing = true;
+            previousBackoff = std::chrono::milliseconds(0);
+            if (everConnected) {
+                ++statistics.recoveries;
+                statistics.lastTimeToRecover = std::chrono::duration_cast< std::chrono::microseconds >(
+                    Clock::now() - lostTime
+                );
+                totalTimeToRecover += statistics.lastTimeToRecover;
+                statistics.averageTimeToRecover = totalTimeToRecover / statistics.recoveries;
+                statistics.maximumTimeToRecover = std::max(
+                    statistics.maximumTimeToRecover,
+                    statistics.lastTimeToRecover
+                );
+            }
+            everConnected = true;
+            lock.unlock();
+            std::weak_ptr< Impl > selfWeak(shared_from_this());
+            WebSocket::Delegates wsDelegates;
+            wsDelegates.ping = [selfWeak](std::string&& data){
+                const auto self = selfWeak.lock();
+                if (self != nullptr) {
+                    const auto delegatesSnapshot = self->GetDelegates();
+                    if (delegatesSnapshot->ping != nullptr) {
+                        delegatesSnapshot->ping(std::move(data));
+                    }
+                }
+            };
+            wsDelegates.pong = [selfWeak](std::string&& data){
+                const auto self = selfWeak.lock();
+                if (self != nullptr) {
+                    const auto delegatesSnapshot = self->GetDelegates();
+                    if (delegatesSnapshot->pong != nullptr) {
+                        delegatesSnapshot->pong(std::move(data));
+                    }
+                }
+            };
+            wsDelegates.text = [selfWeak](std::string&& data){
+                const auto self = selfWeak.lock();
+                if (self != nullptr) {
+                    const auto delegatesSnapshot = self->GetDelegates();
+                    if (delegatesSnapshot->text != nullptr) {
+                        delegatesSnapshot->text(std::move(data));
+                    }
+                }
+            };
+            wsDelegates.binary = [selfWeak](std::string&& data){
+                const auto self = selfWeak.lock();
+                if (self != nullptr) {
+                    const auto delegatesSnapshot = self->GetDelegates();
+                    if (delegatesSnapshot->binary != nullptr) {
+                        delegatesSnapshot->binary(std::move(data));
+                    }
+                }
+            };
+            const auto wsRaw = newWs.get();
+            wsDelegates.close = [selfWeak, wsRaw](
+                unsigned int code,
+                std::string&& reason
+            ){
+                const auto self = selfWeak.lock();
+                if (self != nullptr) {
+                    self->ConnectionClosed(wsRaw, code, std::move(reason));
+                }
+            };
+            newWs->SetDelegates(std::move(wsDelegates));
+            SendHeldMessages(newWs);
+        }
+
+        /**
+         * This method sends the messages held while not connected over
+         * the WebSocket just connected, including any held while doing so.
+         *
+         * @param[in] newWs
+         *     This is the WebSocket just connected.
+         */
+        void SendHeldMessages(std::shared_ptr< WebSocket > newWs) {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            while (
+                !heldMessages.empty()
+                && (ws == newWs)
+            ) {
+                auto message = std::move(heldMessages.front());
+                heldMessages.pop_front();
+                statistics.bufferedOctets -= message.data.length();
+                lock.unlock();
+                if (message.text) {
+                    newWs->SendText(message.data);
+                } else {
+                    newWs->SendBinary(message.data);
+                }
+                lock.lock();
+            }
+            if (ws == newWs) {
+                flushing = false;
+            }
+        }
+
+        /**
+         * This method is called whenever a WebSocket connected by the
+         * instance is closed.
+         *
+         * @param[in] closedWs
+         *     This identifies the WebSocket which was closed.
+         *
+         * @param[in] code
+         *     This is the status code from the received close frame.
+         *
+         * @param[in] reason
+         *     This is the payload data from the received close frame.
+         */
+        void ConnectionClosed(
+            WebSocket* closedWs,
+            unsigned int code,
+            std::string&& reason
+        ) {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            if (ws.get() != closedWs) {
+                return;
+            }
+            if (closed) {
+                ws = nullptr;
+                const auto delegatesSnapshot = delegates;
+                lock.unlock();
+                if (delegatesSnapshot->close != nullptr) {
+                    delegatesSnapshot->close(code, std::move(reason));
+                }
+                return;
+            }
+            ws = nullptr;
+            flushing = false;
+            lostTime = Clock::now();
+            ++statistics.connectionsLost;
+            wakeCondition.notify_all();
+        }
+
+        /**
+         * This method returns the functions provided by the user to call
+         * whenever interesting events occur.
+         *
+         * @return
+         *     The functions provided by the user to call whenever
+         *     interesting events occur are returned.
+         */
+        std::shared_ptr< const WebSocket::Delegates > GetDelegates() const {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            return delegates;
+        }
+
+        /**
+         * This method sends a complete message over the WebSocket,
+         * or holds it to send once connected.
+         *
+         * @param[in] text
+         *     This indicates whether the message is text or binary.
+         *
+         * @param[in] data
+         *     This is the data to include with the message.
+         *
+         * @return
+         *     An indication of whether or not the message was sent or held
+         *     is returned.
+         */
+        bool Send(
+            bool text,
+            const std::string& data
+        ) {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            if (closed) {
+                return false;
+            }
+            if (
+                (ws != nullptr)
+                && !flushing
+            ) {
+                const auto wsToUse = ws;
+                lock.unlock();
+                if (text) {
+                    wsToUse->SendText(data);
+                } else {
+                    wsToUse->SendBinary(data);
+                }
+                return true;
+            }
+            if (statistics.bufferedOctets + data.length() > configuration.maxBufferedOctets) {
+                ++statistics.messagesDropped;
+                return false;
+            }
+            HeldMessage message;
+            message.text = text;
+            message.data = data;
+            heldMessages.push_back(std::move(message));
+            statistics.bufferedOctets += data.length();
+            ++statistics.messagesBuffered;
+            return true;
+        }
+
+        /**
+         * This method stops connecting the WebSocket again and discards
+         * any messages being held.
+         *
+         * @param[out] alreadyClosed
+         *     This is where to store an indication of whether or not
+         *     the instance had already been shut down.
+         *
+         * @return
+         *     The WebSocket currently connected, if any, is returned.
+         */
+        std::shared_ptr< WebSocket > Shutdown(bool& alreadyClosed) {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            alreadyClosed = closed;
+            closed = true;
+            heldMessages.clear();
+            statistics.bufferedOctets = 0;
+            wakeCondition.notify_all();
+            const auto wsToClose = ws;
+            lock.unlock();
+            if (
+                worker.joinable()
+                && (worker.get_id() != std::this_thread::get_id())
+            ) {
+                worker.join();
+            }
+            return wsToClose;
+        }
+    };
+
+    ReconnectingWebSocket::~ReconnectingWebSocket() noexcept {
+        if (impl_ == nullptr) {
+            return;
+        }
+        bool alreadyClosed;
+        const auto ws = impl_->Shutdown(alreadyClosed);
+        if (impl_->worker.joinable()) {
+            impl_->worker.detach();
+        }
+        if (ws != nullptr) {
+            ws->Close(1001);
+        }
+    }
+    ReconnectingWebSocket::ReconnectingWebSocket(ReconnectingWebSocket&&) noexcept = default;
+    ReconnectingWebSocket& ReconnectingWebSocket::operator=(ReconnectingWebSocket&&) noexcept = default;
+
+    ReconnectingWebSocket::ReconnectingWebSocket()
+        : impl_(new Impl)
+    {
+        impl_->generator.seed(std::random_device()());
+    }
+
+    void ReconnectingWebSocket::SetDelegates(WebSocket::Delegates&& delegates) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        impl_->delegates = std::make_shared< const WebSocket::Delegates >(std::move(delegates));
+    }
+
+    void ReconnectingWebSocket::Start(
+        std::shared_ptr< Http::IClient > http,
+        const std::string& host,
+        uint16_t port,
+        std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender,
+        const Configuration& configuration
+    ) {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        if (impl_->started) {
+            return;
+        }
+        impl_->started = true;
+        impl_->http = http;
+        impl_->host = host;
+        impl_->port = port;
+        impl_->diagnosticsSender = diagnosticsSender;
+        impl_->configuration = configuration;
+        const auto impl = impl_;
+        impl_->worker = std::thread(
+            [impl]{
+                impl->Run();
+            }
+        );
+    }
+
+    void ReconnectingWebSocket::Close(
+        unsigned int code,
+        const std::string& reason
+    ) {
+        bool alreadyClosed;
+        const auto ws = impl_->Shutdown(alreadyClosed);
+        if (ws != nullptr) {
+            ws->Close(code, reason);
+        } else if (!alreadyClosed) {
+            const auto delegates = impl_->GetDelegates();
+            if (delegates->close != nullptr) {
+                delegates->close(code, std::string(reason));
+            }
+        }
+    }
+
+    bool ReconnectingWebSocket::IsConnected() const {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        return (impl_->ws != nullptr);
+    }
+
+    bool ReconnectingWebSocket::SendText(const std::string& data) {
+        return impl_->Send(true, data);
+    }
+
+    bool ReconnectingWebSocket::SendBinary(const std::string& data) {
+        return impl_->Send(false, data);
+    }
+
+    auto ReconnectingWebSocket::GetStatistics() const -> Statistics {
+        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
+        return impl_->statistics;
+    }
+
+}
@@ -0,0 +1,530 @@
+/**
+ * @file ShardedServer.cpp
+ *
+ * This module contains the implementation of the
+ * WebSockets::ShardedServer class.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <Http/Connection.hpp>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include <WebSockets/ShardedServer.hpp>
+#include <WebSockets/WebSocket.hpp>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#include <Windows.h>
+#endif
+
+namespace {
+
+    /**
+     * This is one piece of work waiting in the mailbox of a shard.
+     */
+    struct WorkNode {
+        /**
+         * This is the piece of work handed to the shard before this one,
+         * if any.
+         */
+        WorkNode* next = nullptr;
+
+        /**
+         * This is the work to do.
+         */
+        std::function< void() > work;
+    };
+
+    /**
+     * This represents one shard of a sharded server: a thread which does
+     * the work handed to it, in order, through its mailbox.
+     */
+    struct Shard {
+        // Properties
+
+        /**
+         * This is the index of the shard in the server.
+         */
+        size_t index = 0;
+
+        /**
+         * This is the most recently added piece of work in the mailbox
+         * of the shard.  Work is added without locking, and each piece
+         * links to the one added before it, so the mailbox is taken
+         * in reverse order.
+         */
+        std::atomic< WorkNode* > mailbox{nullptr};
+
+        /**
+         * This indicates whether or not the thread of the shard is waiting
+         * for work, in which case it needs to be woken up when work
+         * is added to the mailbox.
+         */
+        std::atomic< bool > sleeping{false};
+
+        /**
+         * This indicates whether or not the thread of the shard
+         * should stop.
+         */
+        std::atomic< bool > stop{false};
+
+        /**
+         * This is used along with the wake condition to put the thread
+         * of the shard to sleep while there's no work for it.
+         */
+        std::mutex wakeMutex;
+
+        /**
+         * This is used to wake up the thread of the shard when it's given
+         * work or told to stop.
+         */
+        std::condition_variable wakeCondition;
+
+        /**
+         * This is the number of WebSockets assigned to the shard.
+         */
+        std::atomic< size_t > webSocketsOpened{0};
+
+        /**
+         * This is the number of pieces of work done by the shard.
+         */
+        std::atomic< size_t > workDone{0};
+
+        /**
+         * This is the thread of the shard.
+         */
+        std::thread thread;
+
+        // Methods
+
+        /**
+         * This is the destructor for the structure.
+         */
+        ~Shard() noexcept {
+            DiscardMailbox();
+        }
+
+        /**
+         * This method takes all the work out of the mailbox of the shard
+         * and throws it away without doing it.  Work often holds onto
+         * WebSockets which in turn hold onto the shard, so this is what
+         * lets them all go once the shard is stopped.
+         */
+        void DiscardMailbox() {
+            auto node = mailbox.exchange(nullptr, std::memory_order_acquire);
+            while (node != nullptr) {
+                const auto next = node->next;
+                delete node;
+                node = next;
+            }
+        }
+
+        /**
+         * This method adds the given work to the mailbox of the shard,
+         * waking up the thread of the shard if it's waiting for work.
+         * Work added once the shard is stopped is discarded.
+         *
+         * @param[in] work
+         *     This is the work to add to the mailbox.
+         */
+        void Post(std::function< void() >&& work) {
+            if (stop) {
+                return;
+            }
+            const auto node = new WorkNode();
+            node->work = std::move(work);
+            node->next = mailbox.load(std::memory_order_relaxed);
+            while (!mailbox.compare_exchange_weak(node->next, node)) {
+            }
+            if (stop) {
+                DiscardMailbox();
+                return;
+            }
+            if (sleeping) {
+                std::lock_guard< decltype(wakeMutex) > lock(wakeMutex);
+                wakeCondition.notify_one();
+            }
+        }
+
+        /**
+         * This method tells the thread of the shard to stop, waits
+         * for it to do so, and then discards any work left in the
+         * mailbox of the shard.
+         */
+        void Stop() {
+            {
+                std::lock_guard< decltype(wakeMutex) > lock(wakeMutex);
+                stop = true;
+                wakeCondition.notify_one();
+            }
+            if (thread.joinable()) {
+                thread.join();
+            }
+            DiscardMailbox();
+        }
+
+        /**
+         * This method is the body of the thread of the shard.
+         */
+        void Run();
+    };
+
+    /**
+     * This is the shard whose thread is the current thread, if any.
+     */
+    thread_local Shard* currentShard = nullptr;
+
+    void Shard::Run() {
+        currentShard = this;
+        while (!stop) {
+            auto nodes = mailbox.exchange(nullptr, std::memory_order_acquire);
+            if (nodes == nullptr) {
+                std::unique_lock< decltype(wakeMutex) > lock(wakeMutex);
+                sleeping = true;
+                wakeCondition.wait(
+                    lock,
+                    [this]{
+                        return stop || (mailbox.load() != nullptr);
+                    }
+                );
+                sleeping = false;
+                continue;
+            }
+            WorkNode* orderedNodes = nullptr;
+            while (nodes != nullptr) {
+                const auto next = nodes->next;
+                nodes->next = orderedNodes;
+                orderedNodes = nodes;
+                nodes = next;
+            }
+            while (orderedNodes != nullptr) {
+                std::unique_ptr< WorkNode > node(orderedNodes);
+                orderedNodes = node->next;
+                if (!stop) {
+                    node->work();
+                    ++workDone;
+                }
+            }
+        }
+        currentShard = nullptr;
+    }
+
+    /**
+     * This function binds the given thread to the given processor core,
+     * where the platform supports it.
+     *
+     * @param[in] thread
+     *     This is the thread to bind.
+     *
+     * @param[in] core
+     *     This is the index of the processor core to which to bind
+     *     the thread.
+     */
+    void PinThread(
+        std::thread& thread,
+        size_t core
+    ) {
+#if defined(__linux__)
+        cpu_set_t cores;
+        CPU_ZERO(&cores);
+        CPU_SET(core % CPU_SETSIZE, &cores);
+        (void)pthread_setaffinity_np(thread.native_handle(), sizeof(cores), &cores);
+#elif defined(_WIN32)
+        (void)SetThreadAffinityMask(
+            thread.native_handle(),
+            (DWORD_PTR)1 << (core % (sizeof(DWORD_PTR) * 8))
+        );
+#else
+        (void)thread;
+        (void)core;
+#endif
+    }
+
+    /**
+     * This is a connection which hands the data received over another
+     * connection to a shard, so that the WebSocket using it processes
+     * the data on that shard.  Data sent is passed straight through.
+     */
+    struct ShardConnection
+        : public Http::Connection
+        , public std::enable_shared_from_this< ShardConnection >
+    {
+        // Properties
+
+        /**
+         * This is the connection which actually carries the data.
+         */
+        std::shared_ptr< Http::Connection > transport;
+
+        /**
+         * This is the shard which processes the data received.
+         */
+        std::shared_ptr< Shard > shard;
+
+        /**
+         * This is the delegate to call, on the shard, whenever data
+         * is received.
+         */
+        DataReceivedDelegate dataReceivedDelegate;
+
+        /**
+         * This is the delegate to call, on the shard, when the
+         * connection is broken.
+         */
+        BrokenDelegate brokenDelegate;
+
+        // Methods
+
+        /**
+         * This is the constructor for the structure.
+         *
+         * @param[in] transport
+         *     This is the connection which actually carries the data.
+         *
+         * @param[in] shard
+         *     This is the shard which processes the data received.
+         */
+        ShardConnection(
+            std::shared_ptr< Http::Connection > transport,
+            std::shared_ptr< Shard > shard
+        )
+            : transport(transport)
+            , shard(shard)
+        {
+        }
+
+        // Http::Connection
+
+        virtual std::string GetPeerAddress() override {
+            return transport->GetPeerAddress();
+        }
+
+        virtual std::string GetPeerId() override {
+            return transport->GetPeerId();
+        }
+
+        virtual void SetDataReceivedDelegate(DataReceivedDelegate newDataReceivedDelegate) override {
+            dataReceivedDelegate = newDataReceivedDelegate;
+            std::weak_ptr< ShardConnection > selfWeak(shared_from_this());
+            const auto shardCopy = shard;
+            transport->SetDataReceivedDelegate(
+                [selfWeak, shardCopy](const std::vector< uint8_t >& data){
+                    const auto self = selfWeak.lock();
+                    if (self == nullptr) {
+                        return;
+                    }
+                    shardCopy->Post(
+                        [self, data]{
+                            if (self->dataReceivedDelegate != nullptr) {
+                                self->dataReceivedDelegate(data);
+                            }
+                        }
+                    );
+                }
+            );
+        }
+
+        virtual void SetBrokenDelegate(BrokenDelegate newBrokenDelegate) override {
+            brokenDelegate = newBrokenDelegate;
+            std::weak_ptr< ShardConnection > selfWeak(shared_from_this());
+            const auto shardCopy = shard;
+            transport->SetBrokenDelegate(
+                [selfWeak, shardCopy](bool graceful){
+                    const auto self = selfWeak.lock();
+                    if (self == nullptr) {
+                        return;
+                    }
+                    shardCopy->Post(
+                        [self, graceful]{
+                            if (self->brokenDelegate != nullptr) {
+                                self->brokenDelegate(graceful);
+                            }
+                        }
+                    );
+                }
+            );
+        }
+
+        virtual void SendData(const std::vector< uint8_t >& data) override {
+            transport->SendData(data);
+        }
+
+        virtual void Break(bool clean) override {
+            transport->Break(clean);
+        }
+    };
+
+}
+
+namespace WebSockets {
+
+    constexpr size_t ShardedServer::NOT_A_SHARD;
+
+    /**
+     * This contains the private properties of a ShardedServer instance.
+     */
+    struct ShardedServer::Impl {
+        // Properties
+
+        /**
+         * These are the configurable parameters in use by the server.
+         */
+        Configuration configuration;
+
+        /**
+         * These are the shards of the server, while it's started.
+         */
+        std::vector< std::shared_ptr< Shard > > shards;
+
+        /**
+         * This is used to take turns among shards in assigning them
+         * WebSockets.
+         */
+        std::atomic< size_t > nextShard{0};
+
+        // Methods
+
+        /**
+         * This method stops the threads of the shards of the server,
+         * and lets go of the shards.
+         */
+        void Stop() {
+            for (const auto& shard: shards) {
+                shard->Stop();
+            }
+            shards.clear();
+        }
+    };
+
+    ShardedServer::~ShardedServer() noexcept {
+        if (impl_ != nullptr) {
+            impl_->Stop();
+        }
+    }
+    ShardedServer::ShardedServer(ShardedServer&&) noexcept = default;
+    ShardedServer& ShardedServer::operator=(ShardedServer&&) noexcept = default;
+
+    ShardedServer::ShardedServer()
+        : impl_(new Impl)
+    {
+    }
+
+    void ShardedServer::Start(const Configuration& configuration) {
+        if (!impl_->shards.empty()) {
+            return;
+        }
+        impl_->configuration = configuration;
+        const size_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+        const size_t numShards = (
+            (configuration.shards == 0)
+            ? cores
+            : configuration.shards
+        );
+        for (size_t i = 0; i < numShards; ++i) {
+            const auto shard = std::make_shared< Shard >();
+            shard->index = i;
+            const auto shardRaw = shard.get();
+            shard->thread = std::thread(
+                [shardRaw]{
+                    shardRaw->Run();
+                }
+            );
+            if (configuration.pinShards) {
+                PinThread(shard->thread, i % cores);
+            }
+            impl_->shards.push_back(shard);
+        }
+    }
+
+    void ShardedServer::Stop() {
+        impl_->Stop();
+    }
+
+    size_t ShardedServer::GetShardCount() const {
+        return impl_->shards.size();
+    }
+
+    size_t ShardedServer::GetCurrentShard() const {
+        for (const auto& shard: impl_->shards) {
+            if (shard.get() == currentShard) {
+                return shard->index;
+            }
+        }
+        return NOT_A_SHARD;
+    }
+
+    void ShardedServer::Post(
+        size_t shard,
+        std::function< void() >&& work
+    ) {
+        if (shard >= impl_->shards.size()) {
+            return;
+        }
+        impl_->shards[shard]->Post(std::move(work));
+    }
+
+    auto ShardedServer::GetStatistics() const -> Statistics {
+        Statistics statistics;
+        for (const auto& shard: impl_->shards) {
+            statistics.webSocketsOpened.push_back(shard->webSocketsOpened);
+            statistics.workDone.push_back(shard->workDone);
+        }
+        return statistics;
+    }
+
+    bool ShardedServer::OpenAsServer(
+        std::shared_ptr< Http::Connection > connection,
+        const Http::Request& request,
+        Http::Response& response,
+        const std::string& trailer,
+        OpenDelegate openDelegate
+    ) {
+        if (impl_->shards.empty()) {
+            return false;
+        }
+        const auto shardIndex = impl_->nextShard++ % impl_->shards.size();
+        const auto shard = impl_->shards[shardIndex];
+        auto webSocketConfiguration = impl_->configuration.webSocketConfiguration;
+        webSocketConfiguration.executor = [shard](std::function< void() >&& work){
+            if (currentShard == shard.get()) {
+                work();
+            } else {
+                shard->Post(std::move(work));
+            }
+        };
+        const auto ws = std::make_shared< WebSocket >();
+        ws->Configure(webSocketConfiguration);
+        if (
+            !ws->OpenAsServer(
+                std::make_shared< ShardConnection >(connection, shard),
+                request,
+                response,
+                trailer
+            )
+        ) {
+            return false;
+        }
+        ++shard->webSocketsOpened;
+        shard->Post(
+            [ws, shardIndex, openDelegate]{
+                if (openDelegate != nullptr) {
+                    openDelegate(ws, shardIndex);
+                }
+            }
+        );
+        return true;
+    }
+
+}
@@ -6,12 +6,19 @@
  * © 2018 by Richard Walters
  */
 
+#include "ExtensionElement.hpp"
+#include "HandshakeKey.hpp"
+#include "MessageSize.hpp"
+#include "PerMessageDeflate.hpp"
+
+#include <algorithm>
+#include <atomic>
 #include <Base64/Base64.hpp>
+#include <chrono>
 #include <functional>
 #include <mutex>
-#include <Hash/Sha1.hpp>
-#include <Hash/Templates.hpp>
-#include <queue>
+#include <map>
+#include <memory>
 #include <stdint.h>
 #include <SystemAbstractions/CryptoRandom.hpp>
 #include <SystemAbstractions/DiagnosticsSender.hpp>
@@ -28,24 +35,23 @@ namespace {
     const std::string CURRENTLY_SUPPORTED_WEBSOCKET_VERSION = "13";
 
     /**
-     * This is the required length of the Base64 decoding of the
-     * "Sec-WebSocket-Key" header in HTTP requests that initiate a WebSocket
-     * opening handshake.
+     * This is the bit to set in the first octet of a WebSocket frame
+     * to indicate that the frame is the final one in a message.
      */
-    constexpr size_t REQUIRED_WEBSOCKET_KEY_LENGTH = 16;
+    constexpr uint8_t FIN = 0x80;
 
     /**
-     * This is the string added to the "Sec-WebSocket-Key" before computing
-     * the SHA-1 hash and Base64 encoding the result to form the
-     * corresponding "Sec-WebSocket-Accept" value.
+     * This is the first of the reserved bits in the first octet of
+     * a WebSocket frame.  The "permessage-deflate" extension sets it
+     * in the first frame of each compressed message.
      */
-    const std::string WEBSOCKET_KEY_SALT = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    constexpr uint8_t RSV1 = 0x40;
 
     /**
-     * This is the bit to set in the first octet of a WebSocket frame
-     * to indicate that the frame is the final one in a message.
+     * This is the mask of all the reserved bits in the first octet of
+     * a WebSocket frame.
      */
-    constexpr uint8_t FIN = 0x80;
+    constexpr uint8_t RESERVED_BITS = 0x70;
 
     /**
      * This is the bit to set in the second octet of a WebSocket frame
@@ -89,6 +95,64 @@ namespace {
      */
     constexpr size_t MAX_CONTROL_FRAME_DATA_LENGTH = 125;
 
+    /**
+     * This is the size of a masking key, in octets.
+     */
+    constexpr size_t MASKING_KEY_LENGTH = 4;
+
+    /**
+     * This is the number of masking keys generated at once whenever
+     * the pool of masking keys held by a client-role WebSocket runs dry.
+     * Generating keys in bulk amortizes the cost of calling into the
+     * cryptographic random number generator over many frames.
+     */
+    constexpr size_t MASKING_KEYS_PER_REFILL = 64;
+
+    /**
+     * This is the weight given to the compression ratio of each message
+     * in the running average of the compression ratio of recent messages.
+     */
+    constexpr double COMPRESSION_RATIO_AVERAGING_WEIGHT = 0.125;
+
+    /**
+     * This is how often, in messages, a WebSocket compresses a message
+     * anyway while recent messages haven't compressed well enough,
+     * in order to find out whether messages have become more compressible.
+     */
+    constexpr size_t COMPRESSION_PROBE_INTERVAL = 16;
+
+    /**
+     * This is the most data, in octets, which a WebSocket gathers from
+     * its queue of outbound frames into one batch before handing the
+     * batch to its connection.
+     */
+    constexpr size_t OUTBOUND_BATCH_LIMIT = 65536;
+
+    /**
+     * This marks the data of pings sent to measure round-trip times,
+     * which is followed by a 4-octet sequence number and the 8-octet
+     * time the ping was sent, both in network byte order.
+     */
+    constexpr char ROUND_TRIP_PING_PREFIX[] = "RTT1";
+
+    /**
+     * This is the length of the data of pings sent to measure
+     * round-trip times.
+     */
+    constexpr size_t ROUND_TRIP_PING_LENGTH = sizeof(ROUND_TRIP_PING_PREFIX) - 1 + 4 + 8;
+
+    /**
+     * This is the number of pings sent to measure round-trip times
+     * which a WebSocket keeps track of at once, waiting for pongs.
+     */
+    constexpr size_t ROUND_TRIP_PINGS_TRACKED = 8;
+
+    /**
+     * This is the weight given to each round-trip time measured in the
+     * exponentially weighted moving average of round-trip times.
+     */
+    constexpr double ROUND_TRIP_TIME_AVERAGING_WEIGHT = 0.125;
+
     /**
      * This is used to track what kind of message is being
      * sent or received in fragments.
@@ -163,21 +227,152 @@ namespace {
     };
 
     /**
-     * This function computes the value of the "Sec-WebSocket-Accept"
-     * HTTP response header that matches the given value of the
-     * "Sec-WebSocket-Key" HTTP request header.
-     *
-     * @param[in] key
-     *     This is the key value for which to compute the matching answer.
-     *
-     * @return
-     *     The answer computed from the given key is returned.
+     * This represents something to be done with a WebSocket's connection
+     * by whichever thread next holds the WebSocket's send lock.
      */
-    std::string ComputeKeyAnswer(const std::string& key) {
-        return Base64::Encode(
-            Hash::StringToBytes< Hash::Sha1 >(key + WEBSOCKET_KEY_SALT)
-        );
-    }
+    struct ControlAction {
+        /**
+         * This indicates what to do with the connection.
+         */
+        enum class Type {
+            /**
+             * This indicates a control frame is to be sent.
+             */
+            Frame,
+
+            /**
+             * This indicates the connection is to be broken.
+             */
+            Break,
+        } type = Type::Frame;
+
+        /**
+         * If a control frame is to be sent, this is its opcode.
+         */
+        uint8_t opcode = 0;
+
+        /**
+         * If a control frame is to be sent, this is its payload.
+         */
+        std::string payload;
+
+        /**
+         * If the connection is to be broken, this indicates whether
+         * or not to break it cleanly.
+         */
+        bool clean = false;
+    };
+
+    /**
+     * This is one entry in a WebSocket's queue of data waiting to be
+     * handed to its connection.
+     */
+    struct OutboundNode {
+        /**
+         * This is the entry queued before this one, if any.
+         */
+        OutboundNode* next = nullptr;
+
+        /**
+         * This is the encoded frame to send.
+         */
+        std::vector< uint8_t > frame;
+
+        /**
+         * This indicates whether or not the connection is to be broken,
+         * instead of a frame sent.
+         */
+        bool breakConnection = false;
+
+        /**
+         * If the connection is to be broken, this indicates whether
+         * or not to break it cleanly.
+         */
+        bool clean = false;
+
+        /**
+         * If set, this entry marks the end of a message, or fragment
+         * thereof, and this is the function to call once everything
+         * queued before it has been handed to the connection.
+         */
+        WebSockets::WebSocket::SentDelegate sentDelegate;
+    };
+
+    /**
+     * This holds what a WebSocket keeps track of for a ping it sent
+     * to measure the round-trip time.
+     */
+    struct RoundTripPing {
+        /**
+         * This is the sequence number of the ping.
+         */
+        uint32_t sequence = 0;
+
+        /**
+         * This is when the ping was sent, in ticks of the steady clock,
+         * or zero if it's been answered.
+         */
+        std::chrono::steady_clock::rep sentTime = 0;
+    };
+
+    /**
+     * This holds a message, or fragment thereof, sent over a WebSocket
+     * while it's still in the OPENING state, to send once it's opened.
+     */
+    struct EarlySend {
+        /**
+         * This is the type of message to send.
+         */
+        FragmentedMessageType type = FragmentedMessageType::None;
+
+        /**
+         * This is the data to include with the message.
+         */
+        std::string data;
+
+        /**
+         * This indicates whether or not this is the last
+         * frame in its message.
+         */
+        bool lastFragment = true;
+
+        /**
+         * This is the choice the user made about compressing
+         * the message.
+         */
+        WebSockets::WebSocket::Compression compression = WebSockets::WebSocket::Compression::Auto;
+
+        /**
+         * If not nullptr, this is the function to call once the message
+         * has been handed to the connection, or could not be.
+         */
+        WebSockets::WebSocket::SentDelegate sentDelegate;
+    };
+
+    /**
+     * This holds what can be shared among the recipients of a message
+     * broadcast over several WebSockets.
+     */
+    struct BroadcastMessage {
+        /**
+         * This indicates whether or not the message has been compressed
+         * into the payload below.
+         */
+        bool compressed = false;
+
+        /**
+         * If the message has been compressed, this is the compressed
+         * payload to send.
+         */
+        std::string compressedPayload;
+
+        /**
+         * This is the frame to send to recipients in the server role,
+         * once it has been encoded.  Server frames are not masked, so
+         * the same frame can be sent to all of them.
+         */
+        std::vector< uint8_t > serverFrame;
+    };
 
 }
 
@@ -186,7 +381,9 @@ namespace WebSockets {
     /**
      * This contains the private properties of a WebSocket instance.
      */
-    struct WebSocket::Impl {
+    struct WebSocket::Impl
+        : public std::enable_shared_from_this< Impl >
+    {
         // Properties
 
         /**
@@ -202,16 +399,154 @@ namespace WebSockets {
         SystemAbstractions::DiagnosticsSender diagnosticsSender;
 
         /**
-         * This is used to synchronize access to the WebSocket.
+         * This is used to synchronize encoding frames to send, and access
+         * to the state involved.  It's held while frames are encoded and
+         * added to the outbound queue, so that they're queued in order,
+         * but never while frames are handed to the connection, nor while
+         * receiving frames.  It's taken through a SendLock, except where
+         * it's taken together with other locks, so that control actions
+         * queued while it's held aren't left behind once it's released.
          */
-        std::recursive_mutex mutex;
+        std::mutex sendMutex;
+
+        /**
+         * This is the most recently added entry in the queue of data
+         * waiting to be handed to the connection.  Entries are added
+         * without locking, and each entry links to the one added before
+         * it, so the queue is taken in reverse order.
+         */
+        std::atomic< OutboundNode* > outboundHead{nullptr};
+
+        /**
+         * This is the number of requests to drain the outbound queue
+         * which haven't yet been satisfied.  The thread whose request
+         * finds no others outstanding becomes the only thread draining
+         * the queue, until all requests are satisfied.
+         */
+        std::atomic< size_t > outboundDrainRequests{0};
+
+        /**
+         * This indicates whether or not the connection has been broken
+         * by the thread draining the outbound queue, after which nothing
+         * else is handed to the connection.
+         */
+        bool outboundBroken = false;
+
+        /**
+         * This is used to synchronize receiving frames, and access to the
+         * state involved in reassembling and decoding them.  It's never
+         * held while frames are sent, so that receiving doesn't have to
+         * wait for sending.
+         */
+        std::mutex receiveMutex;
+
+        /**
+         * This is used to synchronize access to the event queue,
+         * the delegates, and the executor used to call them.
+         */
+        std::mutex eventMutex;
 
         /**
          * This is the queue of events waiting to be reported through
          * delegates.  They sit here until a delegate is registered and the
-         * WebSocket's mutex is not being held (to prevent deadlocks).
+         * WebSocket's locks are not being held (to prevent deadlocks).
+         */
+        std::vector< Event > eventQueue;
+
+        /**
+         * This holds the events taken from the event queue by the thread
+         * reporting them, which is the only thread using it.  It trades
+         * places with the event queue each time events are taken, so that
+         * both keep their capacity, and reporting events in steady state
+         * doesn't allocate memory.
+         */
+        std::vector< Event > eventsBeingDispatched;
+
+        /**
+         * This holds information about the events in the event queue.
+         */
+        EventBufferStatistics eventBufferStatistics;
+
+        /**
+         * This is when the first frame was handed to the connection,
+         * in ticks of the steady clock, or zero if none has been yet.
+         */
+        std::atomic< std::chrono::steady_clock::rep > firstFrameSentTime{0};
+
+        /**
+         * This is when the first frame was received, in ticks of the
+         * steady clock, or zero if none has been yet.
+         */
+        std::atomic< std::chrono::steady_clock::rep > firstFrameReceivedTime{0};
+
+        /**
+         * This is when the most recent frame was received, in ticks of
+         * the steady clock, or zero if none has been yet.
+         */
+        std::atomic< std::chrono::steady_clock::rep > lastFrameReceivedTime{0};
+
+        /**
+         * This is when a close frame was queued to be sent, in ticks of
+         * the steady clock, or zero if none has been yet.
+         */
+        std::atomic< std::chrono::steady_clock::rep > closeSentTime{0};
+
+        /**
+         * This is when the WebSocket was closed, in ticks of the
+         * steady clock, or zero if it hasn't been yet.
+         */
+        std::atomic< std::chrono::steady_clock::rep > closedTime{0};
+
+        /**
+         * This is used to synchronize access to the state involved
+         * in measuring round-trip times.
+         */
+        std::mutex roundTripMutex;
+
+        /**
+         * This is the sequence number of the most recent ping sent
+         * to measure the round-trip time.
+         */
+        uint32_t lastRoundTripPingSequence = 0;
+
+        /**
+         * These are the most recent pings sent to measure the round-trip
+         * time, each kept at the index given by its sequence number
+         * modulo the number of pings tracked.
+         */
+        RoundTripPing roundTripPings[ROUND_TRIP_PINGS_TRACKED];
+
+        /**
+         * These are the round-trip times measured.
          */
-        std::queue< Event > eventQueue;
+        RoundTripTimes roundTripTimes;
+
+        /**
+         * This is used to synchronize access to the queue of
+         * control actions.
+         */
+        std::mutex controlActionsMutex;
+
+        /**
+         * These are control frames to send, and breaking of the connection
+         * to carry out, which were requested without holding the send lock,
+         * such as pongs and close frames sent in reaction to frames
+         * received.  They're carried out in order by whichever thread next
+         * holds the send lock.
+         */
+        std::vector< ControlAction > controlActions;
+
+        /**
+         * This indicates whether or not there are any control actions
+         * waiting to be carried out.
+         */
+        std::atomic< bool > controlActionsQueued{false};
+
+        /**
+         * This indicates whether or not breaking the connection has
+         * been requested.
+         */
+        std::atomic< bool > breakRequested{false};
 
         /**
          * This is the connection to use to send and receive frames.
@@ -230,19 +565,25 @@ namespace WebSockets {
          */
         std::string key;
 
+        /**
+         * This is the subprotocol selected in the opening handshake,
+         * if any.
+         */
+        std::string subprotocol;
+
         /**
          * This flag indicates whether or not the WebSocket has sent
          * a close frame, and is waiting for a one to be received
          * back before closing the WebSocket.
          */
-        bool closeSent = false;
+        std::atomic< bool > closeSent{false};
 
         /**
          * This flag indicates whether or not the WebSocket has received
          * a close frame, and is waiting for the user to finish up
          * and signal a close, in order to close the WebSocket.
          */
-        bool closeReceived = false;
+        std::atomic< bool > closeReceived{false};
 
         /**
          * This indicates what type of message the WebSocket is in the midst
@@ -250,24 +591,137 @@ namespace WebSockets {
          */
         FragmentedMessageType sending = FragmentedMessageType::None;
 
+        /**
+         * This flag indicates whether or not the WebSocket is in the
+         * OPENING state in the client role, holding any messages sent
+         * until the opening handshake is finished.
+         */
+        bool opening = false;
+
+        /**
+         * These are the messages, or fragments thereof, sent while the
+         * WebSocket is in the OPENING state, in the order sent.
+         */
+        std::vector< EarlySend > earlySends;
+
         /**
          * This indicates what type of message the WebSocket is in the midst
          * of receiving, if any.
          */
         FragmentedMessageType receiving = FragmentedMessageType::None;
 
+        /**
+         * These are the reserved bits set in the first frame of the
+         * message the WebSocket is in the midst of receiving.
+         */
+        uint8_t receivingReservedBits = 0;
+
+        /**
+         * These are the extensions which the WebSocket offered
+         * in the opening handshake, when opening as a client.
+         */
+        std::vector< std::shared_ptr< Extension > > offeredExtensions;
+
+        /**
+         * These are the extensions negotiated in the opening handshake,
+         * in the order in which they encode messages sent.
+         */
+        std::vector< std::shared_ptr< Extension > > extensions;
+
+        /**
+         * These are the reserved bits claimed by the extensions
+         * negotiated in the opening handshake.
+         */
+        uint8_t extensionReservedBits = 0;
+
+        /**
+         * If the "permessage-deflate" extension was negotiated in the
+         * opening handshake, this is the extension, which is also
+         * one of the negotiated extensions.
+         */
+        std::shared_ptr< PerMessageDeflate > perMessageDeflate;
+
+        /**
+         * This indicates whether or not the message the WebSocket is
+         * in the midst of sending is being compressed.
+         */
+        bool sendingCompressed = false;
+
+        /**
+         * This is the size of the message the WebSocket is in the midst
+         * of sending compressed, so far, before compression.
+         */
+        size_t sendingOctetsBeforeCompression = 0;
+
+        /**
+         * This is the size of the message the WebSocket is in the midst
+         * of sending compressed, so far, after compression.
+         */
+        size_t sendingOctetsAfterCompression = 0;
+
+        /**
+         * This is the number of messages the WebSocket has decided not
+         * to compress, since it last compressed one, because recent
+         * messages didn't compress well enough.
+         */
+        size_t messagesSkippedSinceCompressionProbe = 0;
+
+        /**
+         * This is the number of messages the WebSocket has compressed.
+         * This and the other compression statistics below are only
+         * changed while holding the send lock, but they're atomic so
+         * that they can be read without it.
+         */
+        std::atomic< size_t > messagesCompressed{0};
+
+        /**
+         * This is the number of messages the WebSocket has decided
+         * not to compress.
+         */
+        std::atomic< size_t > messagesNotCompressed{0};
+
+        /**
+         * This is the total size of the messages the WebSocket has
+         * compressed, before compression.
+         */
+        std::atomic< uint64_t > octetsBeforeCompression{0};
+
+        /**
+         * This is the total size of the messages the WebSocket has
+         * compressed, after compression.
+         */
+        std::atomic< uint64_t > octetsAfterCompression{0};
+
+        /**
+         * This is the total time the WebSocket has spent compressing
+         * messages, in nanoseconds.
+         */
+        std::atomic< std::chrono::nanoseconds::rep > compressionTime{0};
+
+        /**
+         * This is the compression ratio of the messages the WebSocket
+         * has compressed, averaged over recent messages.
+         */
+        std::atomic< double > recentCompressionRatio{0.0};
+
         /**
          * This holds the functions to call whenever anything interesting
-         * happens.
+         * happens.  The functions are never modified once set; setting new
+         * delegates replaces the whole set, so that threads reporting
+         * events can share the set they took without copying it.
+         *
+         * Until this is set, the event queue is not emptied, so that
+         * any events will not be lost.
          */
-        Delegates delegates;
+        std::shared_ptr< const Delegates > delegates;
 
         /**
-         * This indicates whether or not delegates have been set for the
-         * WebSocket.  Until this is true, the event queue is not emptied, so
-         * that any events will not be lost.
+         * This indicates whether or not events from the event queue are
+         * being reported through delegates, or are about to be, by the
+         * configured executor.  Only one thread at a time reports events,
+         * so that they're reported in order.
          */
-        bool delegatesSet = false;
+        bool dispatchingEvents = false;
 
         /**
          * This is where we put data received before it's been
@@ -286,6 +740,20 @@ namespace WebSockets {
          */
         SystemAbstractions::CryptoRandom rng;
 
+        /**
+         * This holds masking keys generated in bulk by the random number
+         * generator, but not yet used.  It's only allocated once the
+         * WebSocket sends its first masked frame.
+         */
+        std::vector< uint8_t > maskingKeyPool;
+
+        /**
+         * This is the offset in the masking key pool of the next masking
+         * key to use.  When it reaches the end of the pool, the pool
+         * is refilled.
+         */
+        size_t maskingKeyPoolOffset = 0;
+
         // Methods
 
         /**
@@ -297,83 +765,503 @@ namespace WebSockets {
         }
 
         /**
-         * This method safely processes the event queue.  For each event,
-         * if a corresponding delegate is registered, the delegate is
-         * called and the event is removed from the queue.
+         * This is the destructor for the structure.
          */
-        void ProcessEventQueue() {
-            std::unique_lock< decltype(mutex) > lock(mutex);
-            if (!delegatesSet) {
-                return;
+        ~Impl() noexcept {
+            auto node = outboundHead.exchange(nullptr);
+            while (node != nullptr) {
+                const auto next = node->next;
+                if (node->sentDelegate != nullptr) {
+                    node->sentDelegate(false);
+                }
+                delete node;
+                node = next;
             }
-            auto delegatesCopy = delegates;
-            std::queue< Event > offloadedEvents;
-            offloadedEvents.swap(eventQueue);
-            lock.unlock();
-            while (!offloadedEvents.empty()) {
-                auto& event = offloadedEvents.front();
-                switch (event.type) {
-                    case Event::Type::Text: {
-                        if (delegatesCopy.text != nullptr) {
-                            delegatesCopy.text(std::move(event.content));
-                        }
-                    } break;
-
-                    case Event::Type::Binary: {
-                        if (delegatesCopy.binary != nullptr) {
-                            delegatesCopy.binary(std::move(event.content));
-                        }
-                    } break;
-
-                    case Event::Type::Ping: {
-                        if (delegatesCopy.ping != nullptr) {
-                            delegatesCopy.ping(std::move(event.content));
-                        }
-                    } break;
-
-                    case Event::Type::Pong: {
-                        if (delegatesCopy.pong != nullptr) {
-                            delegatesCopy.pong(std::move(event.content));
-                        }
-                    } break;
-
-                    case Event::Type::Close: {
-                        if (delegatesCopy.close != nullptr) {
-                            delegatesCopy.close(
-                                event.closeCode,
-                                std::move(event.content)
-                            );
-                        }
-                    } break;
-
-                    default: break;
+            for (auto& earlySend: earlySends) {
+                if (earlySend.sentDelegate != nullptr) {
+                    earlySend.sentDelegate(false);
                 }
-                offloadedEvents.pop();
             }
         }
 
         /**
-         * This method responds to the WebSocket being closed.
-         *
-         * @param[in] code
-         *     This is the status code of the closure.
-         *
-         * @param[in] reason
-         *     This is the reason text of the closure.
+         * This method arranges for the events in the event queue to be
+         * reported through delegates, unless delegates haven't been set
+         * yet, or events are already being reported.  Events are reported
+         * by the configured executor, if any, or else by the calling thread.
+         * The instance is kept alive while events are reported, in case
+         * a delegate lets go of the last reference to the WebSocket.
          */
-        void OnClose(
+        void ProcessEventQueue() {
+            std::unique_lock< decltype(eventMutex) > lock(eventMutex);
+            if (
+                (delegates == nullptr)
+                || dispatchingEvents
+                || eventQueue.empty()
+            ) {
+                return;
+            }
+            dispatchingEvents = true;
+            const auto executor = configuration.executor;
+            lock.unlock();
+            const auto self = shared_from_this();
+            if (executor == nullptr) {
+                self->DispatchEvents();
+            } else {
+                executor(
+                    [self]{
+                        self->DispatchEvents();
+                    }
+                );
+            }
+        }
+
+        /**
+         * This method reports events from the event queue through
+         * delegates until the queue is empty.  For each event,
+         * if a corresponding delegate is registered, the delegate is
+         * called and the event is removed from the queue.
+         */
+        void DispatchEvents() {
+            std::unique_lock< decltype(eventMutex) > lock(eventMutex);
+            while (!eventQueue.empty()) {
+                const auto delegatesSnapshot = delegates;
+                eventsBeingDispatched.swap(eventQueue);
+                eventBufferStatistics.eventsBuffered = 0;
+                eventBufferStatistics.octetsBuffered = 0;
+                lock.unlock();
+                for (auto& event: eventsBeingDispatched) {
+                    switch (event.type) {
+                        case Event::Type::Text: {
+                            if (delegatesSnapshot->text != nullptr) {
+                                delegatesSnapshot->text(std::move(event.content));
+                            }
+                        } break;
+
+                        case Event::Type::Binary: {
+                            if (delegatesSnapshot->binary != nullptr) {
+                                delegatesSnapshot->binary(std::move(event.content));
+                            }
+                        } break;
+
+                        case Event::Type::Ping: {
+                            if (delegatesSnapshot->ping != nullptr) {
+                                delegatesSnapshot->ping(std::move(event.content));
+                            }
+                        } break;
+
+                        case Event::Type::Pong: {
+                            if (delegatesSnapshot->pong != nullptr) {
+                                delegatesSnapshot->pong(std::move(event.content));
+                            }
+                        } break;
+
+                        case Event::Type::Close: {
+                            if (delegatesSnapshot->close != nullptr) {
+                                delegatesSnapshot->close(
+                                    event.closeCode,
+                                    std::move(event.content)
+                                );
+                            }
+                        } break;
+
+                        default: break;
+                    }
+                }
+                eventsBeingDispatched.clear();
+                lock.lock();
+            }
+            dispatchingEvents = false;
+        }
+
+        /**
+         * This method determines whether or not the events waiting to be
+         * reported through delegates exceed the limits configured for
+         * events received before delegates are set.  The event lock must
+         * be held when calling this method.
+         *
+         * @return
+         *     An indication of whether or not the event queue exceeds
+         *     the configured limits is returned.
+         */
+        bool IsEventBufferOverflowing() const {
+            return (
+                (
+                    (configuration.maxBufferedEvents > 0)
+                    && (eventBufferStatistics.eventsBuffered > configuration.maxBufferedEvents)
+                )
+                || (
+                    (configuration.maxBufferedEventOctets > 0)
+                    && (eventBufferStatistics.octetsBuffered > configuration.maxBufferedEventOctets)
+                )
+            );
+        }
+
+        /**
+         * This method discards the oldest events, other than close
+         * events, from the event queue, until it no longer exceeds the
+         * configured limits.  The event lock must be held when calling
+         * this method.
+         */
+        void DropOldestEvents() {
+            size_t eventsKept = 0;
+            for (size_t i = 0; i < eventQueue.size(); ++i) {
+                auto& event = eventQueue[i];
+                if (
+                    (event.type != Event::Type::Close)
+                    && IsEventBufferOverflowing()
+                ) {
+                    --eventBufferStatistics.eventsBuffered;
+                    eventBufferStatistics.octetsBuffered -= event.content.length();
+                    ++eventBufferStatistics.eventsDropped;
+                    continue;
+                }
+                if (eventsKept != i) {
+                    eventQueue[eventsKept] = std::move(event);
+                }
+                ++eventsKept;
+            }
+            eventQueue.resize(eventsKept);
+        }
+
+        /**
+         * This method adds the given event to the queue of events
+         * waiting to be reported through delegates.  If delegates haven't
+         * been set yet, and the queue now exceeds the configured limits,
+         * the configured event buffer overflow policy is applied.
+         * If the policy is to close the WebSocket, but a close frame
+         * has already been sent, the oldest events are dropped instead,
+         * and the connection is broken.
+         *
+         * @param[in] event
+         *     This is the event to add to the queue.
+         */
+        void QueueEvent(Event&& event) {
+            std::unique_lock< decltype(eventMutex) > lock(eventMutex);
+            const bool isClose = (event.type == Event::Type::Close);
+            ++eventBufferStatistics.eventsBuffered;
+            eventBufferStatistics.octetsBuffered += event.content.length();
+            eventQueue.push_back(std::move(event));
+            bool fail = false;
+            bool closing = false;
+            if (
+                !isClose
+                && (delegates == nullptr)
+                && IsEventBufferOverflowing()
+            ) {
+                closing = closeSent;
+                if (
+                    (configuration.eventBufferOverflowPolicy == EventBufferOverflowPolicy::DropOldest)
+                    || closing
+                ) {
+                    DropOldestEvents();
+                }
+                fail = (configuration.eventBufferOverflowPolicy == EventBufferOverflowPolicy::Close);
+            }
+            eventBufferStatistics.peakEventsBuffered = std::max(
+                eventBufferStatistics.peakEventsBuffered,
+                eventBufferStatistics.eventsBuffered
+            );
+            eventBufferStatistics.peakOctetsBuffered = std::max(
+                eventBufferStatistics.peakOctetsBuffered,
+                eventBufferStatistics.octetsBuffered
+            );
+            lock.unlock();
+            if (fail) {
+                if (closing) {
+                    Close(1006, "too many events received before delegates set");
+                } else {
+                    Close(1008, "too many events received before delegates set", true);
+                }
+            }
+        }
+
+        /**
+         * This method adds the given action to the queue of control
+         * actions waiting to be carried out by whichever thread next
+         * holds the send lock.
+         *
+         * @param[in] action
+         *     This is the action to add to the queue.
+         */
+        void QueueControlAction(ControlAction&& action) {
+            std::lock_guard< decltype(controlActionsMutex) > lock(controlActionsMutex);
+            controlActions.push_back(std::move(action));
+            controlActionsQueued = true;
+        }
+
+        /**
+         * This method queues a control frame to be sent.
+         *
+         * @param[in] opcode
+         *     This is the opcode to set in the frame.
+         *
+         * @param[in] payload
+         *     This is the payload to include in the frame.
+         */
+        void QueueControlFrame(
+            uint8_t opcode,
+            const std::string& payload
+        ) {
+            ControlAction action;
+            action.type = ControlAction::Type::Frame;
+            action.opcode = opcode;
+            action.payload = payload;
+            QueueControlAction(std::move(action));
+        }
+
+        /**
+         * This method queues the breaking of the connection, unless it
+         * has already been requested.
+         *
+         * @param[in] clean
+         *     This indicates whether or not to break the
+         *     connection cleanly.
+         */
+        void QueueBreak(bool clean) {
+            if (breakRequested.exchange(true)) {
+                return;
+            }
+            ControlAction action;
+            action.type = ControlAction::Type::Break;
+            action.clean = clean;
+            QueueControlAction(std::move(action));
+        }
+
+        /**
+         * This method adds the given entry to the queue of data waiting
+         * to be handed to the connection.  It never blocks.  The entry
+         * isn't handed to the connection until the queue is drained.
+         *
+         * @param[in] node
+         *     This is the entry to add to the queue.  The queue takes
+         *     ownership of it.
+         */
+        void PushOutbound(OutboundNode* node) {
+            node->next = outboundHead.load(std::memory_order_relaxed);
+            while (
+                !outboundHead.compare_exchange_weak(
+                    node->next,
+                    node,
+                    std::memory_order_release,
+                    std::memory_order_relaxed
+                )
+            ) {
+            }
+        }
+
+        /**
+         * This method hands the given entries from the outbound queue to
+         * the connection, gathering frames into batches so that the
+         * connection is called as few times as possible.
+         *
+         * @param[in] nodes
+         *     These are the entries to hand to the connection, in order.
+         *     This method takes ownership of them.
+         */
+        void WriteOutbound(OutboundNode* nodes) {
+            std::vector< uint8_t > batch;
+            bool framesSent = false;
+            while (nodes != nullptr) {
+                std::unique_ptr< OutboundNode > node(nodes);
+                nodes = node->next;
+                if (node->sentDelegate != nullptr) {
+                    if (!batch.empty()) {
+                        connection->SendData(batch);
+                        batch.clear();
+                    }
+                    node->sentDelegate(!outboundBroken);
+                    continue;
+                }
+                if (outboundBroken) {
+                    continue;
+                }
+                if (node->breakConnection) {
+                    if (!batch.empty()) {
+                        connection->SendData(batch);
+                        batch.clear();
+                    }
+                    outboundBroken = true;
+                    connection->Break(node->clean);
+                    continue;
+                }
+                framesSent = true;
+                if (batch.empty()) {
+                    batch.swap(node->frame);
+                } else {
+                    (void)batch.insert(
+                        batch.end(),
+                        node->frame.begin(),
+                        node->frame.end()
+                    );
+                }
+                if (batch.size() >= OUTBOUND_BATCH_LIMIT) {
+                    connection->SendData(batch);
+                    batch.clear();
+                }
+            }
+            if (!batch.empty()) {
+                connection->SendData(batch);
+            }
+            if (
+                framesSent
+                && (firstFrameSentTime.load(std::memory_order_relaxed) == 0)
+            ) {
+                firstFrameSentTime.store(
+                    std::chrono::steady_clock::now().time_since_epoch().count(),
+                    std::memory_order_relaxed
+                );
+            }
+        }
+
+        /**
+         * This method hands everything in the outbound queue to the
+         * connection, unless another thread is already doing so, in which
+         * case that thread also hands over whatever was queued before
+         * this method was called, before it stops.  It's called without
+         * holding the send lock, after anything that might queue frames.
+         */
+        void DrainOutbound() {
+            size_t requests = 1;
+            if (outboundDrainRequests.fetch_add(requests, std::memory_order_acq_rel) != 0) {
+                return;
+            }
+            for (;;) {
+                auto nodes = outboundHead.exchange(nullptr, std::memory_order_acquire);
+                OutboundNode* orderedNodes = nullptr;
+                while (nodes != nullptr) {
+                    const auto next = nodes->next;
+                    nodes->next = orderedNodes;
+                    orderedNodes = nodes;
+                    nodes = next;
+                }
+                WriteOutbound(orderedNodes);
+                const auto outstandingRequests = outboundDrainRequests.fetch_sub(
+                    requests,
+                    std::memory_order_acq_rel
+                );
+                if (outstandingRequests == requests) {
+                    return;
+                }
+                requests = outstandingRequests - requests;
+            }
+        }
+
+        /**
+         * This method carries out any queued control actions, unless
+         * another thread holds the send lock, in which case that thread
+         * carries them out once it's done sending, and then drains the
+         * outbound queue.  It's called without holding the send lock,
+         * after anything that might queue frames or control actions.
+         */
+        void SendQueuedControlActions() {
+            while (controlActionsQueued) {
+                std::unique_lock< decltype(sendMutex) > sendLock(sendMutex, std::try_to_lock);
+                if (!sendLock.owns_lock()) {
+                    break;
+                }
+                std::vector< ControlAction > actions;
+                {
+                    std::lock_guard< decltype(controlActionsMutex) > lock(controlActionsMutex);
+                    actions.swap(controlActions);
+                    controlActionsQueued = false;
+                }
+                for (const auto& action: actions) {
+                    if (action.type == ControlAction::Type::Frame) {
+                        SendFrame(true, action.opcode, action.payload);
+                    } else {
+                        const auto node = new OutboundNode();
+                        node->breakConnection = true;
+                        node->clean = action.clean;
+                        PushOutbound(node);
+                    }
+                }
+            }
+            DrainOutbound();
+        }
+
+        /**
+         * This holds the send lock of a WebSocket until it's unlocked or
+         * destroyed.  Control actions queued by other threads while the
+         * lock is held are left for the holder to carry out, so they're
+         * carried out whenever the lock is released, however the holder
+         * lets go of it.
+         */
+        struct SendLock {
+            // Properties
+
+            /**
+             * This is the WebSocket whose send lock is held.
+             */
+            Impl& impl;
+
+            /**
+             * This holds the send lock.
+             */
+            std::unique_lock< decltype(Impl::sendMutex) > lock;
+
+            // Lifecycle management
+
+            ~SendLock() noexcept {
+                Unlock();
+            }
+            SendLock(const SendLock&) = delete;
+            SendLock(SendLock&&) = delete;
+            SendLock& operator=(const SendLock&) = delete;
+            SendLock& operator=(SendLock&&) = delete;
+
+            // Methods
+
+            /**
+             * This constructor takes the send lock of the given WebSocket.
+             *
+             * @param[in] impl
+             *     This is the WebSocket whose send lock to take.
+             */
+            explicit SendLock(Impl& impl)
+                : impl(impl)
+                , lock(impl.sendMutex)
+            {
+            }
+
+            /**
+             * This method releases the send lock, if it's still held,
+             * and then carries out any queued control actions.
+             */
+            void Unlock() {
+                if (!lock.owns_lock()) {
+                    return;
+                }
+                lock.unlock();
+                impl.SendQueuedControlActions();
+            }
+        };
+
+        /**
+         * This method responds to the WebSocket being closed.
+         *
+         * @param[in] code
+         *     This is the status code of the closure.
+         *
+         * @param[in] reason
+         *     This is the reason text of the closure.
+         */
+        void OnClose(
             unsigned int code,
             const std::string& reason
         ) {
-            const auto closeSentEarlier = closeSent;
             closeReceived = true;
+            closedTime.store(
+                std::chrono::steady_clock::now().time_since_epoch().count(),
+                std::memory_order_relaxed
+            );
             Event event;
             event.type = Event::Type::Close;
             event.closeCode = code;
             event.content = reason;
-            eventQueue.push(std::move(event));
-            if (closeSentEarlier) {
-                connection->Break(false);
+            QueueEvent(std::move(event));
+            if (closeSent) {
+                QueueBreak(false);
             }
         }
 
@@ -389,131 +1277,977 @@ namespace WebSockets {
                 Event event;
                 event.type = Event::Type::Text;
                 event.content = std::move(message);
-                eventQueue.push(std::move(event));
+                QueueEvent(std::move(event));
             } else {
                 Close(1007, "invalid UTF-8 encoding in text message", true);
             }
         }
 
         /**
-         * This method is called if a binary message has been received.
-         *
-         * @param[in] message
-         *     This is the binary message that has been received.
+         * This method is called if a binary message has been received.
+         *
+         * @param[in] message
+         *     This is the binary message that has been received.
+         */
+        void OnBinaryMessage(std::string&& message) {
+            Event event;
+            event.type = Event::Type::Binary;
+            event.content = std::move(message);
+            QueueEvent(std::move(event));
+        }
+
+        /**
+         * This method initiates the closing of the WebSocket,
+         * sending a close frame with the given status code and reason.
+         *
+         * @param[in] code
+         *     This is the status code to send in the close frame.
+         *
+         * @param[in] reason
+         *     This is the reason text to send in the close frame.
+         *
+         * @param[in] fail
+         *     This indicates whether or not to fail the connection,
+         *     closing the connection and reporting the close
+         *     immediately, rather than waiting for the receipt
+         *     of a close frame from the remote peer.
+         */
+        void Close(
+            unsigned int code,
+            const std::string reason,
+            bool fail = false
+        ) {
+            if (closeSent.exchange(true)) {
+                if (
+                    (code == 1006)
+                    && !closeReceived
+                ) {
+                    OnClose(code, reason);
+                }
+                return;
+            }
+            if (code == 1006) {
+                OnClose(code, reason);
+            } else {
+                std::string data;
+                if (code != 1005) {
+                    data.push_back((uint8_t)(code >> 8));
+                    data.push_back((uint8_t)(code & 0xFF));
+                    data += reason;
+                }
+                QueueControlFrame(OPCODE_CLOSE, data);
+                closeSentTime.store(
+                    std::chrono::steady_clock::now().time_since_epoch().count(),
+                    std::memory_order_relaxed
+                );
+                if (fail) {
+                    OnClose(code, reason);
+                } else if (closeReceived) {
+                    QueueBreak(true);
+                }
+                diagnosticsSender.SendDiagnosticInformationFormatted(
+                    1,
+                    "Connection to %s closed (%s)",
+                    connection->GetPeerId().c_str(),
+                    reason.c_str()
+                );
+            }
+        }
+
+        /**
+         * This method makes the extensions which the WebSocket may
+         * negotiate in the opening handshake, according to its
+         * configuration.
+         *
+         * @return
+         *     The extensions made are returned, in the order in which
+         *     a client offers them.
+         */
+        std::vector< std::shared_ptr< Extension > > MakeExtensions() {
+            std::vector< std::shared_ptr< Extension > > madeExtensions;
+            if (
+                configuration.perMessageDeflate
+                && (GetMaxDecodedMessageSize(configuration) > 0)
+            ) {
+                madeExtensions.push_back(
+                    std::make_shared< PerMessageDeflate >(configuration)
+                );
+            }
+            for (const auto& factory: configuration.extensions) {
+                if (factory == nullptr) {
+                    continue;
+                }
+                const auto extension = factory();
+                if (extension != nullptr) {
+                    madeExtensions.push_back(extension);
+                }
+            }
+            return madeExtensions;
+        }
+
+        /**
+         * This method sets the extensions negotiated in the
+         * opening handshake.
+         *
+         * @param[in] negotiatedExtensions
+         *     These are the extensions negotiated in the opening handshake,
+         *     in the order in which they encode messages sent.
+         */
+        void SetExtensions(
+            const std::vector< std::shared_ptr< Extension > >& negotiatedExtensions
+        ) {
+            extensions = negotiatedExtensions;
+            extensionReservedBits = 0;
+            perMessageDeflate = nullptr;
+            for (const auto& extension: extensions) {
+                extensionReservedBits |= extension->GetReservedBits();
+                if (perMessageDeflate == nullptr) {
+                    perMessageDeflate = std::dynamic_pointer_cast< PerMessageDeflate >(extension);
+                }
+            }
+        }
+
+        /**
+         * This method takes the next masking key from the pool,
+         * refilling the pool from the random number generator first
+         * if it has run dry.
+         *
+         * @param[out] maskingKey
+         *     This is where to store the masking key.
+         */
+        void NextMaskingKey(uint8_t (&maskingKey)[MASKING_KEY_LENGTH]) {
+            if (maskingKeyPoolOffset >= maskingKeyPool.size()) {
+                maskingKeyPool.resize(MASKING_KEY_LENGTH * MASKING_KEYS_PER_REFILL);
+                rng.Generate(maskingKeyPool.data(), maskingKeyPool.size());
+                maskingKeyPoolOffset = 0;
+            }
+            for (size_t i = 0; i < MASKING_KEY_LENGTH; ++i) {
+                maskingKey[i] = maskingKeyPool[maskingKeyPoolOffset + i];
+                maskingKeyPool[maskingKeyPoolOffset + i] = 0;
+            }
+            maskingKeyPoolOffset += MASKING_KEY_LENGTH;
+        }
+
+        /**
+         * This method constructs a frame to send from the WebSocket.
+         *
+         * @param[in] fin
+         *     This indicates whether or not to set the FIN bit in the frame.
+         *
+         * @param[in] opcode
+         *     This is the opcode to set in the frame.
+         *
+         * @param[in] payload
+         *     This is the payload to include in the frame.
+         *
+         * @param[in] reservedBits
+         *     These are the reserved bits to set in the frame.
+         *
+         * @return
+         *     The encoded frame is returned.
+         */
+        std::vector< uint8_t > EncodeFrame(
+            bool fin,
+            uint8_t opcode,
+            const std::string& payload,
+            uint8_t reservedBits = 0
+        ) {
+            std::vector< uint8_t > frame;
+            frame.push_back(
+                (fin ? FIN : 0)
+                + reservedBits
+                + opcode
+            );
+            const uint8_t mask = ((role == Role::Client) ? MASK : 0);
+            if (payload.length() < 126) {
+                frame.push_back((uint8_t)payload.length() + mask);
+            } else if (payload.length() < 65536) {
+                frame.push_back(0x7E + mask);
+                frame.push_back((uint8_t)(payload.length() >> 8));
+                frame.push_back((uint8_t)(payload.length() & 0xFF));
+            } else {
+                frame.push_back(0x7F + mask);
+                frame.push_back((uint8_t)(payload.length() >> 56));
+                frame.push_back((uint8_t)((payload.length() >> 48) & 0xFF));
+                frame.push_back((uint8_t)((payload.length() >> 40) & 0xFF));
+                frame.push_back((uint8_t)((payload.length() >> 32) & 0xFF));
+                frame.push_back((uint8_t)((payload.length() >> 24) & 0xFF));
+                frame.push_back((uint8_t)((payload.length() >> 16) & 0xFF));
+                frame.push_back((uint8_t)((payload.length() >> 8) & 0xFF));
+                frame.push_back((uint8_t)(payload.length() & 0xFF));
+            }
+            if (mask == 0) {
+                (void)frame.insert(
+                    frame.end(),
+                    payload.begin(),
+                    payload.end()
+                );
+            } else {
+                uint8_t maskingKey[MASKING_KEY_LENGTH];
+                NextMaskingKey(maskingKey);
+                for (size_t i = 0; i < sizeof(maskingKey); ++i) {
+                    frame.push_back(maskingKey[i]);
+                }
+                for (size_t i = 0; i < payload.length(); ++i) {
+                    frame.push_back(payload[i] ^ maskingKey[i % 4]);
+                }
+            }
+            return frame;
+        }
+
+        /**
+         * This method adds the given encoded frame to the outbound queue.
+         *
+         * @param[in] frame
+         *     This is the encoded frame to send.
+         */
+        void QueueFrame(std::vector< uint8_t >&& frame) {
+            const auto node = new OutboundNode();
+            node->frame = std::move(frame);
+            PushOutbound(node);
+        }
+
+        /**
+         * This method constructs a frame from the WebSocket and adds it
+         * to the outbound queue.
+         *
+         * @param[in] fin
+         *     This indicates whether or not to set the FIN bit in the frame.
+         *
+         * @param[in] opcode
+         *     This is the opcode to set in the frame.
+         *
+         * @param[in] payload
+         *     This is the payload to include in the frame.
+         *
+         * @param[in] reservedBits
+         *     These are the reserved bits to set in the frame.
+         */
+        void SendFrame(
+            bool fin,
+            uint8_t opcode,
+            const std::string& payload,
+            uint8_t reservedBits = 0
+        ) {
+            QueueFrame(EncodeFrame(fin, opcode, payload, reservedBits));
+        }
+
+        /**
+         * This method decides whether or not to compress a message
+         * about to be sent.
+         *
+         * @param[in] length
+         *     This is the length of the message or, if the message is sent
+         *     in fragments, its first fragment.
+         *
+         * @param[in] compression
+         *     This is the choice the user made about compressing
+         *     the message.
+         *
+         * @return
+         *     An indication of whether or not to compress the message
+         *     is returned.
+         */
+        bool ShouldCompress(
+            size_t length,
+            Compression compression
+        ) {
+            switch (compression) {
+                case Compression::Always: return true;
+                case Compression::Never: return false;
+                default: break;
+            }
+            if (length < configuration.compressionThreshold) {
+                return false;
+            }
+            if (
+                (configuration.compressionRatioCutoff > 0.0)
+                && (messagesCompressed.load(std::memory_order_relaxed) > 0)
+                && (
+                    recentCompressionRatio.load(std::memory_order_relaxed)
+                    > configuration.compressionRatioCutoff
+                )
+                && (++messagesSkippedSinceCompressionProbe < COMPRESSION_PROBE_INTERVAL)
+            ) {
+                return false;
+            }
+            messagesSkippedSinceCompressionProbe = 0;
+            return true;
+        }
+
+        /**
+         * This method records the compression of a complete message
+         * in the compression statistics of the WebSocket.
+         */
+        void RecordMessageCompressed() {
+            const auto ratio = (
+                (sendingOctetsBeforeCompression == 0)
+                ? 1.0
+                : (
+                    (double)sendingOctetsAfterCompression
+                    / (double)sendingOctetsBeforeCompression
+                )
+            );
+            if (messagesCompressed.load(std::memory_order_relaxed) == 0) {
+                recentCompressionRatio.store(ratio, std::memory_order_relaxed);
+            } else {
+                const auto recentRatio = recentCompressionRatio.load(std::memory_order_relaxed);
+                recentCompressionRatio.store(
+                    recentRatio + (ratio - recentRatio) * COMPRESSION_RATIO_AVERAGING_WEIGHT,
+                    std::memory_order_relaxed
+                );
+            }
+            messagesCompressed.fetch_add(1, std::memory_order_relaxed);
+            sendingOctetsBeforeCompression = 0;
+            sendingOctetsAfterCompression = 0;
+        }
+
+        /**
+         * This method constructs and sends a text, binary, or continuation
+         * frame from the WebSocket, encoding the payload with the
+         * extensions negotiated in the opening handshake.  The
+         * "permessage-deflate" extension is only used for messages
+         * the WebSocket decides to compress.
+         *
+         * @param[in] fin
+         *     This indicates whether or not to set the FIN bit in the frame.
+         *
+         * @param[in] opcode
+         *     This is the opcode to set in the frame.
+         *
+         * @param[in] payload
+         *     This is the unencoded payload to include in the frame.
+         *
+         * @param[in] compression
+         *     This is the choice the user made about compressing
+         *     the message.
+         *
+         * @return
+         *     An indication of whether or not the frame was queued
+         *     to be sent is returned.
+         */
+        bool SendDataFrame(
+            bool fin,
+            uint8_t opcode,
+            const std::string& payload,
+            Compression compression
+        ) {
+            if (extensions.empty()) {
+                SendFrame(fin, opcode, payload);
+                return true;
+            }
+            const bool firstFragment = (opcode != OPCODE_CONTINUATION);
+            if (
+                firstFragment
+                && (perMessageDeflate != nullptr)
+            ) {
+                sendingCompressed = ShouldCompress(payload.length(), compression);
+                if (!sendingCompressed) {
+                    messagesNotCompressed.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            const std::string* encodedPayload = &payload;
+            std::string encodingBuffer;
+            uint8_t reservedBits = 0;
+            for (const auto& extension: extensions) {
+                const bool compressing = (extension == perMessageDeflate);
+                if (
+                    compressing
+                    && !sendingCompressed
+                ) {
+                    continue;
+                }
+                if (encodedPayload == &payload) {
+                    encodingBuffer = payload;
+                    encodedPayload = &encodingBuffer;
+                }
+                const auto octetsBeforeEncoding = encodingBuffer.length();
+                const auto encodingStart = std::chrono::steady_clock::now();
+                uint8_t extensionReservedBits = 0;
+                std::string failureReason;
+                const auto encoded = extension->EncodeFragment(
+                    firstFragment,
+                    fin,
+                    encodingBuffer,
+                    extensionReservedBits,
+                    failureReason
+                );
+                if (compressing) {
+                    compressionTime.fetch_add(
+                        std::chrono::duration_cast< std::chrono::nanoseconds >(
+                            std::chrono::steady_clock::now() - encodingStart
+                        ).count(),
+                        std::memory_order_relaxed
+                    );
+                }
+                if (!encoded) {
+                    Close(1011, failureReason, true);
+                    return false;
+                }
+                reservedBits |= (extensionReservedBits & extension->GetReservedBits());
+                if (compressing) {
+                    octetsBeforeCompression.fetch_add(octetsBeforeEncoding, std::memory_order_relaxed);
+                    octetsAfterCompression.fetch_add(encodingBuffer.length(), std::memory_order_relaxed);
+                    sendingOctetsBeforeCompression += octetsBeforeEncoding;
+                    sendingOctetsAfterCompression += encodingBuffer.length();
+                    if (fin) {
+                        RecordMessageCompressed();
+                    }
+                }
+            }
+            SendFrame(
+                fin,
+                opcode,
+                *encodedPayload,
+                (firstFragment ? reservedBits : 0)
+            );
+            return true;
+        }
+
+        /**
+         * This method makes the data for a ping sent to measure the
+         * round-trip time, and keeps track of the ping.
+         *
+         * @return
+         *     The data for the ping is returned.
+         */
+        std::string MakeRoundTripPing() {
+            const auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+            std::lock_guard< decltype(roundTripMutex) > lock(roundTripMutex);
+            const auto sequence = ++lastRoundTripPingSequence;
+            auto& ping = roundTripPings[sequence % ROUND_TRIP_PINGS_TRACKED];
+            ping.sequence = sequence;
+            ping.sentTime = now;
+            std::string data(ROUND_TRIP_PING_PREFIX, sizeof(ROUND_TRIP_PING_PREFIX) - 1);
+            for (int shift = 24; shift >= 0; shift -= 8) {
+                data.push_back((char)(uint8_t)(sequence >> shift));
+            }
+            const auto sentTime = (uint64_t)now;
+            for (int shift = 56; shift >= 0; shift -= 8) {
+                data.push_back((char)(uint8_t)(sentTime >> shift));
+            }
+            return data;
+        }
+
+        /**
+         * This method measures the round-trip time from the given pong,
+         * if it answers a ping sent to measure it which hasn't already
+         * been answered.
+         *
+         * @param[in] data
+         *     This is the data from the pong received.
+         */
+        void MeasureRoundTrip(const std::string& data) {
+            if (
+                (data.length() != ROUND_TRIP_PING_LENGTH)
+                || (data.compare(0, sizeof(ROUND_TRIP_PING_PREFIX) - 1, ROUND_TRIP_PING_PREFIX) != 0)
+            ) {
+                return;
+            }
+            const auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+            size_t offset = sizeof(ROUND_TRIP_PING_PREFIX) - 1;
+            uint32_t sequence = 0;
+            for (size_t i = 0; i < 4; ++i) {
+                sequence = ((sequence << 8) | (uint8_t)data[offset++]);
+            }
+            uint64_t sentTime = 0;
+            for (size_t i = 0; i < 8; ++i) {
+                sentTime = ((sentTime << 8) | (uint8_t)data[offset++]);
+            }
+            std::lock_guard< decltype(roundTripMutex) > lock(roundTripMutex);
+            auto& ping = roundTripPings[sequence % ROUND_TRIP_PINGS_TRACKED];
+            if (
+                (ping.sequence != sequence)
+                || (ping.sentTime == 0)
+                || ((uint64_t)ping.sentTime != sentTime)
+            ) {
+                return;
+            }
+            const auto roundTripTime = std::chrono::duration_cast< std::chrono::microseconds >(
+                std::chrono::steady_clock::duration(now - ping.sentTime)
+            );
+            ping.sentTime = 0;
+            if (roundTripTimes.samples == 0) {
+                roundTripTimes.smoothed = roundTripTime;
+                roundTripTimes.minimum = roundTripTime;
+                roundTripTimes.maximum = roundTripTime;
+            } else {
+                roundTripTimes.smoothed = std::chrono::microseconds(
+                    (std::chrono::microseconds::rep)(
+                        (double)roundTripTimes.smoothed.count()
+                        + ROUND_TRIP_TIME_AVERAGING_WEIGHT * (double)(
+                            roundTripTime.count() - roundTripTimes.smoothed.count()
+                        )
+                    )
+                );
+                roundTripTimes.minimum = std::min(roundTripTimes.minimum, roundTripTime);
+                roundTripTimes.maximum = std::max(roundTripTimes.maximum, roundTripTime);
+            }
+            roundTripTimes.last = roundTripTime;
+            ++roundTripTimes.samples;
+        }
+
+        /**
+         * This method checks the given HTTP response returned to complete
+         * the opening handshake, in the client role, and if it's
+         * acceptable, takes on the extensions and subprotocol selected.
+         *
+         * @param[in] response
+         *     This is the response returned by the server.
+         *
+         * @return
+         *     An indication of whether or not the response
+         *     is acceptable is returned.
+         */
+        bool AcceptUpgradeAsClient(const Http::Response& response) {
+            if (response.statusCode != 101) {
+                return false;
+            }
+            if (!response.headers.HasHeaderToken("Connection", "upgrade")) {
+                return false;
+            }
+            if (SystemAbstractions::ToLower(response.headers.GetHeaderValue("Upgrade")) != "websocket") {
+                return false;
+            }
+            if (!IsHandshakeAnswerFor(key, response.headers.GetHeaderValue("Sec-WebSocket-Accept"))) {
+                return false;
+            }
+            auto remainingOffers = offeredExtensions;
+            std::vector< std::shared_ptr< Extension > > negotiatedExtensions;
+            uint8_t claimedReservedBits = 0;
+            const auto elements = ParseExtensionElements(
+                response.headers.GetHeaderTokens("Sec-WebSocket-Extensions")
+            );
+            for (const auto& element: elements) {
+                std::shared_ptr< Extension > extension;
+                for (auto& offeredExtension: remainingOffers) {
+                    if (
+                        (offeredExtension != nullptr)
+                        && (SystemAbstractions::ToLower(offeredExtension->GetName()) == element.name)
+                    ) {
+                        extension = std::move(offeredExtension);
+                        break;
+                    }
+                }
+                if (
+                    (extension == nullptr)
+                    || ((extension->GetReservedBits() & claimedReservedBits) != 0)
+                    || !extension->NegotiateAsClient(element.parameters)
+                ) {
+                    return false;
+                }
+                claimedReservedBits |= extension->GetReservedBits();
+                negotiatedExtensions.push_back(extension);
+            }
+            const auto subprotocols = response.headers.GetHeaderTokens("Sec-WebSocket-Protocol");
+            std::string selectedSubprotocol;
+            if (!subprotocols.empty()) {
+                if (subprotocols.size() > 1) {
+                    return false;
+                }
+                selectedSubprotocol = subprotocols[0];
+                if (
+                    std::find(
+                        configuration.subprotocols.begin(),
+                        configuration.subprotocols.end(),
+                        selectedSubprotocol
+                    ) == configuration.subprotocols.end()
+                ) {
+                    return false;
+                }
+            }
+            subprotocol = selectedSubprotocol;
+            offeredExtensions.clear();
+            SetExtensions(negotiatedExtensions);
+            return true;
+        }
+
+        /**
+         * This method queues a text or binary message, or fragment thereof,
+         * to send, unless the WebSocket isn't open, has sent a close frame,
+         * or is in the midst of sending a message of the other type.
+         *
+         * The send mutex must be held while calling this method.
+         *
+         * @param[in] type
+         *     This is the type of message to send.
+         *
+         * @param[in] data
+         *     This is the data to include with the message.
+         *
+         * @param[in] lastFragment
+         *     This indicates whether or not this is the last
+         *     frame in its message.
+         *
+         * @param[in] compression
+         *     This is the choice the user made about compressing
+         *     the message.
+         *
+         * @param[in,out] sentDelegate
+         *     If not nullptr, this is the function to call once the message
+         *     has been handed to the connection.  It's taken if the
+         *     message is queued.
+         *
+         * @return
+         *     An indication of whether or not the message
+         *     was queued is returned.
+         */
+        bool QueueMessage(
+            FragmentedMessageType type,
+            const std::string& data,
+            bool lastFragment,
+            Compression compression,
+            SentDelegate& sentDelegate
+        ) {
+            if (
+                (connection == nullptr)
+                || closeSent
+                || (
+                    (sending != FragmentedMessageType::None)
+                    && (sending != type)
+                )
+            ) {
+                return false;
+            }
+            const auto opcode = (
+                (sending == type)
+                ? OPCODE_CONTINUATION
+                : ((type == FragmentedMessageType::Text) ? OPCODE_TEXT : OPCODE_BINARY)
+            );
+            const auto queued = SendDataFrame(lastFragment, opcode, data, compression);
+            sending = (
+                lastFragment
+                ? FragmentedMessageType::None
+                : type
+            );
+            if (
+                queued
+                && (sentDelegate != nullptr)
+            ) {
+                const auto node = new OutboundNode();
+                node->sentDelegate = std::move(sentDelegate);
+                sentDelegate = nullptr;
+                PushOutbound(node);
+            }
+            return queued;
+        }
+
+        /**
+         * This method sends a text or binary message, or fragment thereof,
+         * unless the WebSocket isn't open, has sent a close frame, or is
+         * in the midst of sending a message of the other type.  While the
+         * WebSocket is in the OPENING state in the client role, the
+         * message is held instead, to send once the WebSocket is opened.
+         *
+         * @param[in] type
+         *     This is the type of message to send.
+         *
+         * @param[in] data
+         *     This is the data to include with the message.
+         *
+         * @param[in] lastFragment
+         *     This indicates whether or not this is the last
+         *     frame in its message.
+         *
+         * @param[in] compression
+         *     This is the choice the user made about compressing
+         *     the message.
+         *
+         * @param[in] sentDelegate
+         *     If not nullptr, this is the function to call once the message
+         *     has been handed to the connection, or could not be.
+         */
+        void SendMessage(
+            FragmentedMessageType type,
+            const std::string& data,
+            bool lastFragment,
+            Compression compression,
+            SentDelegate sentDelegate
+        ) {
+            SendLock lock(*this);
+            if (opening) {
+                EarlySend earlySend;
+                earlySend.type = type;
+                earlySend.data = data;
+                earlySend.lastFragment = lastFragment;
+                earlySend.compression = compression;
+                earlySend.sentDelegate = std::move(sentDelegate);
+                earlySends.push_back(std::move(earlySend));
+                return;
+            }
+            const auto queued = QueueMessage(type, data, lastFragment, compression, sentDelegate);
+            lock.Unlock();
+            if (
+                !queued
+                && (sentDelegate != nullptr)
+            ) {
+                sentDelegate(false);
+            }
+            ProcessEventQueue();
+        }
+
+        /**
+         * This method leaves the OPENING state, sending any messages
+         * held while in it, in the order they were sent, ahead of any
+         * sent afterwards.
          */
-        void OnBinaryMessage(std::string&& message) {
-            Event event;
-            event.type = Event::Type::Binary;
-            event.content = std::move(message);
-            eventQueue.push(std::move(event));
+        void SendEarlySends() {
+            SendLock lock(*this);
+            opening = false;
+            std::vector< EarlySend > held;
+            held.swap(earlySends);
+            std::vector< SentDelegate > failedSentDelegates;
+            for (auto& earlySend: held) {
+                if (
+                    !QueueMessage(
+                        earlySend.type,
+                        earlySend.data,
+                        earlySend.lastFragment,
+                        earlySend.compression,
+                        earlySend.sentDelegate
+                    )
+                    && (earlySend.sentDelegate != nullptr)
+                ) {
+                    failedSentDelegates.push_back(std::move(earlySend.sentDelegate));
+                }
+            }
+            lock.Unlock();
+            for (const auto& sentDelegate: failedSentDelegates) {
+                sentDelegate(false);
+            }
         }
 
         /**
-         * This method initiates the closing of the WebSocket,
-         * sending a close frame with the given status code and reason.
+         * This method leaves the OPENING state, discarding any messages
+         * held while in it.
+         */
+        void DiscardEarlySends() {
+            SendLock lock(*this);
+            opening = false;
+            std::vector< EarlySend > held;
+            held.swap(earlySends);
+            lock.Unlock();
+            if (held.empty()) {
+                return;
+            }
+            diagnosticsSender.SendDiagnosticInformationFormatted(
+                SystemAbstractions::DiagnosticsSender::Levels::WARNING,
+                "Discarding %u message(s) sent before the WebSocket could be opened",
+                (unsigned int)held.size()
+            );
+            for (const auto& earlySend: held) {
+                if (earlySend.sentDelegate != nullptr) {
+                    earlySend.sentDelegate(false);
+                }
+            }
+        }
+
+        /**
+         * This method sends a complete text or binary message which is
+         * being broadcast over several WebSockets, reusing whatever
+         * earlier recipients of the message have already prepared that
+         * also fits this WebSocket.
          *
-         * @param[in] code
-         *     This is the status code to send in the close frame.
+         * @param[in] opcode
+         *     This is the opcode to set in the frame.
          *
-         * @param[in] reason
-         *     This is the reason text to send in the close frame.
+         * @param[in] data
+         *     This is the uncompressed message.
          *
-         * @param[in] fail
-         *     This indicates whether or not to fail the connection,
-         *     closing the connection and reporting the close
-         *     immediately, rather than waiting for the receipt
-         *     of a close frame from the remote peer.
+         * @param[in] compression
+         *     This is the choice the user made about compressing
+         *     the message.
+         *
+         * @param[in,out] sharedMessages
+         *     These are the compressed payloads and frames prepared so
+         *     far for the message, keyed by the settings used to compress
+         *     them, or zero for the uncompressed message.
          */
-        void Close(
-            unsigned int code,
-            const std::string reason,
-            bool fail = false
+        void SendBroadcastMessage(
+            uint8_t opcode,
+            const std::string& data,
+            Compression compression,
+            std::map< int, BroadcastMessage >& sharedMessages
         ) {
-            if (closeSent) {
+            if (extensions.size() > ((perMessageDeflate == nullptr) ? 0 : 1)) {
+                SendDataFrame(true, opcode, data, compression);
                 return;
             }
-            closeSent = true;
-            if (code == 1006) {
-                OnClose(code, reason);
-            } else {
-                std::string data;
-                if (code != 1005) {
-                    data.push_back((uint8_t)(code >> 8));
-                    data.push_back((uint8_t)(code & 0xFF));
-                    data += reason;
+            const std::string* payload = &data;
+            uint8_t reservedBits = 0;
+            int sharedMessageKey = 0;
+            if (perMessageDeflate != nullptr) {
+                if (ShouldCompress(data.length(), compression)) {
+                    sharedMessageKey = perMessageDeflate->GetSharedCompressionKey();
+                    if (sharedMessageKey == 0) {
+                        SendDataFrame(true, opcode, data, Compression::Always);
+                        return;
+                    }
+                } else {
+                    messagesNotCompressed.fetch_add(1, std::memory_order_relaxed);
                 }
-                SendFrame(true, OPCODE_CLOSE, data);
-                if (fail) {
-                    OnClose(code, reason);
-                } else if (closeReceived) {
-                    connection->Break(true);
+            }
+            auto& sharedMessage = sharedMessages[sharedMessageKey];
+            if (sharedMessageKey != 0) {
+                if (!sharedMessage.compressed) {
+                    const auto compressionStart = std::chrono::steady_clock::now();
+                    const auto compressed = perMessageDeflate->Compress(
+                        data,
+                        true,
+                        sharedMessage.compressedPayload
+                    );
+                    compressionTime.fetch_add(
+                        std::chrono::duration_cast< std::chrono::nanoseconds >(
+                            std::chrono::steady_clock::now() - compressionStart
+                        ).count(),
+                        std::memory_order_relaxed
+                    );
+                    if (!compressed) {
+                        Close(1011, "unable to compress message", true);
+                        return;
+                    }
+                    sharedMessage.compressed = true;
                 }
-                diagnosticsSender.SendDiagnosticInformationFormatted(
-                    1,
-                    "Connection to %s closed (%s)",
-                    connection->GetPeerId().c_str(),
-                    reason.c_str()
-                );
+                payload = &sharedMessage.compressedPayload;
+                reservedBits = RSV1;
+                octetsBeforeCompression.fetch_add(data.length(), std::memory_order_relaxed);
+                octetsAfterCompression.fetch_add(payload->length(), std::memory_order_relaxed);
+                sendingOctetsBeforeCompression = data.length();
+                sendingOctetsAfterCompression = payload->length();
+                RecordMessageCompressed();
+            }
+            if (role == Role::Server) {
+                if (sharedMessage.serverFrame.empty()) {
+                    sharedMessage.serverFrame = EncodeFrame(
+                        true,
+                        opcode,
+                        *payload,
+                        reservedBits
+                    );
+                }
+                QueueFrame(std::vector< uint8_t >(sharedMessage.serverFrame));
+            } else {
+                SendFrame(true, opcode, *payload, reservedBits);
             }
         }
 
         /**
-         * This method constructs and sends a frame from the WebSocket.
+         * This method sends a complete text or binary message over each
+         * of the given WebSockets which is open and not in the middle of
+         * sending a fragmented message, preparing each distinct payload
+         * and frame only once for all the recipients that can share it.
          *
-         * @param[in] fin
-         *     This indicates whether or not to set the FIN bit in the frame.
+         * @param[in] recipients
+         *     These are the WebSockets over which to send the message.
          *
          * @param[in] opcode
-         *     This is the opcode to set in the frame.
+         *     This is the opcode to set in the frames.
          *
-         * @param[in] payload
-         *     This is the payload to include in the frame.
+         * @param[in] data
+         *     This is the uncompressed message.
+         *
+         * @param[in] compression
+         *     This is the choice the user made about compressing
+         *     the message.
          */
-        void SendFrame(
-            bool fin,
+        static void Broadcast(
+            const std::vector< std::shared_ptr< WebSocket > >& recipients,
             uint8_t opcode,
-            const std::string& payload
+            const std::string& data,
+            Compression compression
         ) {
-            std::vector< uint8_t > frame;
-            frame.push_back(
-                (fin ? FIN : 0)
-                + opcode
-            );
-            const uint8_t mask = ((role == Role::Client) ? MASK : 0);
-            if (payload.length() < 126) {
-                frame.push_back((uint8_t)payload.length() + mask);
-            } else if (payload.length() < 65536) {
-                frame.push_back(0x7E + mask);
-                frame.push_back((uint8_t)(payload.length() >> 8));
-                frame.push_back((uint8_t)(payload.length() & 0xFF));
-            } else {
-                frame.push_back(0x7F + mask);
-                frame.push_back((uint8_t)(payload.length() >> 56));
-                frame.push_back((uint8_t)((payload.length() >> 48) & 0xFF));
-                frame.push_back((uint8_t)((payload.length() >> 40) & 0xFF));
-                frame.push_back((uint8_t)((payload.length() >> 32) & 0xFF));
-                frame.push_back((uint8_t)((payload.length() >> 24) & 0xFF));
-                frame.push_back((uint8_t)((payload.length() >> 16) & 0xFF));
-                frame.push_back((uint8_t)((payload.length() >> 8) & 0xFF));
-                frame.push_back((uint8_t)(payload.length() & 0xFF));
+            std::map< int, BroadcastMessage > sharedMessages;
+            for (const auto& recipient: recipients) {
+                if (recipient == nullptr) {
+                    continue;
+                }
+                const auto& impl = recipient->impl_;
+                SendLock lock(*impl);
+                if (impl->connection == nullptr) {
+                    continue;
+                }
+                if (impl->closeSent) {
+                    continue;
+                }
+                if (impl->sending != FragmentedMessageType::None) {
+                    continue;
+                }
+                impl->SendBroadcastMessage(opcode, data, compression, sharedMessages);
+                lock.Unlock();
+                impl->ProcessEventQueue();
             }
-            if (mask == 0) {
-                (void)frame.insert(
-                    frame.end(),
-                    payload.begin(),
-                    payload.end()
-                );
-            } else {
-                uint8_t maskingKey[4];
-                rng.Generate(maskingKey, sizeof(maskingKey));
-                for (size_t i = 0; i < sizeof(maskingKey); ++i) {
-                    frame.push_back(maskingKey[i]);
+        }
+
+        /**
+         * This method decodes the given message received, with the
+         * extensions negotiated in the opening handshake, in the reverse
+         * of the order in which they encode messages sent.  If it can't
+         * be decoded, or it's larger than the maximum message size,
+         * the WebSocket is failed.
+         *
+         * @param[in,out] message
+         *     This is the message to decode in place.
+         *
+         * @return
+         *     An indication of whether or not the message is ready
+         *     to be delivered is returned.
+         */
+        bool DecodeMessage(std::string& message) {
+            if (!CheckMessageSize(message, configuration.maxMessageSize)) {
+                return false;
+            }
+            const auto maxDecodedMessageSize = GetMaxDecodedMessageSize(configuration);
+            for (
+                auto extension = extensions.rbegin();
+                extension != extensions.rend();
+                ++extension
+            ) {
+                std::string failureReason;
+                if (
+                    !(*extension)->DecodeMessage(
+                        receivingReservedBits,
+                        message,
+                        failureReason
+                    )
+                ) {
+                    Close(1007, failureReason, true);
+                    return false;
                 }
-                for (size_t i = 0; i < payload.length(); ++i) {
-                    frame.push_back(payload[i] ^ maskingKey[i % 4]);
+                if (!CheckMessageSize(message, maxDecodedMessageSize)) {
+                    return false;
                 }
             }
-            connection->SendData(frame);
+            return true;
+        }
+
+        /**
+         * This method checks the given message received, or the part of
+         * it received so far, against the given maximum message size,
+         * and fails the WebSocket if the message is too large.
+         *
+         * @param[in] message
+         *     This is the message to check.
+         *
+         * @param[in] maxSize
+         *     This is the maximum size of the message, or zero if
+         *     there is no limit.
+         *
+         * @return
+         *     An indication of whether or not the message is within
+         *     the maximum message size is returned.
+         */
+        bool CheckMessageSize(
+            const std::string& message,
+            size_t maxSize
+        ) {
+            if (
+                (maxSize > 0)
+                && (message.length() > maxSize)
+            ) {
+                Close(1009, "message too large", true);
+                return false;
+            }
+            return true;
         }
 
         /**
@@ -533,9 +2267,24 @@ namespace WebSockets {
             if (closeReceived) {
                 return;
             }
+            const auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+            lastFrameReceivedTime.store(now, std::memory_order_relaxed);
+            if (firstFrameReceivedTime.load(std::memory_order_relaxed) == 0) {
+                firstFrameReceivedTime.store(now, std::memory_order_relaxed);
+            }
             const bool fin = ((frameReassemblyBuffer[0] & FIN) != 0);
-            const uint8_t reservedBits = ((frameReassemblyBuffer[0] >> 4) & 0x07);
-            if (reservedBits != 0) {
+            const uint8_t reservedBits = (frameReassemblyBuffer[0] & RESERVED_BITS);
+            const uint8_t opcode = (frameReassemblyBuffer[0] & 0x0F);
+            if (
+                (reservedBits != 0)
+                && (
+                    ((reservedBits & ~extensionReservedBits) != 0)
+                    || (
+                        (opcode != OPCODE_TEXT)
+                        && (opcode != OPCODE_BINARY)
+                    )
+                )
+            ) {
                 Close(1002, "reserved bits set", true);
                 return;
             }
@@ -551,7 +2300,6 @@ namespace WebSockets {
                     return;
                 }
             }
-            const uint8_t opcode = (frameReassemblyBuffer[0] & 0x0F);
             std::string data;
             if (role == Role::Server) {
                 data.resize(payloadLength);
@@ -570,15 +2318,29 @@ namespace WebSockets {
             switch (opcode) {
                 case OPCODE_CONTINUATION: {
                     messageReassemblyBuffer += data;
+                    if (
+                        (receiving != FragmentedMessageType::None)
+                        && !CheckMessageSize(messageReassemblyBuffer, configuration.maxMessageSize)
+                    ) {
+                        receiving = FragmentedMessageType::None;
+                        messageReassemblyBuffer.clear();
+                        return;
+                    }
                     switch (receiving) {
                         case FragmentedMessageType::Text: {
-                            if (fin) {
+                            if (
+                                fin
+                                && DecodeMessage(messageReassemblyBuffer)
+                            ) {
                                 OnTextMessage(std::move(messageReassemblyBuffer));
                             }
                         } break;
 
                         case FragmentedMessageType::Binary: {
-                            if (fin) {
+                            if (
+                                fin
+                                && DecodeMessage(messageReassemblyBuffer)
+                            ) {
                                 OnBinaryMessage(std::move(messageReassemblyBuffer));
                             }
                         } break;
@@ -596,8 +2358,11 @@ namespace WebSockets {
 
                 case OPCODE_TEXT: {
                     if (receiving == FragmentedMessageType::None) {
+                        receivingReservedBits = reservedBits;
                         if (fin) {
-                            OnTextMessage(std::move(data));
+                            if (DecodeMessage(data)) {
+                                OnTextMessage(std::move(data));
+                            }
                         } else {
                             receiving = FragmentedMessageType::Text;
                             messageReassemblyBuffer = data;
@@ -609,8 +2374,11 @@ namespace WebSockets {
 
                 case OPCODE_BINARY: {
                     if (receiving == FragmentedMessageType::None) {
+                        receivingReservedBits = reservedBits;
                         if (fin) {
-                            OnBinaryMessage(std::move(data));
+                            if (DecodeMessage(data)) {
+                                OnBinaryMessage(std::move(data));
+                            }
                         } else {
                             receiving = FragmentedMessageType::Binary;
                             messageReassemblyBuffer = data;
@@ -647,18 +2415,21 @@ namespace WebSockets {
                 } break;
 
                 case OPCODE_PING: {
-                    SendFrame(true, OPCODE_PONG, data);
+                    QueueControlFrame(OPCODE_PONG, data);
                     Event event;
                     event.type = Event::Type::Ping;
                     event.content = std::move(data);
-                    eventQueue.push(std::move(event));
+                    QueueEvent(std::move(event));
                 } break;
 
                 case OPCODE_PONG: {
+                    if (configuration.measureRoundTripTimes) {
+                        MeasureRoundTrip(data);
+                    }
                     Event event;
                     event.type = Event::Type::Pong;
                     event.content = std::move(data);
-                    eventQueue.push(std::move(event));
+                    QueueEvent(std::move(event));
                 } break;
 
                 default: {
@@ -677,7 +2448,7 @@ namespace WebSockets {
         void ReceiveData(
             const std::vector< uint8_t >& data
         ) {
-            std::lock_guard< decltype(mutex) > lock(mutex);
+            std::lock_guard< decltype(receiveMutex) > lock(receiveMutex);
             if (connection == nullptr) {
                 return;
             }
@@ -749,7 +2520,7 @@ namespace WebSockets {
          * the remote peer.
          */
         void ConnectionBroken() {
-            std::lock_guard< decltype(mutex) > lock(mutex);
+            std::lock_guard< decltype(receiveMutex) > lock(receiveMutex);
             if (connection == nullptr) {
                 return;
             }
@@ -779,8 +2550,65 @@ namespace WebSockets {
     }
 
     void WebSocket::Configure(Configuration configuration) {
-        std::lock_guard< decltype(impl_->mutex) > lock(impl_->mutex);
-        impl_->configuration = configuration;
+        {
+            std::lock(impl_->sendMutex, impl_->receiveMutex, impl_->eventMutex);
+            std::lock_guard< decltype(impl_->sendMutex) > sendLock(impl_->sendMutex, std::adopt_lock);
+            std::lock_guard< decltype(impl_->receiveMutex) > receiveLock(impl_->receiveMutex, std::adopt_lock);
+            std::lock_guard< decltype(impl_->eventMutex) > eventLock(impl_->eventMutex, std::adopt_lock);
+            impl_->configuration = configuration;
+        }
+        impl_->SendQueuedControlActions();
+    }
+
+    auto WebSocket::GetCompressionStatistics() -> CompressionStatistics {
+        CompressionStatistics statistics;
+        statistics.messagesCompressed = impl_->messagesCompressed.load(std::memory_order_relaxed);
+        statistics.messagesNotCompressed = impl_->messagesNotCompressed.load(std::memory_order_relaxed);
+        statistics.octetsBeforeCompression = impl_->octetsBeforeCompression.load(std::memory_order_relaxed);
+        statistics.octetsAfterCompression = impl_->octetsAfterCompression.load(std::memory_order_relaxed);
+        statistics.compressionTime = std::chrono::nanoseconds(
+            impl_->compressionTime.load(std::memory_order_relaxed)
+        );
+        statistics.recentCompressionRatio = impl_->recentCompressionRatio.load(std::memory_order_relaxed);
+        if (impl_->perMessageDeflate != nullptr) {
+            statistics.memoryInUse = impl_->perMessageDeflate->GetMemoryInUse();
+            statistics.peakMemoryInUse = impl_->perMessageDeflate->GetPeakMemoryInUse();
+        }
+        return statistics;
+    }
+
+    std::string WebSocket::GetSubprotocol() {
+        return impl_->subprotocol;
+    }
+
+    auto WebSocket::GetEventBufferStatistics() -> EventBufferStatistics {
+        std::lock_guard< decltype(impl_->eventMutex) > lock(impl_->eventMutex);
+        return impl_->eventBufferStatistics;
+    }
+
+    auto WebSocket::GetActivityTimes() -> ActivityTimes {
+        ActivityTimes times;
+        times.firstFrameSent += std::chrono::steady_clock::duration(
+            impl_->firstFrameSentTime.load(std::memory_order_relaxed)
+        );
+        times.firstFrameReceived += std::chrono::steady_clock::duration(
+            impl_->firstFrameReceivedTime.load(std::memory_order_relaxed)
+        );
+        times.lastFrameReceived += std::chrono::steady_clock::duration(
+            impl_->lastFrameReceivedTime.load(std::memory_order_relaxed)
+        );
+        times.closeSent += std::chrono::steady_clock::duration(
+            impl_->closeSentTime.load(std::memory_order_relaxed)
+        );
+        times.closed += std::chrono::steady_clock::duration(
+            impl_->closedTime.load(std::memory_order_relaxed)
+        );
+        return times;
+    }
+
+    auto WebSocket::GetRoundTripTimes() -> RoundTripTimes {
+        std::lock_guard< decltype(impl_->roundTripMutex) > lock(impl_->roundTripMutex);
+        return impl_->roundTripTimes;
     }
 
     void WebSocket::StartOpenAsClient(
@@ -793,35 +2621,48 @@ namespace WebSockets {
             std::string(nonce, sizeof(nonce))
         );
         request.headers.SetHeader("Sec-WebSocket-Key", impl_->key);
+        impl_->offeredExtensions = impl_->MakeExtensions();
+        if (!impl_->offeredExtensions.empty()) {
+            std::vector< std::string > offers;
+            for (const auto& extension: impl_->offeredExtensions) {
+                ExtensionElement offer;
+                offer.name = extension->GetName();
+                offer.parameters = extension->MakeOffer();
+                offers.push_back(FormatExtensionElement(offer));
+            }
+            request.headers.SetHeader("Sec-WebSocket-Extensions", offers, true);
+        }
+        if (!impl_->configuration.subprotocols.empty()) {
+            request.headers.SetHeader(
+                "Sec-WebSocket-Protocol",
+                impl_->configuration.subprotocols,
+                true
+            );
+        }
         request.headers.SetHeader("Upgrade", "websocket");
         auto connectionTokens = request.headers.GetHeaderTokens("Connection");
         connectionTokens.push_back("upgrade");
         request.headers.SetHeader("Connection", connectionTokens, true);
+        Impl::SendLock lock(*impl_);
+        impl_->opening = true;
     }
 
     bool WebSocket::FinishOpenAsClient(
         std::shared_ptr< Http::Connection > connection,
-        const Http::Response& response
+        const Http::Response& response,
+        const std::string& trailer
     ) {
-        if (response.statusCode != 101) {
-            return false;
-        }
-        if (!response.headers.HasHeaderToken("Connection", "upgrade")) {
-            return false;
-        }
-        if (SystemAbstractions::ToLower(response.headers.GetHeaderValue("Upgrade")) != "websocket") {
-            return false;
-        }
-        if (response.headers.GetHeaderValue("Sec-WebSocket-Accept") != ComputeKeyAnswer(impl_->key)) {
-            return false;
-        }
-        if (!response.headers.GetHeaderTokens("Sec-WebSocket-Extensions").empty()) {
-            return false;
-        }
-        if (!response.headers.GetHeaderTokens("Sec-WebSocket-Protocol").empty()) {
+        if (!impl_->AcceptUpgradeAsClient(response)) {
+            impl_->DiscardEarlySends();
             return false;
         }
         Open(connection, Role::Client);
+        impl_->SendEarlySends();
+        if (!trailer.empty()) {
+            impl_->ReceiveData(std::vector< uint8_t >(trailer.begin(), trailer.end()));
+        }
+        impl_->SendQueuedControlActions();
+        impl_->ProcessEventQueue();
         return true;
     }
 
@@ -845,25 +2686,85 @@ namespace WebSockets {
             response.reasonPhrase = "Bad Request";
             return false;
         }
-        if (!trailer.empty()) {
-            response.statusCode = 400;
-            response.reasonPhrase = "Bad Request";
-            return false;
-        }
         impl_->key = request.headers.GetHeaderValue("Sec-WebSocket-Key");
-        if (Base64::Decode(impl_->key).length() != REQUIRED_WEBSOCKET_KEY_LENGTH) {
+        if (!IsValidHandshakeKey(impl_->key)) {
             response.statusCode = 400;
             response.reasonPhrase = "Bad Request";
             return false;
         }
+        auto availableExtensions = impl_->MakeExtensions();
+        if (!availableExtensions.empty()) {
+            std::vector< std::shared_ptr< Extension > > negotiatedExtensions;
+            std::vector< std::string > extensionResponses;
+            uint8_t claimedReservedBits = 0;
+            const auto elements = ParseExtensionElements(
+                request.headers.GetHeaderTokens("Sec-WebSocket-Extensions")
+            );
+            for (const auto& element: elements) {
+                for (auto& extension: availableExtensions) {
+                    if (
+                        (extension == nullptr)
+                        || (SystemAbstractions::ToLower(extension->GetName()) != element.name)
+                    ) {
+                        continue;
+                    }
+                    ExtensionElement extensionResponse;
+                    if (
+                        ((extension->GetReservedBits() & claimedReservedBits) == 0)
+                        && extension->NegotiateAsServer(
+                            element.parameters,
+                            extensionResponse.parameters
+                        )
+                    ) {
+                        extensionResponse.name = extension->GetName();
+                        extensionResponses.push_back(
+                            FormatExtensionElement(extensionResponse)
+                        );
+                        claimedReservedBits |= extension->GetReservedBits();
+                        negotiatedExtensions.push_back(std::move(extension));
+                    }
+                    break;
+                }
+            }
+            if (!extensionResponses.empty()) {
+                response.headers.SetHeader(
+                    "Sec-WebSocket-Extensions",
+                    extensionResponses,
+                    true
+                );
+            }
+            impl_->SetExtensions(negotiatedExtensions);
+        }
+        if (!impl_->configuration.subprotocols.empty()) {
+            const auto offeredSubprotocols = request.headers.GetHeaderTokens("Sec-WebSocket-Protocol");
+            for (const auto& subprotocol: impl_->configuration.subprotocols) {
+                if (
+                    std::find(
+                        offeredSubprotocols.begin(),
+                        offeredSubprotocols.end(),
+                        subprotocol
+                    ) != offeredSubprotocols.end()
+                ) {
+                    impl_->subprotocol = subprotocol;
+                    response.headers.SetHeader("Sec-WebSocket-Protocol", subprotocol);
+                    break;
+                }
+            }
+        }
         auto connectionTokens = response.headers.GetHeaderTokens("Connection");
         connectionTokens.push_back("upgrade");
         response.statusCode = 101;
         response.reasonPhrase = "Switching Protocols";
         response.headers.SetHeader("Connection", connectionTokens, true);
         response.headers.SetHeader("Upgrade", "websocket");
-        response.headers.SetHeader("Sec-WebSocket-Accept", ComputeKeyAnswer(impl_->key));
+        char answer[HANDSHAKE_ANSWER_LENGTH];
+        ComputeHandshakeAnswer(impl_->key.data(), answer);
+        response.headers.SetHeader("Sec-WebSocket-Accept", std::string(answer, HANDSHAKE_ANSWER_LENGTH));
         Open(connection, Role::Server);
+        if (!trailer.empty()) {
+            impl_->ReceiveData(std::vector< uint8_t >(trailer.begin(), trailer.end()));
+            impl_->ProcessEventQueue();
+        }
         return true;
     }
 
@@ -881,6 +2782,7 @@ namespace WebSockets {
                 const auto impl = implWeak.lock();
                 if (impl) {
                     impl->ReceiveData(data);
+                    impl->SendQueuedControlActions();
                     impl->ProcessEventQueue();
                 }
             }
@@ -890,6 +2792,7 @@ namespace WebSockets {
                 const auto impl = implWeak.lock();
                 if (impl) {
                     impl->ConnectionBroken();
+                    impl->SendQueuedControlActions();
                     impl->ProcessEventQueue();
                 }
             }
@@ -900,17 +2803,17 @@ namespace WebSockets {
         unsigned int code,
         const std::string reason
     ) {
-        std::unique_lock< decltype(impl_->mutex) > lock(impl_->mutex);
         if (impl_->connection == nullptr) {
+            impl_->DiscardEarlySends();
             return;
         }
         impl_->Close(code, reason);
-        lock.unlock();
+        impl_->SendQueuedControlActions();
         impl_->ProcessEventQueue();
     }
 
     void WebSocket::Ping(const std::string& data) {
-        std::unique_lock< decltype(impl_->mutex) > lock(impl_->mutex);
+        Impl::SendLock lock(*impl_);
         if (impl_->connection == nullptr) {
             return;
         }
@@ -920,13 +2823,20 @@ namespace WebSockets {
         if (data.length() > MAX_CONTROL_FRAME_DATA_LENGTH) {
             return;
         }
-        impl_->SendFrame(true, OPCODE_PING, data);
-        lock.unlock();
+        if (
+            data.empty()
+            && impl_->configuration.measureRoundTripTimes
+        ) {
+            impl_->SendFrame(true, OPCODE_PING, impl_->MakeRoundTripPing());
+        } else {
+            impl_->SendFrame(true, OPCODE_PING, data);
+        }
+        lock.Unlock();
         impl_->ProcessEventQueue();
     }
 
     void WebSocket::Pong(const std::string& data) {
-        std::unique_lock< decltype(impl_->mutex) > lock(impl_->mutex);
+        Impl::SendLock lock(*impl_);
         if (impl_->connection == nullptr) {
             return;
         }
@@ -937,72 +2847,76 @@ namespace WebSockets {
             return;
         }
         impl_->SendFrame(true, OPCODE_PONG, data);
-        lock.unlock();
+        lock.Unlock();
         impl_->ProcessEventQueue();
     }
 
     void WebSocket::SendText(
         const std::string& data,
-        bool lastFragment
+        bool lastFragment,
+        Compression compression
     ) {
-        std::unique_lock< decltype(impl_->mutex) > lock(impl_->mutex);
-        if (impl_->connection == nullptr) {
-            return;
-        }
-        if (impl_->closeSent) {
-            return;
-        }
-        if (impl_->sending == FragmentedMessageType::Binary) {
-            return;
-        }
-        const auto opcode = (
-            (impl_->sending == FragmentedMessageType::Text)
-            ? OPCODE_CONTINUATION
-            : OPCODE_TEXT
-        );
-        impl_->SendFrame(lastFragment, opcode, data);
-        impl_->sending = (
-            lastFragment
-            ? FragmentedMessageType::None
-            : FragmentedMessageType::Text
-        );
-        lock.unlock();
-        impl_->ProcessEventQueue();
+        impl_->SendMessage(FragmentedMessageType::Text, data, lastFragment, compression, nullptr);
     }
 
     void WebSocket::SendBinary(
         const std::string& data,
-        bool lastFragment
+        bool lastFragment,
+        Compression compression
     ) {
-        std::unique_lock< decltype(impl_->mutex) > lock(impl_->mutex);
-        if (impl_->connection == nullptr) {
-            return;
-        }
-        if (impl_->closeSent) {
-            return;
-        }
-        if (impl_->sending == FragmentedMessageType::Text) {
-            return;
-        }
-        const auto opcode = (
-            (impl_->sending == FragmentedMessageType::Binary)
-            ? OPCODE_CONTINUATION
-            : OPCODE_BINARY
+        impl_->SendMessage(FragmentedMessageType::Binary, data, lastFragment, compression, nullptr);
+    }
+
+    void WebSocket::SendText(
+        const std::string& data,
+        bool lastFragment,
+        Compression compression,
+        SentDelegate sentDelegate
+    ) {
+        impl_->SendMessage(
+            FragmentedMessageType::Text,
+            data,
+            lastFragment,
+            compression,
+            std::move(sentDelegate)
         );
-        impl_->SendFrame(lastFragment, opcode, data);
-        impl_->sending = (
-            lastFragment
-            ? FragmentedMessageType::None
-            : FragmentedMessageType::Binary
+    }
+
+    void WebSocket::SendBinary(
+        const std::string& data,
+        bool lastFragment,
+        Compression compression,
+        SentDelegate sentDelegate
+    ) {
+        impl_->SendMessage(
+            FragmentedMessageType::Binary,
+            data,
+            lastFragment,
+            compression,
+            std::move(sentDelegate)
         );
-        lock.unlock();
-        impl_->ProcessEventQueue();
+    }
+
+    void WebSocket::BroadcastText(
+        const std::vector< std::shared_ptr< WebSocket > >& recipients,
+        const std::string& data,
+        Compression compression
+    ) {
+        Impl::Broadcast(recipients, OPCODE_TEXT, data, compression);
+    }
+
+    void WebSocket::BroadcastBinary(
+        const std::vector< std::shared_ptr< WebSocket > >& recipients,
+        const std::string& data,
+        Compression compression
+    ) {
+        Impl::Broadcast(recipients, OPCODE_BINARY, data, compression);
     }
 
     void WebSocket::SetDelegates(Delegates&& delegates) {
-        std::unique_lock< decltype(impl_->mutex) > lock(impl_->mutex);
-        impl_->delegates = std::move(delegates);
-        impl_->delegatesSet = true;
+        std::shared_ptr< const Delegates > newDelegates = std::make_shared< const Delegates >(std::move(delegates));
+        std::unique_lock< decltype(impl_->eventMutex) > lock(impl_->eventMutex);
+        impl_->delegates.swap(newDelegates);
         lock.unlock();
         impl_->ProcessEventQueue();
     }
@@ -0,0 +1,305 @@
+/**
+ * @file ConnectionPoolTests.cpp
+ *
+ * This module contains the unit tests of the
+ * WebSockets::ConnectionPool class.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <Base64/Base64.hpp>
+#include <chrono>
+#include <functional>
+#include <gtest/gtest.h>
+#include <Hash/Sha1.hpp>
+#include <Hash/Templates.hpp>
+#include <Http/Connection.hpp>
+#include <Http/IClient.hpp>
+#include <memory>
+#include <stddef.h>
+#include <string>
+#include <SystemAbstractions/DiagnosticsSender.hpp>
+#include <vector>
+#include <WebSockets/ConnectionPool.hpp>
+#include <WebSockets/WebSocket.hpp>
+
+namespace {
+
+    /**
+     * This is a fake client connection which is used to test.
+     */
+    struct MockConnection
+        : public Http::Connection
+    {
+        // Properties
+
+        DataReceivedDelegate dataReceivedDelegate;
+        BrokenDelegate brokenDelegate;
+        std::string webSocketOutput;
+
+        // Http::Connection
+
+        virtual std::string GetPeerAddress() override {
+            return "mock-server";
+        }
+
+        virtual std::string GetPeerId() override {
+            return "mock-server:1234";
+        }
+
+        virtual void SetDataReceivedDelegate(DataReceivedDelegate newDataReceivedDelegate) override {
+            dataReceivedDelegate = newDataReceivedDelegate;
+        }
+
+        virtual void SetBrokenDelegate(BrokenDelegate newBrokenDelegate) override {
+            brokenDelegate = newBrokenDelegate;
+        }
+
+        virtual void SendData(const std::vector< uint8_t >& data) override {
+            (void)webSocketOutput.insert(
+                webSocketOutput.end(),
+                data.begin(),
+                data.end()
+            );
+        }
+
+        virtual void Break(bool clean) override {
+        }
+    };
+
+    /**
+     * This is a fake HTTP client transaction which is used to test.
+     */
+    struct MockClientTransaction
+        : public Http::IClient::Transaction
+    {
+        // Http::IClient::Transaction
+
+        virtual bool AwaitCompletion(
+            const std::chrono::milliseconds& relativeTime
+        ) override {
+            return true;
+        }
+
+        virtual void AwaitCompletion() override {
+        }
+
+        virtual void SetCompletionDelegate(
+            std::function< void() > completionDelegate
+        ) override {
+            if (state != State::InProgress) {
+                completionDelegate();
+            }
+        }
+    };
+
+    /**
+     * This is a fake HTTP client which is used to test.  It upgrades
+     * every request at once, unless told to leave requests unanswered.
+     */
+    struct MockClient
+        : public Http::IClient
+    {
+        // Properties
+
+        std::vector< std::shared_ptr< MockConnection > > connections;
+        bool answerRequests = true;
+
+        // Http::IClient
+
+        virtual SystemAbstractions::DiagnosticsSender::UnsubscribeDelegate SubscribeToDiagnostics(
+            SystemAbstractions::DiagnosticsSender::DiagnosticMessageDelegate delegate,
+            size_t minLevel = 0
+        ) override {
+            return []{};
+        }
+
+        virtual std::shared_ptr< Transaction > Request(
+            Http::Request request,
+            bool persistConnection = true,
+            UpgradeDelegate upgradeDelegate = nullptr
+        ) override {
+            const auto transaction = std::make_shared< MockClientTransaction >();
+            if (!answerRequests) {
+                transaction->state = Http::IClient::Transaction::State::InProgress;
+                return transaction;
+            }
+            const auto connection = std::make_shared< MockConnection >();
+            connections.push_back(connection);
+            transaction->state = Http::IClient::Transaction::State::Completed;
+            transaction->response.statusCode = 101;
+            transaction->response.headers.SetHeader("Connection", "upgrade");
+            transaction->response.headers.SetHeader("Upgrade", "websocket");
+            transaction->response.headers.SetHeader(
+                "Sec-WebSocket-Accept",
+                Base64::Encode(
+                    Hash::StringToBytes< Hash::Sha1 >(
+                        request.headers.GetHeaderValue("Sec-WebSocket-Key")
+                        + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+                    )
+                )
+            );
+            if (upgradeDelegate != nullptr) {
+                upgradeDelegate(transaction->response, connection, "");
+            }
+            return transaction;
+        }
+    };
+
+}
+
+/**
+ * This is the test fixture for these tests, providing common
+ * setup and teardown for each test.
+ */
+struct ConnectionPoolTests
+    : public ::testing::Test
+{
+    // Properties
+
+    WebSockets::ConnectionPool pool;
+    std::shared_ptr< MockClient > mockClient = std::make_shared< MockClient >();
+    std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender = std::make_shared< SystemAbstractions::DiagnosticsSender >("ConnectionPool");
+    WebSockets::Endpoint upstream;
+
+    // ::testing::Test
+
+    virtual void SetUp() {
+        upstream.host = "upstream";
+        upstream.port = 1234;
+        WebSockets::ConnectionPool::Configuration configuration;
+        configuration.warmConnections = 2;
+        pool.Start(mockClient, diagnosticsSender, configuration);
+    }
+
+    virtual void TearDown() {
+        pool.Stop();
+    }
+
+    // Methods
+
+    std::shared_ptr< WebSockets::WebSocket > Acquire() {
+        std::shared_ptr< WebSockets::WebSocket > acquired;
+        pool.Acquire(
+            upstream,
+            [&acquired](std::shared_ptr< WebSockets::WebSocket > ws){
+                acquired = ws;
+            }
+        );
+        return acquired;
+    }
+};
+
+TEST_F(ConnectionPoolTests, HandOutWarmConnectionAndReplaceIt) {
+    pool.AddUpstream(upstream);
+    ASSERT_EQ(2, mockClient->connections.size());
+    EXPECT_EQ(2, pool.GetStatistics().idleConnections);
+    EXPECT_FALSE(Acquire() == nullptr);
+    EXPECT_EQ(3, mockClient->connections.size());
+    const auto statistics = pool.GetStatistics();
+    EXPECT_EQ(1, statistics.hits);
+    EXPECT_EQ(0, statistics.misses);
+    EXPECT_EQ(1.0, statistics.hitRate);
+    EXPECT_EQ(2, statistics.idleConnections);
+    EXPECT_EQ(3, statistics.connectionsMade);
+}
+
+TEST_F(ConnectionPoolTests, AcquireWithoutWarmConnectionIsMiss) {
+    EXPECT_FALSE(Acquire() == nullptr);
+    EXPECT_EQ(3, mockClient->connections.size());
+    auto statistics = pool.GetStatistics();
+    EXPECT_EQ(0, statistics.hits);
+    EXPECT_EQ(1, statistics.misses);
+    EXPECT_EQ(0.0, statistics.hitRate);
+    EXPECT_EQ(2, statistics.idleConnections);
+    EXPECT_EQ(2, statistics.connectionsMade);
+    EXPECT_FALSE(Acquire() == nullptr);
+    statistics = pool.GetStatistics();
+    EXPECT_EQ(1, statistics.hits);
+    EXPECT_EQ(0.5, statistics.hitRate);
+}
+
+TEST_F(ConnectionPoolTests, ReplaceConnectionNotAnsweringPing) {
+    pool.AddUpstream(upstream);
+    ASSERT_EQ(2, mockClient->connections.size());
+    pool.CheckHealth();
+    for (const auto& connection: mockClient->connections) {
+        ASSERT_GE(connection->webSocketOutput.length(), 2);
+        EXPECT_EQ("\x89\x80", connection->webSocketOutput.substr(0, 2));
+    }
+    const std::string pong = "\x8A\x00";
+    mockClient->connections[0]->dataReceivedDelegate({pong.begin(), pong.begin() + 2});
+    pool.CheckHealth();
+    EXPECT_EQ(3, mockClient->connections.size());
+    const auto statistics = pool.GetStatistics();
+    EXPECT_EQ(1, statistics.healthChecksFailed);
+    EXPECT_EQ(2, statistics.idleConnections);
+}
+
+TEST_F(ConnectionPoolTests, ReplaceConnectionLostWhileIdle) {
+    pool.AddUpstream(upstream);
+    ASSERT_EQ(2, mockClient->connections.size());
+    mockClient->connections[1]->brokenDelegate(false);
+    pool.CheckHealth();
+    EXPECT_EQ(3, mockClient->connections.size());
+    const auto statistics = pool.GetStatistics();
+    EXPECT_EQ(1, statistics.connectionsLost);
+    EXPECT_EQ(2, statistics.idleConnections);
+}
+
+TEST_F(ConnectionPoolTests, HandOutWarmConnectionInsteadOfOneLostWhileIdle) {
+    pool.AddUpstream(upstream);
+    ASSERT_EQ(2, mockClient->connections.size());
+    mockClient->connections[0]->brokenDelegate(false);
+    const auto ws = Acquire();
+    ASSERT_FALSE(ws == nullptr);
+    const auto statistics = pool.GetStatistics();
+    EXPECT_EQ(1, statistics.hits);
+    EXPECT_EQ(1, statistics.connectionsLost);
+    EXPECT_EQ(2, statistics.idleConnections);
+    ws->SendText("Hello");
+    EXPECT_TRUE(mockClient->connections[0]->webSocketOutput.empty());
+    EXPECT_FALSE(mockClient->connections[1]->webSocketOutput.empty());
+}
+
+TEST_F(ConnectionPoolTests, MessagesReceivedWhileIdleReportedOnceDelegatesSet) {
+    pool.AddUpstream(upstream);
+    ASSERT_EQ(2, mockClient->connections.size());
+    pool.CheckHealth();
+    const std::string frames = std::string("\x8A\x00", 2) + "\x81\x05Hello";
+    mockClient->connections[0]->dataReceivedDelegate({frames.begin(), frames.end()});
+    pool.CheckHealth();
+    EXPECT_EQ(1, pool.GetStatistics().healthChecksFailed);
+    const auto ws = Acquire();
+    ASSERT_FALSE(ws == nullptr);
+    std::vector< std::string > texts;
+    size_t pongs = 0;
+    WebSockets::WebSocket::Delegates delegates;
+    delegates.text = [&texts](std::string&& data){
+        texts.push_back(std::move(data));
+    };
+    delegates.pong = [&pongs](std::string&& data){
+        ++pongs;
+    };
+    ws->SetDelegates(std::move(delegates));
+    EXPECT_EQ(std::vector< std::string >{"Hello"}, texts);
+    EXPECT_EQ(1, pongs);
+}
+
+TEST_F(ConnectionPoolTests, StopAbortsConnectionMadeForAcquire) {
+    mockClient->answerRequests = false;
+    bool completed = false;
+    std::shared_ptr< WebSockets::WebSocket > acquired;
+    pool.Acquire(
+        upstream,
+        [&completed, &acquired](std::shared_ptr< WebSockets::WebSocket > ws){
+            completed = true;
+            acquired = ws;
+        }
+    );
+    EXPECT_FALSE(completed);
+    EXPECT_EQ(1, pool.GetStatistics().misses);
+    pool.Stop();
+    EXPECT_TRUE(completed);
+    EXPECT_TRUE(acquired == nullptr);
+}
@@ -0,0 +1,224 @@
+/**
+ * @file CoroutinesTests.cpp
+ *
+ * This module contains the unit tests of the
+ * WebSockets::AsyncWebSocket class.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <WebSockets/Coroutines.hpp>
+
+#if !defined(__cpp_impl_coroutine) && defined(WEB_SOCKETS_REQUIRE_COROUTINES)
+#error "These tests must be compiled with C++20 coroutine support."
+#endif
+
+#if defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <gtest/gtest.h>
+#include <Http/Connection.hpp>
+#include <memory>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <WebSockets/WebSocket.hpp>
+
+namespace {
+
+    /**
+     * This is a fake client connection which is used to test WebSockets.
+     */
+    struct MockConnection
+        : public Http::Connection
+    {
+        // Properties
+
+        /**
+         * This is the delegate to call in order to simulate data coming
+         * into the WebSocket from the remote peer.
+         */
+        DataReceivedDelegate dataReceivedDelegate;
+
+        /**
+         * This holds onto a copy of all data sent by the WebSocket
+         * to the remote peer.
+         */
+        std::string webSocketOutput;
+
+        /**
+         * If set, this is called whenever the WebSocket sends data
+         * to the remote peer, before the data is recorded.
+         */
+        std::function< void() > sendDataHook;
+
+        // Http::Connection
+
+        virtual std::string GetPeerAddress() override {
+            return "mock-client";
+        }
+
+        virtual std::string GetPeerId() override {
+            return "mock-client:5555";
+        }
+
+        virtual void SetDataReceivedDelegate(DataReceivedDelegate newDataReceivedDelegate) override {
+            dataReceivedDelegate = newDataReceivedDelegate;
+        }
+
+        virtual void SetBrokenDelegate(BrokenDelegate newBrokenDelegate) override {
+        }
+
+        virtual void SendData(const std::vector< uint8_t >& data) override {
+            if (sendDataHook != nullptr) {
+                const auto hook = std::move(sendDataHook);
+                sendDataHook = nullptr;
+                hook();
+            }
+            (void)webSocketOutput.insert(
+                webSocketOutput.end(),
+                data.begin(),
+                data.end()
+            );
+        }
+
+        virtual void Break(bool clean) override {
+        }
+    };
+
+    /**
+     * This is the simplest type of coroutine, which starts at once
+     * and runs until finished without anything waiting for it.
+     */
+    struct Task {
+        struct promise_type {
+            Task get_return_object() { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+    };
+
+}
+
+/**
+ * This is the test fixture for these tests, providing common
+ * setup and teardown for each test.
+ */
+struct CoroutinesTests
+    : public ::testing::Test
+{
+    // Properties
+
+    /**
+     * This is the connection used by the WebSocket under test.
+     */
+    std::shared_ptr< MockConnection > connection = std::make_shared< MockConnection >();
+
+    /**
+     * This is the WebSocket wrapped by the unit under test.
+     */
+    std::shared_ptr< WebSockets::WebSocket > ws = std::make_shared< WebSockets::WebSocket >();
+
+    // ::testing::Test
+
+    virtual void SetUp() {
+        ws->Open(connection, WebSockets::WebSocket::Role::Client);
+    }
+
+    virtual void TearDown() {
+    }
+
+    // Methods
+
+    /**
+     * This method simulates receiving the given unmasked frame
+     * from the remote peer.
+     *
+     * @param[in] frame
+     *     This is the frame to receive.
+     */
+    void Receive(const std::string& frame) {
+        connection->dataReceivedDelegate({frame.begin(), frame.end()});
+    }
+};
+
+TEST_F(CoroutinesTests, ReceiveMessages) {
+    WebSockets::AsyncWebSocket asyncWs(ws);
+    Receive("\x81\x03" "foo");
+    std::vector< std::string > received;
+    bool finished = false;
+    const auto coroutine = [&]() -> Task {
+        for (;;) {
+            const auto message = co_await asyncWs.ReceiveMessage();
+            switch (message.type) {
+                case WebSockets::AsyncWebSocket::ReceivedMessage::Type::Text: {
+                    received.push_back("text:" + message.data);
+                } break;
+
+                case WebSockets::AsyncWebSocket::ReceivedMessage::Type::Binary: {
+                    received.push_back("binary:" + message.data);
+                } break;
+
+                default: {
+                    received.push_back("close:" + std::to_string(message.closeCode) + ":" + message.data);
+                    finished = true;
+                    co_return;
+                }
+            }
+        }
+    };
+    coroutine();
+    EXPECT_EQ(std::vector< std::string >{"text:foo"}, received);
+    Receive("\x82\x03" "bar");
+    EXPECT_EQ((std::vector< std::string >{"text:foo", "binary:bar"}), received);
+    EXPECT_FALSE(finished);
+    Receive(std::string("\x88\x05\x03\xe8" "Bye", 7));
+    EXPECT_EQ(
+        (std::vector< std::string >{"text:foo", "binary:bar", "close:1000:Bye"}),
+        received
+    );
+    EXPECT_TRUE(finished);
+    unsigned int closeCode = 0;
+    const auto receiveAfterClose = [&]() -> Task {
+        closeCode = (co_await asyncWs.ReceiveMessage()).closeCode;
+    };
+    receiveAfterClose();
+    EXPECT_EQ(1000, closeCode);
+}
+
+TEST_F(CoroutinesTests, SendCompletesWhenHandedToConnection) {
+    WebSockets::AsyncWebSocket asyncWs(ws);
+    std::vector< bool > sent;
+    const auto coroutine = [&]() -> Task {
+        sent.push_back(co_await asyncWs.SendText("Hello"));
+        ws->Close(1000);
+        sent.push_back(co_await asyncWs.SendBinary("World"));
+    };
+    coroutine();
+    EXPECT_EQ((std::vector< bool >{true, false}), sent);
+    ASSERT_GE(connection->webSocketOutput.length(), 2);
+    EXPECT_EQ("\x81\x85", connection->webSocketOutput.substr(0, 2));
+}
+
+TEST_F(CoroutinesTests, SendSuspendsWhileAnotherSendIsHandingDataToConnection) {
+    WebSockets::AsyncWebSocket asyncWs(ws);
+    bool resumed = false;
+    const auto coroutine = [&]() -> Task {
+        EXPECT_TRUE(co_await asyncWs.SendBinary("World"));
+        resumed = true;
+    };
+    bool resumedDuringOtherSend = true;
+    connection->sendDataHook = [&]{
+        coroutine();
+        resumedDuringOtherSend = resumed;
+    };
+    ws->SendText("Hello");
+    EXPECT_FALSE(resumedDuringOtherSend);
+    EXPECT_TRUE(resumed);
+}
+
+#endif /* __cpp_impl_coroutine */
@@ -0,0 +1,102 @@
+/**
+ * @file HandshakeKeyTests.cpp
+ *
+ * This module contains the unit tests of the functions which check the
+ * "Sec-WebSocket-Key" header of the opening handshake and compute the
+ * matching "Sec-WebSocket-Accept" header.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <gtest/gtest.h>
+#include <src/HandshakeKey.hpp>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+    /**
+     * This is the SHA-1 state before any blocks are hashed.
+     */
+    const uint32_t SHA1_INITIAL_STATE[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+    /**
+     * This function hashes the given message, which must fit in a single
+     * SHA-1 block once padded, using the given function to hash the block.
+     *
+     * @param[in] compress
+     *     This is the function to use to hash the block.
+     *
+     * @param[in] message
+     *     This is the message to hash.
+     *
+     * @return
+     *     The SHA-1 state after hashing the message is returned.
+     */
+    std::vector< uint32_t > HashOneBlock(
+        WebSockets::Sha1CompressFunction compress,
+        const std::string& message
+    ) {
+        uint8_t block[64] = {0};
+        (void)memcpy(block, message.data(), message.length());
+        block[message.length()] = 0x80;
+        const auto bits = message.length() * 8;
+        block[62] = (uint8_t)(bits >> 8);
+        block[63] = (uint8_t)bits;
+        std::vector< uint32_t > state(SHA1_INITIAL_STATE, SHA1_INITIAL_STATE + 5);
+        compress(state.data(), block);
+        return state;
+    }
+
+    /**
+     * This function checks the given function to hash SHA-1 blocks
+     * against known vectors, including the sample handshake of
+     * [RFC 6455](https://tools.ietf.org/html/rfc6455).
+     *
+     * @param[in] compress
+     *     This is the function to check.
+     */
+    void CheckSha1Compress(WebSockets::Sha1CompressFunction compress) {
+        EXPECT_EQ(
+            (std::vector< uint32_t >{0xda39a3ee, 0x5e6b4b0d, 0x3255bfef, 0x95601890, 0xafd80709}),
+            HashOneBlock(compress, "")
+        );
+        EXPECT_EQ(
+            (std::vector< uint32_t >{0xa9993e36, 0x4706816a, 0xba3e2571, 0x7850c26c, 0x9cd0d89d}),
+            HashOneBlock(compress, "abc")
+        );
+        char answer[WebSockets::HANDSHAKE_ANSWER_LENGTH];
+        WebSockets::ComputeHandshakeAnswer("dGhlIHNhbXBsZSBub25jZQ==", answer, compress);
+        EXPECT_EQ(
+            "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=",
+            std::string(answer, WebSockets::HANDSHAKE_ANSWER_LENGTH)
+        );
+    }
+
+}
+
+TEST(HandshakeKeyTests, Sha1CompressPortable) {
+    CheckSha1Compress(WebSockets::Sha1CompressPortable);
+}
+
+TEST(HandshakeKeyTests, Sha1CompressShaNi) {
+    const auto compress = WebSockets::GetSha1CompressShaNi();
+    if (compress == nullptr) {
+        return;
+    }
+    CheckSha1Compress(compress);
+}
+
+TEST(HandshakeKeyTests, ComputeHandshakeAnswer) {
+    char answer[WebSockets::HANDSHAKE_ANSWER_LENGTH];
+    WebSockets::ComputeHandshakeAnswer("dGhlIHNhbXBsZSBub25jZQ==", answer);
+    EXPECT_EQ(
+        "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=",
+        std::string(answer, WebSockets::HANDSHAKE_ANSWER_LENGTH)
+    );
+    EXPECT_TRUE(WebSockets::IsHandshakeAnswerFor("dGhlIHNhbXBsZSBub25jZQ==", "s3pPLMBiTxaQ9kYGzzhZRbK+xOo="));
+    EXPECT_FALSE(WebSockets::IsHandshakeAnswerFor("dGhlIHNhbXBsZSBub25jZQ==", "s3pPLMBiTxaQ9kYGzzhZRbK+xOp="));
+}
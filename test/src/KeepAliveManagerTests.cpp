@@ -0,0 +1,235 @@
+/**
+ * @file KeepAliveManagerTests.cpp
+ *
+ * This module contains the unit tests of the
+ * WebSockets::KeepAliveManager class.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <chrono>
+#include <functional>
+#include <gtest/gtest.h>
+#include <Http/Connection.hpp>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include <WebSockets/KeepAliveManager.hpp>
+#include <WebSockets/WebSocket.hpp>
+
+namespace {
+
+    /**
+     * This is a fake client connection which is used to test.
+     */
+    struct MockConnection
+        : public Http::Connection
+    {
+        // Properties
+
+        std::mutex mutex;
+        DataReceivedDelegate dataReceivedDelegate;
+        BrokenDelegate brokenDelegate;
+        std::string webSocketOutput;
+        bool broken = false;
+
+        // Methods
+
+        std::string GetWebSocketOutput() {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            return webSocketOutput;
+        }
+
+        bool IsBroken() {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            return broken;
+        }
+
+        // Http::Connection
+
+        virtual std::string GetPeerAddress() override {
+            return "mock-client";
+        }
+
+        virtual std::string GetPeerId() override {
+            return "mock-client:5555";
+        }
+
+        virtual void SetDataReceivedDelegate(DataReceivedDelegate newDataReceivedDelegate) override {
+            dataReceivedDelegate = newDataReceivedDelegate;
+        }
+
+        virtual void SetBrokenDelegate(BrokenDelegate newBrokenDelegate) override {
+            brokenDelegate = newBrokenDelegate;
+        }
+
+        virtual void SendData(const std::vector< uint8_t >& data) override {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            (void)webSocketOutput.insert(
+                webSocketOutput.end(),
+                data.begin(),
+                data.end()
+            );
+        }
+
+        virtual void Break(bool clean) override {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            broken = true;
+        }
+    };
+
+    /**
+     * This function waits up to a second for the given condition to
+     * become true.
+     *
+     * @param[in] condition
+     *     This is the condition for which to wait.
+     *
+     * @return
+     *     An indication of whether or not the condition became true
+     *     is returned.
+     */
+    bool WaitFor(std::function< bool() > condition) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        while (!condition()) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+
+    /**
+     * This is a masked pong frame, as a client would send it.
+     */
+    const std::string PONG_FRAME("\x8A\x80\x00\x00\x00\x00", 6);
+
+    /**
+     * This is the unmasked ping frame sent by a server.
+     */
+    const std::string PING_FRAME("\x89\x00", 2);
+
+}
+
+/**
+ * This is the test fixture for these tests, providing common
+ * setup and teardown for each test.
+ */
+struct KeepAliveManagerTests
+    : public ::testing::Test
+{
+    // Properties
+
+    WebSockets::KeepAliveManager manager;
+    WebSockets::KeepAliveManager::Configuration configuration;
+    std::shared_ptr< WebSockets::WebSocket > ws = std::make_shared< WebSockets::WebSocket >();
+    std::shared_ptr< MockConnection > connection = std::make_shared< MockConnection >();
+    std::mutex mutex;
+    std::vector< unsigned int > closeCodes;
+
+    // Methods
+
+    std::vector< unsigned int > GetCloseCodes() {
+        std::lock_guard< decltype(mutex) > lock(mutex);
+        return closeCodes;
+    }
+
+    void Receive(const std::string& frame) {
+        connection->dataReceivedDelegate({frame.begin(), frame.end()});
+    }
+
+    // ::testing::Test
+
+    virtual void SetUp() {
+        configuration.pingInterval = std::chrono::milliseconds(100);
+        configuration.replyTimeout = std::chrono::milliseconds(50);
+        configuration.tickInterval = std::chrono::milliseconds(1);
+        ws->Open(connection, WebSockets::WebSocket::Role::Server);
+        WebSockets::WebSocket::Delegates delegates;
+        delegates.close = [this](
+            unsigned int code,
+            std::string&& reason
+        ){
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            closeCodes.push_back(code);
+        };
+        ws->SetDelegates(std::move(delegates));
+    }
+
+    virtual void TearDown() {
+        manager.Stop();
+    }
+};
+
+TEST_F(KeepAliveManagerTests, PingIdleWebSocketAndFailItIfNothingReceived) {
+    manager.Start(configuration);
+    manager.Add(ws);
+    ASSERT_TRUE(WaitFor([this]{ return !connection->GetWebSocketOutput().empty(); }));
+    EXPECT_EQ(PING_FRAME, connection->GetWebSocketOutput());
+    ASSERT_TRUE(WaitFor([this]{ return !GetCloseCodes().empty(); }));
+    EXPECT_EQ(std::vector< unsigned int >{1006}, GetCloseCodes());
+    EXPECT_TRUE(connection->IsBroken());
+    ASSERT_TRUE(WaitFor([this]{ return manager.GetStatistics().webSockets == 0; }));
+    const auto statistics = manager.GetStatistics();
+    EXPECT_EQ(1, statistics.pingsSent);
+    EXPECT_EQ(1, statistics.pingTimeouts);
+    EXPECT_EQ(0, statistics.closeTimeouts);
+}
+
+TEST_F(KeepAliveManagerTests, KeepWebSocketWhichAnswersPings) {
+    manager.Start(configuration);
+    manager.Add(ws);
+    for (size_t i = 1; i <= 2; ++i) {
+        ASSERT_TRUE(WaitFor([this, i]{ return connection->GetWebSocketOutput().length() == PING_FRAME.length() * i; }));
+        Receive(PONG_FRAME);
+    }
+    EXPECT_TRUE(GetCloseCodes().empty());
+    const auto statistics = manager.GetStatistics();
+    EXPECT_EQ(1, statistics.webSockets);
+    EXPECT_EQ(2, statistics.pingsSent);
+    EXPECT_EQ(0, statistics.pingTimeouts);
+}
+
+TEST_F(KeepAliveManagerTests, SkipPingsWhileReceiving) {
+    manager.Start(configuration);
+    manager.Add(ws);
+    const auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+    while (std::chrono::steady_clock::now() < end) {
+        Receive(PONG_FRAME);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    EXPECT_TRUE(connection->GetWebSocketOutput().empty());
+    EXPECT_TRUE(GetCloseCodes().empty());
+    const auto statistics = manager.GetStatistics();
+    EXPECT_EQ(0, statistics.pingsSent);
+    EXPECT_GT(statistics.pingsSkipped, 0);
+}
+
+TEST_F(KeepAliveManagerTests, FailWebSocketWhoseCloseReplyIsOverdue) {
+    manager.Start(configuration);
+    manager.Add(ws);
+    ws->Close(1000, "bye");
+    EXPECT_EQ('\x88', connection->GetWebSocketOutput()[0]);
+    ASSERT_TRUE(WaitFor([this]{ return !GetCloseCodes().empty(); }));
+    EXPECT_EQ(std::vector< unsigned int >{1006}, GetCloseCodes());
+    EXPECT_TRUE(connection->IsBroken());
+    ASSERT_TRUE(WaitFor([this]{ return manager.GetStatistics().webSockets == 0; }));
+    EXPECT_EQ(1, manager.GetStatistics().closeTimeouts);
+}
+
+TEST_F(KeepAliveManagerTests, ForgetWebSocketsRemovedOrDestroyed) {
+    const auto otherWs = std::make_shared< WebSockets::WebSocket >();
+    manager.Add(ws);
+    manager.Add(otherWs);
+    manager.Start(configuration);
+    EXPECT_EQ(2, manager.GetStatistics().webSockets);
+    manager.Remove(otherWs);
+    EXPECT_EQ(1, manager.GetStatistics().webSockets);
+    ws = nullptr;
+    ASSERT_TRUE(WaitFor([this]{ return manager.GetStatistics().webSockets == 0; }));
+    EXPECT_TRUE(connection->GetWebSocketOutput().empty());
+}
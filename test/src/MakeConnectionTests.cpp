@@ -13,6 +13,8 @@
 #include <Hash/Templates.hpp>
 #include <Http/Connection.hpp>
 #include <Http/IClient.hpp>
+#include <map>
+#include <mutex>
 #include <SystemAbstractions/DiagnosticsSender.hpp>
 #include <SystemAbstractions/StringExtensions.hpp>
 #include <WebSockets/MakeConnection.hpp>
@@ -104,7 +106,11 @@ namespace {
 
         // Properties
 
+        std::mutex mutex;
         Behaviors behavior = Behaviors::SuccessfulConnection;
+        std::map< std::string, Behaviors > behaviorsByHost;
+        std::string trailer;
+        std::vector< std::string > hostsRequested;
         std::promise< std::shared_ptr< MockConnection > > connectionPromise;
 
         // Methods
@@ -134,7 +140,18 @@ namespace {
             const auto transaction = std::make_shared< MockClientTransaction >();
             const auto connection = std::make_shared< MockConnection >();
             connection->request = request;
-            switch (behavior) {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            const auto host = request.target.GetHost();
+            const auto firstRequest = hostsRequested.empty();
+            hostsRequested.push_back(host);
+            const auto behaviorsByHostEntry = behaviorsByHost.find(host);
+            const auto behaviorForHost = (
+                (behaviorsByHostEntry == behaviorsByHost.end())
+                ? behavior
+                : behaviorsByHostEntry->second
+            );
+            lock.unlock();
+            switch (behaviorForHost) {
                 case Behaviors::SuccessfulConnection: {
                     transaction->state = Http::IClient::Transaction::State::Completed;
                     transaction->response.statusCode = 101;
@@ -151,7 +168,7 @@ namespace {
                     );
                     transaction->response.headers.SetHeader("Sec-WebSocket-Protocol", "");
                     if (upgradeDelegate != nullptr) {
-                        upgradeDelegate(transaction->response, connection, "");
+                        upgradeDelegate(transaction->response, connection, trailer);
                     }
                 } break;
 
@@ -188,7 +205,9 @@ namespace {
                     transaction->awaitCompletionResult = false;
                 } break;
             }
-            connectionPromise.set_value(connection);
+            if (firstRequest) {
+                connectionPromise.set_value(connection);
+            }
             return transaction;
         }
     };
@@ -284,6 +303,35 @@ TEST_F(MakeConnectionTests, SuccessfulConnection) {
     );
 }
 
+TEST_F(MakeConnectionTests, SuccessfulConnectionReceivesFramesInTrailer) {
+    // Arrange
+    mockClient->behavior = MockClient::Behaviors::SuccessfulConnection;
+    mockClient->trailer = "\x81\x05Hello";
+
+    // Act
+    auto results = WebSockets::MakeConnection(
+        mockClient,
+        "foobar",
+        1234,
+        diagnosticsSender
+    );
+    ASSERT_EQ(
+        std::future_status::ready,
+        results.connectionFuture.wait_for(std::chrono::seconds(1))
+    );
+    const auto ws = results.connectionFuture.get();
+    ASSERT_FALSE(ws == nullptr);
+    std::vector< std::string > texts;
+    WebSockets::WebSocket::Delegates delegates;
+    delegates.text = [&texts](std::string&& data){
+        texts.push_back(std::move(data));
+    };
+    ws->SetDelegates(std::move(delegates));
+
+    // Assert
+    EXPECT_EQ(std::vector< std::string >{"Hello"}, texts);
+}
+
 TEST_F(MakeConnectionTests, UpgradeWithoutEngage) {
     // Arrange
     mockClient->behavior = MockClient::Behaviors::UpgradeWithoutEngage;
@@ -452,3 +500,333 @@ TEST_F(MakeConnectionTests, ConnectionAborted) {
         diagnosticMessages
     );
 }
+
+TEST_F(MakeConnectionTests, WebSocketAvailableAtOnceAndIsTheOneConnected) {
+    // Arrange
+    mockClient->behavior = MockClient::Behaviors::SuccessfulConnection;
+
+    // Act
+    auto results = WebSockets::MakeConnection(
+        mockClient,
+        "foobar",
+        1234,
+        diagnosticsSender
+    );
+
+    // Assert
+    ASSERT_FALSE(results.ws == nullptr);
+    ASSERT_EQ(
+        std::future_status::ready,
+        results.connectionFuture.wait_for(std::chrono::seconds(1))
+    );
+    EXPECT_EQ(results.ws, results.connectionFuture.get());
+}
+
+TEST_F(MakeConnectionTests, MessagesSentBeforeConnectionMadeDiscardedIfAborted) {
+    // Arrange
+    mockClient->behavior = MockClient::Behaviors::ConnectionAborted;
+    auto results = WebSockets::MakeConnection(
+        mockClient,
+        "foobar",
+        1234,
+        diagnosticsSender
+    );
+    ASSERT_FALSE(results.ws == nullptr);
+    std::vector< bool > sentResults;
+    results.ws->SendText(
+        "Hello",
+        true,
+        WebSockets::WebSocket::Compression::Auto,
+        [&sentResults](bool sent){ sentResults.push_back(sent); }
+    );
+    EXPECT_TRUE(sentResults.empty());
+
+    // Act
+    results.abortConnection();
+
+    // Assert
+    EXPECT_EQ(std::vector< bool >{false}, sentResults);
+    EXPECT_TRUE(results.connectionFuture.get() == nullptr);
+}
+
+TEST_F(MakeConnectionTests, ConnectionCompletesWithoutWaitingOnAnotherThread) {
+    // Arrange
+    mockClient->behavior = MockClient::Behaviors::SuccessfulConnection;
+
+    // Act
+    auto results = WebSockets::MakeConnection(
+        mockClient,
+        "foobar",
+        1234,
+        diagnosticsSender
+    );
+
+    // Assert
+    ASSERT_EQ(
+        std::future_status::ready,
+        results.connectionFuture.wait_for(std::chrono::seconds(0))
+    );
+    EXPECT_FALSE(results.connectionFuture.get() == nullptr);
+}
+
+TEST_F(MakeConnectionTests, SuccessfulConnectionWithCompleteDelegate) {
+    // Arrange
+    mockClient->behavior = MockClient::Behaviors::SuccessfulConnection;
+    std::vector< std::shared_ptr< WebSockets::WebSocket > > completions;
+
+    // Act
+    const auto abortConnection = WebSockets::MakeConnection(
+        mockClient,
+        "foobar",
+        1234,
+        diagnosticsSender,
+        [&completions](std::shared_ptr< WebSockets::WebSocket > ws){
+            completions.push_back(ws);
+        }
+    );
+    abortConnection();
+
+    // Assert
+    ASSERT_EQ(1, completions.size());
+    EXPECT_FALSE(completions[0] == nullptr);
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "MakeConnection[2]: Connecting...",
+            "MakeConnection[2]: Connection established.",
+        }),
+        diagnosticMessages
+    );
+}
+
+TEST_F(MakeConnectionTests, ConnectionAbortedWithCompleteDelegate) {
+    // Arrange
+    mockClient->behavior = MockClient::Behaviors::ConnectionAborted;
+    std::vector< std::shared_ptr< WebSockets::WebSocket > > completions;
+
+    // Act
+    const auto abortConnection = WebSockets::MakeConnection(
+        mockClient,
+        "foobar",
+        1234,
+        diagnosticsSender,
+        [&completions](std::shared_ptr< WebSockets::WebSocket > ws){
+            completions.push_back(ws);
+        }
+    );
+    EXPECT_TRUE(completions.empty());
+    abortConnection();
+    abortConnection();
+
+    // Assert
+    ASSERT_EQ(1, completions.size());
+    EXPECT_TRUE(completions[0] == nullptr);
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "MakeConnection[2]: Connecting...",
+            "MakeConnection[5]: connection aborted",
+        }),
+        diagnosticMessages
+    );
+}
+
+TEST_F(MakeConnectionTests, SuccessfulConnectionTimings) {
+    // Arrange
+    mockClient->behavior = MockClient::Behaviors::SuccessfulConnection;
+    const auto histogramsBefore = WebSockets::GetMakeConnectionHistograms();
+
+    // Act
+    auto results = WebSockets::MakeConnection(
+        mockClient,
+        "foobar",
+        1234,
+        diagnosticsSender
+    );
+
+    // Assert
+    ASSERT_EQ(
+        std::future_status::ready,
+        results.timingsFuture.wait_for(std::chrono::seconds(1))
+    );
+    const auto timings = results.timingsFuture.get();
+    EXPECT_NE(std::chrono::steady_clock::time_point(), timings.started);
+    EXPECT_GE(timings.requestBuilt, timings.started);
+    EXPECT_GE(timings.responseReceived, timings.requestBuilt);
+    EXPECT_GE(timings.upgradeValidated, timings.responseReceived);
+    EXPECT_GE(timings.completed, timings.upgradeValidated);
+    const auto histogramsAfter = WebSockets::GetMakeConnectionHistograms();
+    ASSERT_EQ(32, histogramsAfter.connecting.counts.size());
+    size_t connectingCounted = 0;
+    size_t validatingCounted = 0;
+    for (size_t i = 0; i < 32; ++i) {
+        connectingCounted += (
+            histogramsAfter.connecting.counts[i]
+            - histogramsBefore.connecting.counts[i]
+        );
+        validatingCounted += (
+            histogramsAfter.validatingUpgrade.counts[i]
+            - histogramsBefore.validatingUpgrade.counts[i]
+        );
+    }
+    EXPECT_EQ(1, connectingCounted);
+    EXPECT_EQ(1, validatingCounted);
+}
+
+TEST_F(MakeConnectionTests, FailedConnectionTimingsLeaveUnreachedPhasesUnset) {
+    // Arrange
+    mockClient->behavior = MockClient::Behaviors::UnableToConnect;
+    const auto histogramsBefore = WebSockets::GetMakeConnectionHistograms();
+
+    // Act
+    auto results = WebSockets::MakeConnection(
+        mockClient,
+        "foobar",
+        1234,
+        diagnosticsSender
+    );
+
+    // Assert
+    ASSERT_EQ(
+        std::future_status::ready,
+        results.timingsFuture.wait_for(std::chrono::seconds(1))
+    );
+    const auto timings = results.timingsFuture.get();
+    EXPECT_GE(timings.requestBuilt, timings.started);
+    EXPECT_EQ(std::chrono::steady_clock::time_point(), timings.responseReceived);
+    EXPECT_EQ(std::chrono::steady_clock::time_point(), timings.upgradeValidated);
+    EXPECT_GE(timings.completed, timings.requestBuilt);
+    const auto histogramsAfter = WebSockets::GetMakeConnectionHistograms();
+    EXPECT_EQ(histogramsBefore.connecting.counts, histogramsAfter.connecting.counts);
+    EXPECT_EQ(histogramsBefore.awaitingResponse.counts, histogramsAfter.awaitingResponse.counts);
+    EXPECT_NE(histogramsBefore.buildingRequest.counts, histogramsAfter.buildingRequest.counts);
+}
+
+TEST_F(MakeConnectionTests, RaceUsesFirstConnectionMadeAndAbortsOthers) {
+    // Arrange
+    mockClient->behaviorsByHost["slow"] = MockClient::Behaviors::ConnectionAborted;
+    mockClient->behaviorsByHost["fast"] = MockClient::Behaviors::SuccessfulConnection;
+    std::vector< WebSockets::Endpoint > endpoints(2);
+    endpoints[0].host = "slow";
+    endpoints[0].port = 1234;
+    endpoints[1].host = "fast";
+    endpoints[1].port = 1234;
+
+    // Act
+    auto results = WebSockets::MakeConnection(
+        mockClient,
+        endpoints,
+        std::chrono::milliseconds(1),
+        diagnosticsSender
+    );
+
+    // Assert
+    ASSERT_EQ(
+        std::future_status::ready,
+        results.connectionFuture.wait_for(std::chrono::seconds(1))
+    );
+    EXPECT_FALSE(results.connectionFuture.get() == nullptr);
+    EXPECT_EQ(
+        std::vector< std::string >({"slow", "fast"}),
+        mockClient->hostsRequested
+    );
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "MakeConnection[2]: Connecting...",
+            "MakeConnection[2]: Connecting...",
+            "MakeConnection[2]: Connection established.",
+            "MakeConnection[5]: connection aborted",
+        }),
+        diagnosticMessages
+    );
+}
+
+TEST_F(MakeConnectionTests, RaceStartsNextAttemptAtOnceWhenEarlierOnesFail) {
+    // Arrange
+    mockClient->behaviorsByHost["down"] = MockClient::Behaviors::UnableToConnect;
+    mockClient->behaviorsByHost["up"] = MockClient::Behaviors::SuccessfulConnection;
+    std::vector< WebSockets::Endpoint > endpoints(3);
+    endpoints[0].host = "down";
+    endpoints[1].host = "up";
+    endpoints[2].host = "up";
+
+    // Act
+    auto results = WebSockets::MakeConnection(
+        mockClient,
+        endpoints,
+        std::chrono::milliseconds(3600000),
+        diagnosticsSender
+    );
+
+    // Assert
+    ASSERT_EQ(
+        std::future_status::ready,
+        results.connectionFuture.wait_for(std::chrono::seconds(0))
+    );
+    EXPECT_FALSE(results.connectionFuture.get() == nullptr);
+    EXPECT_EQ(
+        std::vector< std::string >({"down", "up"}),
+        mockClient->hostsRequested
+    );
+}
+
+TEST_F(MakeConnectionTests, RaceFailsOnceAllAttemptsFail) {
+    // Arrange
+    mockClient->behavior = MockClient::Behaviors::UnableToConnect;
+    std::vector< WebSockets::Endpoint > endpoints(2);
+    endpoints[0].host = "foo";
+    endpoints[1].host = "bar";
+
+    // Act
+    auto results = WebSockets::MakeConnection(
+        mockClient,
+        endpoints,
+        std::chrono::milliseconds(3600000),
+        diagnosticsSender
+    );
+
+    // Assert
+    ASSERT_EQ(
+        std::future_status::ready,
+        results.connectionFuture.wait_for(std::chrono::seconds(0))
+    );
+    EXPECT_TRUE(results.connectionFuture.get() == nullptr);
+    EXPECT_EQ(
+        std::vector< std::string >({"foo", "bar"}),
+        mockClient->hostsRequested
+    );
+}
+
+TEST_F(MakeConnectionTests, RaceAbortedWithCompleteDelegate) {
+    // Arrange
+    mockClient->behavior = MockClient::Behaviors::ConnectionAborted;
+    std::vector< WebSockets::Endpoint > endpoints(2);
+    endpoints[0].host = "foo";
+    endpoints[1].host = "bar";
+    std::vector< std::shared_ptr< WebSockets::WebSocket > > completions;
+
+    // Act
+    const auto abortConnection = WebSockets::MakeConnection(
+        mockClient,
+        endpoints,
+        std::chrono::milliseconds(0),
+        diagnosticsSender,
+        [&completions](std::shared_ptr< WebSockets::WebSocket > ws){
+            completions.push_back(ws);
+        }
+    );
+    EXPECT_TRUE(completions.empty());
+    abortConnection();
+    abortConnection();
+
+    // Assert
+    ASSERT_EQ(1, completions.size());
+    EXPECT_TRUE(completions[0] == nullptr);
+    EXPECT_EQ(
+        std::vector< std::string >({
+            "MakeConnection[2]: Connecting...",
+            "MakeConnection[2]: Connecting...",
+            "MakeConnection[5]: connection aborted",
+            "MakeConnection[5]: connection aborted",
+        }),
+        diagnosticMessages
+    );
+}
@@ -0,0 +1,366 @@
+/**
+ * @file MakeConnectionsTests.cpp
+ *
+ * This module contains the unit tests of the
+ * WebSockets::MakeConnections function.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <Base64/Base64.hpp>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <gtest/gtest.h>
+#include <Hash/Sha1.hpp>
+#include <Hash/Templates.hpp>
+#include <Http/Connection.hpp>
+#include <Http/IClient.hpp>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <string>
+#include <SystemAbstractions/DiagnosticsSender.hpp>
+#include <vector>
+#include <WebSockets/MakeConnections.hpp>
+
+namespace {
+
+    /**
+     * This is a fake client connection which is used to test.
+     */
+    struct MockConnection
+        : public Http::Connection
+    {
+        // Http::Connection
+
+        virtual std::string GetPeerAddress() override {
+            return "mock-client";
+        }
+
+        virtual std::string GetPeerId() override {
+            return "mock-client:5555";
+        }
+
+        virtual void SetDataReceivedDelegate(DataReceivedDelegate newDataReceivedDelegate) override {
+        }
+
+        virtual void SetBrokenDelegate(BrokenDelegate newBrokenDelegate) override {
+        }
+
+        virtual void SendData(const std::vector< uint8_t >& data) override {
+        }
+
+        virtual void Break(bool clean) override {
+        }
+    };
+
+    /**
+     * This is a fake HTTP client transaction which is used to test.
+     */
+    struct MockClientTransaction
+        : public Http::IClient::Transaction
+    {
+        // Properties
+
+        std::mutex mutex;
+        std::function< void() > completionDelegate;
+        bool completed = false;
+
+        // Methods
+
+        void Complete() {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            completed = true;
+            const auto completionDelegateToCall = completionDelegate;
+            lock.unlock();
+            if (completionDelegateToCall != nullptr) {
+                completionDelegateToCall();
+            }
+        }
+
+        // Http::IClient::Transaction
+
+        virtual bool AwaitCompletion(
+            const std::chrono::milliseconds& relativeTime
+        ) override {
+            return completed;
+        }
+
+        virtual void AwaitCompletion() override {
+        }
+
+        virtual void SetCompletionDelegate(
+            std::function< void() > newCompletionDelegate
+        ) override {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            completionDelegate = newCompletionDelegate;
+            const auto completeNow = completed;
+            lock.unlock();
+            if (completeNow) {
+                newCompletionDelegate();
+            }
+        }
+    };
+
+    /**
+     * This is a fake HTTP client which is used to test.  It upgrades
+     * every request, either at once or when told to.
+     */
+    struct MockClient
+        : public Http::IClient
+    {
+        // Types
+
+        struct PendingRequest {
+            std::shared_ptr< MockClientTransaction > transaction;
+            UpgradeDelegate upgradeDelegate;
+        };
+
+        // Properties
+
+        std::mutex mutex;
+        bool completeAtOnce = true;
+        std::vector< std::string > hostsRequested;
+        std::vector< std::chrono::steady_clock::time_point > requestTimes;
+        std::vector< PendingRequest > pendingRequests;
+
+        // Methods
+
+        void Upgrade(const PendingRequest& pendingRequest) {
+            const auto transaction = pendingRequest.transaction;
+            if (pendingRequest.upgradeDelegate != nullptr) {
+                pendingRequest.upgradeDelegate(
+                    transaction->response,
+                    std::make_shared< MockConnection >(),
+                    ""
+                );
+            }
+            transaction->Complete();
+        }
+
+        size_t GetRequestCount() {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            return hostsRequested.size();
+        }
+
+        void CompleteOldestPendingRequest() {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            ASSERT_FALSE(pendingRequests.empty());
+            const auto pendingRequest = pendingRequests.front();
+            pendingRequests.erase(pendingRequests.begin());
+            lock.unlock();
+            Upgrade(pendingRequest);
+        }
+
+        // Http::IClient
+
+        virtual SystemAbstractions::DiagnosticsSender::UnsubscribeDelegate SubscribeToDiagnostics(
+            SystemAbstractions::DiagnosticsSender::DiagnosticMessageDelegate delegate,
+            size_t minLevel = 0
+        ) override {
+            return []{};
+        }
+
+        virtual std::shared_ptr< Transaction > Request(
+            Http::Request request,
+            bool persistConnection = true,
+            UpgradeDelegate upgradeDelegate = nullptr
+        ) override {
+            PendingRequest pendingRequest;
+            pendingRequest.transaction = std::make_shared< MockClientTransaction >();
+            pendingRequest.upgradeDelegate = upgradeDelegate;
+            const auto transaction = pendingRequest.transaction;
+            transaction->state = Http::IClient::Transaction::State::Completed;
+            transaction->response.statusCode = 101;
+            transaction->response.headers.SetHeader("Connection", "upgrade");
+            transaction->response.headers.SetHeader("Upgrade", "websocket");
+            transaction->response.headers.SetHeader(
+                "Sec-WebSocket-Accept",
+                Base64::Encode(
+                    Hash::StringToBytes< Hash::Sha1 >(
+                        request.headers.GetHeaderValue("Sec-WebSocket-Key")
+                        + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+                    )
+                )
+            );
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            hostsRequested.push_back(request.target.GetHost());
+            requestTimes.push_back(std::chrono::steady_clock::now());
+            if (completeAtOnce) {
+                lock.unlock();
+                Upgrade(pendingRequest);
+            } else {
+                pendingRequests.push_back(pendingRequest);
+            }
+            return transaction;
+        }
+    };
+
+}
+
+/**
+ * This is the test fixture for these tests, providing common
+ * setup and teardown for each test.
+ */
+struct MakeConnectionsTests
+    : public ::testing::Test
+{
+    // Properties
+
+    std::shared_ptr< MockClient > mockClient = std::make_shared< MockClient >();
+    std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender = std::make_shared< SystemAbstractions::DiagnosticsSender >("MakeConnections");
+    std::mutex mutex;
+    std::vector< size_t > indexesFinished;
+    std::vector< bool > connected;
+
+    // Methods
+
+    WebSockets::MakeConnectionsDelegate MakeConnectionDelegate() {
+        return [this](
+            size_t index,
+            std::shared_ptr< WebSockets::WebSocket > ws,
+            std::chrono::microseconds latency
+        ){
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            indexesFinished.push_back(index);
+            connected.push_back(ws != nullptr);
+        };
+    }
+
+    std::vector< WebSockets::Endpoint > MakeEndpoints(size_t count) {
+        std::vector< WebSockets::Endpoint > endpoints;
+        for (size_t i = 0; i < count; ++i) {
+            WebSockets::Endpoint endpoint;
+            endpoint.host = "host" + std::to_string(i);
+            endpoint.port = 1234;
+            endpoints.push_back(endpoint);
+        }
+        return endpoints;
+    }
+};
+
+TEST_F(MakeConnectionsTests, ConnectToEachEndpointWithinInFlightLimit) {
+    // Arrange
+    mockClient->completeAtOnce = false;
+    WebSockets::MakeConnectionsOptions options;
+    options.maxInFlight = 2;
+
+    // Act
+    auto results = WebSockets::MakeConnections(
+        mockClient,
+        MakeEndpoints(5),
+        diagnosticsSender,
+        options,
+        MakeConnectionDelegate()
+    );
+    EXPECT_EQ(2, mockClient->GetRequestCount());
+    mockClient->CompleteOldestPendingRequest();
+    EXPECT_EQ(3, mockClient->GetRequestCount());
+    for (size_t i = 0; i < 4; ++i) {
+        mockClient->CompleteOldestPendingRequest();
+    }
+
+    // Assert
+    ASSERT_EQ(
+        std::future_status::ready,
+        results.statisticsFuture.wait_for(std::chrono::seconds(0))
+    );
+    const auto statistics = results.statisticsFuture.get();
+    EXPECT_EQ(5, statistics.connected);
+    EXPECT_EQ(0, statistics.failed);
+    EXPECT_EQ(0, statistics.notStarted);
+    EXPECT_EQ(2, statistics.peakInFlight);
+    EXPECT_LE(statistics.minimumLatency, statistics.medianLatency);
+    EXPECT_LE(statistics.medianLatency, statistics.p99Latency);
+    EXPECT_LE(statistics.p99Latency, statistics.maximumLatency);
+    EXPECT_EQ(
+        (std::vector< std::string >{"host0", "host1", "host2", "host3", "host4"}),
+        mockClient->hostsRequested
+    );
+    EXPECT_EQ((std::vector< size_t >{0, 1, 2, 3, 4}), indexesFinished);
+    EXPECT_EQ((std::vector< bool >{true, true, true, true, true}), connected);
+}
+
+TEST_F(MakeConnectionsTests, ManyConnectionsCompletingAtOnce) {
+    // Arrange
+    WebSockets::MakeConnectionsOptions options;
+    options.maxInFlight = 1;
+
+    // Act
+    auto results = WebSockets::MakeConnections(
+        mockClient,
+        MakeEndpoints(1000),
+        diagnosticsSender,
+        options,
+        MakeConnectionDelegate()
+    );
+
+    // Assert
+    ASSERT_EQ(
+        std::future_status::ready,
+        results.statisticsFuture.wait_for(std::chrono::seconds(0))
+    );
+    const auto statistics = results.statisticsFuture.get();
+    EXPECT_EQ(1000, statistics.connected);
+    EXPECT_EQ(1, statistics.peakInFlight);
+    EXPECT_EQ(1000, indexesFinished.size());
+}
+
+TEST_F(MakeConnectionsTests, AbortGivesUpOnAttemptsNotStarted) {
+    // Arrange
+    mockClient->completeAtOnce = false;
+    WebSockets::MakeConnectionsOptions options;
+    options.maxInFlight = 2;
+
+    // Act
+    auto results = WebSockets::MakeConnections(
+        mockClient,
+        MakeEndpoints(5),
+        diagnosticsSender,
+        options,
+        MakeConnectionDelegate()
+    );
+    results.abortConnections();
+
+    // Assert
+    ASSERT_EQ(
+        std::future_status::ready,
+        results.statisticsFuture.wait_for(std::chrono::seconds(0))
+    );
+    const auto statistics = results.statisticsFuture.get();
+    EXPECT_EQ(0, statistics.connected);
+    EXPECT_EQ(2, statistics.failed);
+    EXPECT_EQ(3, statistics.notStarted);
+    EXPECT_EQ((std::vector< bool >{false, false}), connected);
+    EXPECT_EQ(2, mockClient->GetRequestCount());
+}
+
+TEST_F(MakeConnectionsTests, RampRateSpreadsOutStarts) {
+    // Arrange
+    WebSockets::MakeConnectionsOptions options;
+    options.rampRate = 50.0;
+
+    // Act
+    auto results = WebSockets::MakeConnections(
+        mockClient,
+        MakeEndpoints(3),
+        diagnosticsSender,
+        options,
+        MakeConnectionDelegate()
+    );
+
+    // Assert
+    ASSERT_EQ(
+        std::future_status::ready,
+        results.statisticsFuture.wait_for(std::chrono::seconds(1))
+    );
+    const auto statistics = results.statisticsFuture.get();
+    EXPECT_EQ(3, statistics.connected);
+    EXPECT_GE(statistics.elapsed, std::chrono::milliseconds(40));
+    ASSERT_EQ(3, mockClient->requestTimes.size());
+    EXPECT_GE(
+        mockClient->requestTimes[2] - mockClient->requestTimes[0],
+        std::chrono::milliseconds(40)
+    );
+}
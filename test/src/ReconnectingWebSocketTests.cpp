@@ -0,0 +1,367 @@
+/**
+ * @file ReconnectingWebSocketTests.cpp
+ *
+ * This module contains the unit tests of the
+ * WebSockets::ReconnectingWebSocket class.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <Base64/Base64.hpp>
+#include <chrono>
+#include <functional>
+#include <gtest/gtest.h>
+#include <Hash/Sha1.hpp>
+#include <Hash/Templates.hpp>
+#include <Http/Connection.hpp>
+#include <Http/IClient.hpp>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <string>
+#include <SystemAbstractions/DiagnosticsSender.hpp>
+#include <thread>
+#include <vector>
+#include <WebSockets/ReconnectingWebSocket.hpp>
+#include <WebSockets/WebSocket.hpp>
+
+namespace {
+
+    /**
+     * This is a fake client connection which is used to test.
+     */
+    struct MockConnection
+        : public Http::Connection
+    {
+        // Properties
+
+        std::mutex mutex;
+        DataReceivedDelegate dataReceivedDelegate;
+        BrokenDelegate brokenDelegate;
+        std::string webSocketOutput;
+
+        // Methods
+
+        std::string GetWebSocketOutput() {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            return webSocketOutput;
+        }
+
+        // Http::Connection
+
+        virtual std::string GetPeerAddress() override {
+            return "mock-server";
+        }
+
+        virtual std::string GetPeerId() override {
+            return "mock-server:1234";
+        }
+
+        virtual void SetDataReceivedDelegate(DataReceivedDelegate newDataReceivedDelegate) override {
+            dataReceivedDelegate = newDataReceivedDelegate;
+        }
+
+        virtual void SetBrokenDelegate(BrokenDelegate newBrokenDelegate) override {
+            brokenDelegate = newBrokenDelegate;
+        }
+
+        virtual void SendData(const std::vector< uint8_t >& data) override {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            (void)webSocketOutput.insert(
+                webSocketOutput.end(),
+                data.begin(),
+                data.end()
+            );
+        }
+
+        virtual void Break(bool clean) override {
+        }
+    };
+
+    /**
+     * This is a fake HTTP client transaction which is used to test.
+     */
+    struct MockClientTransaction
+        : public Http::IClient::Transaction
+    {
+        // Http::IClient::Transaction
+
+        virtual bool AwaitCompletion(
+            const std::chrono::milliseconds& relativeTime
+        ) override {
+            return true;
+        }
+
+        virtual void AwaitCompletion() override {
+        }
+
+        virtual void SetCompletionDelegate(
+            std::function< void() > completionDelegate
+        ) override {
+            completionDelegate();
+        }
+    };
+
+    /**
+     * This is a fake HTTP client which is used to test.  It either
+     * upgrades each request at once, or fails to connect.
+     */
+    struct MockClient
+        : public Http::IClient
+    {
+        // Properties
+
+        std::mutex mutex;
+        size_t failuresToCome = 0;
+        std::vector< std::shared_ptr< MockConnection > > connections;
+        std::function< void() > requestDelegate;
+
+        // Methods
+
+        void FailNext(size_t failures) {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            failuresToCome = failures;
+        }
+
+        std::shared_ptr< MockConnection > GetConnection(size_t index) {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            return connections.at(index);
+        }
+
+        // Http::IClient
+
+        virtual SystemAbstractions::DiagnosticsSender::UnsubscribeDelegate SubscribeToDiagnostics(
+            SystemAbstractions::DiagnosticsSender::DiagnosticMessageDelegate delegate,
+            size_t minLevel = 0
+        ) override {
+            return []{};
+        }
+
+        virtual std::shared_ptr< Transaction > Request(
+            Http::Request request,
+            bool persistConnection = true,
+            UpgradeDelegate upgradeDelegate = nullptr
+        ) override {
+            std::unique_lock< decltype(mutex) > lock(mutex);
+            const auto requestDelegateSnapshot = requestDelegate;
+            lock.unlock();
+            if (requestDelegateSnapshot != nullptr) {
+                requestDelegateSnapshot();
+            }
+            const auto transaction = std::make_shared< MockClientTransaction >();
+            lock.lock();
+            if (failuresToCome > 0) {
+                --failuresToCome;
+                transaction->state = Http::IClient::Transaction::State::UnableToConnect;
+                return transaction;
+            }
+            const auto connection = std::make_shared< MockConnection >();
+            connections.push_back(connection);
+            lock.unlock();
+            transaction->state = Http::IClient::Transaction::State::Completed;
+            transaction->response.statusCode = 101;
+            transaction->response.headers.SetHeader("Connection", "upgrade");
+            transaction->response.headers.SetHeader("Upgrade", "websocket");
+            transaction->response.headers.SetHeader(
+                "Sec-WebSocket-Accept",
+                Base64::Encode(
+                    Hash::StringToBytes< Hash::Sha1 >(
+                        request.headers.GetHeaderValue("Sec-WebSocket-Key")
+                        + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+                    )
+                )
+            );
+            if (upgradeDelegate != nullptr) {
+                upgradeDelegate(transaction->response, connection, "");
+            }
+            return transaction;
+        }
+    };
+
+    /**
+     * This function waits up to a second for the given condition to
+     * become true.
+     *
+     * @param[in] condition
+     *     This is the condition for which to wait.
+     *
+     * @return
+     *     An indication of whether or not the condition became true
+     *     is returned.
+     */
+    bool WaitFor(std::function< bool() > condition) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        while (!condition()) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+
+}
+
+/**
+ * This is the test fixture for these tests, providing common
+ * setup and teardown for each test.
+ */
+struct ReconnectingWebSocketTests
+    : public ::testing::Test
+{
+    // Properties
+
+    WebSockets::ReconnectingWebSocket ws;
+    std::shared_ptr< MockClient > mockClient = std::make_shared< MockClient >();
+    std::shared_ptr< SystemAbstractions::DiagnosticsSender > diagnosticsSender = std::make_shared< SystemAbstractions::DiagnosticsSender >("ReconnectingWebSocket");
+    WebSockets::ReconnectingWebSocket::Configuration configuration;
+
+    // ::testing::Test
+
+    virtual void SetUp() {
+        configuration.initialBackoff = std::chrono::milliseconds(1);
+        configuration.maxBackoff = std::chrono::milliseconds(5);
+    }
+
+    virtual void TearDown() {
+    }
+
+    // Methods
+
+    void Start() {
+        ws.Start(mockClient, "upstream", 1234, diagnosticsSender, configuration);
+    }
+};
+
+TEST_F(ReconnectingWebSocketTests, ReconnectAfterConnectionLostAndSendHeldMessages) {
+    std::mutex mutex;
+    std::vector< std::string > texts;
+    WebSockets::WebSocket::Delegates delegates;
+    delegates.text = [&mutex, &texts](std::string&& data){
+        std::lock_guard< decltype(mutex) > lock(mutex);
+        texts.push_back(std::move(data));
+    };
+    ws.SetDelegates(std::move(delegates));
+    configuration.initialBackoff = std::chrono::milliseconds(10);
+    configuration.maxBackoff = std::chrono::milliseconds(20);
+    Start();
+    ASSERT_TRUE(WaitFor([this]{ return ws.IsConnected(); }));
+    mockClient->FailNext(2);
+    mockClient->GetConnection(0)->brokenDelegate(false);
+    EXPECT_TRUE(ws.SendText("a"));
+    EXPECT_TRUE(ws.SendBinary("b"));
+    ASSERT_TRUE(WaitFor([this]{ return ws.IsConnected(); }));
+    const auto connection = mockClient->GetConnection(1);
+    ASSERT_TRUE(WaitFor([connection]{ return connection->GetWebSocketOutput().length() == 14; }));
+    const auto output = connection->GetWebSocketOutput();
+    EXPECT_EQ('\x81', output[0]);
+    EXPECT_EQ('\x82', output[7]);
+    const auto statistics = ws.GetStatistics();
+    EXPECT_EQ(1, statistics.connectionsLost);
+    EXPECT_EQ(4, statistics.connectionAttempts);
+    EXPECT_EQ(2, statistics.connectionAttemptsFailed);
+    EXPECT_EQ(1, statistics.recoveries);
+    EXPECT_EQ(2, statistics.messagesBuffered);
+    EXPECT_EQ(0, statistics.bufferedOctets);
+    EXPECT_GT(statistics.lastTimeToRecover.count(), 0);
+    EXPECT_EQ(statistics.lastTimeToRecover, statistics.maximumTimeToRecover);
+    EXPECT_EQ(statistics.lastTimeToRecover, statistics.averageTimeToRecover);
+    const std::string frame = "\x81\x05Hello";
+    connection->dataReceivedDelegate({frame.begin(), frame.end()});
+    std::lock_guard< decltype(mutex) > lock(mutex);
+    EXPECT_EQ(std::vector< std::string >{"Hello"}, texts);
+}
+
+TEST_F(ReconnectingWebSocketTests, DiscardMessagesBeyondBufferLimit) {
+    configuration.maxBufferedOctets = 5;
+    mockClient->FailNext(1000000);
+    Start();
+    EXPECT_TRUE(ws.SendText("abc"));
+    EXPECT_FALSE(ws.SendText("def"));
+    EXPECT_TRUE(ws.SendBinary("gh"));
+    const auto statistics = ws.GetStatistics();
+    EXPECT_EQ(2, statistics.messagesBuffered);
+    EXPECT_EQ(1, statistics.messagesDropped);
+    EXPECT_EQ(5, statistics.bufferedOctets);
+}
+
+TEST_F(ReconnectingWebSocketTests, CloseStopsReconnecting) {
+    std::vector< unsigned int > closeCodes;
+    WebSockets::WebSocket::Delegates delegates;
+    delegates.close = [&closeCodes](
+        unsigned int code,
+        std::string&& reason
+    ){
+        closeCodes.push_back(code);
+    };
+    ws.SetDelegates(std::move(delegates));
+    Start();
+    ASSERT_TRUE(WaitFor([this]{ return ws.IsConnected(); }));
+    ws.Close(1000, "bye");
+    const auto connection = mockClient->GetConnection(0);
+    EXPECT_EQ('\x88', connection->GetWebSocketOutput()[0]);
+    const std::string frame = "\x88\x02\x03\xe8";
+    connection->dataReceivedDelegate({frame.begin(), frame.end()});
+    EXPECT_EQ(std::vector< unsigned int >{1000}, closeCodes);
+    EXPECT_FALSE(ws.IsConnected());
+    EXPECT_FALSE(ws.SendText("too late"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(1, ws.GetStatistics().connectionAttempts);
+}
+
+TEST_F(ReconnectingWebSocketTests, CloseWhileDisconnectedCallsCloseDelegate) {
+    std::vector< unsigned int > closeCodes;
+    std::vector< std::string > closeReasons;
+    WebSockets::WebSocket::Delegates delegates;
+    delegates.close = [&closeCodes, &closeReasons](
+        unsigned int code,
+        std::string&& reason
+    ){
+        closeCodes.push_back(code);
+        closeReasons.push_back(std::move(reason));
+    };
+    ws.SetDelegates(std::move(delegates));
+    mockClient->FailNext(1000000);
+    Start();
+    ws.Close(1000, "bye");
+    EXPECT_EQ(std::vector< unsigned int >{1000}, closeCodes);
+    EXPECT_EQ(std::vector< std::string >{"bye"}, closeReasons);
+    ws.Close(1001, "again");
+    EXPECT_EQ(std::vector< unsigned int >{1000}, closeCodes);
+}
+
+TEST_F(ReconnectingWebSocketTests, DestroyOnWorkerThread) {
+    std::unique_ptr< WebSockets::ReconnectingWebSocket > reconnectingWs(
+        new WebSockets::ReconnectingWebSocket()
+    );
+    std::mutex mutex;
+    bool destroyed = false;
+    mockClient->requestDelegate = [&reconnectingWs, &mutex, &destroyed]{
+        std::lock_guard< decltype(mutex) > lock(mutex);
+        if (reconnectingWs != nullptr) {
+            reconnectingWs.reset();
+            destroyed = true;
+        }
+    };
+    mockClient->FailNext(1000000);
+    {
+        std::lock_guard< decltype(mutex) > lock(mutex);
+        reconnectingWs->Start(mockClient, "upstream", 1234, diagnosticsSender, configuration);
+    }
+    ASSERT_TRUE(
+        WaitFor(
+            [&mutex, &destroyed]{
+                std::lock_guard< decltype(mutex) > lock(mutex);
+                return destroyed;
+            }
+        )
+    );
+    const auto requestsRemaining = [this]{
+        std::lock_guard< decltype(mockClient->mutex) > lock(mockClient->mutex);
+        return mockClient->failuresToCome;
+    };
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    const auto requestsRemainingBefore = requestsRemaining();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_EQ(requestsRemainingBefore, requestsRemaining());
+}
@@ -0,0 +1,292 @@
+/**
+ * @file ShardedServerTests.cpp
+ *
+ * This module contains the unit tests of the
+ * WebSockets::ShardedServer class.
+ *
+ * © 2018 by Richard Walters
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <gtest/gtest.h>
+#include <Http/Connection.hpp>
+#include <Http/Request.hpp>
+#include <Http/Response.hpp>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <WebSockets/ShardedServer.hpp>
+#include <WebSockets/WebSocket.hpp>
+
+namespace {
+
+    /**
+     * This is a fake connection which is used to test the server.
+     */
+    struct MockConnection
+        : public Http::Connection
+    {
+        // Properties
+
+        /**
+         * This is the delegate to call in order to simulate data coming
+         * into the WebSocket from the remote peer.
+         */
+        DataReceivedDelegate dataReceivedDelegate;
+
+        /**
+         * This is the delegate to call in order to simulate closing
+         * the connection from the remote peer side.
+         */
+        BrokenDelegate brokenDelegate;
+
+        /**
+         * This is used to synchronize access to the data sent.
+         */
+        std::mutex mutex;
+
+        /**
+         * This holds onto a copy of all data sent by the WebSocket
+         * to the remote peer.
+         */
+        std::string webSocketOutput;
+
+        // Http::Connection
+
+        virtual std::string GetPeerAddress() override {
+            return "mock-client";
+        }
+
+        virtual std::string GetPeerId() override {
+            return "mock-client:5555";
+        }
+
+        virtual void SetDataReceivedDelegate(DataReceivedDelegate newDataReceivedDelegate) override {
+            dataReceivedDelegate = newDataReceivedDelegate;
+        }
+
+        virtual void SetBrokenDelegate(BrokenDelegate newBrokenDelegate) override {
+            brokenDelegate = newBrokenDelegate;
+        }
+
+        virtual void SendData(const std::vector< uint8_t >& data) override {
+            std::lock_guard< decltype(mutex) > lock(mutex);
+            (void)webSocketOutput.insert(
+                webSocketOutput.end(),
+                data.begin(),
+                data.end()
+            );
+        }
+
+        virtual void Break(bool clean) override {
+        }
+    };
+
+    /**
+     * This function makes an HTTP request which opens a WebSocket.
+     *
+     * @return
+     *     The request is returned.
+     */
+    Http::Request MakeOpeningRequest() {
+        Http::Request request;
+        request.method = "GET";
+        request.headers.SetHeader("Connection", "upgrade");
+        request.headers.SetHeader("Upgrade", "websocket");
+        request.headers.SetHeader("Sec-WebSocket-Version", "13");
+        request.headers.SetHeader("Sec-WebSocket-Key", "dGhlIHNhbXBsZSBub25jZQ==");
+        return request;
+    }
+
+}
+
+/**
+ * This is the test fixture for these tests, providing common
+ * setup and teardown for each test.
+ */
+struct ShardedServerTests
+    : public ::testing::Test
+{
+    // Properties
+
+    /**
+     * This is the unit under test.
+     */
+    WebSockets::ShardedServer server;
+
+    // ::testing::Test
+
+    virtual void SetUp() {
+        WebSockets::ShardedServer::Configuration configuration;
+        configuration.shards = 2;
+        configuration.pinShards = false;
+        server.Start(configuration);
+    }
+
+    virtual void TearDown() {
+        server.Stop();
+    }
+};
+
+TEST_F(ShardedServerTests, PostRunsWorkOnShardInOrder) {
+    ASSERT_EQ(2, server.GetShardCount());
+    EXPECT_EQ(WebSockets::ShardedServer::NOT_A_SHARD, server.GetCurrentShard());
+    std::vector< size_t > shardsSeen;
+    std::vector< int > order;
+    std::promise< void > done;
+    for (int i = 0; i < 3; ++i) {
+        server.Post(
+            1,
+            [this, i, &shardsSeen, &order]{
+                shardsSeen.push_back(server.GetCurrentShard());
+                order.push_back(i);
+            }
+        );
+    }
+    server.Post(
+        1,
+        [&done]{
+            done.set_value();
+        }
+    );
+    ASSERT_EQ(
+        std::future_status::ready,
+        done.get_future().wait_for(std::chrono::seconds(1))
+    );
+    EXPECT_EQ((std::vector< size_t >{1, 1, 1}), shardsSeen);
+    EXPECT_EQ((std::vector< int >{0, 1, 2}), order);
+}
+
+TEST_F(ShardedServerTests, WebSocketsTakeTurnsAmongShards) {
+    std::vector< std::shared_ptr< MockConnection > > connections;
+    std::mutex mutex;
+    std::vector< size_t > openedShards;
+    std::promise< void > allOpened;
+    for (size_t i = 0; i < 4; ++i) {
+        const auto connection = std::make_shared< MockConnection >();
+        connections.push_back(connection);
+        Http::Response response;
+        ASSERT_TRUE(
+            server.OpenAsServer(
+                connection,
+                MakeOpeningRequest(),
+                response,
+                "",
+                [this, &mutex, &openedShards, &allOpened](
+                    std::shared_ptr< WebSockets::WebSocket > ws,
+                    size_t shard
+                ){
+                    EXPECT_EQ(shard, server.GetCurrentShard());
+                    std::lock_guard< decltype(mutex) > lock(mutex);
+                    openedShards.push_back(shard);
+                    if (openedShards.size() == 4) {
+                        allOpened.set_value();
+                    }
+                }
+            )
+        );
+        EXPECT_EQ(101, response.statusCode);
+    }
+    ASSERT_EQ(
+        std::future_status::ready,
+        allOpened.get_future().wait_for(std::chrono::seconds(1))
+    );
+    std::sort(openedShards.begin(), openedShards.end());
+    EXPECT_EQ((std::vector< size_t >{0, 0, 1, 1}), openedShards);
+    EXPECT_EQ(
+        (std::vector< size_t >{2, 2}),
+        server.GetStatistics().webSocketsOpened
+    );
+}
+
+TEST_F(ShardedServerTests, DataProcessedAndDelegatesCalledOnOwningShard) {
+    const auto connection = std::make_shared< MockConnection >();
+    Http::Response response;
+    std::promise< size_t > textReceived;
+    std::shared_ptr< WebSockets::WebSocket > webSocket;
+    std::promise< void > opened;
+    ASSERT_TRUE(
+        server.OpenAsServer(
+            connection,
+            MakeOpeningRequest(),
+            response,
+            "",
+            [this, &webSocket, &textReceived, &opened](
+                std::shared_ptr< WebSockets::WebSocket > ws,
+                size_t shard
+            ){
+                WebSockets::WebSocket::Delegates delegates;
+                delegates.text = [this, &textReceived, shard](
+                    std::string&& data
+                ){
+                    EXPECT_EQ("foobar", data);
+                    EXPECT_EQ(shard, server.GetCurrentShard());
+                    textReceived.set_value(shard);
+                };
+                ws->SetDelegates(std::move(delegates));
+                webSocket = ws;
+                opened.set_value();
+            }
+        )
+    );
+    ASSERT_EQ(
+        std::future_status::ready,
+        opened.get_future().wait_for(std::chrono::seconds(1))
+    );
+    const char mask[4] = {0x12, 0x34, 0x56, 0x78};
+    const std::string data = "foobar";
+    std::string frame = "\x81\x86";
+    frame += std::string(mask, 4);
+    for (size_t i = 0; i < data.length(); ++i) {
+        frame += data[i] ^ mask[i % 4];
+    }
+    connection->dataReceivedDelegate({frame.begin(), frame.end()});
+    auto textReceivedFuture = textReceived.get_future();
+    ASSERT_EQ(
+        std::future_status::ready,
+        textReceivedFuture.wait_for(std::chrono::seconds(1))
+    );
+    EXPECT_EQ(0, textReceivedFuture.get());
+    webSocket->SendText("Hello");
+    std::lock_guard< decltype(connection->mutex) > lock(connection->mutex);
+    EXPECT_EQ("\x81\x05Hello", connection->webSocketOutput);
+}
+
+TEST_F(ShardedServerTests, WorkHandedToStoppedShardReleased) {
+    auto connection = std::make_shared< MockConnection >();
+    const std::weak_ptr< MockConnection > connectionWeak(connection);
+    Http::Response response;
+    std::shared_ptr< WebSockets::WebSocket > webSocket;
+    std::promise< void > opened;
+    ASSERT_TRUE(
+        server.OpenAsServer(
+            connection,
+            MakeOpeningRequest(),
+            response,
+            "",
+            [&webSocket, &opened](
+                std::shared_ptr< WebSockets::WebSocket > ws,
+                size_t shard
+            ){
+                webSocket = ws;
+                opened.set_value();
+            }
+        )
+    );
+    ASSERT_EQ(
+        std::future_status::ready,
+        opened.get_future().wait_for(std::chrono::seconds(1))
+    );
+    server.Stop();
+    const std::string frame = "\x81\x80\x12\x34\x56\x78";
+    connection->dataReceivedDelegate({frame.begin(), frame.end()});
+    const std::weak_ptr< WebSockets::WebSocket > webSocketWeak(webSocket);
+    webSocket = nullptr;
+    connection = nullptr;
+    EXPECT_TRUE(webSocketWeak.expired());
+    EXPECT_TRUE(connectionWeak.expired());
+}
@@ -8,16 +8,23 @@
  */
 
 #include <Base64/Base64.hpp>
+#include <chrono>
+#include <functional>
+#include <future>
 #include <gtest/gtest.h>
 #include <Http/Connection.hpp>
 #include <memory>
+#include <set>
 #include <Hash/Sha1.hpp>
 #include <Hash/Templates.hpp>
 #include <stddef.h>
 #include <string>
 #include <SystemAbstractions/DiagnosticsSender.hpp>
 #include <SystemAbstractions/StringExtensions.hpp>
+#include <thread>
 #include <vector>
+#include <WebSockets/CompressionPool.hpp>
+#include <WebSockets/Extension.hpp>
 #include <WebSockets/WebSocket.hpp>
 
 namespace {
@@ -54,6 +61,19 @@ namespace {
          */
         bool brokenByWebSocket = false;
 
+        /**
+         * This is the number of times the WebSocket has sent data
+         * to the remote peer.
+         */
+        size_t sendDataCalls = 0;
+
+        /**
+         * If set, this is called whenever the WebSocket sends data
+         * to the remote peer, before the data is recorded, with the
+         * number of times data has been sent so far.
+         */
+        std::function< void(size_t calls) > sendDataHook;
+
         // Http::Connection
 
         virtual std::string GetPeerAddress() override {
@@ -73,6 +93,10 @@ namespace {
         }
 
         virtual void SendData(const std::vector< uint8_t >& data) override {
+            ++sendDataCalls;
+            if (sendDataHook != nullptr) {
+                sendDataHook(sendDataCalls);
+            }
             (void)webSocketOutput.insert(
                 webSocketOutput.end(),
                 data.begin(),
@@ -85,6 +109,125 @@ namespace {
         }
     };
 
+    /**
+     * This is a fake extension which is used to test how WebSockets
+     * negotiate and use extensions.  It encodes messages by toggling
+     * the case of every letter, marking them with a reserved bit.
+     */
+    struct ToggleCaseExtension
+        : public WebSockets::Extension
+    {
+        // Properties
+
+        /**
+         * This is the name of the extension.
+         */
+        std::string name = "x-toggle-case";
+
+        /**
+         * These are the reserved bits claimed by the extension.
+         */
+        uint8_t reservedBits = 0x20;
+
+        /**
+         * These are the parameters of the extension offer
+         * made by a client.
+         */
+        Parameters offer;
+
+        /**
+         * These are the parameters received in the last extension offer
+         * or response.
+         */
+        Parameters parametersReceived;
+
+        /**
+         * This indicates whether or not the extension accepts
+         * the offers and responses it receives.
+         */
+        bool accept = true;
+
+        /**
+         * This indicates whether or not the extension fails
+         * to decode messages.
+         */
+        bool failDecode = false;
+
+        // Methods
+
+        /**
+         * This method toggles the case of every letter in the given data.
+         *
+         * @param[in,out] data
+         *     This is the data to modify in place.
+         */
+        static void ToggleCase(std::string& data) {
+            for (auto& c: data) {
+                if (
+                    ((c >= 'a') && (c <= 'z'))
+                    || ((c >= 'A') && (c <= 'Z'))
+                ) {
+                    c ^= 0x20;
+                }
+            }
+        }
+
+        // WebSockets::Extension
+
+        virtual std::string GetName() override {
+            return name;
+        }
+
+        virtual uint8_t GetReservedBits() override {
+            return reservedBits;
+        }
+
+        virtual Parameters MakeOffer() override {
+            return offer;
+        }
+
+        virtual bool NegotiateAsClient(const Parameters& response) override {
+            parametersReceived = response;
+            return accept;
+        }
+
+        virtual bool NegotiateAsServer(
+            const Parameters& offer,
+            Parameters& response
+        ) override {
+            parametersReceived = offer;
+            response = offer;
+            return accept;
+        }
+
+        virtual bool EncodeFragment(
+            bool firstFragment,
+            bool lastFragment,
+            std::string& payload,
+            uint8_t& reservedBits,
+            std::string& failureReason
+        ) override {
+            ToggleCase(payload);
+            reservedBits = (firstFragment ? this->reservedBits : 0);
+            return true;
+        }
+
+        virtual bool DecodeMessage(
+            uint8_t reservedBits,
+            std::string& message,
+            std::string& failureReason
+        ) override {
+            if (failDecode) {
+                failureReason = "case not toggled";
+                return false;
+            }
+            if ((reservedBits & this->reservedBits) != 0) {
+                ToggleCase(message);
+            }
+            return true;
+        }
+    };
+
 }
 
 /**
@@ -690,6 +833,67 @@ TEST_F(WebSocketTests, FailCompleteOpenAsServerBadKey) {
     );
 }
 
+TEST_F(WebSocketTests, FailCompleteOpenAsServerKeyNotBase64) {
+    Http::Request request;
+    request.method = "GET";
+    request.headers.SetHeader("Connection", "upgrade");
+    request.headers.SetHeader("Upgrade", "websocket");
+    request.headers.SetHeader("Sec-WebSocket-Version", "13");
+    Http::Response response;
+    const auto connection = std::make_shared< MockConnection >();
+    for (const auto& key: {
+        "YWJjZGVmZ2hpamtsbW5vcA",
+        "YWJjZGVmZ2hp!mtsbW5vcA==",
+        "YWJjZGVmZ2hpamtsbW5vcA=A",
+        "YWJjZGVmZ2hpamtsbW5vcAAA",
+    }) {
+        request.headers.SetHeader("Sec-WebSocket-Key", key);
+        EXPECT_FALSE(
+            ws.OpenAsServer(
+                connection,
+                request,
+                response,
+                ""
+            )
+        ) << key;
+        EXPECT_EQ(400, response.statusCode);
+    }
+}
+
+TEST_F(WebSocketTests, CompleteOpenAsServerAnswerMatchesReferenceForManyKeys) {
+    Http::Request request;
+    request.method = "GET";
+    request.headers.SetHeader("Connection", "upgrade");
+    request.headers.SetHeader("Upgrade", "websocket");
+    request.headers.SetHeader("Sec-WebSocket-Version", "13");
+    for (size_t i = 0; i < 256; ++i) {
+        std::string nonce(16, '\0');
+        for (size_t j = 0; j < nonce.length(); ++j) {
+            nonce[j] = (char)(i * 31 + j * 7);
+        }
+        const auto key = Base64::Encode(nonce);
+        request.headers.SetHeader("Sec-WebSocket-Key", key);
+        Http::Response response;
+        WebSockets::WebSocket server;
+        ASSERT_TRUE(
+            server.OpenAsServer(
+                std::make_shared< MockConnection >(),
+                request,
+                response,
+                ""
+            )
+        );
+        EXPECT_EQ(
+            Base64::Encode(
+                Hash::StringToBytes< Hash::Sha1 >(
+                    key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+                )
+            ),
+            response.headers.GetHeaderValue("Sec-WebSocket-Accept")
+        ) << key;
+    }
+}
+
 TEST_F(WebSocketTests, FailCompleteOpenAsServerMissingVersion) {
     Http::Request request;
     request.method = "GET";
@@ -753,7 +957,7 @@ TEST_F(WebSocketTests, FailCompleteOpenAsServerBadVersion) {
     );
 }
 
-TEST_F(WebSocketTests, FailCompleteOpenAsServerWhenTrailerNotEmpty) {
+TEST_F(WebSocketTests, CompleteOpenAsServerReceivesFramesInTrailer) {
     Http::Request request;
     request.method = "GET";
     request.headers.SetHeader("Connection", "upgrade");
@@ -763,24 +967,155 @@ TEST_F(WebSocketTests, FailCompleteOpenAsServerWhenTrailerNotEmpty) {
     request.headers.SetHeader("Sec-WebSocket-Key", key);
     Http::Response response;
     const auto connection = std::make_shared< MockConnection >();
+    std::vector< std::string > texts;
     std::vector< std::string > pongs;
     WebSockets::WebSocket::Delegates delegates;
+    delegates.text = [&texts](
+        std::string&& data
+    ){
+        texts.push_back(std::move(data));
+    };
     delegates.pong = [&pongs](
         const std::string& data
     ){
         pongs.push_back(data);
     };
     ws.SetDelegates(std::move(delegates));
-    EXPECT_FALSE(
+    std::string trailer = "\x81\x85\x12\x34\x56\x78";
+    const std::string text = "Hello";
+    for (size_t i = 0; i < text.length(); ++i) {
+        trailer += (char)(text[i] ^ trailer[2 + (i % 4)]);
+    }
+    trailer += "\x8A\x80\x12\x34\x56\x78";
+    trailer += "\x89\x80\x12\x34\x56\x78";
+    ASSERT_TRUE(
         ws.OpenAsServer(
             connection,
             request,
             response,
-            "\x8A"
+            trailer
         )
     );
-    EXPECT_EQ(400, response.statusCode);
-    EXPECT_EQ("Bad Request", response.reasonPhrase);
+    EXPECT_EQ(101, response.statusCode);
+    EXPECT_EQ(std::vector< std::string >{"Hello"}, texts);
+    EXPECT_EQ(std::vector< std::string >{""}, pongs);
+    EXPECT_TRUE(connection->webSocketOutput.empty());
+    ws.SendText("World");
+    EXPECT_EQ(
+        std::string("\x81\x05" "World" "\x8A\x00", 9),
+        connection->webSocketOutput
+    );
+}
+
+TEST_F(WebSocketTests, CompleteOpenAsClientReceivesFramesInTrailer) {
+    Http::Request request;
+    ws.StartOpenAsClient(request);
+    Http::Response response;
+    response.statusCode = 101;
+    response.headers.SetHeader("Connection", "upgrade");
+    response.headers.SetHeader("Upgrade", "websocket");
+    response.headers.SetHeader(
+        "Sec-WebSocket-Accept",
+        Base64::Encode(
+            Hash::StringToBytes< Hash::Sha1 >(
+                request.headers.GetHeaderValue("Sec-WebSocket-Key")
+                + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+            )
+        )
+    );
+    const auto connection = std::make_shared< MockConnection >();
+    std::vector< std::string > texts;
+    WebSockets::WebSocket::Delegates delegates;
+    delegates.text = [&texts](
+        std::string&& data
+    ){
+        texts.push_back(std::move(data));
+    };
+    ws.SetDelegates(std::move(delegates));
+    ASSERT_TRUE(
+        ws.FinishOpenAsClient(
+            connection,
+            response,
+            std::string("\x81\x05Hello\x89\x00", 9)
+        )
+    );
+    EXPECT_EQ(std::vector< std::string >{"Hello"}, texts);
+    ASSERT_EQ(6, connection->webSocketOutput.length());
+    EXPECT_EQ("\x8A\x80", connection->webSocketOutput.substr(0, 2));
+}
+
+TEST_F(WebSocketTests, MessagesSentWhileOpeningAsClientSentOnceOpened) {
+    Http::Request request;
+    ws.StartOpenAsClient(request);
+    std::vector< bool > sentResults;
+    ws.SendText(
+        "a",
+        true,
+        WebSockets::WebSocket::Compression::Auto,
+        [&sentResults](bool sent){ sentResults.push_back(sent); }
+    );
+    ws.SendBinary("b");
+    EXPECT_TRUE(sentResults.empty());
+    Http::Response response;
+    response.statusCode = 101;
+    response.headers.SetHeader("Connection", "upgrade");
+    response.headers.SetHeader("Upgrade", "websocket");
+    response.headers.SetHeader(
+        "Sec-WebSocket-Accept",
+        Base64::Encode(
+            Hash::StringToBytes< Hash::Sha1 >(
+                request.headers.GetHeaderValue("Sec-WebSocket-Key")
+                + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+            )
+        )
+    );
+    const auto connection = std::make_shared< MockConnection >();
+    ASSERT_TRUE(ws.FinishOpenAsClient(connection, response));
+    EXPECT_EQ(std::vector< bool >{true}, sentResults);
+    ws.SendText("c");
+    ASSERT_EQ(21, connection->webSocketOutput.length());
+    EXPECT_EQ("\x81\x81", connection->webSocketOutput.substr(0, 2));
+    EXPECT_EQ("\x82\x81", connection->webSocketOutput.substr(7, 2));
+    EXPECT_EQ("\x81\x81", connection->webSocketOutput.substr(14, 2));
+}
+
+TEST_F(WebSocketTests, MessagesSentWhileOpeningAsClientDiscardedIfOpenFails) {
+    Http::Request request;
+    ws.StartOpenAsClient(request);
+    std::vector< bool > sentResults;
+    ws.SendText(
+        "a",
+        true,
+        WebSockets::WebSocket::Compression::Auto,
+        [&sentResults](bool sent){ sentResults.push_back(sent); }
+    );
+    Http::Response response;
+    response.statusCode = 404;
+    const auto connection = std::make_shared< MockConnection >();
+    ASSERT_FALSE(ws.FinishOpenAsClient(connection, response));
+    EXPECT_EQ(std::vector< bool >{false}, sentResults);
+    EXPECT_TRUE(connection->webSocketOutput.empty());
+}
+
+TEST_F(WebSocketTests, MessagesSentWhileOpeningAsClientDiscardedIfClosed) {
+    Http::Request request;
+    ws.StartOpenAsClient(request);
+    std::vector< bool > sentResults;
+    ws.SendBinary(
+        "a",
+        true,
+        WebSockets::WebSocket::Compression::Auto,
+        [&sentResults](bool sent){ sentResults.push_back(sent); }
+    );
+    ws.Close();
+    EXPECT_EQ(std::vector< bool >{false}, sentResults);
+    ws.SendBinary(
+        "b",
+        true,
+        WebSockets::WebSocket::Compression::Auto,
+        [&sentResults](bool sent){ sentResults.push_back(sent); }
+    );
+    EXPECT_EQ((std::vector< bool >{false, false}), sentResults);
 }
 
 TEST_F(WebSocketTests, SendPingNormalWithData) {
@@ -798,6 +1133,71 @@ TEST_F(WebSocketTests, SendPingNormalWithoutData) {
     ASSERT_EQ(std::string("\x89\x00", 2), connection->webSocketOutput);
 }
 
+TEST_F(WebSocketTests, MeasureRoundTripTimesFromPongsAnsweringPings) {
+    WebSockets::WebSocket::Configuration configuration;
+    configuration.measureRoundTripTimes = true;
+    ws.Configure(configuration);
+    const auto connection = std::make_shared< MockConnection >();
+    ws.Open(connection, WebSockets::WebSocket::Role::Server);
+    std::vector< std::string > pongs;
+    WebSockets::WebSocket::Delegates delegates;
+    delegates.pong = [&pongs](
+        const std::string& data
+    ){
+        pongs.push_back(data);
+    };
+    ws.SetDelegates(std::move(delegates));
+    std::vector< std::chrono::microseconds > lasts;
+    for (size_t i = 0; i < 2; ++i) {
+        connection->webSocketOutput.clear();
+        ws.Ping();
+        ASSERT_EQ(18, connection->webSocketOutput.length());
+        EXPECT_EQ("\x89\x10" "RTT1", connection->webSocketOutput.substr(0, 6));
+        const auto pong = (
+            std::string("\x8A\x90\x00\x00\x00\x00", 6)
+            + connection->webSocketOutput.substr(2)
+        );
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        connection->dataReceivedDelegate({pong.begin(), pong.end()});
+        connection->dataReceivedDelegate({pong.begin(), pong.end()});
+        const auto times = ws.GetRoundTripTimes();
+        EXPECT_EQ(i + 1, times.samples);
+        EXPECT_GE(times.last, std::chrono::milliseconds(2));
+        lasts.push_back(times.last);
+    }
+    const auto times = ws.GetRoundTripTimes();
+    EXPECT_EQ(std::min(lasts[0], lasts[1]), times.minimum);
+    EXPECT_EQ(std::max(lasts[0], lasts[1]), times.maximum);
+    EXPECT_NEAR(
+        (double)lasts[0].count() + ((double)lasts[1].count() - (double)lasts[0].count()) / 8.0,
+        (double)times.smoothed.count(),
+        1.0
+    );
+    EXPECT_EQ(4, pongs.size());
+}
+
+TEST_F(WebSocketTests, IgnoreForeignPongsWhenMeasuringRoundTripTimes) {
+    WebSockets::WebSocket::Configuration configuration;
+    configuration.measureRoundTripTimes = true;
+    ws.Configure(configuration);
+    const auto connection = std::make_shared< MockConnection >();
+    ws.Open(connection, WebSockets::WebSocket::Role::Server);
+    ws.Ping("Hello");
+    EXPECT_EQ("\x89\x05Hello", connection->webSocketOutput);
+    ws.Ping();
+    const auto forgedPong = (
+        std::string("\x8A\x90\x00\x00\x00\x00", 6)
+        + connection->webSocketOutput.substr(9, 8)
+        + std::string(8, '\x01')
+    );
+    connection->dataReceivedDelegate({forgedPong.begin(), forgedPong.end()});
+    const std::string helloPong = "\x8A\x85\x00\x00\x00\x00Hello";
+    connection->dataReceivedDelegate({helloPong.begin(), helloPong.end()});
+    const auto emptyPong = std::string("\x8A\x80\x00\x00\x00\x00", 6);
+    connection->dataReceivedDelegate({emptyPong.begin(), emptyPong.end()});
+    EXPECT_EQ(0, ws.GetRoundTripTimes().samples);
+}
+
 TEST_F(WebSocketTests, SendPingAlmostTooMuchData) {
     const auto connection = std::make_shared< MockConnection >();
     ws.Open(connection, WebSockets::WebSocket::Role::Server);
@@ -941,6 +1341,98 @@ TEST_F(WebSocketTests, SendBinary) {
     ASSERT_EQ("\x82\x0DHello, World!", connection->webSocketOutput);
 }
 
+TEST_F(WebSocketTests, SentDelegateCalledOnceMessageHandedToConnection) {
+    const auto connection = std::make_shared< MockConnection >();
+    ws.Open(connection, WebSockets::WebSocket::Role::Server);
+    std::vector< bool > sent;
+    std::string outputWhenSent;
+    ws.SendBinary(
+        "Hello",
+        true,
+        WebSockets::WebSocket::Compression::Auto,
+        [&sent, &outputWhenSent, connection](bool wasSent){
+            sent.push_back(wasSent);
+            outputWhenSent = connection->webSocketOutput;
+        }
+    );
+    EXPECT_EQ(std::vector< bool >{true}, sent);
+    EXPECT_EQ("\x82\x05Hello", outputWhenSent);
+    ws.Close(1000);
+    ws.SendText(
+        "World",
+        true,
+        WebSockets::WebSocket::Compression::Auto,
+        [&sent](bool wasSent){
+            sent.push_back(wasSent);
+        }
+    );
+    EXPECT_EQ((std::vector< bool >{true, false}), sent);
+}
+
+TEST_F(WebSocketTests, ActivityTimesMarkFirstFramesSentAndReceived) {
+    const auto connection = std::make_shared< MockConnection >();
+    ws.Open(connection, WebSockets::WebSocket::Role::Server);
+    auto times = ws.GetActivityTimes();
+    EXPECT_EQ(std::chrono::steady_clock::time_point(), times.firstFrameSent);
+    EXPECT_EQ(std::chrono::steady_clock::time_point(), times.firstFrameReceived);
+    const auto beforeSend = std::chrono::steady_clock::now();
+    ws.SendText("Hello", true);
+    times = ws.GetActivityTimes();
+    EXPECT_GE(times.firstFrameSent, beforeSend);
+    EXPECT_EQ(std::chrono::steady_clock::time_point(), times.firstFrameReceived);
+    const auto firstFrameSent = times.firstFrameSent;
+    const std::string frame = "\x8A\x80" "\x12\x34\x56\x78";
+    connection->dataReceivedDelegate({frame.begin(), frame.end()});
+    ws.SendText("World", true);
+    times = ws.GetActivityTimes();
+    EXPECT_EQ(firstFrameSent, times.firstFrameSent);
+    EXPECT_GE(times.firstFrameReceived, firstFrameSent);
+}
+
+TEST_F(WebSocketTests, ActivityTimesMarkLastFrameReceivedAndClosingHandshake) {
+    const auto connection = std::make_shared< MockConnection >();
+    ws.Open(connection, WebSockets::WebSocket::Role::Server);
+    const std::string pong = "\x8A\x80" "\x12\x34\x56\x78";
+    connection->dataReceivedDelegate({pong.begin(), pong.end()});
+    auto times = ws.GetActivityTimes();
+    const auto firstFrameReceived = times.firstFrameReceived;
+    EXPECT_EQ(firstFrameReceived, times.lastFrameReceived);
+    EXPECT_EQ(std::chrono::steady_clock::time_point(), times.closeSent);
+    EXPECT_EQ(std::chrono::steady_clock::time_point(), times.closed);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    connection->dataReceivedDelegate({pong.begin(), pong.end()});
+    ws.Close(1000, "bye");
+    times = ws.GetActivityTimes();
+    EXPECT_EQ(firstFrameReceived, times.firstFrameReceived);
+    EXPECT_GT(times.lastFrameReceived, firstFrameReceived);
+    EXPECT_GE(times.closeSent, times.lastFrameReceived);
+    EXPECT_EQ(std::chrono::steady_clock::time_point(), times.closed);
+    const std::string close = "\x88\x82" "\x12\x34\x56\x78" "\x11\xdc";
+    connection->dataReceivedDelegate({close.begin(), close.end()});
+    times = ws.GetActivityTimes();
+    EXPECT_GE(times.closed, times.closeSent);
+}
+
+TEST_F(WebSocketTests, CloseWith1006AfterCloseSentFailsConnection) {
+    const auto connection = std::make_shared< MockConnection >();
+    ws.Open(connection, WebSockets::WebSocket::Role::Server);
+    std::vector< unsigned int > closeCodes;
+    WebSockets::WebSocket::Delegates delegates;
+    delegates.close = [&closeCodes](
+        unsigned int code,
+        std::string&& reason
+    ){
+        closeCodes.push_back(code);
+    };
+    ws.SetDelegates(std::move(delegates));
+    ws.Close(1000, "bye");
+    EXPECT_FALSE(connection->brokenByWebSocket);
+    EXPECT_TRUE(closeCodes.empty());
+    ws.Close(1006, "timed out");
+    EXPECT_TRUE(connection->brokenByWebSocket);
+    EXPECT_EQ(std::vector< unsigned int >{1006}, closeCodes);
+}
+
 TEST_F(WebSocketTests, ReceiveBinary) {
     const auto connection = std::make_shared< MockConnection >();
     ws.Open(connection, WebSockets::WebSocket::Role::Client);
@@ -979,6 +1471,64 @@ TEST_F(WebSocketTests, SendMasked) {
     }
 }
 
+TEST_F(WebSocketTests, SendMaskedAcrossMaskingKeyPoolRefills) {
+    const auto connection = std::make_shared< MockConnection >();
+    ws.Open(connection, WebSockets::WebSocket::Role::Client);
+    const std::string data = "Hello";
+    std::set< std::string > maskingKeys;
+    for (size_t frameIndex = 0; frameIndex < 200; ++frameIndex) {
+        connection->webSocketOutput.clear();
+        ws.SendText(data);
+        ASSERT_EQ(11, connection->webSocketOutput.length());
+        ASSERT_EQ("\x81\x85", connection->webSocketOutput.substr(0, 2));
+        for (size_t i = 0; i < data.length(); ++i) {
+            ASSERT_EQ(
+                data[i] ^ connection->webSocketOutput[2 + (i % 4)],
+                connection->webSocketOutput[6 + i]
+            );
+        }
+        (void)maskingKeys.insert(connection->webSocketOutput.substr(2, 4));
+    }
+    EXPECT_GT(maskingKeys.size(), 190);
+}
+
+TEST_F(WebSocketTests, SendWhileAnotherThreadSendingIsQueuedAndBatched) {
+    const auto connection = std::make_shared< MockConnection >();
+    ws.Open(connection, WebSockets::WebSocket::Role::Server);
+    std::promise< void > firstSendStarted;
+    std::promise< void > firstSendMayFinish;
+    auto firstSendMayFinishFuture = firstSendMayFinish.get_future().share();
+    connection->sendDataHook = [&firstSendStarted, firstSendMayFinishFuture](size_t calls){
+        if (calls == 1) {
+            firstSendStarted.set_value();
+            firstSendMayFinishFuture.wait();
+        }
+    };
+    std::thread firstSender(
+        [this]{
+            ws.SendText("Hello");
+        }
+    );
+    firstSendStarted.get_future().wait();
+    auto otherSends = std::async(
+        std::launch::async,
+        [this]{
+            ws.SendText("World");
+            ws.SendBinary("!!");
+        }
+    );
+    EXPECT_EQ(
+        std::future_status::ready,
+        otherSends.wait_for(std::chrono::seconds(1))
+    );
+    firstSendMayFinish.set_value();
+    firstSender.join();
+    otherSends.wait();
+    ASSERT_FALSE(connection->brokenByWebSocket);
+    ASSERT_EQ("\x81\x05Hello\x81\x05World\x82\x02!!", connection->webSocketOutput);
+    EXPECT_EQ(2, connection->sendDataCalls);
+}
+
 TEST_F(WebSocketTests, ReceiveMasked) {
     const auto connection = std::make_shared< MockConnection >();
     ws.Open(connection, WebSockets::WebSocket::Role::Server);
@@ -1621,35 +2171,247 @@ TEST_F(WebSocketTests, ReceiveTextBeforeRegisterringTextDelegate) {
     );
 }
 
-TEST_F(WebSocketTests, ConnectionBrokenBeforeRegisterringCloseDelegate) {
+TEST_F(WebSocketTests, DropOldestEventsReceivedBeforeDelegatesSetBeyondLimit) {
     // Arrange
+    WebSockets::WebSocket::Configuration configuration;
+    configuration.maxBufferedEvents = 2;
+    configuration.eventBufferOverflowPolicy = WebSockets::WebSocket::EventBufferOverflowPolicy::DropOldest;
+    ws.Configure(configuration);
     const auto connection = std::make_shared< MockConnection >();
-    ws.Open(connection, WebSockets::WebSocket::Role::Server);
-    unsigned int codeReceived;
-    std::string reasonReceived;
-    bool closeReceived = false;
+    ws.Open(connection, WebSockets::WebSocket::Role::Client);
+    std::vector< std::string > texts;
 
     // Act
-    connection->brokenDelegate(false);
+    const std::string frame1 = "\x81\x06" "foobar";
+    const std::string frame2 = "\x81\x06" "Hello!";
+    const std::string frame3 = "\x81\x03" "bye";
+    connection->dataReceivedDelegate({frame1.begin(), frame1.end()});
+    connection->dataReceivedDelegate({frame2.begin(), frame2.end()});
+    connection->dataReceivedDelegate({frame3.begin(), frame3.end()});
+    const auto statisticsBeforeDelegatesSet = ws.GetEventBufferStatistics();
     WebSockets::WebSocket::Delegates delegates;
-    delegates.close = [&codeReceived, &reasonReceived, &closeReceived](
-        unsigned int code,
-        const std::string& reason
+    delegates.text = [&texts](
+        std::string&& data
     ){
-        codeReceived = code;
-        reasonReceived = reason;
-        closeReceived = true;
+        texts.push_back(std::move(data));
     };
     ws.SetDelegates(std::move(delegates));
+    const auto statisticsAfterDelegatesSet = ws.GetEventBufferStatistics();
 
     // Assert
-    ASSERT_TRUE(connection->brokenByWebSocket);
-    ASSERT_TRUE(closeReceived);
-    EXPECT_EQ(1006, codeReceived);
-    EXPECT_EQ("connection broken by peer", reasonReceived);
-    ASSERT_EQ(
+    EXPECT_FALSE(connection->brokenByWebSocket);
+    EXPECT_EQ(
         (std::vector< std::string >{
-            "WebSockets::WebSocket[1]: Connection to mock-client:5555 broken by peer",
+            "Hello!",
+            "bye",
+        }),
+        texts
+    );
+    EXPECT_EQ(2, statisticsBeforeDelegatesSet.eventsBuffered);
+    EXPECT_EQ(9, statisticsBeforeDelegatesSet.octetsBuffered);
+    EXPECT_EQ(2, statisticsBeforeDelegatesSet.peakEventsBuffered);
+    EXPECT_EQ(12, statisticsBeforeDelegatesSet.peakOctetsBuffered);
+    EXPECT_EQ(1, statisticsBeforeDelegatesSet.eventsDropped);
+    EXPECT_EQ(0, statisticsAfterDelegatesSet.eventsBuffered);
+    EXPECT_EQ(0, statisticsAfterDelegatesSet.octetsBuffered);
+}
+
+TEST_F(WebSocketTests, FailWhenEventsReceivedBeforeDelegatesSetExceedOctetLimit) {
+    // Arrange
+    WebSockets::WebSocket::Configuration configuration;
+    configuration.maxBufferedEventOctets = 10;
+    ws.Configure(configuration);
+    const auto connection = std::make_shared< MockConnection >();
+    ws.Open(connection, WebSockets::WebSocket::Role::Server);
+    std::vector< std::string > texts;
+    unsigned int closeCode = 0;
+
+    // Act
+    const std::string frame("\x81\x86\x00\x00\x00\x00" "foobar", 12);
+    connection->dataReceivedDelegate({frame.begin(), frame.end()});
+    EXPECT_FALSE(connection->brokenByWebSocket);
+    connection->dataReceivedDelegate({frame.begin(), frame.end()});
+    connection->dataReceivedDelegate({frame.begin(), frame.end()});
+    WebSockets::WebSocket::Delegates delegates;
+    delegates.text = [&texts](
+        std::string&& data
+    ){
+        texts.push_back(std::move(data));
+    };
+    delegates.close = [&closeCode](
+        unsigned int code,
+        std::string&& reason
+    ){
+        closeCode = code;
+    };
+    ws.SetDelegates(std::move(delegates));
+
+    // Assert
+    EXPECT_TRUE(connection->brokenByWebSocket);
+    EXPECT_EQ("\x88\x2f\x03\xf0", connection->webSocketOutput.substr(0, 4));
+    EXPECT_EQ(
+        (std::vector< std::string >{
+            "foobar",
+            "foobar",
+        }),
+        texts
+    );
+    EXPECT_EQ(1008, closeCode);
+}
+
+TEST_F(WebSocketTests, DropEventsAndFailWhenEventsReceivedAfterCloseSentExceedLimit) {
+    // Arrange
+    WebSockets::WebSocket::Configuration configuration;
+    configuration.maxBufferedEvents = 2;
+    ws.Configure(configuration);
+    const auto connection = std::make_shared< MockConnection >();
+    ws.Open(connection, WebSockets::WebSocket::Role::Client);
+    ws.Close(1000, "bye");
+    ASSERT_FALSE(connection->brokenByWebSocket);
+    std::vector< std::string > texts;
+    unsigned int closeCode = 0;
+
+    // Act
+    const std::string frame = "\x81\x06" "foobar";
+    for (size_t i = 0; i < 10; ++i) {
+        connection->dataReceivedDelegate({frame.begin(), frame.end()});
+    }
+    const auto statistics = ws.GetEventBufferStatistics();
+    WebSockets::WebSocket::Delegates delegates;
+    delegates.text = [&texts](
+        std::string&& data
+    ){
+        texts.push_back(std::move(data));
+    };
+    delegates.close = [&closeCode](
+        unsigned int code,
+        std::string&& reason
+    ){
+        closeCode = code;
+    };
+    ws.SetDelegates(std::move(delegates));
+
+    // Assert
+    EXPECT_TRUE(connection->brokenByWebSocket);
+    EXPECT_LE(statistics.eventsBuffered, 3);
+    EXPECT_LE(statistics.peakEventsBuffered, 3);
+    EXPECT_GT(statistics.eventsDropped, 0);
+    EXPECT_LE(texts.size(), 2);
+    EXPECT_EQ(1006, closeCode);
+}
+
+TEST_F(WebSocketTests, ReplaceDelegatesFromDelegate) {
+    // Arrange
+    const auto connection = std::make_shared< MockConnection >();
+    ws.Open(connection, WebSockets::WebSocket::Role::Client);
+    std::vector< std::string > texts;
+    const std::string prefix = "first: ";
+    WebSockets::WebSocket::Delegates delegates;
+    delegates.text = [this, &texts, prefix](
+        std::string&& data
+    ){
+        WebSockets::WebSocket::Delegates newDelegates;
+        newDelegates.text = [&texts](
+            std::string&& data
+        ){
+            texts.push_back("second: " + data);
+        };
+        ws.SetDelegates(std::move(newDelegates));
+        texts.push_back(prefix + data);
+    };
+    ws.SetDelegates(std::move(delegates));
+
+    // Act
+    const std::string frame1 = "\x81\x06" "foobar";
+    const std::string frame2 = "\x81\x06" "Hello!";
+    connection->dataReceivedDelegate({frame1.begin(), frame1.end()});
+    connection->dataReceivedDelegate({frame2.begin(), frame2.end()});
+
+    // Assert
+    EXPECT_EQ(
+        (std::vector< std::string >{
+            "first: foobar",
+            "second: Hello!",
+        }),
+        texts
+    );
+}
+
+TEST_F(WebSocketTests, DelegatesCalledThroughExecutor) {
+    // Arrange
+    std::vector< std::function< void() > > work;
+    WebSockets::WebSocket::Configuration configuration;
+    configuration.executor = [&work](std::function< void() >&& newWork){
+        work.push_back(std::move(newWork));
+    };
+    ws.Configure(configuration);
+    const auto connection = std::make_shared< MockConnection >();
+    ws.Open(connection, WebSockets::WebSocket::Role::Client);
+    std::vector< std::string > texts;
+    WebSockets::WebSocket::Delegates delegates;
+    delegates.text = [&texts](
+        std::string&& data
+    ){
+        texts.push_back(std::move(data));
+    };
+    ws.SetDelegates(std::move(delegates));
+
+    // Act
+    const std::string frame1 = "\x81\x06" "foobar";
+    const std::string frame2 = "\x81\x06" "Hello!";
+    const std::string frame3 = "\x81\x03" "bye";
+    connection->dataReceivedDelegate({frame1.begin(), frame1.end()});
+    connection->dataReceivedDelegate({frame2.begin(), frame2.end()});
+
+    // Assert
+    EXPECT_TRUE(texts.empty());
+    ASSERT_EQ(1, work.size());
+    auto nextWork = std::move(work[0]);
+    work.clear();
+    connection->dataReceivedDelegate({frame3.begin(), frame3.end()});
+    EXPECT_TRUE(work.empty());
+    nextWork();
+    EXPECT_EQ(
+        (std::vector< std::string >{
+            "foobar",
+            "Hello!",
+            "bye",
+        }),
+        texts
+    );
+    connection->dataReceivedDelegate({frame1.begin(), frame1.end()});
+    EXPECT_EQ(1, work.size());
+}
+
+TEST_F(WebSocketTests, ConnectionBrokenBeforeRegisterringCloseDelegate) {
+    // Arrange
+    const auto connection = std::make_shared< MockConnection >();
+    ws.Open(connection, WebSockets::WebSocket::Role::Server);
+    unsigned int codeReceived;
+    std::string reasonReceived;
+    bool closeReceived = false;
+
+    // Act
+    connection->brokenDelegate(false);
+    WebSockets::WebSocket::Delegates delegates;
+    delegates.close = [&codeReceived, &reasonReceived, &closeReceived](
+        unsigned int code,
+        const std::string& reason
+    ){
+        codeReceived = code;
+        reasonReceived = reason;
+        closeReceived = true;
+    };
+    ws.SetDelegates(std::move(delegates));
+
+    // Assert
+    ASSERT_TRUE(connection->brokenByWebSocket);
+    ASSERT_TRUE(closeReceived);
+    EXPECT_EQ(1006, codeReceived);
+    EXPECT_EQ("connection broken by peer", reasonReceived);
+    ASSERT_EQ(
+        (std::vector< std::string >{
+            "WebSockets::WebSocket[1]: Connection to mock-client:5555 broken by peer",
         }),
         diagnosticMessages
     );
@@ -1710,3 +2472,1063 @@ TEST_F(WebSocketTests, DropConnectionIfFrameTooLarge) {
     EXPECT_EQ(1009, codeReceived);
     EXPECT_EQ("frame too large", reasonReceived);
 }
+
+TEST_F(WebSocketTests, InitiateOpenAsClientOfferingPerMessageDeflate) {
+    WebSockets::WebSocket::Configuration configuration;
+    configuration.perMessageDeflate = true;
+    ws.Configure(configuration);
+    Http::Request request;
+    ws.StartOpenAsClient(request);
+    EXPECT_EQ(
+        "permessage-deflate; client_max_window_bits",
+        request.headers.GetHeaderValue("Sec-WebSocket-Extensions")
+    );
+    ReplaceWebSocket();
+    configuration.serverNoContextTakeover = true;
+    configuration.serverMaxWindowBits = 10;
+    configuration.clientMaxWindowBits = 12;
+    ws.Configure(configuration);
+    request = Http::Request();
+    ws.StartOpenAsClient(request);
+    EXPECT_EQ(
+        "permessage-deflate; server_no_context_takeover; server_max_window_bits=10; client_max_window_bits=12",
+        request.headers.GetHeaderValue("Sec-WebSocket-Extensions")
+    );
+}
+
+TEST_F(WebSocketTests, InitiateOpenAsClientNotOfferingPerMessageDeflateByDefault) {
+    Http::Request request;
+    ws.StartOpenAsClient(request);
+    EXPECT_FALSE(request.headers.HasHeader("Sec-WebSocket-Extensions"));
+}
+
+TEST_F(WebSocketTests, CompleteOpenAsClientWithPerMessageDeflate) {
+    WebSockets::WebSocket::Configuration configuration;
+    configuration.perMessageDeflate = true;
+    ws.Configure(configuration);
+    Http::Request request;
+    ws.StartOpenAsClient(request);
+    Http::Response response;
+    response.statusCode = 101;
+    response.headers.SetHeader("Connection", "upgrade");
+    response.headers.SetHeader("Upgrade", "websocket");
+    response.headers.SetHeader(
+        "Sec-WebSocket-Accept",
+        Base64::Encode(
+            Hash::StringToBytes< Hash::Sha1 >(
+                request.headers.GetHeaderValue("Sec-WebSocket-Key")
+                + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+            )
+        )
+    );
+    response.headers.SetHeader(
+        "Sec-WebSocket-Extensions",
+        "permessage-deflate; client_no_context_takeover"
+    );
+    const auto connection = std::make_shared< MockConnection >();
+    ASSERT_TRUE(
+        ws.FinishOpenAsClient(
+            connection,
+            response
+        )
+    );
+    const std::string compressedData("\xf2\x48\xcd\xc9\xc9\x07\x00", 7);
+    ws.SendText("Hello");
+    ws.SendText("Hello");
+    ASSERT_EQ(26, connection->webSocketOutput.length());
+    for (size_t frameIndex = 0; frameIndex < 2; ++frameIndex) {
+        const auto frame = connection->webSocketOutput.substr(frameIndex * 13, 13);
+        ASSERT_EQ("\xc1\x87", frame.substr(0, 2));
+        for (size_t i = 0; i < compressedData.length(); ++i) {
+            ASSERT_EQ(
+                compressedData[i] ^ frame[2 + (i % 4)],
+                frame[6 + i]
+            );
+        }
+    }
+}
+
+TEST_F(WebSocketTests, CompleteOpenAsClientWithCustomExtension) {
+    struct TestVector {
+        std::string responseExtensions;
+        bool accept;
+        bool expectSuccess;
+    };
+    const std::vector< TestVector > testVectors{
+        {"x-toggle-case; mode=fast", true, true},
+        {"x-toggle-case", false, false},
+        {"x-toggle-case, x-toggle-case", true, false},
+        {"permessage-deflate, x-toggle-case", true, true},
+        {"x-toggle-case, permessage-deflate", true, true},
+    };
+    size_t index = 0;
+    for (const auto& testVector: testVectors) {
+        ReplaceWebSocket();
+        const auto extension = std::make_shared< ToggleCaseExtension >();
+        extension->offer.emplace_back("mode", "fast");
+        extension->accept = testVector.accept;
+        WebSockets::WebSocket::Configuration configuration;
+        configuration.perMessageDeflate = true;
+        configuration.extensions.push_back(
+            [extension]{ return extension; }
+        );
+        ws.Configure(configuration);
+        Http::Request request;
+        ws.StartOpenAsClient(request);
+        EXPECT_EQ(
+            "permessage-deflate; client_max_window_bits, x-toggle-case; mode=fast",
+            request.headers.GetHeaderValue("Sec-WebSocket-Extensions")
+        );
+        Http::Response response;
+        response.statusCode = 101;
+        response.headers.SetHeader("Connection", "upgrade");
+        response.headers.SetHeader("Upgrade", "websocket");
+        response.headers.SetHeader(
+            "Sec-WebSocket-Accept",
+            Base64::Encode(
+                Hash::StringToBytes< Hash::Sha1 >(
+                    request.headers.GetHeaderValue("Sec-WebSocket-Key")
+                    + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+                )
+            )
+        );
+        response.headers.SetHeader(
+            "Sec-WebSocket-Extensions",
+            testVector.responseExtensions
+        );
+        const auto connection = std::make_shared< MockConnection >();
+        EXPECT_EQ(
+            testVector.expectSuccess,
+            ws.FinishOpenAsClient(connection, response)
+        ) << index;
+        ++index;
+    }
+}
+
+TEST_F(WebSocketTests, FailCompleteOpenAsClientDueToPerMessageDeflateNotOffered) {
+    Http::Request request;
+    ws.StartOpenAsClient(request);
+    Http::Response response;
+    response.statusCode = 101;
+    response.headers.SetHeader("Connection", "upgrade");
+    response.headers.SetHeader("Upgrade", "websocket");
+    response.headers.SetHeader(
+        "Sec-WebSocket-Accept",
+        Base64::Encode(
+            Hash::StringToBytes< Hash::Sha1 >(
+                request.headers.GetHeaderValue("Sec-WebSocket-Key")
+                + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+            )
+        )
+    );
+    response.headers.SetHeader("Sec-WebSocket-Extensions", "permessage-deflate");
+    const auto connection = std::make_shared< MockConnection >();
+    ASSERT_FALSE(
+        ws.FinishOpenAsClient(
+            connection,
+            response
+        )
+    );
+}
+
+TEST_F(WebSocketTests, FailCompleteOpenAsClientDueToBadPerMessageDeflateResponse) {
+    const std::vector< std::string > badResponses{
+        "permessage-deflate; foo",
+        "permessage-deflate; server_no_context_takeover; server_no_context_takeover",
+        "permessage-deflate; server_max_window_bits=16",
+        "permessage-deflate; server_max_window_bits",
+        "permessage-deflate; client_max_window_bits",
+        "permessage-deflate; client_max_window_bits=8",
+        "permessage-deflate, permessage-deflate",
+        "permessage-deflate, foobar",
+    };
+    WebSockets::WebSocket::Configuration configuration;
+    configuration.perMessageDeflate = true;
+    for (const auto& badResponse: badResponses) {
+        ReplaceWebSocket();
+        ws.Configure(configuration);
+        Http::Request request;
+        ws.StartOpenAsClient(request);
+        Http::Response response;
+        response.statusCode = 101;
+        response.headers.SetHeader("Connection", "upgrade");
+        response.headers.SetHeader("Upgrade", "websocket");
+        response.headers.SetHeader(
+            "Sec-WebSocket-Accept",
+            Base64::Encode(
+                Hash::StringToBytes< Hash::Sha1 >(
+                    request.headers.GetHeaderValue("Sec-WebSocket-Key")
+                    + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+                )
+            )
+        );
+        response.headers.SetHeader("Sec-WebSocket-Extensions", badResponse);
+        const auto connection = std::make_shared< MockConnection >();
+        EXPECT_FALSE(
+            ws.FinishOpenAsClient(
+                connection,
+                response
+            )
+        ) << badResponse;
+    }
+}
+
+TEST_F(WebSocketTests, CompleteOpenAsServerWithPerMessageDeflate) {
+    struct TestVector {
+        std::string offer;
+        std::string response;
+    };
+    const std::vector< TestVector > testVectors{
+        {"permessage-deflate", "permessage-deflate"},
+        {"permessage-deflate; client_max_window_bits", "permessage-deflate"},
+        {"foo, permessage-deflate; server_max_window_bits=10", "permessage-deflate; server_max_window_bits=10"},
+        {"permessage-deflate; client_max_window_bits=9; server_no_context_takeover", "permessage-deflate; server_no_context_takeover; client_max_window_bits=9"},
+        {"permessage-deflate; server_max_window_bits=8, permessage-deflate", "permessage-deflate"},
+        {"permessage-deflate; server_max_window_bits=16", ""},
+        {"permessage-deflate; bar=1", ""},
+        {"foo", ""},
+    };
+    WebSockets::WebSocket::Configuration configuration;
+    configuration.perMessageDeflate = true;
+    for (const auto& testVector: testVectors) {
+        ReplaceWebSocket();
+        ws.Configure(configuration);
+        Http::Request request;
+        request.method = "GET";
+        request.headers.SetHeader("Connection", "upgrade");
+        request.headers.SetHeader("Upgrade", "websocket");
+        request.headers.SetHeader("Sec-WebSocket-Version", "13");
+        request.headers.SetHeader("Sec-WebSocket-Key", "dGhlIHNhbXBsZSBub25jZQ==");
+        request.headers.SetHeader("Sec-WebSocket-Extensions", testVector.offer);
+        Http::Response response;
+        const auto connection = std::make_shared< MockConnection >();
+        ASSERT_TRUE(
+            ws.OpenAsServer(
+                connection,
+                request,
+                response,
+                ""
+            )
+        ) << testVector.offer;
+        EXPECT_EQ(
+            testVector.response,
+            response.headers.GetHeaderValue("Sec-WebSocket-Extensions")
+        ) << testVector.offer;
+    }
+}
+
+TEST_F(WebSocketTests, CompleteOpenAsServerDeclinesPerMessageDeflateWhenNotConfigured) {
+    Http::Request request;
+    request.method = "GET";
+    request.headers.SetHeader("Connection", "upgrade");
+    request.headers.SetHeader("Upgrade", "websocket");
+    request.headers.SetHeader("Sec-WebSocket-Version", "13");
+    request.headers.SetHeader("Sec-WebSocket-Key", "dGhlIHNhbXBsZSBub25jZQ==");
+    request.headers.SetHeader("Sec-WebSocket-Extensions", "permessage-deflate");
+    Http::Response response;
+    const auto connection = std::make_shared< MockConnection >();
+    ASSERT_TRUE(
+        ws.OpenAsServer(
+            connection,
+            request,
+            response,
+            ""
+        )
+    );
+    EXPECT_FALSE(response.headers.HasHeader("Sec-WebSocket-Extensions"));
+    ws.SendText("Hello");
+    EXPECT_EQ("\x81\x05Hello", connection->webSocketOutput);
+}
+
+TEST_F(WebSocketTests, InitiateOpenAsClientOfferingSubprotocols) {
+    WebSockets::WebSocket::Configuration configuration;
+    configuration.subprotocols = {"quote.binary.v2", "quote.json"};
+    ws.Configure(configuration);
+    Http::Request request;
+    ws.StartOpenAsClient(request);
+    EXPECT_EQ(
+        "quote.binary.v2, quote.json",
+        request.headers.GetHeaderValue("Sec-WebSocket-Protocol")
+    );
+    ReplaceWebSocket();
+    Http::Request requestWithoutSubprotocols;
+    ws.StartOpenAsClient(requestWithoutSubprotocols);
+    EXPECT_FALSE(requestWithoutSubprotocols.headers.HasHeader("Sec-WebSocket-Protocol"));
+}
+
+TEST_F(WebSocketTests, CompleteOpenAsClientWithSubprotocol) {
+    struct TestVector {
+        std::string responseSubprotocol;
+        bool expectSuccess;
+    };
+    const std::vector< TestVector > testVectors{
+        {"quote.json", true},
+        {"quote.binary.v2", true},
+        {"", true},
+        {"quote.xml", false},
+        {"Quote.Json", false},
+        {"quote.json, quote.binary.v2", false},
+    };
+    size_t index = 0;
+    for (const auto& testVector: testVectors) {
+        ReplaceWebSocket();
+        WebSockets::WebSocket::Configuration configuration;
+        configuration.subprotocols = {"quote.binary.v2", "quote.json"};
+        ws.Configure(configuration);
+        Http::Request request;
+        ws.StartOpenAsClient(request);
+        Http::Response response;
+        response.statusCode = 101;
+        response.headers.SetHeader("Connection", "upgrade");
+        response.headers.SetHeader("Upgrade", "websocket");
+        response.headers.SetHeader(
+            "Sec-WebSocket-Accept",
+            Base64::Encode(
+                Hash::StringToBytes< Hash::Sha1 >(
+                    request.headers.GetHeaderValue("Sec-WebSocket-Key")
+                    + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+                )
+            )
+        );
+        if (!testVector.responseSubprotocol.empty()) {
+            response.headers.SetHeader(
+                "Sec-WebSocket-Protocol",
+                testVector.responseSubprotocol
+            );
+        }
+        const auto connection = std::make_shared< MockConnection >();
+        EXPECT_EQ(
+            testVector.expectSuccess,
+            ws.FinishOpenAsClient(connection, response)
+        ) << index;
+        if (testVector.expectSuccess) {
+            EXPECT_EQ(testVector.responseSubprotocol, ws.GetSubprotocol()) << index;
+        } else {
+            EXPECT_EQ("", ws.GetSubprotocol()) << index;
+        }
+        ++index;
+    }
+}
+
+TEST_F(WebSocketTests, CompleteOpenAsServerWithSubprotocol) {
+    struct TestVector {
+        std::vector< std::string > supportedSubprotocols;
+        std::string offeredSubprotocols;
+        std::string expectedSubprotocol;
+    };
+    const std::vector< TestVector > testVectors{
+        {{"quote.binary.v2", "quote.json"}, "quote.json, quote.binary.v2", "quote.binary.v2"},
+        {{"quote.binary.v2", "quote.json"}, "quote.json", "quote.json"},
+        {{"quote.binary.v2", "quote.json"}, "quote.xml", ""},
+        {{"quote.binary.v2", "quote.json"}, "", ""},
+        {{}, "quote.json", ""},
+    };
+    size_t index = 0;
+    for (const auto& testVector: testVectors) {
+        ReplaceWebSocket();
+        WebSockets::WebSocket::Configuration configuration;
+        configuration.subprotocols = testVector.supportedSubprotocols;
+        ws.Configure(configuration);
+        Http::Request request;
+        request.method = "GET";
+        request.headers.SetHeader("Connection", "upgrade");
+        request.headers.SetHeader("Upgrade", "websocket");
+        request.headers.SetHeader("Sec-WebSocket-Version", "13");
+        request.headers.SetHeader("Sec-WebSocket-Key", "dGhlIHNhbXBsZSBub25jZQ==");
+        if (!testVector.offeredSubprotocols.empty()) {
+            request.headers.SetHeader(
+                "Sec-WebSocket-Protocol",
+                testVector.offeredSubprotocols
+            );
+        }
+        Http::Response response;
+        const auto connection = std::make_shared< MockConnection >();
+        ASSERT_TRUE(ws.OpenAsServer(connection, request, response, "")) << index;
+        EXPECT_EQ(testVector.expectedSubprotocol, ws.GetSubprotocol()) << index;
+        if (testVector.expectedSubprotocol.empty()) {
+            EXPECT_FALSE(response.headers.HasHeader("Sec-WebSocket-Protocol")) << index;
+        } else {
+            EXPECT_EQ(
+                testVector.expectedSubprotocol,
+                response.headers.GetHeaderValue("Sec-WebSocket-Protocol")
+            ) << index;
+        }
+        ++index;
+    }
+}
+
+/**
+ * This is the test fixture for tests of the "permessage-deflate"
+ * extension, with the WebSocket opened in the server role.
+ */
+struct WebSocketPerMessageDeflateTests
+    : public WebSocketTests
+{
+    // Properties
+
+    /**
+     * This is the connection given to the WebSocket.
+     */
+    std::shared_ptr< MockConnection > connection = std::make_shared< MockConnection >();
+
+    /**
+     * This is the configuration given to the WebSocket.  The
+     * "permessage-deflate" extension is always enabled.
+     */
+    WebSockets::WebSocket::Configuration configuration;
+
+    /**
+     * These are the text messages received by the WebSocket.
+     */
+    std::vector< std::string > texts;
+
+    /**
+     * This is the close status code received by the WebSocket, if any.
+     */
+    unsigned int codeReceived = 0;
+
+    /**
+     * This is the close reason received by the WebSocket, if any.
+     */
+    std::string reasonReceived;
+
+    /**
+     * This is the HTTP response the WebSocket formed to complete
+     * the opening handshake.
+     */
+    Http::Response openResponse;
+
+    // Methods
+
+    /**
+     * This method opens the WebSocket in the server role, negotiating
+     * the "permessage-deflate" extension using the given offer.
+     *
+     * @param[in] offer
+     *     This is the extension offer from the client.
+     */
+    void OpenWithOffer(const std::string& offer) {
+        configuration.perMessageDeflate = true;
+        ws.Configure(configuration);
+        Http::Request request;
+        request.method = "GET";
+        request.headers.SetHeader("Connection", "upgrade");
+        request.headers.SetHeader("Upgrade", "websocket");
+        request.headers.SetHeader("Sec-WebSocket-Version", "13");
+        request.headers.SetHeader("Sec-WebSocket-Key", "dGhlIHNhbXBsZSBub25jZQ==");
+        request.headers.SetHeader("Sec-WebSocket-Extensions", offer);
+        openResponse = Http::Response();
+        ASSERT_TRUE(ws.OpenAsServer(connection, request, openResponse, ""));
+        WebSockets::WebSocket::Delegates delegates;
+        delegates.text = [this](
+            std::string&& data
+        ){
+            texts.push_back(std::move(data));
+        };
+        delegates.close = [this](
+            unsigned int code,
+            std::string&& reason
+        ){
+            codeReceived = code;
+            reasonReceived = std::move(reason);
+        };
+        ws.SetDelegates(std::move(delegates));
+    }
+
+    /**
+     * This method simulates the client sending the given frame to
+     * the WebSocket, masking it with a fixed masking key.
+     *
+     * @param[in] header
+     *     This is the first octet of the frame.
+     *
+     * @param[in] payload
+     *     This is the unmasked payload of the frame.
+     */
+    void ReceiveFrame(
+        uint8_t header,
+        const std::string& payload
+    ) {
+        const char mask[4] = {0x12, 0x34, 0x56, 0x78};
+        std::string frame;
+        frame.push_back((char)header);
+        if (payload.length() < 126) {
+            frame.push_back((char)(0x80 + payload.length()));
+        } else if (payload.length() < 65536) {
+            frame.push_back((char)(0x80 + 126));
+            frame.push_back((char)(payload.length() >> 8));
+            frame.push_back((char)payload.length());
+        } else {
+            frame.push_back((char)(0x80 + 127));
+            for (int shift = 56; shift >= 0; shift -= 8) {
+                frame.push_back((char)((uint64_t)payload.length() >> shift));
+            }
+        }
+        frame += std::string(mask, 4);
+        for (size_t i = 0; i < payload.length(); ++i) {
+            frame += payload[i] ^ mask[i % 4];
+        }
+        connection->dataReceivedDelegate({frame.begin(), frame.end()});
+    }
+
+    /**
+     * This method makes and opens another WebSocket in the server role,
+     * using the fixture's configuration, for tests involving several
+     * WebSockets.
+     *
+     * @param[in] otherConnection
+     *     This is the connection to give to the other WebSocket.
+     *
+     * @param[in] offer
+     *     This is the extension offer from the client, or an empty
+     *     string if the client doesn't offer any extensions.
+     *
+     * @return
+     *     The other WebSocket is returned.
+     */
+    std::shared_ptr< WebSockets::WebSocket > OpenOtherWebSocket(
+        std::shared_ptr< MockConnection > otherConnection,
+        const std::string& offer
+    ) {
+        const auto otherWs = std::make_shared< WebSockets::WebSocket >();
+        auto otherConfiguration = configuration;
+        otherConfiguration.perMessageDeflate = true;
+        otherWs->Configure(otherConfiguration);
+        Http::Request request;
+        request.method = "GET";
+        request.headers.SetHeader("Connection", "upgrade");
+        request.headers.SetHeader("Upgrade", "websocket");
+        request.headers.SetHeader("Sec-WebSocket-Version", "13");
+        request.headers.SetHeader("Sec-WebSocket-Key", "dGhlIHNhbXBsZSBub25jZQ==");
+        if (!offer.empty()) {
+            request.headers.SetHeader("Sec-WebSocket-Extensions", offer);
+        }
+        Http::Response response;
+        EXPECT_TRUE(otherWs->OpenAsServer(otherConnection, request, response, ""));
+        return otherWs;
+    }
+};
+
+TEST_F(WebSocketPerMessageDeflateTests, SendCompressedWithContextTakeover) {
+    OpenWithOffer("permessage-deflate");
+    ws.SendText("Hello");
+    ws.SendText("Hello");
+    EXPECT_EQ(
+        std::string("\xc1\x07\xf2\x48\xcd\xc9\xc9\x07\x00", 9)
+        + std::string("\xc1\x05\xf2\x00\x11\x00\x00", 7),
+        connection->webSocketOutput
+    );
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, SendCompressedWithoutContextTakeover) {
+    OpenWithOffer("permessage-deflate; server_no_context_takeover");
+    ws.SendText("Hello");
+    ws.SendText("Hello");
+    EXPECT_EQ(
+        std::string("\xc1\x07\xf2\x48\xcd\xc9\xc9\x07\x00", 9)
+        + std::string("\xc1\x07\xf2\x48\xcd\xc9\xc9\x07\x00", 9),
+        connection->webSocketOutput
+    );
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, SendCompressedFragments) {
+    OpenWithOffer("permessage-deflate");
+    ws.SendBinary("Hel", false);
+    ws.SendBinary("lo", true);
+    ASSERT_GE(connection->webSocketOutput.length(), 4);
+    EXPECT_EQ('\x42', connection->webSocketOutput[0]);
+    const auto secondFrame = connection->webSocketOutput.substr(
+        2 + (size_t)connection->webSocketOutput[1]
+    );
+    ASSERT_GE(secondFrame.length(), 2);
+    EXPECT_EQ('\x80', secondFrame[0]);
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, ReceiveCompressed) {
+    OpenWithOffer("permessage-deflate");
+    ReceiveFrame(0xc1, std::string("\xf2\x48\xcd\xc9\xc9\x07\x00", 7));
+    ReceiveFrame(0xc1, std::string("\xf2\x00\x11\x00\x00", 5));
+    ReceiveFrame(0x81, "World");
+    EXPECT_FALSE(connection->brokenByWebSocket);
+    EXPECT_EQ(
+        (std::vector< std::string >{
+            "Hello",
+            "Hello",
+            "World",
+        }),
+        texts
+    );
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, ReceiveCompressedFragments) {
+    OpenWithOffer("permessage-deflate");
+    ReceiveFrame(0x41, std::string("\xf2\x48\xcd", 3));
+    ReceiveFrame(0x80, std::string("\xc9\xc9\x07\x00", 4));
+    EXPECT_FALSE(connection->brokenByWebSocket);
+    EXPECT_EQ(
+        (std::vector< std::string >{
+            "Hello",
+        }),
+        texts
+    );
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, ReceiveCompressedUsingStoredBlock) {
+    OpenWithOffer("permessage-deflate");
+    ReceiveFrame(0xc1, std::string("\x00\x05\x00\xfa\xffHello\x00", 11));
+    EXPECT_FALSE(connection->brokenByWebSocket);
+    EXPECT_EQ(
+        (std::vector< std::string >{
+            "Hello",
+        }),
+        texts
+    );
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, ViolationCompressedControlFrame) {
+    OpenWithOffer("permessage-deflate");
+    ReceiveFrame(0xc9, "Hello");
+    EXPECT_TRUE(connection->brokenByWebSocket);
+    EXPECT_EQ(1002, codeReceived);
+    EXPECT_EQ("reserved bits set", reasonReceived);
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, ViolationCompressedContinuationFrame) {
+    OpenWithOffer("permessage-deflate");
+    ReceiveFrame(0x41, std::string("\xf2\x48\xcd", 3));
+    ReceiveFrame(0xc0, std::string("\xc9\xc9\x07\x00", 4));
+    EXPECT_TRUE(connection->brokenByWebSocket);
+    EXPECT_EQ(1002, codeReceived);
+    EXPECT_EQ("reserved bits set", reasonReceived);
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, ViolationInvalidCompressedData) {
+    OpenWithOffer("permessage-deflate");
+    ReceiveFrame(0xc1, "\xff\xff\xff\xff");
+    EXPECT_TRUE(connection->brokenByWebSocket);
+    EXPECT_EQ(1007, codeReceived);
+    EXPECT_EQ("invalid compressed data", reasonReceived);
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, ViolationCompressedMessageTooLarge) {
+    const auto otherConnection = std::make_shared< MockConnection >();
+    const auto otherWs = OpenOtherWebSocket(otherConnection, "permessage-deflate");
+    const std::string message(100000, 'a');
+    otherWs->SendText(message);
+    const auto& frame = otherConnection->webSocketOutput;
+    ASSERT_GE(frame.length(), 2);
+    ASSERT_EQ('\xc1', frame[0]);
+    ASSERT_LT((uint8_t)frame[1], 126);
+    const auto compressedMessage = frame.substr(2);
+    configuration.maxMessageSize = message.length();
+    OpenWithOffer("permessage-deflate; client_no_context_takeover");
+    ReceiveFrame(0xc1, compressedMessage);
+    EXPECT_FALSE(connection->brokenByWebSocket);
+    EXPECT_EQ(
+        (std::vector< std::string >{
+            message,
+        }),
+        texts
+    );
+    ReplaceWebSocket();
+    connection = std::make_shared< MockConnection >();
+    texts.clear();
+    configuration.maxMessageSize = message.length() - 1;
+    OpenWithOffer("permessage-deflate; client_no_context_takeover");
+    ReceiveFrame(0xc1, compressedMessage);
+    EXPECT_TRUE(connection->brokenByWebSocket);
+    EXPECT_TRUE(texts.empty());
+    EXPECT_EQ(1009, codeReceived);
+    EXPECT_EQ("message too large", reasonReceived);
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, ViolationCompressedMessageTooLargeWithDefaultConfiguration) {
+    const auto otherConnection = std::make_shared< MockConnection >();
+    const auto otherWs = OpenOtherWebSocket(otherConnection, "permessage-deflate");
+    ASSERT_GT(configuration.maxDecodedMessageSize, 0);
+    const std::string message(configuration.maxDecodedMessageSize + 1, 'a');
+    otherWs->SendText(message);
+    const auto& frame = otherConnection->webSocketOutput;
+    ASSERT_GE(frame.length(), 4);
+    ASSERT_EQ('\xc1', frame[0]);
+    ASSERT_EQ(126, (uint8_t)frame[1]);
+    const auto compressedMessage = frame.substr(4);
+    OpenWithOffer("permessage-deflate");
+    ReceiveFrame(0xc1, compressedMessage);
+    EXPECT_TRUE(connection->brokenByWebSocket);
+    EXPECT_TRUE(texts.empty());
+    EXPECT_EQ(1009, codeReceived);
+    EXPECT_EQ("message too large", reasonReceived);
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, NotNegotiatedWithoutMessageSizeLimits) {
+    configuration.maxMessageSize = 0;
+    configuration.maxDecodedMessageSize = 0;
+    OpenWithOffer("permessage-deflate");
+    EXPECT_FALSE(openResponse.headers.HasHeader("Sec-WebSocket-Extensions"));
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, ViolationFragmentedMessageTooLarge) {
+    configuration.maxMessageSize = 5;
+    OpenWithOffer("permessage-deflate");
+    ReceiveFrame(0x01, "Hel");
+    ReceiveFrame(0x80, "lo!");
+    EXPECT_TRUE(connection->brokenByWebSocket);
+    EXPECT_TRUE(texts.empty());
+    EXPECT_EQ(1009, codeReceived);
+    EXPECT_EQ("message too large", reasonReceived);
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, CompressionMemoryHeldOnlyDuringMessagesWithoutContextTakeover) {
+    OpenWithOffer("permessage-deflate; server_no_context_takeover; client_no_context_takeover");
+    EXPECT_EQ(0, ws.GetCompressionStatistics().memoryInUse);
+    ws.SendText("Hello");
+    auto statistics = ws.GetCompressionStatistics();
+    EXPECT_EQ(0, statistics.memoryInUse);
+    EXPECT_GT(statistics.peakMemoryInUse, 0);
+    ReceiveFrame(0xc1, std::string("\xf2\x48\xcd\xc9\xc9\x07\x00", 7));
+    statistics = ws.GetCompressionStatistics();
+    EXPECT_EQ(0, statistics.memoryInUse);
+    EXPECT_EQ(
+        (std::vector< std::string >{
+            "Hello",
+        }),
+        texts
+    );
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, CompressionMemoryHeldBetweenMessagesWithContextTakeover) {
+    OpenWithOffer("permessage-deflate");
+    EXPECT_EQ(0, ws.GetCompressionStatistics().memoryInUse);
+    ws.SendText("Hello");
+    const auto memoryAfterSend = ws.GetCompressionStatistics().memoryInUse;
+    EXPECT_GT(memoryAfterSend, 0);
+    ReceiveFrame(0xc1, std::string("\xf2\x48\xcd\xc9\xc9\x07\x00", 7));
+    const auto statistics = ws.GetCompressionStatistics();
+    EXPECT_GT(statistics.memoryInUse, memoryAfterSend);
+    EXPECT_EQ(statistics.memoryInUse, statistics.peakMemoryInUse);
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, CompressionStreamsRecycledThroughSharedPool) {
+    const auto pool = std::make_shared< WebSockets::CompressionPool >();
+    configuration.compressionPool = pool;
+    OpenWithOffer("permessage-deflate; server_no_context_takeover");
+    ws.SendText("Hello");
+    auto poolStatistics = pool->GetStatistics();
+    EXPECT_EQ(1, poolStatistics.streamsCreated);
+    EXPECT_EQ(0, poolStatistics.streamsReused);
+    EXPECT_EQ(1, poolStatistics.idleDeflaters);
+    EXPECT_GT(poolStatistics.idleMemory, 0);
+    const auto otherConnection = std::make_shared< MockConnection >();
+    WebSockets::WebSocket otherWs;
+    otherWs.Configure(configuration);
+    Http::Request request;
+    request.method = "GET";
+    request.headers.SetHeader("Connection", "upgrade");
+    request.headers.SetHeader("Upgrade", "websocket");
+    request.headers.SetHeader("Sec-WebSocket-Version", "13");
+    request.headers.SetHeader("Sec-WebSocket-Key", "dGhlIHNhbXBsZSBub25jZQ==");
+    request.headers.SetHeader(
+        "Sec-WebSocket-Extensions",
+        "permessage-deflate; server_no_context_takeover"
+    );
+    Http::Response response;
+    ASSERT_TRUE(otherWs.OpenAsServer(otherConnection, request, response, ""));
+    otherWs.SendText("Hello");
+    ws.SendText("Hello");
+    poolStatistics = pool->GetStatistics();
+    EXPECT_EQ(1, poolStatistics.streamsCreated);
+    EXPECT_EQ(2, poolStatistics.streamsReused);
+    EXPECT_EQ(1, poolStatistics.idleDeflaters);
+    EXPECT_EQ(
+        std::string("\xc1\x07\xf2\x48\xcd\xc9\xc9\x07\x00", 9),
+        otherConnection->webSocketOutput
+    );
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, SmallerWindowAndMemoryLevelUseLessMemory) {
+    OpenWithOffer("permessage-deflate");
+    ws.SendText("Hello");
+    const auto defaultMemory = ws.GetCompressionStatistics().memoryInUse;
+    ReplaceWebSocket();
+    connection = std::make_shared< MockConnection >();
+    configuration.serverMaxWindowBits = 9;
+    configuration.compressionMemoryLevel = 1;
+    OpenWithOffer("permessage-deflate");
+    ws.SendText("Hello");
+    const auto smallMemory = ws.GetCompressionStatistics().memoryInUse;
+    EXPECT_LT(smallMemory * 4, defaultMemory);
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, MessagesBelowThresholdNotCompressed) {
+    configuration.compressionThreshold = 16;
+    OpenWithOffer("permessage-deflate");
+    ws.SendText("Hello");
+    EXPECT_EQ("\x81\x05Hello", connection->webSocketOutput);
+    connection->webSocketOutput.clear();
+    const std::string largeMessage(100, 'x');
+    ws.SendText(largeMessage);
+    ASSERT_GE(connection->webSocketOutput.length(), 2);
+    EXPECT_EQ('\xc1', connection->webSocketOutput[0]);
+    EXPECT_LT(connection->webSocketOutput.length(), largeMessage.length());
+    const auto statistics = ws.GetCompressionStatistics();
+    EXPECT_EQ(1, statistics.messagesCompressed);
+    EXPECT_EQ(1, statistics.messagesNotCompressed);
+    EXPECT_EQ(largeMessage.length(), statistics.octetsBeforeCompression);
+    EXPECT_EQ(connection->webSocketOutput.length() - 2, statistics.octetsAfterCompression);
+    EXPECT_GT(statistics.compressionTime.count(), 0);
+    EXPECT_DOUBLE_EQ(
+        (double)statistics.octetsAfterCompression / (double)statistics.octetsBeforeCompression,
+        statistics.recentCompressionRatio
+    );
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, CompressionChosenPerMessage) {
+    configuration.compressionThreshold = 16;
+    OpenWithOffer("permessage-deflate; server_no_context_takeover");
+    ws.SendText("Hello", true, WebSockets::WebSocket::Compression::Always);
+    EXPECT_EQ(
+        std::string("\xc1\x07\xf2\x48\xcd\xc9\xc9\x07\x00", 9),
+        connection->webSocketOutput
+    );
+    connection->webSocketOutput.clear();
+    const std::string largeMessage(100, 'x');
+    ws.SendBinary(largeMessage, true, WebSockets::WebSocket::Compression::Never);
+    EXPECT_EQ(
+        std::string("\x82\x64") + largeMessage,
+        connection->webSocketOutput
+    );
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, CompressionDecidedByFirstFragment) {
+    configuration.compressionThreshold = 16;
+    OpenWithOffer("permessage-deflate");
+    ws.SendText("Hel", false);
+    ws.SendText(std::string(100, 'x'), true);
+    EXPECT_EQ(
+        std::string("\x01\x03Hel\x80\x64") + std::string(100, 'x'),
+        connection->webSocketOutput
+    );
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, PoorlyCompressingMessagesMostlySentUncompressed) {
+    configuration.compressionRatioCutoff = 0.9;
+    OpenWithOffer("permessage-deflate; server_no_context_takeover");
+    std::string compressedFrames;
+    for (size_t i = 0; i < 18; ++i) {
+        connection->webSocketOutput.clear();
+        ws.SendText("Hello");
+        ASSERT_FALSE(connection->webSocketOutput.empty());
+        compressedFrames += (
+            ((connection->webSocketOutput[0] & 0x40) == 0)
+            ? "-"
+            : "C"
+        );
+    }
+    EXPECT_EQ("C---------------C-", compressedFrames);
+    const auto statistics = ws.GetCompressionStatistics();
+    EXPECT_EQ(2, statistics.messagesCompressed);
+    EXPECT_EQ(16, statistics.messagesNotCompressed);
+    EXPECT_DOUBLE_EQ(1.4, statistics.recentCompressionRatio);
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, BroadcastCompressesOncePerCompressionSettings) {
+    const auto pool = std::make_shared< WebSockets::CompressionPool >();
+    configuration.compressionPool = pool;
+    std::vector< std::shared_ptr< MockConnection > > connections;
+    std::vector< std::shared_ptr< WebSockets::WebSocket > > recipients;
+    for (const auto& offer: {
+        "permessage-deflate; server_no_context_takeover",
+        "permessage-deflate; server_no_context_takeover; server_max_window_bits=10",
+        "permessage-deflate; server_no_context_takeover",
+        "permessage-deflate; server_no_context_takeover; server_max_window_bits=10",
+        "permessage-deflate; server_no_context_takeover",
+    }) {
+        connections.push_back(std::make_shared< MockConnection >());
+        recipients.push_back(OpenOtherWebSocket(connections.back(), offer));
+    }
+    WebSockets::WebSocket::BroadcastText(recipients, "Hello");
+    const auto poolStatistics = pool->GetStatistics();
+    EXPECT_EQ(2, poolStatistics.streamsCreated + poolStatistics.streamsReused);
+    for (size_t i = 0; i < recipients.size(); ++i) {
+        EXPECT_EQ(
+            std::string("\xc1\x07\xf2\x48\xcd\xc9\xc9\x07\x00", 9),
+            connections[i]->webSocketOutput
+        ) << i;
+        const auto statistics = recipients[i]->GetCompressionStatistics();
+        EXPECT_EQ(1, statistics.messagesCompressed) << i;
+        EXPECT_EQ(5, statistics.octetsBeforeCompression) << i;
+        EXPECT_EQ(7, statistics.octetsAfterCompression) << i;
+    }
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, BroadcastToMixedRecipients) {
+    const auto pool = std::make_shared< WebSockets::CompressionPool >();
+    configuration.compressionPool = pool;
+    const auto uncompressedConnection = std::make_shared< MockConnection >();
+    const auto uncompressedWs = OpenOtherWebSocket(uncompressedConnection, "");
+    const auto contextTakeoverConnection = std::make_shared< MockConnection >();
+    const auto contextTakeoverWs = OpenOtherWebSocket(
+        contextTakeoverConnection,
+        "permessage-deflate"
+    );
+    const auto busyConnection = std::make_shared< MockConnection >();
+    const auto busyWs = OpenOtherWebSocket(
+        busyConnection,
+        "permessage-deflate; server_no_context_takeover"
+    );
+    busyWs->SendBinary("Hel", false, WebSockets::WebSocket::Compression::Never);
+    busyConnection->webSocketOutput.clear();
+    const std::vector< std::shared_ptr< WebSockets::WebSocket > > recipients{
+        uncompressedWs,
+        contextTakeoverWs,
+        busyWs,
+        nullptr,
+    };
+    WebSockets::WebSocket::BroadcastText(recipients, "Hello");
+    WebSockets::WebSocket::BroadcastText(recipients, "Hello");
+    EXPECT_EQ("\x81\x05Hello\x81\x05Hello", uncompressedConnection->webSocketOutput);
+    EXPECT_EQ(
+        std::string("\xc1\x07\xf2\x48\xcd\xc9\xc9\x07\x00", 9)
+        + std::string("\xc1\x05\xf2\x00\x11\x00\x00", 7),
+        contextTakeoverConnection->webSocketOutput
+    );
+    EXPECT_EQ("", busyConnection->webSocketOutput);
+}
+
+TEST_F(WebSocketPerMessageDeflateTests, BroadcastToClientsMasksEachFrame) {
+    std::vector< std::shared_ptr< MockConnection > > connections;
+    std::vector< std::shared_ptr< WebSockets::WebSocket > > recipients;
+    for (size_t i = 0; i < 2; ++i) {
+        connections.push_back(std::make_shared< MockConnection >());
+        recipients.push_back(std::make_shared< WebSockets::WebSocket >());
+        recipients.back()->Open(connections.back(), WebSockets::WebSocket::Role::Client);
+    }
+    WebSockets::WebSocket::BroadcastBinary(recipients, "Hello");
+    for (const auto& recipientConnection: connections) {
+        const auto& output = recipientConnection->webSocketOutput;
+        ASSERT_EQ(11, output.length());
+        EXPECT_EQ('\x82', output[0]);
+        EXPECT_EQ('\x85', output[1]);
+        std::string payload;
+        for (size_t i = 0; i < 5; ++i) {
+            payload.push_back(output[6 + i] ^ output[2 + (i % 4)]);
+        }
+        EXPECT_EQ("Hello", payload);
+    }
+}
+
+/**
+ * This is the test fixture for tests of WebSockets using extensions
+ * other than "permessage-deflate".
+ */
+struct WebSocketExtensionTests
+    : public WebSocketPerMessageDeflateTests
+{
+    // Properties
+
+    /**
+     * This is the extension made for the WebSocket.
+     */
+    std::shared_ptr< ToggleCaseExtension > extension = std::make_shared< ToggleCaseExtension >();
+
+    // ::testing::Test
+
+    virtual void SetUp() override {
+        WebSocketPerMessageDeflateTests::SetUp();
+        const auto madeExtension = extension;
+        configuration.extensions.push_back(
+            [madeExtension]{ return madeExtension; }
+        );
+    }
+};
+
+TEST_F(WebSocketExtensionTests, NegotiateAndUseCustomExtensionAsServer) {
+    OpenWithOffer("x-toggle-case; mode=fast");
+    EXPECT_EQ(
+        "x-toggle-case; mode=fast",
+        openResponse.headers.GetHeaderValue("Sec-WebSocket-Extensions")
+    );
+    ASSERT_EQ(1, extension->parametersReceived.size());
+    EXPECT_EQ("mode", extension->parametersReceived[0].first);
+    EXPECT_EQ("fast", extension->parametersReceived[0].second);
+    ws.SendText("Hello");
+    ws.SendText("Hel", false);
+    ws.SendText("lo", true);
+    EXPECT_EQ("\xa1\x05hELLO\x21\x03hEL\x80\x02LO", connection->webSocketOutput);
+    ReceiveFrame(0xa1, "hELLO");
+    ReceiveFrame(0x81, "Hi");
+    ReceiveFrame(0x21, "wOR");
+    ReceiveFrame(0x80, "LD");
+    EXPECT_EQ(
+        (std::vector< std::string >{"Hello", "Hi", "World"}),
+        texts
+    );
+    EXPECT_EQ(0, codeReceived);
+}
+
+TEST_F(WebSocketExtensionTests, ExtensionsChainedInNegotiatedOrder) {
+    OpenWithOffer("permessage-deflate; server_no_context_takeover, x-toggle-case");
+    EXPECT_EQ(
+        "permessage-deflate; server_no_context_takeover, x-toggle-case",
+        openResponse.headers.GetHeaderValue("Sec-WebSocket-Extensions")
+    );
+    ws.SendText("Hello");
+    EXPECT_EQ(
+        std::string("\xe1\x07\xf2\x68\xcd\xc9\xc9\x07\x00", 9),
+        connection->webSocketOutput
+    );
+    ReceiveFrame(0xe1, std::string("\xf2\x68\xcd\xc9\xc9\x07\x00", 7));
+    ReceiveFrame(0xa1, "hI");
+    EXPECT_EQ(
+        (std::vector< std::string >{"Hello", "Hi"}),
+        texts
+    );
+    EXPECT_EQ(0, codeReceived);
+}
+
+TEST_F(WebSocketExtensionTests, ConflictingReservedBitsNotNegotiated) {
+    extension->reservedBits = 0x40;
+    OpenWithOffer("permessage-deflate, x-toggle-case");
+    EXPECT_EQ(
+        "permessage-deflate",
+        openResponse.headers.GetHeaderValue("Sec-WebSocket-Extensions")
+    );
+    ws.SendText("Hello");
+    EXPECT_EQ(
+        std::string("\xc1\x07\xf2\x48\xcd\xc9\xc9\x07\x00", 9),
+        connection->webSocketOutput
+    );
+}
+
+TEST_F(WebSocketExtensionTests, DeclinedOfferNotNegotiated) {
+    extension->accept = false;
+    OpenWithOffer("x-toggle-case");
+    EXPECT_FALSE(openResponse.headers.HasHeader("Sec-WebSocket-Extensions"));
+    ReceiveFrame(0xa1, "hELLO");
+    EXPECT_EQ(1002, codeReceived);
+    EXPECT_EQ("reserved bits set", reasonReceived);
+}
+
+TEST_F(WebSocketExtensionTests, ViolationReservedBitNotClaimed) {
+    OpenWithOffer("x-toggle-case");
+    ReceiveFrame(0x91, "Hello");
+    EXPECT_EQ(1002, codeReceived);
+    EXPECT_EQ("reserved bits set", reasonReceived);
+}
+
+TEST_F(WebSocketExtensionTests, ViolationReservedBitInControlFrame) {
+    OpenWithOffer("x-toggle-case");
+    ReceiveFrame(0xa9, "Hello");
+    EXPECT_EQ(1002, codeReceived);
+    EXPECT_EQ("reserved bits set", reasonReceived);
+}
+
+TEST_F(WebSocketExtensionTests, ViolationMessageNotDecoded) {
+    extension->failDecode = true;
+    OpenWithOffer("x-toggle-case");
+    ReceiveFrame(0xa1, "hELLO");
+    EXPECT_TRUE(texts.empty());
+    EXPECT_EQ(1007, codeReceived);
+    EXPECT_EQ("case not toggled", reasonReceived);
+}